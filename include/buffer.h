@@ -1,18 +1,39 @@
 #ifndef KSEDIT_BUFFER_H
 #define KSEDIT_BUFFER_H
 
+#include "colindex.h"
+#include "lineindex.h"
+#include "piece.h"
 #include "types.h"
 #include "undo.h"
 
+typedef enum {
+    STORAGE_GAP,   // Single contiguous gap buffer (default)
+    STORAGE_PIECE, // Piece table: original text + append-only add buffer
+} BufferStorage;
+
+struct BufferSnapshot;
+
+// An extra cursor for multi-cursor editing. It has a selection when anchor
+// differs from pos.
+typedef struct
+{
+    size_t pos;
+    size_t anchor;
+} BufferCursor;
+
 typedef struct
 {
+    BufferStorage storage;
+    PieceTable*   pieces; // Only used with STORAGE_PIECE
+
     char*  data;
     size_t gap_start;
     size_t gap_end;
     size_t capacity;
     size_t cursor;
     size_t line;
-    size_t col;
+    size_t col; // Display column (see buffer_line_pos)
     bool   modified;
     char*  filename;
 
@@ -22,35 +43,88 @@ typedef struct
     size_t sel_start; // Min of anchor and cursor
     size_t sel_end; // Max of anchor and cursor
 
+    // Multi-cursor: cursors besides the one above, ascending and never
+    // overlapping it or each other. Dropped by any edit not made through
+    // buffer_multi_*.
+    BufferCursor* cursors;
+    size_t        cursor_count;
+    size_t        cursor_capacity;
+
     // Undo
     UndoStack* undo;
 
-    // Line index for fast scrolling (gap buffer for O(1) insert/delete)
-    size_t* line_offsets;
-    size_t  line_count;
-    size_t  line_capacity;
-    size_t  line_gap_start;  // Gap in line_offsets array
-    size_t  line_gap_end;
+    // Line index for fast scrolling. line_count mirrors the index and is
+    // 0 while it needs a rebuild.
+    LineIndex* lines;
+    size_t     line_count;
+
+    // Column checkpoints for the long lines used last
+    ColIndex cols;
+
+    // Progressive load (see loader.h): content grows up to load_total
+    bool   loading;
+    size_t load_total;
 
-    // Delta tracking for O(1) edits
-    size_t dirty_from_line;  // Lines >= this have stale offsets
-    i64    offset_delta;     // Delta to add to stale offsets
+    // Background save (see saver.h)
+    struct BufferSnapshot* snapshot; // Gap snapshot still sharing data
+    u64                    revision; // Bumped by every edit
+    bool                   saving;
+    size_t                 save_done;
+    size_t                 save_total;
+
+    // Told about every edit of the text once it's made (see findset.h)
+    void (*on_edit)(void* ctx, size_t pos, size_t removed, size_t inserted);
+    void* on_edit_ctx;
 } Buffer;
 
+// Contents frozen for writing out on another thread while editing goes on.
+// Piece storage only records its spans, since pieces never change in place.
+// A gap buffer shares its array with the snapshot and copies it only when
+// an edit has to write over bytes the snapshot still reads.
+typedef struct
+{
+    const char* text;
+    size_t      len;
+} BufferSpan;
+
+typedef struct BufferSnapshot
+{
+    Buffer*     buf; // Still sharing its array with us, or NULL
+    BufferSpan* spans;
+    size_t      span_count;
+    size_t      length;
+
+    // Gap storage: the shared array, and the gap edits may still fill
+    char*  data;
+    size_t capacity;
+    size_t gap_start;
+    size_t gap_end;
+    bool   owns_data; // The buffer moved to a new array; free on release
+    bool   broken;    // Couldn't copy before an edit; contents unreliable
+
+    // Piece storage: spans in the original can be copied from its file
+    const char* original;
+    size_t      original_len;
+    int         original_fd;
+} BufferSnapshot;
+
 Buffer* buffer_create(size_t initial_capacity);
+Buffer* buffer_create_with_storage(size_t initial_capacity, BufferStorage storage);
 void    buffer_destroy(Buffer* buf);
 
 void buffer_insert_char(Buffer* buf, char c);
 void buffer_delete_char(Buffer* buf);
 void buffer_backspace(Buffer* buf);
 
-void buffer_move_cursor(Buffer* buf, i32 delta);
+void buffer_move_cursor(Buffer* buf, i32 delta); // By bytes
+void buffer_move_char(Buffer* buf, i32 delta);   // By whole characters
 void buffer_move_cursor_to(Buffer* buf, size_t pos);
 void buffer_move_line(Buffer* buf, i32 delta);
 void buffer_move_to_line_start(Buffer* buf);
 void buffer_move_to_line_end(Buffer* buf);
 
 size_t buffer_length(Buffer* buf);
+void   buffer_reserve(Buffer* buf, size_t len);
 char   buffer_char_at(Buffer* buf, size_t pos);
 size_t buffer_get_cursor(Buffer* buf);
 size_t buffer_line_count(Buffer* buf);
@@ -58,6 +132,14 @@ size_t buffer_line_count(Buffer* buf);
 bool buffer_load_file(Buffer* buf, const char* filename);
 bool buffer_save_file(Buffer* buf);
 
+// A gap buffer shares its array with one snapshot at a time, so this returns
+// NULL while another is live. Release snapshots before destroying or
+// reloading the buffer. Saving is safe from any thread; progress, if given,
+// is advanced atomically as bytes are written.
+BufferSnapshot* buffer_snapshot(Buffer* buf);
+void            buffer_snapshot_release(BufferSnapshot* snap);
+bool            buffer_snapshot_save(BufferSnapshot* snap, const char* filename, size_t* progress);
+
 void buffer_get_line_col(Buffer* buf, size_t* line, size_t* col);
 
 // Selection
@@ -71,13 +153,93 @@ void  buffer_delete_selection(Buffer* buf);
 // Bulk operations
 void   buffer_insert_text(Buffer* buf, const char* text, size_t len);
 void   buffer_delete_range(Buffer* buf, size_t start, size_t end);
+
+// Replace the old_len bytes at each of positions (ascending) with new_text,
+// skipping any that overlap the one before. The result is built in one pass
+// and recorded as a single undo step. Returns how many were replaced.
+size_t buffer_replace_all(Buffer* buf, const size_t* positions, size_t count, size_t old_len, const char* new_text,
+    size_t new_len);
+
+// Replace [start, end) with text; positions are in the text before any of
+// the edits in the same call
+typedef struct
+{
+    size_t      start;
+    size_t      end;
+    const char* text;
+    size_t      len;
+} BufferEdit;
+
+// Apply edits (ascending by start, not overlapping) as one step: a single
+// pass over the text, the line index patched along the way, and one undo
+// record, which restores the cursor to where it is now. The cursor ends up
+// at cursor, a position in the edited text. Returns false, changing
+// nothing, if the edits are out of order or out of memory.
+bool buffer_apply_edits(Buffer* buf, const BufferEdit* edits, size_t count, size_t cursor);
+
 char*  buffer_get_range(Buffer* buf, size_t start, size_t end);
 size_t buffer_extract(Buffer* buf, size_t start, size_t len, char* dest);
 
+// Walk [start, end) as the contiguous spans it is stored in (two at most
+// for a gap buffer, one per piece for a piece table), so scans can run
+// memchr or vector code over each span. next() moves to the span after the
+// current one, prev() to the one before it. Any edit invalidates the
+// iterator.
+typedef struct
+{
+    Buffer*     buf;
+    size_t      start;
+    size_t      end;
+    size_t      pos;  // Text position of text[0]
+    const char* text; // Current span
+    size_t      len;
+} BufferIter;
+
+void buffer_iter_init(BufferIter* it, Buffer* buf, size_t start, size_t end);         // Before the first span
+void buffer_iter_init_reverse(BufferIter* it, Buffer* buf, size_t start, size_t end); // After the last span
+bool buffer_iter_next(BufferIter* it);
+bool buffer_iter_prev(BufferIter* it);
+
+// First / last position of c in [start, end), or -1
+i64 buffer_find_byte(Buffer* buf, char c, size_t start, size_t end);
+i64 buffer_rfind_byte(Buffer* buf, char c, size_t start, size_t end);
+
+// Multi-cursor editing. The primary cursor and selection stay where they
+// are, and motion keys keep driving them. The buffer_multi_* edits apply a
+// keystroke at every cursor in one pass over the text, recorded as a
+// single undo step.
+bool   buffer_add_cursor(Buffer* buf, size_t pos, size_t anchor); // False if it overlaps another
+void   buffer_clear_cursors(Buffer* buf);
+size_t buffer_cursor_count(Buffer* buf); // Including the primary one
+
+// Select the next occurrence of the selection (wrapping around), keeping a
+// cursor on the current one. Without a selection, selects the word under
+// the cursor instead. False if there is no further occurrence.
+bool buffer_add_cursor_at_next_match(Buffer* buf);
+
+// A cursor at the end of every line the selection touches; returns how
+// many there are now
+size_t buffer_add_cursors_on_lines(Buffer* buf);
+
+void buffer_multi_insert(Buffer* buf, const char* text, size_t len);
+
+// Paste at every cursor, replacing the selection if there is one. One undo
+// step either way.
+void buffer_paste(Buffer* buf, const char* text, size_t len);
+void buffer_multi_backspace(Buffer* buf);
+void buffer_multi_delete(Buffer* buf);
+void buffer_multi_move(Buffer* buf, i32 delta); // Every cursor; drops selections
+
 // Undo/Redo
 void buffer_undo(Buffer* buf);
 void buffer_redo(Buffer* buf);
 
+// Edits between these undo and redo as one step, in one pass that puts the
+// cursor back where it was at buffer_begin_group (or at buffer_end_group).
+// They nest.
+void buffer_begin_group(Buffer* buf);
+void buffer_end_group(Buffer* buf);
+
 // Find
 i64 buffer_find(Buffer* buf, const char* needle, size_t start);
 i64 buffer_find_next(Buffer* buf, const char* needle);
@@ -88,6 +250,20 @@ void buffer_goto_line(Buffer* buf, size_t line);
 // Line index
 void   buffer_rebuild_line_index(Buffer* buf);
 size_t buffer_get_line_offset(Buffer* buf, size_t line);
+void   buffer_append_line_starts(Buffer* buf, const size_t* starts, size_t count);
+
+// UTF-8 positions within a line (see utf8.h), with columns counting display
+// cells. Long lines keep column checkpoints (see colindex.h), so these are
+// O(log n) however long the line is.
+Utf8Pos buffer_line_pos(Buffer* buf, size_t pos); // The character holding pos, from its line start
+
+// The character on line reaching target in the given unit, as utf8_walk
+// stops, or the line end; offsets are from the line start
+Utf8Pos buffer_line_seek(Buffer* buf, size_t line, Utf8Unit unit, size_t target);
+
+// Start of the character after / before the one at pos
+size_t buffer_next_char(Buffer* buf, size_t pos);
+size_t buffer_prev_char(Buffer* buf, size_t pos);
 
 // Word operations
 void buffer_move_word_left(Buffer* buf);
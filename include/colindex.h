@@ -0,0 +1,75 @@
+#ifndef KSEDIT_COLINDEX_H
+#define KSEDIT_COLINDEX_H
+
+#include "types.h"
+#include "utf8.h"
+
+// Column checkpoints for long lines. Turning a byte offset into a codepoint
+// or display column (or back) means decoding the line from its start, which
+// is too slow per keystroke once a line runs to megabytes. A ColLine keeps
+// the running totals roughly every COL_SAMPLE bytes, so a lookup is a binary
+// search and a walk of at most one sample. Checkpoints are built lazily, as
+// far as lookups have reached, and only for the few lines used last.
+//
+// Edits keep the points in step by arithmetic alone, so they cost nothing
+// until the next lookup: points inside an edited stretch are dropped and
+// later ones shift their byte offsets, while the change in codepoints and
+// columns, which needs the text, is left for the buffer to measure (see
+// buffer.c).
+
+#define COL_SAMPLE      4096
+#define COL_INDEX_MIN   (16 * 1024) // Shorter lines are decoded directly
+#define COL_CACHE_LINES 4
+
+typedef struct
+{
+    size_t   start;    // Line start in the text
+    size_t   len;      // Line length, without its '\n'
+    Utf8Pos* points;   // Ascending, on character boundaries; points[0] is the line start
+    size_t   count;    // 0 for an unused slot
+    size_t   capacity;
+    bool     complete; // Points run to the line end
+    bool     stale;    // Points past stale_at are off by an unmeasured change
+    size_t   stale_at; // in codepoints and columns
+    u64      used;     // Clock of the last lookup, for eviction
+} ColLine;
+
+typedef struct
+{
+    ColLine lines[COL_CACHE_LINES];
+    u64     clock;
+} ColIndex;
+
+void colindex_init(ColIndex* ci);
+void colindex_free(ColIndex* ci);
+
+// Forget every line (after the text was replaced wholesale)
+void colindex_clear(ColIndex* ci);
+
+// The line starting at start, or NULL if it isn't held. Marks it used.
+ColLine* colindex_get(ColIndex* ci, size_t start);
+
+// A slot for the line at start, taking the least recently used one. It
+// holds just the line-start point. NULL if out of memory.
+ColLine* colindex_claim(ColIndex* ci, size_t start, size_t len);
+
+void colindex_drop(ColLine* cl);
+bool colindex_push(ColLine* cl, Utf8Pos at);
+
+// The removed bytes at pos were replaced by inserted new ones. text holds
+// the new bytes that weren't there before (for a batch, the text between
+// its edits is neither) and is only looked at, for a '\n', when the edit
+// lands inside a held line. Lines the edit splits or joins are dropped.
+void colindex_edit(ColIndex* ci, size_t pos, size_t removed, size_t inserted, const char* text, size_t text_len);
+
+// Index of the last point whose unit is at most target
+size_t colindex_find(const ColLine* cl, Utf8Unit unit, size_t target);
+
+// Replace the points strictly between a and b with fresh ones, and move
+// every point from b on by the change in the stretch from a to b: it went
+// from old_span to new_span (in all three units). False if out of memory,
+// leaving the points alone.
+bool colindex_splice(ColLine* cl, size_t a, size_t b, const Utf8Pos* fresh, size_t n, Utf8Pos old_span,
+    Utf8Pos new_span);
+
+#endif
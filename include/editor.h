@@ -2,9 +2,14 @@
 #define KSEDIT_EDITOR_H
 
 #include "buffer.h"
+#include "findset.h"
 #include "history.h"
 #include "input.h"
+#include "loader.h"
+#include "regex.h"
 #include "render.h"
+#include "saver.h"
+#include "search.h"
 #include "types.h"
 #include "window.h"
 
@@ -12,12 +17,15 @@ typedef enum {
     MODE_NORMAL,
     MODE_INSERT,
     MODE_FIND,
+    MODE_REPLACE,
     MODE_GOTO,
 } EditorMode;
 
 typedef struct
 {
     Buffer*      buffer;
+    Loader*      loader; // Non-NULL while a file is streaming in
+    Saver*       saver;  // Non-NULL while a save is being written
     Window_State window;
     Renderer     renderer;
     EditorMode   mode;
@@ -32,6 +40,16 @@ typedef struct
     // Find/Goto input
     char   input_buf[256];
     size_t input_len;
+    u32    find_flags;          // SearchFlags
+    Regex* find_regex;          // Compiled query in regex mode, kept while it's unchanged
+    bool   find_counted;        // find_count is for the current query
+    size_t find_count;          // Matches in the whole buffer
+    u64    find_count_revision; // Buffer revision it was counted at
+    FindSet find;               // Literal mode: every match, updated as the query is typed
+    size_t  find_origin;        // Cursor when the prompt opened; the search starts here
+    bool    find_pending;       // Waiting for the scan to reach the first match
+    char    replace_buf[256];   // Replacement for every match of the find query
+    size_t  replace_len;
 
     // Clipboard
     char*  clipboard;
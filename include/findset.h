@@ -0,0 +1,48 @@
+#ifndef KSEDIT_FINDSET_H
+#define KSEDIT_FINDSET_H
+
+#include "buffer.h"
+#include "search.h"
+#include "types.h"
+
+// Every match of the find prompt's query, kept up to date while the user
+// types. The buffer is scanned a slice at a time (findset_step, once per
+// frame), so a keystroke never waits for a whole file. Extending the query
+// narrows the matches already found instead of scanning again, and edits
+// patch the set in place (findset_edit, from Buffer.on_edit).
+
+#define FINDSET_PENDING (-2) // Not known until more of the buffer is scanned
+
+typedef struct
+{
+    Searcher   searcher;
+    bool       active;   // Has a query
+    SearchHits hits;     // Starts of the matches before scanned, unless overflow
+    size_t     total;    // Matches starting before scanned
+    size_t     scanned;  // Every match starting before here is known
+    bool       overflow; // Too many to keep: only counted
+} FindSet;
+
+void findset_init(FindSet* fs);
+void findset_free(FindSet* fs);
+void findset_clear(FindSet* fs);
+
+// Starts a new query, or narrows the current one if it just got longer.
+// Returns false (and clears the set) if the needle is empty.
+bool findset_query(FindSet* fs, Buffer* buf, const char* needle, size_t len, u32 flags);
+
+// Scans up to budget more bytes. True once the whole buffer is covered.
+bool findset_step(FindSet* fs, Buffer* buf, size_t budget);
+bool findset_done(const FindSet* fs, Buffer* buf);
+
+// First match starting at or after from, wrapping around to the top; -1 if
+// there is none, FINDSET_PENDING if that isn't known yet
+i64 findset_next(FindSet* fs, Buffer* buf, size_t from);
+
+// Starts of the matches overlapping [start, end), at most max of them
+size_t findset_visible(FindSet* fs, Buffer* buf, size_t start, size_t end, size_t* out, size_t max);
+
+// pos..pos + removed was replaced by inserted bytes
+void findset_edit(FindSet* fs, Buffer* buf, size_t pos, size_t removed, size_t inserted);
+
+#endif
@@ -8,5 +8,6 @@
 
 void      font_init(void);
 const u8* font_get_glyph(char c);
+const u8* font_get_codepoint_glyph(u32 cp); // A box for anything past ASCII
 
 #endif
@@ -29,6 +29,7 @@ typedef enum {
     KEY_CTRL_V,
     KEY_CTRL_X,
     KEY_CTRL_F,
+    KEY_CTRL_R,
     KEY_CTRL_G,
     KEY_CTRL_A,
     KEY_CTRL_H,
@@ -46,12 +47,16 @@ typedef enum {
     KEY_ALT_RIGHT,
     KEY_SCROLL_UP,
     KEY_SCROLL_DOWN,
+    KEY_SCROLL_LEFT,
+    KEY_SCROLL_RIGHT,
 } KeyType;
 
 typedef struct
 {
     KeyType type;
-    char    c;
+    char    c; // First byte of text
+    char    text[32]; // KEY_CHAR: the typed characters in UTF-8, not terminated
+    u8      text_len;
     bool    ctrl;
     bool    shift;
     bool    alt;
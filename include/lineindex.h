@@ -0,0 +1,56 @@
+#ifndef KSEDIT_LINEINDEX_H
+#define KSEDIT_LINEINDEX_H
+
+#include "types.h"
+
+// Line index: the length of every line (including its '\n') kept in blocks
+// that live in a treap ordered by line number. Each node caches the line
+// and byte totals of its subtree, so offset-of-line, line-of-offset and
+// edits anywhere in the document are all O(log lines). There is always at
+// least one line; the last one has no trailing newline.
+
+#define LINE_BLOCK 128
+
+typedef struct LineNode
+{
+    size_t           lens[LINE_BLOCK];
+    u32              count; // Lines used in lens
+    u32              priority;
+    size_t           bytes;         // Sum of lens
+    size_t           subtree_lines; // Sum of count over this subtree
+    size_t           subtree_bytes; // Sum of bytes over this subtree
+    struct LineNode* left;
+    struct LineNode* right;
+} LineNode;
+
+typedef struct
+{
+    LineNode* root;
+    size_t    node_count;
+    u32       seed;
+} LineIndex;
+
+LineIndex* lineindex_create(void);
+void       lineindex_destroy(LineIndex* li);
+
+// Back to a single empty line
+void lineindex_clear(LineIndex* li);
+
+// len bytes were inserted at pos. starts holds, in ascending order, the
+// position (in the updated text) just past each inserted '\n'. False if
+// out of memory, leaving the index as it was.
+bool lineindex_insert(LineIndex* li, size_t pos, size_t len, const size_t* starts, size_t count);
+
+// len bytes were removed at pos. False if out of memory, as above.
+bool lineindex_delete(LineIndex* li, size_t pos, size_t len);
+
+size_t lineindex_count(LineIndex* li);
+size_t lineindex_length(LineIndex* li);
+
+// Byte offset where line starts (line < count)
+size_t lineindex_offset(LineIndex* li, size_t line);
+
+// Line containing pos (pos <= length); optionally its start offset
+size_t lineindex_line_at(LineIndex* li, size_t pos, size_t* line_start);
+
+#endif
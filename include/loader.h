@@ -0,0 +1,54 @@
+#ifndef KSEDIT_LOADER_H
+#define KSEDIT_LOADER_H
+
+#include "buffer.h"
+#include "types.h"
+#include <pthread.h>
+
+// Progressive file open. A worker thread streams the file into the buffer
+// (or, for piece storage, walks the mapping) and publishes the line starts
+// it finds chunk by chunk. The UI thread calls loader_poll() every frame to
+// make the newly loaded prefix visible, so the first screen can be drawn
+// long before the whole file has been read.
+
+typedef enum {
+    LOAD_RUNNING,
+    LOAD_DONE,
+    LOAD_FAILED,
+} LoadStatus;
+
+typedef struct LoadChunk
+{
+    struct LoadChunk* next;
+    size_t            loaded; // Bytes available once this chunk is applied
+    size_t            count;
+    size_t            capacity;
+    size_t            starts[];
+} LoadChunk;
+
+typedef struct
+{
+    Buffer*   buf;
+    pthread_t thread;
+    bool      running; // Worker not yet joined
+    int       fd;
+    char*     dest; // Gap buffer data, or the file mapping
+    size_t    total;
+    bool      mapped;
+
+    // Shared with the worker
+    pthread_mutex_t lock;
+    LoadChunk*      ready_head;
+    LoadChunk*      ready_tail;
+    bool            finished;
+    bool            failed;
+    bool            cancel;
+} Loader;
+
+// Start loading filename into buf. Returns NULL if the file can't be opened.
+// Until loading finishes the buffer must not be edited.
+Loader*    loader_start(Buffer* buf, const char* filename);
+LoadStatus loader_poll(Loader* ld);
+void       loader_destroy(Loader* ld); // Cancels a running load
+
+#endif
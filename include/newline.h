@@ -0,0 +1,29 @@
+#ifndef KSEDIT_NEWLINE_H
+#define KSEDIT_NEWLINE_H
+
+#include "types.h"
+
+// Newline scanning kernels shared by every line index path. The best
+// implementation for the running CPU (AVX2, SSE2 or scalar) is picked once
+// at startup; all functions work on a single contiguous run of bytes.
+
+typedef enum {
+    NEWLINE_SCALAR,
+    NEWLINE_SSE2,
+    NEWLINE_AVX2,
+} NewlineKernel;
+
+// Number of '\n' bytes in [p, p + len)
+size_t newline_count(const char* p, size_t len);
+
+// Store base + i + 1 (the start of the following line) for every '\n' at
+// p[i] into out, which must have room for newline_count(p, len) entries.
+// Returns the number stored.
+size_t newline_collect(const char* p, size_t len, size_t base, size_t* out);
+
+// Force a specific kernel (tests/benchmarks). Returns false if the CPU
+// doesn't support it, leaving the current choice alone.
+bool          newline_use_kernel(NewlineKernel kernel);
+NewlineKernel newline_active_kernel(void);
+
+#endif
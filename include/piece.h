@@ -0,0 +1,102 @@
+#ifndef KSEDIT_PIECE_H
+#define KSEDIT_PIECE_H
+
+#include "types.h"
+
+// Piece table: the document is a sequence of pieces, each pointing into
+// either the original file contents or an append-only add buffer. Pieces
+// live in a treap keyed by byte position, so insert/delete anywhere in the
+// document is O(log pieces) regardless of how far apart the edits are.
+
+typedef struct PieceNode
+{
+    const char*       text;
+    size_t            len;
+    size_t            subtree_len; // Sum of len over this subtree
+    u32               priority;
+    struct PieceNode* left;
+    struct PieceNode* right;
+} PieceNode;
+
+// Add buffer chunks never move once allocated, so pieces can point
+// straight into them.
+typedef struct AddChunk
+{
+    struct AddChunk* next;
+    size_t           used;
+    size_t           capacity;
+    char             data[];
+} AddChunk;
+
+typedef struct
+{
+    const char* original;
+    size_t      original_len;
+    bool        original_owned;  // Free original on destroy
+    bool        original_mapped; // Original is an mmap'd file, munmap on destroy
+    int         original_fd;     // File the mapping came from, or -1
+
+    AddChunk*  add; // Newest chunk first
+    PieceNode* root;
+    size_t     piece_count;
+    u32        seed;
+    PieceNode* spare; // Allocated ahead by piece_reserve, linked by right
+    size_t     spare_count;
+
+    // Last piece found by lookup, makes sequential access O(1)
+    PieceNode* cache_node;
+    size_t     cache_start;
+} PieceTable;
+
+PieceTable* piece_create(void);
+void        piece_destroy(PieceTable* pt);
+
+// Replace the whole document with the given original text. If owned, the
+// table takes ownership and frees it with free() on destroy.
+void piece_set_original(PieceTable* pt, const char* data, size_t len, bool owned);
+
+// Same as above, but data is a read-only mapping of fd. The table owns both;
+// keeping the fd lets saves copy unchanged ranges file to file.
+void piece_set_original_mapped(PieceTable* pt, const char* data, size_t len, int fd);
+
+// Progressive loading: expose only the first len bytes of the original.
+// Only valid while the table holds nothing but the original piece.
+void piece_set_original_visible(PieceTable* pt, size_t len);
+
+// False if out of memory, leaving the document as it was
+bool piece_insert(PieceTable* pt, size_t pos, const char* text, size_t len);
+bool piece_delete(PieceTable* pt, size_t pos, size_t len);
+
+size_t piece_length(PieceTable* pt);
+char   piece_char_at(PieceTable* pt, size_t pos);
+size_t piece_extract(PieceTable* pt, size_t start, size_t len, char* dest);
+
+// Make sure the next edits can't run out of memory: up to nodes new pieces
+// (an insert takes at most two, a delete at most two) and bytes of inserted
+// text. False if out of memory, changing nothing.
+bool piece_reserve(PieceTable* pt, size_t nodes, size_t bytes);
+
+// Room for len bytes in the add buffer for the caller to fill. They stay
+// put for pieces to use. Returns NULL if out of memory.
+char* piece_add_reserve(PieceTable* pt, size_t len);
+
+// Replace the document with these runs of text, in order, in one go. Each
+// must point into the original or the add buffer (e.g. a span from below,
+// or piece_add_reserve). Builds the tree in O(count); false if out of
+// memory, leaving the document as it was.
+typedef struct
+{
+    const char* text;
+    size_t      len;
+} PieceSpan;
+
+bool piece_set_spans(PieceTable* pt, const PieceSpan* spans, size_t count);
+
+// Contiguous run of text starting at pos. Returns NULL past the end.
+const char* piece_span_at(PieceTable* pt, size_t pos, size_t* out_len);
+
+// Contiguous run of text ending at pos; returns its first byte, which is
+// at pos - *out_len. Returns NULL at position 0.
+const char* piece_span_before(PieceTable* pt, size_t pos, size_t* out_len);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef KSEDIT_REGEX_H
+#define KSEDIT_REGEX_H
+
+#include "buffer.h"
+#include "search.h"
+#include "types.h"
+
+// Regular expressions for Find. Matching runs a lazily built DFA one byte
+// at a time over the buffer's spans, so it takes time linear in the text
+// whatever the pattern: there is no backtracking. A DFA for the pattern
+// finds where the leftmost match ends; one for the reversed pattern then
+// runs backward from there to find where it starts. When every match must
+// begin with the same literal, the vector kernels in search.h skip to the
+// next place it occurs whenever the DFA has nothing in progress.
+//
+// Syntax: literal bytes, '.', classes [a-z] and [^...], the escapes \d \w
+// \s \D \W \S \n \t \r and escaped punctuation, groups ( ) and (?: ),
+// alternation |, the repeats * + ? and their lazy forms *? +? ??, and ^ $
+// at line boundaries. Matches are leftmost-first, as in Perl: the earliest
+// starting match wins, then the one the repeats and alternatives prefer.
+
+typedef struct Regex Regex;
+
+// flags: SEARCH_IGNORE_CASE (ASCII letters). On a bad pattern returns NULL
+// and points *error at a short description.
+Regex* regex_compile(const char* pattern, size_t len, u32 flags, const char** error);
+void   regex_free(Regex* re);
+
+// First match lying inside [start, end), as [*match_start, *match_end)
+bool regex_search_forward(Regex* re, Buffer* buf, size_t start, size_t end, size_t* match_start, size_t* match_end);
+
+// Last of the non-overlapping matches from start that begins before end
+bool regex_search_backward(Regex* re, Buffer* buf, size_t start, size_t end, size_t* match_start, size_t* match_end);
+
+// Non-overlapping matches inside [start, end)
+size_t regex_count(Regex* re, Buffer* buf, size_t start, size_t end);
+
+// Length of the literal every match begins with, 0 if none (prefilter)
+size_t regex_prefix_len(const Regex* re);
+
+#endif
@@ -2,6 +2,7 @@
 #define KSEDIT_RENDER_H
 
 #include "buffer.h"
+#include "findset.h"
 #include "types.h"
 #include "window.h"
 
@@ -14,6 +15,7 @@ typedef struct
     u32 status_bg;
     u32 status_fg;
     u32 selection;
+    u32 match;
 
     // Syntax colors
     u32 keyword;
@@ -33,6 +35,7 @@ typedef struct
     size_t        scroll_x;
     float         font_scale;
     bool          syntax_enabled;
+    FindSet*      find; // Matches to highlight, or NULL
 } Renderer;
 
 void render_init(Renderer* r, Window_State* win);
@@ -40,6 +43,7 @@ void render_clear(Renderer* r);
 void render_buffer(Renderer* r, Buffer* buf);
 void render_status_bar(Renderer* r, Buffer* buf);
 void render_char(Renderer* r, int x, int y, char c, u32 fg, u32 bg);
+void render_glyph(Renderer* r, int x, int y, const u8* glyph, u32 fg, u32 bg);
 void render_rect(Renderer* r, int x, int y, int w, int h, u32 color);
 void render_scrollbar(Renderer* r, Buffer* buf);
 int  render_scrollbar_width(void);
@@ -0,0 +1,41 @@
+#ifndef KSEDIT_SAVER_H
+#define KSEDIT_SAVER_H
+
+#include "buffer.h"
+#include "types.h"
+#include <pthread.h>
+
+// Background save. The buffer's contents are frozen in a snapshot (see
+// buffer_snapshot()) and a worker thread writes it out while editing goes
+// on. The UI thread calls saver_poll() every frame to update progress and
+// to find out when the file is on disk.
+
+typedef enum {
+    SAVE_RUNNING,
+    SAVE_DONE,
+    SAVE_FAILED,
+} SaveStatus;
+
+typedef struct
+{
+    Buffer*         buf;
+    BufferSnapshot* snap;
+    char*           filename;
+    u64             revision; // Buffer revision the snapshot was taken at
+    pthread_t       thread;
+    bool            running; // Worker not yet joined
+
+    // Shared with the worker
+    size_t          written; // Updated atomically
+    pthread_mutex_t lock;
+    bool            finished;
+    bool            ok;
+} Saver;
+
+// Start saving buf to its filename. Returns NULL if it has none or another
+// save of it is still running.
+Saver*     saver_start(Buffer* buf);
+SaveStatus saver_poll(Saver* sv);
+void       saver_destroy(Saver* sv); // Waits for a running save
+
+#endif
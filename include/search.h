@@ -0,0 +1,75 @@
+#ifndef KSEDIT_SEARCH_H
+#define KSEDIT_SEARCH_H
+
+#include "buffer.h"
+#include "types.h"
+
+// Literal substring search. Candidates are found with a vector filter on
+// the needle's first and last bytes; on CPUs without one, long needles use
+// Horspool's skip loop and short ones memchr. Searches run directly over
+// the buffer's spans (see BufferIter); matches that straddle two spans are
+// checked in a small window copied around the seam. The kernel for the
+// running CPU is picked once at startup, like newline.h.
+
+typedef enum {
+    SEARCH_IGNORE_CASE = 1 << 0, // ASCII letters only
+    SEARCH_WHOLE_WORD  = 1 << 1, // No word character directly before or after
+    SEARCH_REGEX       = 1 << 2, // Pattern for regex.h; the literal searcher ignores it
+} SearchFlags;
+
+typedef enum {
+    SEARCH_SCALAR,
+    SEARCH_SSE2,
+    SEARCH_AVX2,
+} SearchKernel;
+
+// A compiled needle. Read-only once initialised, so one searcher can be
+// shared by several threads.
+typedef struct
+{
+    u8*    needle; // Lowercased when ignoring case
+    size_t len;
+    u32    flags;
+    size_t shift[256];      // Horspool skips, scanning forward
+    size_t shift_back[256]; // Horspool skips, scanning backward
+} Searcher;
+
+bool search_init(Searcher* s, const char* needle, size_t len, u32 flags);
+void search_free(Searcher* s);
+
+// First / last match lying entirely inside [p, p + len), or NULL. Whole-word
+// mode is not applied here, since it needs the bytes around the block.
+const char* search_block(const Searcher* s, const char* p, size_t len);
+const char* search_block_last(const Searcher* s, const char* p, size_t len);
+
+// First / last match lying entirely inside [start, end) of the buffer, or -1
+i64 search_forward(const Searcher* s, Buffer* buf, size_t start, size_t end);
+i64 search_backward(const Searcher* s, Buffer* buf, size_t start, size_t end);
+
+// Match starts in order, as collected below
+typedef struct
+{
+    size_t* pos;
+    size_t  count;
+    size_t  capacity;
+} SearchHits;
+
+// Appends every match lying entirely inside [start, end), overlapping ones
+// included. Returns false if it ran out of memory on the way.
+bool search_collect(const Searcher* s, Buffer* buf, size_t start, size_t end, SearchHits* hits);
+
+// Multi-threaded variants for large ranges. The range is cut into chunks
+// that overlap by the needle length; workers from a shared pool claim them
+// in order. A forward search stops claiming chunks once an earlier one
+// holds a match. search_count counts every match, overlapping ones
+// included, i.e. every stop of repeated find-next. threads <= 0 means one
+// per CPU. The buffer must not change until they return.
+i64    search_forward_parallel(const Searcher* s, Buffer* buf, size_t start, size_t end, int threads);
+size_t search_count(const Searcher* s, Buffer* buf, size_t start, size_t end, int threads);
+
+// Force a specific kernel (tests/benchmarks). Returns false if the CPU
+// doesn't support it, leaving the current choice alone.
+bool         search_use_kernel(SearchKernel kernel);
+SearchKernel search_active_kernel(void);
+
+#endif
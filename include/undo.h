@@ -6,30 +6,173 @@
 typedef enum {
     OP_INSERT,
     OP_DELETE,
+    OP_REPLACE,
+    OP_BATCH,
 } OpType;
 
+// A replace-all, kept as the match offsets and the two strings rather than
+// a delete and an insert per match. Offsets are ascending and refer to the
+// text before the replace. old_text is one old_len string, or count of
+// them back to back when the matches differed (ignoring case).
+typedef struct
+{
+    size_t* positions;
+    size_t  count;
+    char*   old_text;
+    size_t  old_len;
+    bool    old_each;
+    char*   new_text;
+    size_t  new_len;
+} ReplaceOp;
+
+// Several edits made as one step, such as a keystroke at every cursor or a
+// line operation. Edits are ascending, don't overlap, and give their
+// position in the text before the batch. The removed and inserted texts are
+// kept back to back, in edit order.
 typedef struct
 {
-    OpType type;
     size_t pos;
-    char*  text;
-    size_t len;
+    size_t old_len;
+    size_t new_len;
+} BatchEdit;
+
+typedef struct
+{
+    BatchEdit* edits;
+    size_t     count;
+    char*      old_text;
+    char*      new_text;
+    bool       one_cursor; // Undo/redo leave a single cursor at cursor_old/new,
+    size_t     cursor_old; // rather than one after each edit
+    size_t     cursor_new;
+} BatchOp;
+
+typedef struct
+{
+    OpType     type;
+    size_t     pos;
+    char*      text;
+    size_t     len;
+    size_t     lead;     // Spare bytes taken before text, and the whole
+    size_t     capacity; // block, so keystrokes can grow it either way
+    size_t     chunk;    // Arena top before the text was taken, to cut
+    size_t     used;     // back to when the operation is dropped
+    i64        spill;    // Offset of the text in the spill file, or -1
+    bool       joined;   // Undone and redone with the one below (a group)
+    ReplaceOp* replace;  // OP_REPLACE only
+    BatchOp*   batch;    // OP_BATCH only
 } Operation;
 
+// Operation text lives in an append-only arena of chunks. Taking text bumps
+// an offset into the last chunk, dropping redo history moves the top back
+// to where the first dropped operation began, and the whole history goes
+// in a few frees. Replaces and batches own their arrays as before.
+#define UNDO_CHUNK (256 * 1024)
+
+typedef struct
+{
+    char*  data;
+    size_t size;
+} UndoChunk;
+
+typedef struct
+{
+    UndoChunk* chunks;
+    size_t     count;    // Chunks held, including a spare past top
+    size_t     capacity;
+    size_t     top;      // Chunk being filled
+    size_t     used;     // Bytes taken from it
+    size_t     bytes;    // Size of all the chunks held
+} UndoArena;
+
+// History is bounded. A text of spill_min bytes or more goes to an unlinked
+// temporary file instead of memory, with text left NULL, and is read back
+// in blocks when undone. Once the operations held in memory pass
+// memory_limit bytes, or the live part of the file passes disk_limit, the
+// oldest operations are dropped.
+#define UNDO_SPILL_MIN    (1024 * 1024)
+#define UNDO_MEMORY_LIMIT (64 * 1024 * 1024)
+#define UNDO_DISK_LIMIT   ((size_t)4 << 30)
+
 typedef struct
 {
     Operation* ops;
     size_t     count;
     size_t     capacity;
-    size_t     current; // Index for undo/redo position
+    size_t     current;      // Index for undo/redo position
+    bool       open;         // The top operation can still take keystrokes
+    u64        last_ms;      // When the last keystroke was taken
+    UndoArena  arena;
+    size_t     memory;       // Bytes the operations hold outside the arena
+    size_t     pending;      // Bytes of the top operation's text still to come
+    int        spill_fd;     // -1 until a text is spilled
+    size_t     spill_start;  // Live bytes of the file; those before were
+    size_t     spill_end;    // dropped with their operations
+    size_t     memory_limit;
+    size_t     spill_min;
+    size_t     disk_limit;
+    size_t     group_depth;  // Open undo_begin_group calls
+    size_t     group_start;  // First operation of the outermost group
+    size_t     group_cursor; // Cursor when it began
 } UndoStack;
 
+// Keystrokes merge into one step until a pause this long, or until a word
+// starts once the step holds at least UNDO_STEP_MIN bytes
+#define UNDO_MERGE_MS 1000
+#define UNDO_STEP_MIN 32
+
 UndoStack* undo_create(void);
 void       undo_destroy(UndoStack* stack);
 
+// Change the bounds from UNDO_MEMORY_LIMIT, UNDO_SPILL_MIN and
+// UNDO_DISK_LIMIT. They apply from the next push.
+void undo_set_limits(UndoStack* stack, size_t memory_limit, size_t spill_min, size_t disk_limit);
+
 void undo_push_insert(UndoStack* stack, size_t pos, const char* text, size_t len);
 void undo_push_delete(UndoStack* stack, size_t pos, const char* text, size_t len);
 
+// The same for a text that isn't in one place, such as a deleted range of
+// the buffer: undo_push_begin with its length, then undo_push_piece for
+// each piece in order. False if the text can't be kept (it is bigger than
+// disk_limit, or the file can't be written), in which case the history
+// before it goes too, since undoing past the gap would be wrong.
+bool undo_push_begin(UndoStack* stack, OpType type, size_t pos, size_t len);
+void undo_push_piece(UndoStack* stack, const char* text, size_t len);
+
+// Forget the operation just pushed, for an edit that then couldn't be made
+void undo_drop(UndoStack* stack);
+
+// Copy n bytes of op's text from offset on into out, from memory or from
+// the spill file. False if the file can't be read.
+bool undo_read_text(UndoStack* stack, const Operation* op, size_t offset, char* out, size_t n);
+
+// A keystroke: text typed at pos (OP_INSERT), or removed from pos by
+// Backspace or Delete (OP_DELETE). It joins the operation on top if that
+// was a keystroke of the same kind right next to it, within UNDO_MERGE_MS,
+// and the join isn't a word start in a step of UNDO_STEP_MIN bytes or more;
+// otherwise it starts a new one. now_ms is from a monotonic clock.
+void undo_push_typed(UndoStack* stack, OpType type, size_t pos, const char* text, size_t len, u64 now_ms);
+
+// Let no further keystroke join the operation on top (the cursor moved)
+void undo_seal(UndoStack* stack);
+
+// Everything pushed between these two, such as a paste over a selection,
+// is one step. Groups nest, and it is the outermost that counts: when it
+// ends, its operations are composed into one OP_BATCH of edits to the text
+// as it was when the group began, so undo and redo are a single pass that
+// leaves the cursor at cursor (as given to begin, then end). A group with
+// spilled text can't be composed; its operations are marked joined instead.
+void undo_begin_group(UndoStack* stack, size_t cursor);
+void undo_end_group(UndoStack* stack, size_t cursor);
+
+// Takes ownership of replace and everything it points to
+void undo_push_replace(UndoStack* stack, ReplaceOp* replace);
+void undo_free_replace(ReplaceOp* replace);
+
+// Takes ownership of batch and everything it points to
+void undo_push_batch(UndoStack* stack, BatchOp* batch);
+void undo_free_batch(BatchOp* batch);
+
 Operation* undo_pop(UndoStack* stack);
 Operation* redo_pop(UndoStack* stack);
 
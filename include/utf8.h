@@ -0,0 +1,69 @@
+#ifndef KSEDIT_UTF8_H
+#define KSEDIT_UTF8_H
+
+#include "types.h"
+
+// UTF-8 decoding and display widths. Text is never rejected: a byte that
+// doesn't start a well-formed sequence (stray continuation, overlong form,
+// surrogate, truncated sequence) decodes on its own as U+FFFD, one column
+// wide. Runs of ASCII, the common case, are skipped with the best vector
+// kernel for the running CPU (AVX2, SSE2 or scalar), picked at startup.
+
+#define UTF8_REPLACEMENT 0xFFFD
+#define UTF8_MAX         4 // Longest sequence
+
+typedef enum {
+    UTF8_SCALAR,
+    UTF8_SSE2,
+    UTF8_AVX2,
+} Utf8Kernel;
+
+// Decode the character at p (len > 0 bytes available) into *cp. Returns its
+// length in bytes, 1 for a malformed byte.
+size_t utf8_decode(const char* p, size_t len, u32* cp);
+
+// Encode cp into out (UTF8_MAX bytes of room). Returns the length, 0 for
+// surrogates and values past U+10FFFF.
+size_t utf8_encode(u32 cp, char* out);
+
+// Display columns: 0 for combining marks and other zero-width characters,
+// 2 for East Asian wide characters and emoji, 1 for everything else.
+int utf8_width(u32 cp);
+
+// Number of leading bytes of [p, p + len) below 0x80
+size_t utf8_ascii_run(const char* p, size_t len);
+
+// Position within a line, as offsets from its start in each unit
+typedef struct
+{
+    size_t byte;
+    size_t cp;
+    size_t col;
+} Utf8Pos;
+
+typedef enum {
+    UTF8_BYTES,
+    UTF8_CODEPOINTS,
+    UTF8_COLUMNS,
+} Utf8Unit;
+
+static inline size_t utf8_pos_get(const Utf8Pos* at, Utf8Unit unit)
+{
+    return unit == UTF8_BYTES ? at->byte : unit == UTF8_CODEPOINTS ? at->cp : at->col;
+}
+
+// Walk whole characters of p, advancing *at by each, while fewer than stop
+// bytes have been walked and the next character wouldn't carry the given
+// unit past target (at must not be past it already). Characters may run on
+// past stop up to len, so a caller walking a window of a longer line can
+// hand over a few bytes of lookahead. Zero-width characters at a column
+// target are taken in, keeping combining marks with their base. Returns the
+// bytes walked.
+size_t utf8_walk(const char* p, size_t len, size_t stop, Utf8Unit unit, size_t target, Utf8Pos* at);
+
+// Force a specific kernel (tests/benchmarks). Returns false if the CPU
+// doesn't support it, leaving the current choice alone.
+bool       utf8_use_kernel(Utf8Kernel kernel);
+Utf8Kernel utf8_active_kernel(void);
+
+#endif
@@ -15,6 +15,10 @@ typedef struct
     int      height;
     Atom     wm_delete;
     bool     should_close;
+
+    // Input method for composed and non-Latin text; ic is NULL without one
+    XIM im;
+    XIC ic;
 } Window_State;
 
 bool window_init(Window_State* win, int width, int height, const char* title);
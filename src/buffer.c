@@ -1,29 +1,103 @@
+#define _GNU_SOURCE // copy_file_range, mremap
 #include "buffer.h"
+#include "newline.h"
+#include "search.h"
+#include "utf8.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #define INITIAL_GAP_SIZE 4096
 
-// Forward declarations for O(1) line index delta tracking
-static void line_index_on_insert(Buffer* buf, size_t pos, char c);
-static void line_index_on_delete(Buffer* buf, size_t pos, char c);
-static void buffer_flush_line_index(Buffer* buf);
+// Spilled undo text is read back this much at a time
+#define UNDO_STREAM_BLOCK (1024 * 1024)
+
+// Large gap arrays are anonymous mappings: growing one is an mremap that
+// moves page tables instead of copying, gap pages that were never touched
+// cost nothing, and pages freed by a big delete go back to the kernel.
+#define GAP_MMAP_THRESHOLD   (1024 * 1024)
+#define GAP_HUGE_THRESHOLD   (8 * 1024 * 1024)
+#define GAP_RELEASE_MIN      (1024 * 1024)
+#define GAP_RELEASE_HEADROOM (64 * 1024) // Kept resident for typing after a delete
+
+// Forward declarations for the line index, columns and cursor bookkeeping below
+static size_t line_index_on_insert(Buffer* buf, size_t pos, const char* text, size_t len);
+static void line_index_on_delete(Buffer* buf, size_t pos, size_t len);
+static void cursors_place(Buffer* buf, const size_t* ends, size_t count, size_t primary);
+static Utf8Pos line_pos(Buffer* buf, size_t pos, size_t* line);
+static size_t step_chars(Buffer* buf, size_t pos, i32 delta);
+static size_t line_bounds(Buffer* buf, size_t line, size_t* len);
+
+static bool gap_mapped(size_t capacity)
+{
+    return capacity >= GAP_MMAP_THRESHOLD;
+}
+
+static void gap_advise(char* data, size_t capacity)
+{
+    if (capacity >= GAP_HUGE_THRESHOLD)
+        madvise(data, capacity, MADV_HUGEPAGE);
+}
+
+static char* gap_alloc(size_t capacity)
+{
+    if (!gap_mapped(capacity))
+        return malloc(capacity);
+
+    char* data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+    gap_advise(data, capacity);
+    return data;
+}
+
+static void gap_free(char* data, size_t capacity)
+{
+    if (gap_mapped(capacity))
+        munmap(data, capacity);
+    else
+        free(data);
+}
 
 Buffer* buffer_create(size_t initial_capacity)
+{
+    return buffer_create_with_storage(initial_capacity, STORAGE_GAP);
+}
+
+Buffer* buffer_create_with_storage(size_t initial_capacity, BufferStorage storage)
 {
     Buffer* buf = malloc(sizeof(Buffer));
     if (!buf)
         return NULL;
 
-    if (initial_capacity < INITIAL_GAP_SIZE) {
-        initial_capacity = INITIAL_GAP_SIZE;
-    }
+    buf->storage = storage;
+    buf->pieces  = NULL;
+    buf->data    = NULL;
 
-    buf->data = malloc(initial_capacity);
-    if (!buf->data) {
-        free(buf);
-        return NULL;
+    if (storage == STORAGE_PIECE) {
+        buf->pieces = piece_create();
+        if (!buf->pieces) {
+            free(buf);
+            return NULL;
+        }
+        initial_capacity = 0;
+    } else {
+        if (initial_capacity < INITIAL_GAP_SIZE) {
+            initial_capacity = INITIAL_GAP_SIZE;
+        }
+
+        buf->data = gap_alloc(initial_capacity);
+        if (!buf->data) {
+            free(buf);
+            return NULL;
+        }
     }
 
     buf->capacity  = initial_capacity;
@@ -40,15 +114,27 @@ Buffer* buffer_create(size_t initial_capacity)
     buf->sel_start     = 0;
     buf->sel_end       = 0;
 
+    buf->cursors         = NULL;
+    buf->cursor_count    = 0;
+    buf->cursor_capacity = 0;
+
     buf->undo = undo_create();
 
-    buf->line_offsets    = NULL;
-    buf->line_count      = 0;
-    buf->line_capacity   = 0;
-    buf->line_gap_start  = 0;
-    buf->line_gap_end    = 0;
-    buf->dirty_from_line = 0;
-    buf->offset_delta    = 0;
+    buf->lines      = lineindex_create();
+    buf->line_count = 0;
+    colindex_init(&buf->cols);
+
+    buf->loading    = false;
+    buf->load_total = 0;
+
+    buf->snapshot   = NULL;
+    buf->revision   = 0;
+    buf->saving     = false;
+    buf->save_done  = 0;
+    buf->save_total = 0;
+
+    buf->on_edit     = NULL;
+    buf->on_edit_ctx = NULL;
 
     return buf;
 }
@@ -57,38 +143,107 @@ void buffer_destroy(Buffer* buf)
 {
     if (!buf)
         return;
-    free(buf->data);
+    gap_free(buf->data, buf->capacity);
+    piece_destroy(buf->pieces);
     free(buf->filename);
-    free(buf->line_offsets);
+    lineindex_destroy(buf->lines);
+    colindex_free(&buf->cols);
     undo_destroy(buf->undo);
+    free(buf->cursors);
     free(buf);
 }
 
-static void buffer_expand(Buffer* buf, size_t needed)
+// A live snapshot shares the gap array. Before writing to [start, end) of
+// it, switch to a private copy unless the range lies inside the snapshot's
+// gap, which it never reads. If the copy can't be made the edit still goes
+// ahead and the snapshot is marked broken, so its save is abandoned.
+static void buffer_unshare(Buffer* buf, size_t start, size_t end)
+{
+    BufferSnapshot* snap = buf->snapshot;
+    if (!snap || (start >= snap->gap_start && end <= snap->gap_end))
+        return;
+
+    char* copy = gap_alloc(buf->capacity);
+    if (!copy) {
+        __atomic_store_n(&snap->broken, true, __ATOMIC_RELEASE);
+        snap->buf     = NULL;
+        buf->snapshot = NULL;
+        return;
+    }
+    memcpy(copy, buf->data, buf->gap_start);
+    memcpy(copy + buf->gap_end, buf->data + buf->gap_end, buf->capacity - buf->gap_end);
+
+    snap->owns_data = true;
+    snap->buf       = NULL;
+    buf->snapshot   = NULL;
+    buf->data       = copy;
+}
+
+static void buffer_move_gap(Buffer* buf, size_t pos);
+
+// Grow a mapped array in place (or let the kernel move its pages), then
+// slide the text after the gap up to the new end. No second copy of the
+// text ever exists.
+static bool buffer_remap(Buffer* buf, size_t new_capacity, size_t pos)
+{
+    char* grown = mremap(buf->data, buf->capacity, new_capacity, MREMAP_MAYMOVE);
+    if (grown == MAP_FAILED)
+        return false;
+    gap_advise(grown, new_capacity);
+
+    size_t tail = buf->capacity - buf->gap_end;
+    memmove(grown + new_capacity - tail, grown + buf->gap_end, tail);
+    buf->data     = grown;
+    buf->gap_end  = new_capacity - tail;
+    buf->capacity = new_capacity;
+    buffer_move_gap(buf, pos);
+    return true;
+}
+
+// Grow so the gap holds at least needed bytes, laying the text out with
+// the gap already at pos so no second move is needed
+static void buffer_expand_at(Buffer* buf, size_t needed, size_t pos)
 {
     size_t gap_size = buf->gap_end - buf->gap_start;
     if (gap_size >= needed)
         return;
 
-    size_t new_capacity      = buf->capacity * 2;
-    size_t content_after_gap = buf->capacity - buf->gap_end;
+    size_t len          = buffer_length(buf);
+    size_t new_capacity = buf->capacity * 2;
 
-    while (new_capacity - buffer_length(buf) < needed) {
+    while (new_capacity - len < needed) {
         new_capacity *= 2;
     }
 
-    char* new_data = malloc(new_capacity);
+    // A snapshot reading the array pins it where it is
+    if (!buf->snapshot && gap_mapped(buf->capacity) && buffer_remap(buf, new_capacity, pos))
+        return;
+
+    char* new_data = gap_alloc(new_capacity);
     if (!new_data)
         return;
 
-    memcpy(new_data, buf->data, buf->gap_start);
-    size_t new_gap_end = new_capacity - content_after_gap;
-    memcpy(new_data + new_gap_end, buf->data + buf->gap_end, content_after_gap);
+    size_t new_gap_end = new_capacity - (len - pos);
+    buffer_extract(buf, 0, pos, new_data);
+    buffer_extract(buf, pos, len - pos, new_data + new_gap_end);
 
-    free(buf->data);
-    buf->data     = new_data;
-    buf->gap_end  = new_gap_end;
-    buf->capacity = new_capacity;
+    // The old array stays alive for a snapshot still reading it
+    if (buf->snapshot) {
+        buf->snapshot->owns_data = true;
+        buf->snapshot->buf       = NULL;
+        buf->snapshot            = NULL;
+    } else {
+        gap_free(buf->data, buf->capacity);
+    }
+    buf->data      = new_data;
+    buf->gap_start = pos;
+    buf->gap_end   = new_gap_end;
+    buf->capacity  = new_capacity;
+}
+
+static void buffer_expand(Buffer* buf, size_t needed)
+{
+    buffer_expand_at(buf, needed, buf->gap_start);
 }
 
 static void buffer_move_gap(Buffer* buf, size_t pos)
@@ -98,28 +253,407 @@ static void buffer_move_gap(Buffer* buf, size_t pos)
 
     if (pos < buf->gap_start) {
         size_t delta = buf->gap_start - pos;
+        buffer_unshare(buf, buf->gap_end - delta, buf->gap_end);
         memmove(buf->data + buf->gap_end - delta, buf->data + pos, delta);
         buf->gap_start = pos;
         buf->gap_end -= delta;
     } else {
         size_t delta = pos - buf->gap_start;
+        buffer_unshare(buf, buf->gap_start, buf->gap_start + delta);
         memmove(buf->data + buf->gap_start, buf->data + buf->gap_end, delta);
         buf->gap_start += delta;
         buf->gap_end += delta;
     }
 }
 
-void buffer_insert_char(Buffer* buf, char c)
+// After a big delete, give the gap's pages back to the kernel. They read
+// back as zeros once touched again, which is all a gap needs. Pages a live
+// snapshot may still read are left alone.
+static void buffer_release_gap(Buffer* buf)
+{
+    if (buf->snapshot || !gap_mapped(buf->capacity))
+        return;
+
+    uintptr_t page  = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)(buf->data + buf->gap_start) + GAP_RELEASE_HEADROOM;
+    uintptr_t end   = (uintptr_t)(buf->data + buf->gap_end);
+    start           = (start + page - 1) & ~(page - 1);
+    end &= ~(page - 1);
+    if (end > start)
+        madvise((void*)start, end - start, MADV_DONTNEED);
+}
+
+// Raw storage edits - no undo, line index or cursor bookkeeping, except
+// that extra cursors are dropped since they no longer point anywhere useful.
+// False if out of memory, with nothing changed.
+static bool storage_insert(Buffer* buf, size_t pos, const char* text, size_t len)
+{
+    if (buf->storage == STORAGE_PIECE) {
+        if (!piece_insert(buf->pieces, pos, text, len))
+            return false;
+    } else {
+        buffer_expand_at(buf, len, pos);
+        if (buf->gap_end - buf->gap_start < len)
+            return false;
+
+        buffer_move_gap(buf, pos);
+        buffer_unshare(buf, buf->gap_start, buf->gap_start + len);
+        memcpy(buf->data + buf->gap_start, text, len);
+        buf->gap_start += len;
+    }
+    buf->revision++;
+    buf->cursor_count = 0;
+    colindex_edit(&buf->cols, pos, 0, len, text, len);
+    if (buf->on_edit)
+        buf->on_edit(buf->on_edit_ctx, pos, 0, len);
+    return true;
+}
+
+static bool storage_delete(Buffer* buf, size_t pos, size_t len)
+{
+    if (buf->storage == STORAGE_PIECE) {
+        if (!piece_delete(buf->pieces, pos, len))
+            return false;
+    } else {
+        buffer_move_gap(buf, pos);
+        buf->gap_end += len;
+        if (len >= GAP_RELEASE_MIN)
+            buffer_release_gap(buf);
+    }
+    buf->revision++;
+    buf->cursor_count = 0;
+    colindex_edit(&buf->cols, pos, len, 0, NULL, 0);
+    if (buf->on_edit)
+        buf->on_edit(buf->on_edit_ctx, pos, len, 0);
+    return true;
+}
+
+// Longest contiguous run of text starting at pos (pos < buffer_length)
+static const char* storage_span_at(Buffer* buf, size_t pos, size_t* out_len)
+{
+    if (buf->storage == STORAGE_PIECE)
+        return piece_span_at(buf->pieces, pos, out_len);
+
+    if (pos < buf->gap_start) {
+        *out_len = buf->gap_start - pos;
+        return buf->data + pos;
+    }
+    size_t back = buf->gap_end + (pos - buf->gap_start);
+    *out_len    = buf->capacity - back;
+    return buf->data + back;
+}
+
+// Contiguous run of text ending at pos, starting pos - *out_len
+static const char* storage_span_before(Buffer* buf, size_t pos, size_t* out_len)
+{
+    if (buf->storage == STORAGE_PIECE)
+        return piece_span_before(buf->pieces, pos, out_len);
+
+    if (pos <= buf->gap_start) {
+        *out_len = pos;
+        return buf->data;
+    }
+    *out_len = pos - buf->gap_start;
+    return buf->data + buf->gap_end;
+}
+
+// Store the start of every line that begins in (start, end]
+static size_t storage_collect_line_starts(Buffer* buf, size_t start, size_t end, size_t* out)
+{
+    size_t count = 0;
+    while (start < end) {
+        size_t      len;
+        const char* run = storage_span_at(buf, start, &len);
+        if (len > end - start)
+            len = end - start;
+        count += newline_collect(run, len, start, out + count);
+        start += len;
+    }
+    return count;
+}
+
+// Start of occurrence i of a rewrite, given positions from a text where
+// every occurrence before it was at_len long and is now from_len
+static inline size_t rewrite_pos(const size_t* at, size_t i, size_t at_len, size_t from_len)
+{
+    return at[i] + i * from_len - i * at_len;
+}
+
+// Dense matches would cost more in pieces (two per match) than copying
+// the whole text into one
+#define REWRITE_PIECE_SPACING 512
+
+static inline const char* rewrite_text(const char* to, size_t to_len, bool to_each, size_t i)
+{
+    return to_each ? to + i * to_len : to;
+}
+
+// Piece table: a fresh tree whose pieces reuse the text between the
+// occurrences, or for dense ones, a single piece holding a fresh copy
+static bool rewrite_pieces(Buffer* buf, const size_t* at, size_t count, size_t at_len, size_t from_len,
+    const char* to, size_t to_len, bool to_each, size_t total)
+{
+    PieceTable* pt  = buf->pieces;
+    size_t      len = buffer_length(buf);
+
+    if (count > total / REWRITE_PIECE_SPACING) {
+        char* out = piece_add_reserve(pt, total);
+        if (!out && total > 0)
+            return false;
+        size_t src = 0;
+        size_t n   = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t pos = rewrite_pos(at, i, at_len, from_len);
+            n += buffer_extract(buf, src, pos - src, out + n);
+            memcpy(out + n, rewrite_text(to, to_len, to_each, i), to_len);
+            n += to_len;
+            src = pos + from_len;
+        }
+        buffer_extract(buf, src, len - src, out + n);
+        PieceSpan whole = { out, total };
+        return piece_set_spans(pt, &whole, 1);
+    }
+
+    size_t     to_all = to_each ? count * to_len : to_len;
+    char*      stored = piece_add_reserve(pt, to_all);
+    PieceSpan* spans  = malloc((pt->piece_count + 2 * count + 1) * sizeof(PieceSpan));
+    if ((!stored && to_all > 0) || !spans) {
+        free(spans);
+        return false;
+    }
+    memcpy(stored, to, to_all);
+
+    size_t n   = 0;
+    size_t src = 0;
+    for (size_t i = 0; i <= count; i++) {
+        size_t end = i < count ? rewrite_pos(at, i, at_len, from_len) : len;
+        while (src < end) {
+            size_t      run;
+            const char* text = piece_span_at(pt, src, &run);
+            if (run > end - src)
+                run = end - src;
+            spans[n++] = (PieceSpan) { text, run };
+            src += run;
+        }
+        if (i < count) {
+            spans[n++] = (PieceSpan) { rewrite_text(stored, to_len, to_each, i), to_len };
+            src += from_len;
+        }
+    }
+    bool ok = piece_set_spans(pt, spans, n);
+    free(spans);
+    return ok;
+}
+
+// Gap buffer: in place, with the gap moved to the end first. Shrinking
+// slides the text down front to back; growing slides it up back to front
+// into the gap. Bytes before the first occurrence never move, and same
+// length replacements move nothing at all.
+static bool rewrite_gap(Buffer* buf, const size_t* at, size_t count, size_t at_len, size_t from_len,
+    const char* to, size_t to_len, bool to_each, size_t total)
+{
+    size_t len = buffer_length(buf);
+    if (total > len) {
+        buffer_expand_at(buf, total - len, len);
+        if (buf->gap_end - buf->gap_start < total - len)
+            return false;
+    }
+    buffer_move_gap(buf, len);
+    buffer_unshare(buf, 0, len);
+
+    char* d = buf->data;
+    if (to_len <= from_len) {
+        size_t out = rewrite_pos(at, 0, at_len, from_len);
+        size_t src = out;
+        for (size_t i = 0; i < count; i++) {
+            size_t pos = rewrite_pos(at, i, at_len, from_len);
+            if (out != src)
+                memmove(d + out, d + src, pos - src);
+            out += pos - src;
+            memcpy(d + out, rewrite_text(to, to_len, to_each, i), to_len);
+            out += to_len;
+            src = pos + from_len;
+        }
+        if (out != src)
+            memmove(d + out, d + src, len - src);
+    } else {
+        size_t out = total;
+        size_t end = len;
+        for (size_t i = count; i-- > 0;) {
+            size_t pos  = rewrite_pos(at, i, at_len, from_len);
+            size_t tail = end - (pos + from_len);
+            out -= tail;
+            memmove(d + out, d + pos + from_len, tail);
+            out -= to_len;
+            memcpy(d + out, rewrite_text(to, to_len, to_each, i), to_len);
+            end = pos;
+        }
+    }
+
+    buf->gap_start = total;
+    buf->gap_end   = buf->capacity;
+    if (len - total >= GAP_RELEASE_MIN && len > total)
+        buffer_release_gap(buf);
+    return true;
+}
+
+// Rebuild the text in one pass with count occurrences, each from_len long,
+// replaced by to (or by to + i * to_len each, if to_each). False if out of
+// memory, changing nothing.
+static bool storage_rewrite(Buffer* buf, const size_t* at, size_t count, size_t at_len, size_t from_len,
+    const char* to, size_t to_len, bool to_each)
+{
+    size_t len   = buffer_length(buf);
+    size_t total = len - count * from_len + count * to_len;
+    bool   ok    = buf->storage == STORAGE_PIECE
+           ? rewrite_pieces(buf, at, count, at_len, from_len, to, to_len, to_each, total)
+           : rewrite_gap(buf, at, count, at_len, from_len, to, to_len, to_each, total);
+    if (!ok)
+        return false;
+
+    buf->revision++;
+    buf->cursor_count = 0;
+    colindex_clear(&buf->cols);
+    if (buf->on_edit)
+        buf->on_edit(buf->on_edit_ctx, 0, len, total);
+    return true;
+}
+
+// What a batch edit takes out of the text and puts in, going forward or
+// undoing
+static inline size_t batch_out(const BatchEdit* e, bool undo) { return undo ? e->new_len : e->old_len; }
+static inline size_t batch_in(const BatchEdit* e, bool undo) { return undo ? e->old_len : e->new_len; }
+
+// Apply a batch in one pass: each edit's old text is replaced by its new
+// text, or the other way round when undoing. A gap buffer grows once up
+// front, then its gap sweeps across the edits in one direction, so the
+// text between them moves once; the sweep starts from whichever end is
+// nearer the gap, so repeated keystrokes don't drag it back each time.
+// The line index is patched edit by edit. ends, if given, gets the
+// position just past each edit's inserted text. Extra cursors are left for
+// the caller to place.
+static bool storage_batch(Buffer* buf, const BatchOp* b, bool undo, size_t* ends)
+{
+    size_t n = b->count;
+    if (n == 0)
+        return true;
+
+    size_t old_total = 0;
+    size_t new_total = 0;
+    for (size_t i = 0; i < n; i++) {
+        old_total += b->edits[i].old_len;
+        new_total += b->edits[i].new_len;
+    }
+
+    // Positions in the text as it is now, before the batch
+    const BatchEdit* last  = &b->edits[n - 1];
+    size_t           first = b->edits[0].pos;
+    size_t last_at = undo ? last->pos - (old_total - last->old_len) + (new_total - last->new_len) : last->pos;
+
+    bool backward = false;
+    if (buf->storage == STORAGE_GAP) {
+        size_t gap = buf->gap_start;
+        backward   = (gap > last_at ? gap - last_at : last_at - gap) < (gap > first ? gap - first : first - gap);
+
+        // Room for the most the text grows at any point along the way
+        size_t grown = 0, shrunk = 0, peak = 0;
+        for (size_t k = 0; k < n; k++) {
+            const BatchEdit* e = &b->edits[backward ? n - 1 - k : k];
+            grown += batch_in(e, undo);
+            shrunk += batch_out(e, undo);
+            if (grown > shrunk && grown - shrunk > peak)
+                peak = grown - shrunk;
+        }
+        buffer_expand_at(buf, peak, backward ? last_at : first);
+        if (buf->gap_end - buf->gap_start < peak)
+            return false;
+    } else {
+        // Set aside what the piece edits below need, so none fails half way
+        if (!piece_reserve(buf->pieces, 4 * n, undo ? old_total : new_total))
+            return false;
+    }
+
+    // Going left to right, the text before edit i already has the earlier
+    // edits made, so it sits at its final position; going right to left it
+    // is still where it was
+    size_t old_prefix = backward ? old_total : 0; // Old and new text of the edits before i
+    size_t new_prefix = backward ? new_total : 0;
+    for (size_t k = 0; k < n; k++) {
+        size_t           i = backward ? n - 1 - k : k;
+        const BatchEdit* e = &b->edits[i];
+        if (backward) {
+            old_prefix -= e->old_len;
+            new_prefix -= e->new_len;
+        }
+        size_t      final = undo ? e->pos : e->pos - old_prefix + new_prefix;
+        size_t      now   = undo ? e->pos - old_prefix + new_prefix : e->pos;
+        size_t      at    = backward ? now : final;
+        size_t      del   = batch_out(e, undo);
+        size_t      ins   = batch_in(e, undo);
+        const char* text  = undo ? b->old_text + old_prefix : b->new_text + new_prefix;
+
+        if (buf->storage == STORAGE_PIECE) {
+            if (del > 0)
+                piece_delete(buf->pieces, at, del);
+            if (ins > 0)
+                piece_insert(buf->pieces, at, text, ins);
+        } else {
+            buffer_move_gap(buf, at);
+            buf->gap_end += del;
+            buffer_unshare(buf, buf->gap_start, buf->gap_start + ins);
+            memcpy(buf->data + buf->gap_start, text, ins);
+            buf->gap_start += ins;
+        }
+        if (del > 0)
+            line_index_on_delete(buf, at, del);
+        if (ins > 0)
+            line_index_on_insert(buf, at, text, ins);
+        if (ends)
+            ends[i] = final + ins;
+
+        if (!backward) {
+            old_prefix += e->old_len;
+            new_prefix += e->new_len;
+        }
+    }
+
+    size_t removed = undo ? new_total : old_total;
+    size_t added   = undo ? old_total : new_total;
+    if (buf->storage == STORAGE_GAP && removed >= GAP_RELEASE_MIN)
+        buffer_release_gap(buf);
+
+    // Watchers hear of one edit spanning the whole batch, however many
+    // cursors made it
+    size_t span_old = last_at + batch_out(last, undo) - first;
+    buf->revision++;
+    colindex_edit(&buf->cols, first, span_old, span_old - removed + added, undo ? b->old_text : b->new_text, added);
+    if (buf->on_edit)
+        buf->on_edit(buf->on_edit_ctx, first, span_old, span_old - removed + added);
+    return true;
+}
+
+// No character runs across pos, so an edit there leaves the columns before
+// it alone: the byte at pos doesn't continue a multi-byte sequence
+static bool char_boundary(Buffer* buf, size_t pos)
+{
+    return pos >= buffer_length(buf) || ((u8)buffer_char_at(buf, pos) & 0xC0) != 0x80;
+}
+
+// Monotonic milliseconds, for merging keystrokes into undo steps
+static u64 clock_ms(void)
 {
-    char str[2] = { c, '\0' };
-    undo_push_insert(buf->undo, buf->cursor, str, 1);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+}
 
-    buffer_expand(buf, 1);
-    buffer_move_gap(buf, buf->cursor);
-    buf->data[buf->gap_start++] = c;
+void buffer_insert_char(Buffer* buf, char c)
+{
+    if (!storage_insert(buf, buf->cursor, &c, 1))
+        return;
+    undo_push_typed(buf->undo, OP_INSERT, buf->cursor, &c, 1, clock_ms());
 
-    // O(1) line index delta update
-    line_index_on_insert(buf, buf->cursor, c);
+    line_index_on_insert(buf, buf->cursor, &c, 1);
 
     buf->cursor++;
     buf->modified = true;
@@ -127,26 +661,40 @@ void buffer_insert_char(Buffer* buf, char c)
     if (c == '\n') {
         buf->line++;
         buf->col = 0;
-    } else {
+    } else if ((u8)c < 0x80 && char_boundary(buf, buf->cursor)) {
         buf->col++;
+    } else {
+        // Part of a multi-byte character: it may have completed one, or
+        // split one
+        buf->col = buffer_line_pos(buf, buf->cursor).col;
     }
 }
 
+// Delete and remember for undo the character in [start, end), merged with
+// the keystrokes before it
+static void delete_char_range(Buffer* buf, size_t start, size_t end)
+{
+    char   deleted[UTF8_MAX];
+    size_t n = buffer_extract(buf, start, end - start, deleted);
+    if (!storage_delete(buf, start, n))
+        return;
+    undo_push_typed(buf->undo, OP_DELETE, start, deleted, n, clock_ms());
+    line_index_on_delete(buf, start, n);
+    buf->modified = true;
+}
+
 void buffer_delete_char(Buffer* buf)
 {
     if (buf->cursor >= buffer_length(buf))
         return;
 
-    char deleted_char = buffer_char_at(buf, buf->cursor);
-    char deleted[2]   = { deleted_char, '\0' };
-    undo_push_delete(buf->undo, buf->cursor, deleted, 1);
-
-    buffer_move_gap(buf, buf->cursor);
-    buf->gap_end++;
-    buf->modified = true;
-
-    // O(1) line index delta update
-    line_index_on_delete(buf, buf->cursor, deleted_char);
+    // The whole character goes. The column stays unless bytes before the
+    // cursor can now decode differently: after an ASCII byte they can't,
+    // but a truncated sequence may take in what follows, in malformed text.
+    delete_char_range(buf, buf->cursor, buffer_next_char(buf, buf->cursor));
+    bool ascii_before = buf->cursor == 0 || (u8)buffer_char_at(buf, buf->cursor - 1) < 0x80;
+    if (!ascii_before || !char_boundary(buf, buf->cursor))
+        buf->col = buffer_line_pos(buf, buf->cursor).col;
 }
 
 void buffer_backspace(Buffer* buf)
@@ -154,31 +702,44 @@ void buffer_backspace(Buffer* buf)
     if (buf->cursor == 0)
         return;
 
-    char deleted_char = buffer_char_at(buf, buf->cursor - 1);
-    char deleted[2]   = { deleted_char, '\0' };
-    undo_push_delete(buf->undo, buf->cursor - 1, deleted, 1);
-
-    buffer_move_gap(buf, buf->cursor);
-    buf->gap_start--;
-    buf->cursor--;
-    buf->modified = true;
-
-    // O(1) line index delta update
-    line_index_on_delete(buf, buf->cursor, deleted_char);
+    size_t start = buffer_prev_char(buf, buf->cursor);
+    char   first = buffer_char_at(buf, start);
+    bool   ascii = buf->cursor - start == 1 && (u8)first < 0x80;
+    delete_char_range(buf, start, buf->cursor);
+    buf->cursor = start;
 
-    if (deleted_char == '\n') {
+    if (first == '\n') {
         buf->line--;
-        buf->col   = 0;
-        size_t pos = buf->cursor;
-        while (pos > 0 && buffer_char_at(buf, pos - 1) != '\n') {
-            pos--;
-            buf->col++;
-        }
-    } else {
+        buf->col = buffer_line_pos(buf, buf->cursor).col;
+    } else if (ascii && char_boundary(buf, buf->cursor)) {
         buf->col--;
+    } else {
+        buf->col = buffer_line_pos(buf, buf->cursor).col;
     }
 }
 
+// Start of the line holding pos, and the position of the newline ending it,
+// from the line index rather than a scan for the nearest '\n'
+static size_t line_start_at(Buffer* buf, size_t pos)
+{
+    if (buf->line_count == 0)
+        buffer_rebuild_line_index(buf);
+
+    size_t start;
+    lineindex_line_at(buf->lines, pos, &start);
+    return start;
+}
+
+static size_t line_end_at(Buffer* buf, size_t pos)
+{
+    if (buf->line_count == 0)
+        buffer_rebuild_line_index(buf);
+
+    size_t len;
+    size_t start = line_bounds(buf, lineindex_line_at(buf->lines, pos, NULL), &len);
+    return start + len;
+}
+
 void buffer_move_cursor(Buffer* buf, i32 delta)
 {
     size_t len     = buffer_length(buf);
@@ -192,97 +753,78 @@ void buffer_move_cursor(Buffer* buf, i32 delta)
     buffer_move_cursor_to(buf, (size_t)new_pos);
 }
 
+void buffer_move_char(Buffer* buf, i32 delta) { buffer_move_cursor_to(buf, step_chars(buf, buf->cursor, delta)); }
+
 void buffer_move_cursor_to(Buffer* buf, size_t pos)
 {
     size_t len = buffer_length(buf);
     if (pos > len)
         pos = len;
     buf->cursor = pos;
+    undo_seal(buf->undo); // Typing from here is a new undo step
 
     // Ensure line index exists
-    if (buf->line_offsets == NULL || buf->line_count == 0) {
+    if (buf->line_count == 0) {
         buffer_rebuild_line_index(buf);
     }
 
-    // If in recalc mode, flush stale offsets first (O(n) once)
-    // This is much faster than doing O(n) per binary search iteration
-    buffer_flush_line_index(buf);
-
-    // Binary search to find which line pos is on
-    size_t lo = 0;
-    size_t hi = buf->line_count;
-    while (lo < hi) {
-        size_t mid = lo + (hi - lo) / 2;
-        if (buffer_get_line_offset(buf, mid) <= pos) {
-            lo = mid + 1;
-        } else {
-            hi = mid;
-        }
-    }
-
-    // lo is now the first line whose offset > pos, so pos is on line lo-1
-    buf->line = (lo > 0) ? lo - 1 : 0;
-    buf->col  = pos - buffer_get_line_offset(buf, buf->line);
+    buf->col = line_pos(buf, pos, &buf->line).col;
 }
 
 void buffer_move_line(Buffer* buf, i32 delta)
 {
-    size_t target_col = buf->col;
-
-    if (delta < 0) {
-        while (delta < 0 && buf->line > 0) {
-            buffer_move_to_line_start(buf);
-            if (buf->cursor > 0) {
-                buffer_move_cursor(buf, -1);
-            }
-            delta++;
-        }
-    } else {
-        while (delta > 0) {
-            buffer_move_to_line_end(buf);
-            if (buf->cursor < buffer_length(buf)) {
-                buffer_move_cursor(buf, 1);
-            } else {
-                break;
-            }
-            delta--;
-        }
-    }
-
-    size_t line_start = buf->cursor;
-    size_t line_end   = line_start;
-    size_t len        = buffer_length(buf);
-
-    while (line_end < len && buffer_char_at(buf, line_end) != '\n') {
-        line_end++;
-    }
-
-    size_t line_len = line_end - line_start;
-    size_t new_col  = target_col < line_len ? target_col : line_len;
-    buffer_move_cursor_to(buf, line_start + new_col);
+    // The target line comes straight from the line index, so moving a
+    // page or a million lines costs the same as moving one
+    size_t count = buffer_line_count(buf);
+    size_t line  = buf->line < count ? buf->line : count - 1;
+    if (delta < 0)
+        line = (size_t)-(i64)delta > line ? 0 : line - (size_t)-(i64)delta;
+    else
+        line = (size_t)delta > count - 1 - line ? count - 1 : line + (size_t)delta;
+
+    // The character at the same display column, or the line end
+    size_t  start = buffer_get_line_offset(buf, line);
+    Utf8Pos at    = buffer_line_seek(buf, line, UTF8_COLUMNS, buf->col);
+    buf->cursor   = start + at.byte;
+    buf->line     = line;
+    buf->col      = at.col;
+    undo_seal(buf->undo);
 }
 
 void buffer_move_to_line_start(Buffer* buf)
 {
-    while (buf->cursor > 0 && buffer_char_at(buf, buf->cursor - 1) != '\n') {
-        buf->cursor--;
-    }
-    buf->col = 0;
+    buf->cursor = line_start_at(buf, buf->cursor);
+    buf->col    = 0;
+    undo_seal(buf->undo);
 }
 
 void buffer_move_to_line_end(Buffer* buf)
 {
-    size_t len = buffer_length(buf);
-    while (buf->cursor < len && buffer_char_at(buf, buf->cursor) != '\n') {
-        buf->cursor++;
-        buf->col++;
-    }
+    size_t end  = line_end_at(buf, buf->cursor);
+    buf->cursor = end;
+    buf->col    = buffer_line_pos(buf, end).col;
+    undo_seal(buf->undo);
 }
 
-size_t buffer_length(Buffer* buf) { return buf->capacity - (buf->gap_end - buf->gap_start); }
+// Make sure len more bytes can be inserted without reallocating
+void buffer_reserve(Buffer* buf, size_t len)
+{
+    if (buf->storage == STORAGE_GAP)
+        buffer_expand(buf, len);
+}
+
+size_t buffer_length(Buffer* buf)
+{
+    if (buf->storage == STORAGE_PIECE)
+        return piece_length(buf->pieces);
+    return buf->capacity - (buf->gap_end - buf->gap_start);
+}
 
 char buffer_char_at(Buffer* buf, size_t pos)
 {
+    if (buf->storage == STORAGE_PIECE)
+        return piece_char_at(buf->pieces, pos);
+
     if (pos >= buffer_length(buf))
         return '\0';
 
@@ -304,26 +846,68 @@ size_t buffer_line_count(Buffer* buf)
     return buf->line_count;
 }
 
-bool buffer_load_file(Buffer* buf, const char* filename)
+// Map the file read-only and use the mapping as the piece table's original
+// text. Nothing is copied up front: unmodified regions are served straight
+// from the page cache and edits only ever append to the add buffer.
+static bool buffer_map_file(Buffer* buf, const char* filename)
 {
-    FILE* f = fopen(filename, "rb");
-    if (!f)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
         return false;
+    }
 
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        piece_set_original(buf->pieces, NULL, 0, false);
+        return true;
+    }
 
-    buffer_expand(buf, size);
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
 
-    buf->gap_start = 0;
-    buf->gap_end   = buf->capacity;
-    buf->cursor    = 0;
+    // The line index scan reads the whole file front to back: ask for
+    // aggressive readahead now, then drop back to normal afterwards
+    madvise(map, size, MADV_SEQUENTIAL);
+    madvise(map, size, MADV_WILLNEED);
 
-    size_t read = fread(buf->data, 1, size, f);
-    fclose(f);
+    piece_set_original_mapped(buf->pieces, map, size, fd);
+    return true;
+}
+
+bool buffer_load_file(Buffer* buf, const char* filename)
+{
+    if (buf->storage == STORAGE_PIECE) {
+        if (!buffer_map_file(buf, filename))
+            return false;
+    } else {
+        FILE* f = fopen(filename, "rb");
+        if (!f)
+            return false;
+
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        buffer_expand(buf, size);
+
+        buf->gap_start = 0;
+        buf->gap_end   = buf->capacity;
+
+        size_t read = fread(buf->data, 1, size, f);
+        fclose(f);
+
+        buf->gap_start = read;
+    }
 
-    buf->gap_start = read;
     buf->cursor    = 0;
     buf->line      = 0;
     buf->col       = 0;
@@ -335,55 +919,250 @@ bool buffer_load_file(Buffer* buf, const char* filename)
     // Build line index for fast scrolling
     buffer_rebuild_line_index(buf);
 
+    if (buf->storage == STORAGE_PIECE && buf->pieces->original_mapped) {
+        madvise((void*)buf->pieces->original, buf->pieces->original_len, MADV_NORMAL);
+    }
+
     return true;
 }
 
-bool buffer_save_file(Buffer* buf)
-{
-    if (!buf->filename)
-        return false;
-
-    FILE* f = fopen(buf->filename, "wb");
-    if (!f)
-        return false;
-
-    fwrite(buf->data, 1, buf->gap_start, f);
-    fwrite(buf->data + buf->gap_end, 1, buf->capacity - buf->gap_end, f);
+// Writes are issued in bounded chunks so progress moves smoothly
+#define SAVE_CHUNK (8 * 1024 * 1024)
 
-    fclose(f);
-    buf->modified = false;
-    return true;
+static void save_progress(size_t* progress, size_t n)
+{
+    if (progress)
+        __atomic_add_fetch(progress, n, __ATOMIC_RELAXED);
 }
 
-void buffer_get_line_col(Buffer* buf, size_t* line, size_t* col)
+// Write all len bytes, retrying short writes
+static bool save_write(int fd, const char* data, size_t len, size_t* progress)
 {
-    *line = buf->line;
-    *col  = buf->col;
+    while (len > 0) {
+        ssize_t n = write(fd, data, len < SAVE_CHUNK ? len : SAVE_CHUNK);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+        save_progress(progress, (size_t)n);
+    }
+    return true;
 }
 
-// Selection functions
-void buffer_start_selection(Buffer* buf)
+// Unchanged original text: let the kernel copy it file to file (sharing
+// extents on filesystems with reflinks) instead of bouncing it through
+// user space. Whatever it can't copy is written from the mapping.
+static bool save_copy_original(BufferSnapshot* snap, int fd, const char* span, size_t len,
+    size_t* progress)
 {
-    buf->has_selection = true;
-    buf->sel_anchor    = buf->cursor;
-    buf->sel_start     = buf->cursor;
-    buf->sel_end       = buf->cursor;
+    loff_t off = span - snap->original;
+    while (len > 0) {
+        ssize_t n = copy_file_range(snap->original_fd, &off, fd, NULL, len < SAVE_CHUNK ? len : SAVE_CHUNK, 0);
+        if (n <= 0)
+            break;
+        span += n;
+        len -= (size_t)n;
+        save_progress(progress, (size_t)n);
+    }
+    return save_write(fd, span, len, progress);
 }
 
-void buffer_clear_selection(Buffer* buf)
+static bool save_contents(BufferSnapshot* snap, int fd, size_t* progress)
 {
-    buf->has_selection = false;
-    buf->sel_anchor    = 0;
-    buf->sel_start     = 0;
-    buf->sel_end       = 0;
+    for (size_t i = 0; i < snap->span_count; i++) {
+        const char* span      = snap->spans[i].text;
+        size_t      span_len  = snap->spans[i].len;
+        bool        from_file = snap->original_fd >= 0 && span >= snap->original
+            && span < snap->original + snap->original_len;
+
+        bool ok = from_file ? save_copy_original(snap, fd, span, span_len, progress)
+                            : save_write(fd, span, span_len, progress);
+        if (!ok)
+            return false;
+    }
+    return true;
 }
 
-void buffer_update_selection(Buffer* buf)
+// Make a rename durable by flushing the directory that holds it
+static void save_sync_dir(const char* path)
 {
-    if (!buf->has_selection)
+    const char* slash = strrchr(path, '/');
+    char*       dir   = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+    if (!dir)
         return;
 
-    if (buf->cursor < buf->sel_anchor) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// Give the temp file the permissions (and, if allowed, owner) of the file
+// it replaces, or the usual defaults for a new file
+static void save_copy_mode(int fd, const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+        if (fchown(fd, st.st_uid, st.st_gid) < 0) {
+            // Only root may give a file away; keeping our ownership is fine
+        }
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0666 & ~mask);
+    }
+}
+
+BufferSnapshot* buffer_snapshot(Buffer* buf)
+{
+    if (buf->snapshot)
+        return NULL;
+
+    BufferSnapshot* snap = calloc(1, sizeof(BufferSnapshot));
+    if (!snap)
+        return NULL;
+    snap->length      = buffer_length(buf);
+    snap->original_fd = -1;
+
+    if (buf->storage == STORAGE_GAP) {
+        snap->spans = malloc(2 * sizeof(BufferSpan));
+        if (!snap->spans) {
+            free(snap);
+            return NULL;
+        }
+        snap->spans[0]   = (BufferSpan) { buf->data, buf->gap_start };
+        snap->spans[1]   = (BufferSpan) { buf->data + buf->gap_end, buf->capacity - buf->gap_end };
+        snap->span_count = 2;
+        snap->data       = buf->data;
+        snap->capacity   = buf->capacity;
+        snap->gap_start  = buf->gap_start;
+        snap->gap_end    = buf->gap_end;
+        snap->buf        = buf;
+        buf->snapshot    = snap;
+        return snap;
+    }
+
+    // Pieces never change in place, so recording their spans is enough
+    PieceTable* pt = buf->pieces;
+    snap->spans    = malloc((pt->piece_count + 1) * sizeof(BufferSpan));
+    if (!snap->spans) {
+        free(snap);
+        return NULL;
+    }
+    size_t pos = 0;
+    while (pos < snap->length) {
+        size_t      len;
+        const char* text                  = piece_span_at(pt, pos, &len);
+        snap->spans[snap->span_count++] = (BufferSpan) { text, len };
+        pos += len;
+    }
+    snap->original     = pt->original;
+    snap->original_len = pt->original_len;
+    snap->original_fd  = pt->original_fd;
+    return snap;
+}
+
+void buffer_snapshot_release(BufferSnapshot* snap)
+{
+    if (!snap)
+        return;
+
+    if (snap->buf)
+        snap->buf->snapshot = NULL;
+    if (snap->owns_data)
+        gap_free(snap->data, snap->capacity);
+    free(snap->spans);
+    free(snap);
+}
+
+// Never truncate the real file: write a temp file beside it, fsync it and
+// rename it over the original, so a crash leaves either the old or the
+// new contents on disk. The rename also keeps a mapped original intact.
+bool buffer_snapshot_save(BufferSnapshot* snap, const char* filename, size_t* progress)
+{
+    // Save through symlinks instead of replacing them
+    char*       target = realpath(filename, NULL);
+    const char* path   = target ? target : filename;
+
+    size_t name_len = strlen(path);
+    char*  tmp      = malloc(name_len + sizeof(".ksswap-XXXXXX"));
+    if (!tmp) {
+        free(target);
+        return false;
+    }
+    memcpy(tmp, path, name_len);
+    memcpy(tmp + name_len, ".ksswap-XXXXXX", sizeof(".ksswap-XXXXXX"));
+
+    int  fd = mkstemp(tmp);
+    bool ok = fd >= 0;
+    if (ok) {
+        save_copy_mode(fd, path);
+        ok = save_contents(snap, fd, progress) && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        ok = ok && !__atomic_load_n(&snap->broken, __ATOMIC_ACQUIRE);
+        ok = ok && rename(tmp, path) == 0;
+        if (ok)
+            save_sync_dir(path);
+        else
+            unlink(tmp);
+    }
+
+    free(tmp);
+    free(target);
+    return ok;
+}
+
+bool buffer_save_file(Buffer* buf)
+{
+    if (!buf->filename)
+        return false;
+
+    BufferSnapshot* snap = buffer_snapshot(buf);
+    if (!snap)
+        return false;
+
+    bool ok = buffer_snapshot_save(snap, buf->filename, NULL);
+    buffer_snapshot_release(snap);
+    if (ok)
+        buf->modified = false;
+    return ok;
+}
+
+void buffer_get_line_col(Buffer* buf, size_t* line, size_t* col)
+{
+    *line = buf->line;
+    *col  = buf->col;
+}
+
+// Selection functions
+void buffer_start_selection(Buffer* buf)
+{
+    buf->has_selection = true;
+    buf->sel_anchor    = buf->cursor;
+    buf->sel_start     = buf->cursor;
+    buf->sel_end       = buf->cursor;
+}
+
+void buffer_clear_selection(Buffer* buf)
+{
+    buf->has_selection = false;
+    buf->sel_anchor    = 0;
+    buf->sel_start     = 0;
+    buf->sel_end       = 0;
+}
+
+void buffer_update_selection(Buffer* buf)
+{
+    if (!buf->has_selection)
+        return;
+
+    if (buf->cursor < buf->sel_anchor) {
         buf->sel_start = buf->cursor;
         buf->sel_end   = buf->sel_anchor;
     } else {
@@ -401,114 +1180,90 @@ char* buffer_get_selection(Buffer* buf, size_t* out_len)
         return NULL;
     }
 
-    size_t start = buf->sel_start;
-    size_t end   = buf->sel_end;
-    size_t len   = end - start;
-    char*  text  = malloc(len + 1);
+    size_t len  = buf->sel_end - buf->sel_start;
+    char*  text = malloc(len + 1);
 
-    // Optimize: use memcpy instead of char-by-char
-    if (end <= buf->gap_start) {
-        // Entire selection before gap
-        memcpy(text, buf->data + start, len);
-    } else if (start >= buf->gap_start) {
-        // Entire selection after gap
-        size_t offset = buf->gap_end - buf->gap_start;
-        memcpy(text, buf->data + start + offset, len);
-    } else {
-        // Selection spans gap
-        size_t before_gap = buf->gap_start - start;
-        memcpy(text, buf->data + start, before_gap);
-        memcpy(text + before_gap, buf->data + buf->gap_end, len - before_gap);
-    }
+    buffer_extract(buf, buf->sel_start, len, text);
 
     text[len] = '\0';
     *out_len  = len;
     return text;
 }
 
+// Delete [start, start + len), saving it for undo first span by span, so
+// even a whole huge file is never copied in one piece (the undo stack may
+// send it to its spill file). If deleting then fails, the record is dropped.
+static bool delete_recorded(Buffer* buf, size_t start, size_t len)
+{
+    bool recorded = undo_push_begin(buf->undo, OP_DELETE, start, len);
+    if (recorded) {
+        BufferIter it;
+        buffer_iter_init(&it, buf, start, start + len);
+        while (buffer_iter_next(&it))
+            undo_push_piece(buf->undo, it.text, it.len);
+    }
+
+    if (!storage_delete(buf, start, len)) {
+        if (recorded)
+            undo_drop(buf->undo);
+        return false;
+    }
+    line_index_on_delete(buf, start, len);
+    return true;
+}
+
 void buffer_delete_selection(Buffer* buf)
 {
+    // Edits made without touching the selection can leave it past the end
+    size_t total = buffer_length(buf);
+    if (buf->sel_end > total)
+        buf->sel_end = total;
+    if (buf->sel_start > buf->sel_end)
+        buf->sel_start = buf->sel_end;
     if (!buffer_has_selection(buf))
         return;
 
     size_t sel_len = buf->sel_end - buf->sel_start;
 
-    // Save for undo
-    size_t len;
-    char*  text = buffer_get_selection(buf, &len);
-    if (text) {
-        undo_push_delete(buf->undo, buf->sel_start, text, len);
-        free(text);
-    }
-
-    // Move gap to selection start, then expand to consume selection
-    buffer_move_gap(buf, buf->sel_start);
-    buf->gap_end += sel_len;
+    if (!delete_recorded(buf, buf->sel_start, sel_len))
+        return;
     buf->cursor = buf->sel_start;
 
     // Update line/col
     buffer_move_cursor_to(buf, buf->cursor);
 
-    buf->modified   = true;
-    buf->line_count = 0; // Invalidate line index
+    buf->modified = true;
     buffer_clear_selection(buf);
 }
 
 // Bulk operations
 void buffer_insert_text(Buffer* buf, const char* text, size_t len)
 {
-    if (buffer_has_selection(buf)) {
+    // Pasting over a selection is one undo step
+    bool replace = buffer_has_selection(buf);
+    if (replace) {
+        buffer_begin_group(buf);
         buffer_delete_selection(buf);
     }
 
-    undo_push_insert(buf->undo, buf->cursor, text, len);
-
-    // Count newlines for delta tracking
-    size_t newline_count = 0;
-    for (size_t i = 0; i < len; i++) {
-        if (text[i] == '\n') newline_count++;
-    }
-
-    // Find current line before insert (for delta tracking)
-    size_t current_line = buf->line;
-
-    buffer_expand(buf, len);
-    buffer_move_gap(buf, buf->cursor);
-
-    for (size_t i = 0; i < len; i++) {
-        buf->data[buf->gap_start++] = text[i];
-        buf->cursor++;
-
-        if (text[i] == '\n') {
-            buf->line++;
-            buf->col = 0;
-        } else {
-            buf->col++;
-        }
+    // One copy into storage, then one vectorized pass for the line index
+    if (len == 0 || !storage_insert(buf, buf->cursor, text, len)) {
+        if (replace)
+            buffer_end_group(buf);
+        return;
     }
+    undo_push_insert(buf->undo, buf->cursor, text, len);
+    size_t newlines = line_index_on_insert(buf, buf->cursor, text, len);
+
+    buf->cursor += len;
+    buf->line += newlines;
+    if (newlines == 0 && utf8_ascii_run(text, len) == len && char_boundary(buf, buf->cursor))
+        buf->col += len;
+    else
+        buf->col = buffer_line_pos(buf, buf->cursor).col;
     buf->modified = true;
-
-    // Update line index with delta tracking (O(1))
-    if (buf->line_count > 0 && buf->line_offsets != NULL) {
-        if (newline_count > 0) {
-            // Inserted newlines: update count and go to recalc mode
-            buf->line_count += newline_count;
-            if (buf->dirty_from_line == 0 || current_line + 1 < buf->dirty_from_line)
-                buf->dirty_from_line = current_line + 1;
-            buf->offset_delta = (i64)0x7FFFFFFF;
-        } else {
-            // No newlines: just adjust delta
-            if (buf->offset_delta == (i64)0x7FFFFFFF) {
-                // Already in recalc mode
-                if (current_line + 1 < buf->dirty_from_line)
-                    buf->dirty_from_line = current_line + 1;
-            } else {
-                if (buf->dirty_from_line == 0 || current_line + 1 < buf->dirty_from_line)
-                    buf->dirty_from_line = current_line + 1;
-                buf->offset_delta += (i64)len;
-            }
-        }
-    }
+    if (replace)
+        buffer_end_group(buf);
 }
 
 void buffer_delete_range(Buffer* buf, size_t start, size_t end)
@@ -518,56 +1273,143 @@ void buffer_delete_range(Buffer* buf, size_t start, size_t end)
 
     size_t del_len = end - start;
 
-    // Save for undo and count newlines in deleted range
-    char* text = buffer_get_range(buf, start, end);
-    size_t newline_count = 0;
-    if (text) {
-        for (size_t i = 0; i < del_len; i++) {
-            if (text[i] == '\n') newline_count++;
-        }
-        undo_push_delete(buf->undo, start, text, del_len);
-        free(text);
+    if (!delete_recorded(buf, start, del_len))
+        return;
+    buf->cursor = start;
+
+    buffer_move_cursor_to(buf, buf->cursor);
+    buf->modified = true;
+}
+
+size_t buffer_replace_all(Buffer* buf, const size_t* positions, size_t count, size_t old_len, const char* new_text,
+    size_t new_len)
+{
+    size_t len = buffer_length(buf);
+    if (count == 0 || old_len == 0)
+        return 0;
+
+    ReplaceOp* op = calloc(1, sizeof(ReplaceOp));
+    if (!op)
+        return 0;
+    op->old_len   = old_len;
+    op->new_len   = new_len;
+    op->positions = malloc(count * sizeof(size_t));
+    op->old_text  = malloc(old_len);
+    op->new_text  = malloc(new_len ? new_len : 1);
+    if (!op->positions || !op->old_text || !op->new_text) {
+        undo_free_replace(op);
+        return 0;
     }
+    memcpy(op->new_text, new_text, new_len);
 
-    // Move gap to start, expand to consume range
-    buffer_move_gap(buf, start);
-    buf->gap_end += del_len;
-    buf->cursor = start;
+    // Skip a match overlapping the one before, as stepping through them and
+    // replacing each would
+    size_t end = 0;
+    for (size_t i = 0; i < count && positions[i] + old_len <= len; i++) {
+        if (positions[i] < end)
+            continue;
+        op->positions[op->count++] = positions[i];
+        end                        = positions[i] + old_len;
+    }
+    if (op->count == 0) {
+        undo_free_replace(op);
+        return 0;
+    }
 
-    // Update line index with delta tracking (O(1))
-    if (buf->line_count > 0 && buf->line_offsets != NULL) {
-        // Find which line start is on
-        size_t lo = 0, hi = buf->line_count;
-        while (lo < hi) {
-            size_t mid = lo + (hi - lo) / 2;
-            if (buffer_get_line_offset(buf, mid) <= start)
-                lo = mid + 1;
-            else
-                hi = mid;
+    // The old text is only kept per match if the matches differ (in case)
+    char  small[256];
+    char* scratch = old_len <= sizeof(small) ? small : malloc(old_len);
+    bool  ok      = scratch != NULL;
+    buffer_extract(buf, op->positions[0], old_len, op->old_text);
+    for (size_t i = 1; ok && i < op->count && !op->old_each; i++) {
+        buffer_extract(buf, op->positions[i], old_len, scratch);
+        op->old_each = memcmp(scratch, op->old_text, old_len) != 0;
+    }
+    if (scratch != small)
+        free(scratch);
+    if (ok && op->old_each) {
+        char* all = realloc(op->old_text, op->count * old_len);
+        ok        = all != NULL;
+        if (ok) {
+            op->old_text = all;
+            for (size_t i = 0; i < op->count; i++)
+                buffer_extract(buf, op->positions[i], old_len, all + i * old_len);
         }
-        size_t current_line = (lo > 0) ? lo - 1 : 0;
+    }
+    if (!ok || !storage_rewrite(buf, op->positions, op->count, old_len, old_len, new_text, new_len, false)) {
+        undo_free_replace(op);
+        return 0;
+    }
 
-        if (newline_count > 0) {
-            // Deleted newlines: update count and go to recalc mode
-            buf->line_count -= newline_count;
-            buf->dirty_from_line = current_line + 1;
-            buf->offset_delta = (i64)0x7FFFFFFF;
-        } else {
-            // No newlines: just adjust delta
-            if (buf->offset_delta == (i64)0x7FFFFFFF) {
-                // Already in recalc mode
-                if (current_line + 1 < buf->dirty_from_line)
-                    buf->dirty_from_line = current_line + 1;
-            } else {
-                if (buf->dirty_from_line == 0 || current_line + 1 < buf->dirty_from_line)
-                    buf->dirty_from_line = current_line + 1;
-                buf->offset_delta -= (i64)del_len;
-            }
-        }
+    // Keep the cursor on the same text, or at the start of a replaced match
+    size_t cursor = buf->cursor;
+    size_t before = 0;
+    while (before < op->count && op->positions[before] + old_len <= cursor)
+        before++;
+    if (before < op->count && op->positions[before] < cursor)
+        cursor = op->positions[before];
+    cursor = cursor - before * old_len + before * new_len;
+
+    size_t replaced = op->count;
+    undo_push_replace(buf->undo, op);
+    buffer_rebuild_line_index(buf);
+    buffer_clear_selection(buf);
+    buffer_move_cursor_to(buf, cursor);
+    buf->modified = true;
+    return replaced;
+}
+
+bool buffer_apply_edits(Buffer* buf, const BufferEdit* edits, size_t count, size_t cursor)
+{
+    size_t len      = buffer_length(buf);
+    size_t prev_end = 0;
+    size_t removed  = 0;
+    size_t added    = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (edits[i].start < prev_end || edits[i].end < edits[i].start || edits[i].end > len)
+            return false;
+        prev_end = edits[i].end;
+        removed += edits[i].end - edits[i].start;
+        added += edits[i].len;
+    }
+    if (count == 0)
+        return true;
+
+    BatchOp* batch = calloc(1, sizeof(BatchOp));
+    if (batch) {
+        batch->edits    = malloc(count * sizeof(BatchEdit));
+        batch->old_text = malloc(removed ? removed : 1);
+        batch->new_text = malloc(added ? added : 1);
+    }
+    if (!batch || !batch->edits || !batch->old_text || !batch->new_text) {
+        undo_free_batch(batch);
+        return false;
     }
 
-    buffer_move_cursor_to(buf, buf->cursor);
+    // One copy of what goes and what comes in, back to back
+    size_t old_off = 0, new_off = 0;
+    for (size_t i = 0; i < count; i++) {
+        const BufferEdit* e = &edits[i];
+        batch->edits[i]     = (BatchEdit) { e->start, e->end - e->start, e->len };
+        old_off += buffer_extract(buf, e->start, e->end - e->start, batch->old_text + old_off);
+        memcpy(batch->new_text + new_off, e->text, e->len);
+        new_off += e->len;
+    }
+    batch->count      = count;
+    batch->one_cursor = true;
+    batch->cursor_old = buf->cursor;
+    batch->cursor_new = cursor;
+
+    if (!storage_batch(buf, batch, false, NULL)) {
+        undo_free_batch(batch);
+        return false;
+    }
+    undo_push_batch(buf->undo, batch);
+    buf->cursor_count = 0;
+    buffer_clear_selection(buf);
+    buffer_move_cursor_to(buf, cursor);
     buf->modified = true;
+    return true;
 }
 
 char* buffer_get_range(Buffer* buf, size_t start, size_t end)
@@ -578,20 +1420,7 @@ char* buffer_get_range(Buffer* buf, size_t start, size_t end)
     size_t len  = end - start;
     char*  text = malloc(len + 1);
 
-    // Optimize: use memcpy instead of char-by-char
-    if (end <= buf->gap_start) {
-        // Entire range before gap
-        memcpy(text, buf->data + start, len);
-    } else if (start >= buf->gap_start) {
-        // Entire range after gap
-        size_t offset = buf->gap_end - buf->gap_start;
-        memcpy(text, buf->data + start + offset, len);
-    } else {
-        // Range spans gap
-        size_t before_gap = buf->gap_start - start;
-        memcpy(text, buf->data + start, before_gap);
-        memcpy(text + before_gap, buf->data + buf->gap_end, len - before_gap);
-    }
+    buffer_extract(buf, start, len, text);
 
     text[len] = '\0';
     return text;
@@ -600,6 +1429,9 @@ char* buffer_get_range(Buffer* buf, size_t start, size_t end)
 // Fast extraction into provided buffer (no allocation)
 size_t buffer_extract(Buffer* buf, size_t start, size_t len, char* dest)
 {
+    if (buf->storage == STORAGE_PIECE)
+        return piece_extract(buf->pieces, start, len, dest);
+
     size_t buf_len = buffer_length(buf);
     if (start >= buf_len)
         return 0;
@@ -625,84 +1457,258 @@ size_t buffer_extract(Buffer* buf, size_t start, size_t len, char* dest)
     return len;
 }
 
+void buffer_iter_init(BufferIter* it, Buffer* buf, size_t start, size_t end)
+{
+    size_t len = buffer_length(buf);
+    if (end > len)
+        end = len;
+    if (start > end)
+        start = end;
+
+    it->buf   = buf;
+    it->start = start;
+    it->end   = end;
+    it->pos   = start;
+    it->text  = NULL;
+    it->len   = 0;
+}
+
+void buffer_iter_init_reverse(BufferIter* it, Buffer* buf, size_t start, size_t end)
+{
+    buffer_iter_init(it, buf, start, end);
+    it->pos = it->end;
+}
+
+bool buffer_iter_next(BufferIter* it)
+{
+    size_t pos = it->pos + it->len;
+    if (pos >= it->end) {
+        it->pos = it->end;
+        it->len = 0;
+        return false;
+    }
+
+    size_t      len;
+    const char* text = storage_span_at(it->buf, pos, &len);
+    if (len > it->end - pos)
+        len = it->end - pos;
+    it->pos  = pos;
+    it->text = text;
+    it->len  = len;
+    return true;
+}
+
+bool buffer_iter_prev(BufferIter* it)
+{
+    size_t pos = it->pos;
+    if (pos <= it->start) {
+        it->len = 0;
+        return false;
+    }
+
+    size_t      len;
+    const char* text = storage_span_before(it->buf, pos, &len);
+    if (len > pos - it->start) {
+        text += len - (pos - it->start);
+        len = pos - it->start;
+    }
+    it->pos  = pos - len;
+    it->text = text;
+    it->len  = len;
+    return true;
+}
+
+i64 buffer_find_byte(Buffer* buf, char c, size_t start, size_t end)
+{
+    BufferIter it;
+    buffer_iter_init(&it, buf, start, end);
+    while (buffer_iter_next(&it)) {
+        const char* hit = memchr(it.text, c, it.len);
+        if (hit)
+            return (i64)(it.pos + (size_t)(hit - it.text));
+    }
+    return -1;
+}
+
+i64 buffer_rfind_byte(Buffer* buf, char c, size_t start, size_t end)
+{
+    BufferIter it;
+    buffer_iter_init_reverse(&it, buf, start, end);
+    while (buffer_iter_prev(&it)) {
+        const char* hit = memrchr(it.text, c, it.len);
+        if (hit)
+            return (i64)(it.pos + (size_t)(hit - it.text));
+    }
+    return -1;
+}
+
 // Undo/Redo
-void buffer_undo(Buffer* buf)
+// Undo or redo a batch, with a cursor after each of its edits, or the one
+// cursor a transaction had
+static bool buffer_batch_again(Buffer* buf, const BatchOp* batch, bool undo)
 {
-    Operation* op = undo_pop(buf->undo);
-    if (!op)
-        return;
+    if (batch->one_cursor) {
+        if (!storage_batch(buf, batch, undo, NULL))
+            return false;
+        buf->cursor_count = 0;
+        buffer_move_cursor_to(buf, undo ? batch->cursor_old : batch->cursor_new);
+        buf->modified = true;
+        return true;
+    }
+
+    size_t* ends = malloc(batch->count * sizeof(size_t));
+    if (!ends)
+        return false;
+    bool ok = storage_batch(buf, batch, undo, ends);
+    if (ok) {
+        cursors_place(buf, ends, batch->count, 0);
+        buf->modified = true;
+    }
+    free(ends);
+    return ok;
+}
+
+// Put op's text back at its position. A spilled text is read back a block
+// at a time rather than all at once; if a block fails, those before it are
+// taken out again. Deleting text just inserted needs no new pieces, so that
+// can't fail.
+static bool undo_text_insert(Buffer* buf, const Operation* op)
+{
+    if (op->text) {
+        if (!storage_insert(buf, op->pos, op->text, op->len))
+            return false;
+        line_index_on_insert(buf, op->pos, op->text, op->len);
+        return true;
+    }
+
+    size_t block_len = op->len < UNDO_STREAM_BLOCK ? op->len : UNDO_STREAM_BLOCK;
+    char*  block     = malloc(block_len);
+    if (!block)
+        return false;
+    size_t done = 0;
+    while (done < op->len) {
+        size_t n = op->len - done < block_len ? op->len - done : block_len;
+        if (!undo_read_text(buf->undo, op, done, block, n) || !storage_insert(buf, op->pos + done, block, n))
+            break;
+        line_index_on_insert(buf, op->pos + done, block, n);
+        done += n;
+    }
+    free(block);
+    if (done < op->len && done > 0 && storage_delete(buf, op->pos, done))
+        line_index_on_delete(buf, op->pos, done);
+    return done == op->len;
+}
+
+// Take op's text out again
+static bool undo_text_delete(Buffer* buf, const Operation* op)
+{
+    if (!storage_delete(buf, op->pos, op->len))
+        return false;
+    line_index_on_delete(buf, op->pos, op->len);
+    return true;
+}
+
+// False if out of memory, with the text as it was
+static bool buffer_undo_op(Buffer* buf, const Operation* op)
+{
+    buffer_clear_selection(buf); // It may reach past the restored text
 
     if (op->type == OP_INSERT) {
         // Undo insert = delete
-        buffer_move_cursor_to(buf, op->pos);
-        for (size_t i = 0; i < op->len; i++) {
-            buffer_move_gap(buf, buf->cursor);
-            buf->gap_end++;
-        }
-    } else {
+        if (!undo_text_delete(buf, op))
+            return false;
+    } else if (op->type == OP_DELETE) {
         // Undo delete = insert
-        buffer_move_cursor_to(buf, op->pos);
-        buffer_expand(buf, op->len);
-        buffer_move_gap(buf, buf->cursor);
-        for (size_t i = 0; i < op->len; i++) {
-            buf->data[buf->gap_start++] = op->text[i];
-            buf->cursor++;
-        }
+        if (!undo_text_insert(buf, op))
+            return false;
+    } else if (op->type == OP_BATCH) {
+        // Undo batch = the same pass the other way, cursors back where
+        // they were
+        return buffer_batch_again(buf, op->batch, true);
+    } else {
+        // Undo replace = replace the new text back, in one pass again
+        ReplaceOp* r  = op->replace;
+        bool       ok = storage_rewrite(buf, r->positions, r->count, r->old_len, r->new_len, r->old_text, r->old_len,
+            r->old_each);
+        if (!ok)
+            return false;
+        buffer_rebuild_line_index(buf);
     }
-    buf->modified   = true;
-    buf->line_count = 0; // Invalidate line index
+    buf->modified = true;
     buffer_move_cursor_to(buf, op->pos);
+    return true;
 }
 
-void buffer_redo(Buffer* buf)
+static bool buffer_redo_op(Buffer* buf, const Operation* op)
 {
-    Operation* op = redo_pop(buf->undo);
-    if (!op)
-        return;
+    buffer_clear_selection(buf);
 
     if (op->type == OP_INSERT) {
         // Redo insert = insert again
-        buffer_move_cursor_to(buf, op->pos);
-        buffer_expand(buf, op->len);
-        buffer_move_gap(buf, buf->cursor);
-        for (size_t i = 0; i < op->len; i++) {
-            buf->data[buf->gap_start++] = op->text[i];
-            buf->cursor++;
-        }
-    } else {
+        if (!undo_text_insert(buf, op))
+            return false;
+    } else if (op->type == OP_DELETE) {
         // Redo delete = delete again
-        buffer_move_cursor_to(buf, op->pos);
-        for (size_t i = 0; i < op->len; i++) {
-            buffer_move_gap(buf, buf->cursor);
-            buf->gap_end++;
-        }
+        if (!undo_text_delete(buf, op))
+            return false;
+    } else if (op->type == OP_BATCH) {
+        return buffer_batch_again(buf, op->batch, false);
+    } else {
+        ReplaceOp* r = op->replace;
+        if (!storage_rewrite(buf, r->positions, r->count, r->old_len, r->old_len, r->new_text, r->new_len, false))
+            return false;
+        buffer_rebuild_line_index(buf);
     }
-    buf->modified   = true;
-    buf->line_count = 0; // Invalidate line index
+    buf->modified = true;
     buffer_move_cursor_to(buf, op->pos + (op->type == OP_INSERT ? op->len : 0));
+    return true;
+}
+
+// A group is normally one batch operation; one that couldn't be made one
+// is a run of joined operations, taken together. An operation that fails
+// stays where it was on the stack, so it can be tried again.
+void buffer_undo(Buffer* buf)
+{
+    const Operation* op;
+    do {
+        op = undo_pop(buf->undo);
+        if (!op)
+            return;
+        if (!buffer_undo_op(buf, op)) {
+            redo_pop(buf->undo);
+            return;
+        }
+    } while (op->joined);
+}
+
+void buffer_redo(Buffer* buf)
+{
+    UndoStack* undo = buf->undo;
+    do {
+        const Operation* op = redo_pop(undo);
+        if (!op)
+            return;
+        if (!buffer_redo_op(buf, op)) {
+            undo_pop(undo);
+            return;
+        }
+    } while (undo->current < undo->count && undo->ops[undo->current].joined);
 }
 
+void buffer_begin_group(Buffer* buf) { undo_begin_group(buf->undo, buf->cursor); }
+
+void buffer_end_group(Buffer* buf) { undo_end_group(buf->undo, buf->cursor); }
+
 // Find
 i64 buffer_find(Buffer* buf, const char* needle, size_t start)
 {
-    size_t needle_len = strlen(needle);
-    size_t buf_len    = buffer_length(buf);
-
-    if (needle_len == 0 || start + needle_len > buf_len)
+    Searcher s;
+    if (!search_init(&s, needle, strlen(needle), 0))
         return -1;
 
-    for (size_t i = start; i <= buf_len - needle_len; i++) {
-        bool match = true;
-        for (size_t j = 0; j < needle_len; j++) {
-            if (buffer_char_at(buf, i + j) != needle[j]) {
-                match = false;
-                break;
-            }
-        }
-        if (match)
-            return (i64)i;
-    }
-    return -1;
+    i64 pos = search_forward(&s, buf, start, buffer_length(buf));
+    search_free(&s);
+    return pos;
 }
 
 i64 buffer_find_next(Buffer* buf, const char* needle)
@@ -723,10 +1729,58 @@ void buffer_goto_line(Buffer* buf, size_t target_line)
     buffer_move_cursor_to(buf, pos);
 }
 
-// Helper: check if character is a word character
-static bool is_word_char(char c)
+// Helper: check if character is a word character. Branch-free so the
+// block scans below vectorize.
+static inline bool is_word_char(char c)
+{
+    unsigned char u = (unsigned char)c;
+    return ((unsigned char)((u | 0x20) - 'a') < 26) | ((unsigned char)(u - '0') < 10) | (u == '_');
+}
+
+// Scan from pos while characters are (or aren't) word characters. Returns
+// the first position past the run, or the start of the run going back.
+// Whole 32-byte blocks are classified at once and only the block holding
+// the end of the run is walked byte by byte.
+#define WORD_SCAN_BLOCK 32
+
+static bool word_block_uniform(const char* p, bool word)
+{
+    unsigned char differ = 0;
+    for (size_t i = 0; i < WORD_SCAN_BLOCK; i++)
+        differ |= is_word_char(p[i]) != word;
+    return !differ;
+}
+
+static size_t skip_word_forward(Buffer* buf, size_t pos, bool word)
+{
+    BufferIter it;
+    buffer_iter_init(&it, buf, pos, buffer_length(buf));
+    while (buffer_iter_next(&it)) {
+        size_t i = 0;
+        while (i + WORD_SCAN_BLOCK <= it.len && word_block_uniform(it.text + i, word))
+            i += WORD_SCAN_BLOCK;
+        for (; i < it.len; i++) {
+            if (is_word_char(it.text[i]) != word)
+                return it.pos + i;
+        }
+    }
+    return it.end;
+}
+
+static size_t skip_word_backward(Buffer* buf, size_t pos, bool word)
 {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    BufferIter it;
+    buffer_iter_init_reverse(&it, buf, 0, pos);
+    while (buffer_iter_prev(&it)) {
+        size_t i = it.len;
+        while (i >= WORD_SCAN_BLOCK && word_block_uniform(it.text + i - WORD_SCAN_BLOCK, word))
+            i -= WORD_SCAN_BLOCK;
+        for (; i > 0; i--) {
+            if (is_word_char(it.text[i - 1]) != word)
+                return it.pos + i;
+        }
+    }
+    return 0;
 }
 
 // Word operations
@@ -735,17 +1789,12 @@ void buffer_move_word_left(Buffer* buf)
     if (buf->cursor == 0)
         return;
 
-    // Skip whitespace/non-word chars first
-    while (buf->cursor > 0 && !is_word_char(buffer_char_at(buf, buf->cursor - 1))) {
-        buf->cursor--;
-    }
-    // Then skip word chars
-    while (buf->cursor > 0 && is_word_char(buffer_char_at(buf, buf->cursor - 1))) {
-        buf->cursor--;
-    }
+    // Skip whitespace/non-word chars first, then word chars
+    size_t pos = skip_word_backward(buf, buf->cursor, false);
+    pos        = skip_word_backward(buf, pos, true);
 
     // Update line/col
-    buffer_move_cursor_to(buf, buf->cursor);
+    buffer_move_cursor_to(buf, pos);
 }
 
 void buffer_move_word_right(Buffer* buf)
@@ -754,17 +1803,12 @@ void buffer_move_word_right(Buffer* buf)
     if (buf->cursor >= len)
         return;
 
-    // Skip current word chars first
-    while (buf->cursor < len && is_word_char(buffer_char_at(buf, buf->cursor))) {
-        buf->cursor++;
-    }
-    // Then skip whitespace/non-word chars
-    while (buf->cursor < len && !is_word_char(buffer_char_at(buf, buf->cursor))) {
-        buf->cursor++;
-    }
+    // Skip current word chars first, then whitespace/non-word chars
+    size_t pos = skip_word_forward(buf, buf->cursor, true);
+    pos        = skip_word_forward(buf, pos, false);
 
     // Update line/col
-    buffer_move_cursor_to(buf, buf->cursor);
+    buffer_move_cursor_to(buf, pos);
 }
 
 void buffer_delete_word_backward(Buffer* buf)
@@ -774,16 +1818,10 @@ void buffer_delete_word_backward(Buffer* buf)
 
     size_t end = buf->cursor;
 
-    // Skip whitespace first
-    while (buf->cursor > 0 && !is_word_char(buffer_char_at(buf, buf->cursor - 1))) {
-        buf->cursor--;
-    }
-    // Then skip word chars
-    while (buf->cursor > 0 && is_word_char(buffer_char_at(buf, buf->cursor - 1))) {
-        buf->cursor--;
-    }
+    // Skip whitespace first, then word chars
+    size_t start = skip_word_backward(buf, end, false);
+    start        = skip_word_backward(buf, start, true);
 
-    size_t start = buf->cursor;
     buffer_move_cursor_to(buf, start);
     buffer_delete_range(buf, start, end);
 }
@@ -794,75 +1832,40 @@ void buffer_delete_word_forward(Buffer* buf)
     if (buf->cursor >= len)
         return;
 
+    // Skip current word chars first, then whitespace
     size_t start = buf->cursor;
-    size_t end   = buf->cursor;
-
-    // Skip current word chars first
-    while (end < len && is_word_char(buffer_char_at(buf, end))) {
-        end++;
-    }
-    // Then skip whitespace
-    while (end < len && !is_word_char(buffer_char_at(buf, end))) {
-        end++;
-    }
+    size_t end   = skip_word_forward(buf, start, true);
+    end          = skip_word_forward(buf, end, false);
 
     buffer_delete_range(buf, start, end);
 }
 
-// Line operations
+// Line operations. Each is one buffer_apply_edits call, so one undo step
+// and one pass over the text, with line bounds from the line index.
 void buffer_duplicate_line(Buffer* buf)
 {
-    // Find line start and end
-    size_t line_start = buf->cursor;
-    while (line_start > 0 && buffer_char_at(buf, line_start - 1) != '\n') {
-        line_start--;
-    }
-
-    size_t line_end = buf->cursor;
-    size_t len      = buffer_length(buf);
-    while (line_end < len && buffer_char_at(buf, line_end) != '\n') {
-        line_end++;
-    }
+    size_t line_start = line_start_at(buf, buf->cursor);
+    size_t line_end   = line_end_at(buf, buf->cursor);
+    size_t line_len   = line_end - line_start;
 
-    // Get line content
-    size_t line_len = line_end - line_start;
-    char*  line     = malloc(line_len + 2); // +2 for newline and null
-    for (size_t i = 0; i < line_len; i++) {
-        line[i] = buffer_char_at(buf, line_start + i);
-    }
-    line[line_len]     = '\n';
-    line[line_len + 1] = '\0';
-
-    // Move to end of line and insert
-    buffer_move_cursor_to(buf, line_end);
-    if (line_end < len) {
-        // There's a newline after, insert before it
-        buffer_insert_text(buf, "\n", 1);
-        buffer_move_cursor(buf, -1);
-        buffer_insert_text(buf, line, line_len);
-    } else {
-        // At end of file
-        buffer_insert_text(buf, "\n", 1);
-        buffer_insert_text(buf, line, line_len);
-    }
+    // The copy goes below, after a newline, and the cursor with it
+    char* copy = malloc(line_len + 1);
+    if (!copy)
+        return;
+    copy[0] = '\n';
+    buffer_extract(buf, line_start, line_len, copy + 1);
 
-    free(line);
+    BufferEdit edit = { line_end, line_end, copy, line_len + 1 };
+    buffer_apply_edits(buf, &edit, 1, buf->cursor + line_len + 1);
+    free(copy);
 }
 
 void buffer_delete_line(Buffer* buf)
 {
-    // Find line start
-    size_t line_start = buf->cursor;
-    while (line_start > 0 && buffer_char_at(buf, line_start - 1) != '\n') {
-        line_start--;
-    }
-
-    // Find line end (including newline)
-    size_t line_end = buf->cursor;
-    size_t len      = buffer_length(buf);
-    while (line_end < len && buffer_char_at(buf, line_end) != '\n') {
-        line_end++;
-    }
+    // Find line start and end (including newline)
+    size_t line_start = line_start_at(buf, buf->cursor);
+    size_t line_end   = line_end_at(buf, buf->cursor);
+    size_t len        = buffer_length(buf);
     if (line_end < len) {
         line_end++; // Include the newline
     }
@@ -872,115 +1875,60 @@ void buffer_delete_line(Buffer* buf)
         line_start--; // Include preceding newline instead
     }
 
-    buffer_delete_range(buf, line_start, line_end);
-    buffer_move_cursor_to(buf, line_start);
+    BufferEdit edit = { line_start, line_end, "", 0 };
+    buffer_apply_edits(buf, &edit, 1, line_start);
+}
+
+// Swap line upper with the one below it. The cursor stays on its line, at
+// the same offset. Only the shorter line is copied and moved; the longer
+// one is just shifted by the storage pass.
+static void swap_lines(Buffer* buf, size_t upper)
+{
+    size_t upper_len, lower_len;
+    size_t upper_start = line_bounds(buf, upper, &upper_len);
+    size_t lower_start = line_bounds(buf, upper + 1, &lower_len);
+    size_t upper_end   = upper_start + upper_len;
+    size_t lower_end   = lower_start + lower_len;
+    size_t cursor      = buf->cursor >= lower_start ? upper_start + (buf->cursor - lower_start)
+                                                    : upper_start + lower_len + 1 + (buf->cursor - upper_start);
+
+    BufferEdit edits[2];
+    char*      moved;
+    if (lower_len <= upper_len) {
+        // The lower line and a newline go in above the upper one
+        moved = malloc(lower_len + 1);
+        if (!moved)
+            return;
+        buffer_extract(buf, lower_start, lower_len, moved);
+        moved[lower_len] = '\n';
+        edits[0]         = (BufferEdit) { upper_start, upper_start, moved, lower_len + 1 };
+        edits[1]         = (BufferEdit) { upper_end, lower_end, "", 0 };
+    } else {
+        // The upper line goes in below the lower one, after a newline
+        moved = malloc(upper_len + 1);
+        if (!moved)
+            return;
+        moved[0] = '\n';
+        buffer_extract(buf, upper_start, upper_len, moved + 1);
+        edits[0] = (BufferEdit) { upper_start, lower_start, "", 0 };
+        edits[1] = (BufferEdit) { lower_end, lower_end, moved, upper_len + 1 };
+    }
+    buffer_apply_edits(buf, edits, 2, cursor);
+    free(moved);
 }
 
 void buffer_move_line_up(Buffer* buf)
 {
     if (buf->line == 0)
         return;
-
-    // Find current line boundaries
-    size_t curr_start = buf->cursor;
-    while (curr_start > 0 && buffer_char_at(buf, curr_start - 1) != '\n') {
-        curr_start--;
-    }
-
-    size_t curr_end = buf->cursor;
-    size_t len      = buffer_length(buf);
-    while (curr_end < len && buffer_char_at(buf, curr_end) != '\n') {
-        curr_end++;
-    }
-
-    // Find previous line start
-    size_t prev_start = curr_start - 1; // Point to newline before current line
-    while (prev_start > 0 && buffer_char_at(buf, prev_start - 1) != '\n') {
-        prev_start--;
-    }
-
-    // Get current line content
-    size_t curr_len = curr_end - curr_start;
-    char*  curr     = malloc(curr_len + 1);
-    for (size_t i = 0; i < curr_len; i++) {
-        curr[i] = buffer_char_at(buf, curr_start + i);
-    }
-    curr[curr_len] = '\0';
-
-    // Calculate cursor offset within line
-    size_t cursor_offset = buf->cursor - curr_start;
-
-    // Delete current line (including newline before it)
-    size_t delete_start = curr_start > 0 ? curr_start - 1 : curr_start;
-    size_t delete_end   = curr_end;
-    buffer_delete_range(buf, delete_start, delete_end);
-
-    // Insert at previous line start
-    buffer_move_cursor_to(buf, prev_start);
-    buffer_insert_text(buf, curr, curr_len);
-    buffer_insert_text(buf, "\n", 1);
-
-    // Restore cursor position within line
-    buffer_move_cursor_to(buf, prev_start + cursor_offset);
-
-    free(curr);
+    swap_lines(buf, buf->line - 1);
 }
 
 void buffer_move_line_down(Buffer* buf)
 {
-    size_t len = buffer_length(buf);
-
-    // Find current line boundaries
-    size_t curr_start = buf->cursor;
-    while (curr_start > 0 && buffer_char_at(buf, curr_start - 1) != '\n') {
-        curr_start--;
-    }
-
-    size_t curr_end = buf->cursor;
-    while (curr_end < len && buffer_char_at(buf, curr_end) != '\n') {
-        curr_end++;
-    }
-
-    // Check if there's a next line
-    if (curr_end >= len)
+    if (buf->line + 1 >= buffer_line_count(buf))
         return;
-
-    // Find next line end
-    size_t next_end = curr_end + 1;
-    while (next_end < len && buffer_char_at(buf, next_end) != '\n') {
-        next_end++;
-    }
-
-    // Get current line content
-    size_t curr_len = curr_end - curr_start;
-    char*  curr     = malloc(curr_len + 1);
-    for (size_t i = 0; i < curr_len; i++) {
-        curr[i] = buffer_char_at(buf, curr_start + i);
-    }
-    curr[curr_len] = '\0';
-
-    // Calculate cursor offset within line
-    size_t cursor_offset = buf->cursor - curr_start;
-
-    // Delete current line (including newline after it)
-    buffer_delete_range(buf, curr_start, curr_end + 1);
-
-    // Recalculate next_end after deletion
-    len      = buffer_length(buf);
-    next_end = curr_start;
-    while (next_end < len && buffer_char_at(buf, next_end) != '\n') {
-        next_end++;
-    }
-
-    // Insert after the (now previous) next line
-    buffer_move_cursor_to(buf, next_end);
-    buffer_insert_text(buf, "\n", 1);
-    buffer_insert_text(buf, curr, curr_len);
-
-    // Restore cursor position within line
-    buffer_move_cursor_to(buf, next_end + 1 + cursor_offset);
-
-    free(curr);
+    swap_lines(buf, buf->line);
 }
 
 // Word/line selection
@@ -994,23 +1942,9 @@ void buffer_select_word(Buffer* buf)
     char c          = buffer_char_at(buf, buf->cursor);
     bool word_chars = is_word_char(c);
 
-    // Find word start
-    size_t start = buf->cursor;
-    while (start > 0) {
-        char prev = buffer_char_at(buf, start - 1);
-        if (is_word_char(prev) != word_chars)
-            break;
-        start--;
-    }
-
-    // Find word end
-    size_t end = buf->cursor;
-    while (end < len) {
-        char next = buffer_char_at(buf, end);
-        if (is_word_char(next) != word_chars)
-            break;
-        end++;
-    }
+    // Find word start and end
+    size_t start = skip_word_backward(buf, buf->cursor, word_chars);
+    size_t end   = skip_word_forward(buf, buf->cursor, word_chars);
 
     // Create selection
     buffer_move_cursor_to(buf, start);
@@ -1021,19 +1955,10 @@ void buffer_select_word(Buffer* buf)
 
 void buffer_select_line(Buffer* buf)
 {
-    // Find line start
-    size_t line_start = buf->cursor;
-    while (line_start > 0 && buffer_char_at(buf, line_start - 1) != '\n') {
-        line_start--;
-    }
-
-    // Find line end (including newline)
-    size_t line_end = buf->cursor;
-    size_t len      = buffer_length(buf);
-    while (line_end < len && buffer_char_at(buf, line_end) != '\n') {
-        line_end++;
-    }
-    if (line_end < len) {
+    // Find line start and end (including newline)
+    size_t line_start = line_start_at(buf, buf->cursor);
+    size_t line_end   = line_end_at(buf, buf->cursor);
+    if (line_end < buffer_length(buf)) {
         line_end++; // Include the newline
     }
 
@@ -1044,263 +1969,596 @@ void buffer_select_line(Buffer* buf)
     buffer_update_selection(buf);
 }
 
-// Helper to get raw line offset from gap buffer
-static inline size_t line_offset_at(Buffer* buf, size_t line)
+// Multi-cursor editing
+static inline size_t cursor_start(const BufferCursor* c) { return c->pos < c->anchor ? c->pos : c->anchor; }
+static inline size_t cursor_end(const BufferCursor* c) { return c->pos > c->anchor ? c->pos : c->anchor; }
+
+// Two cursors clash if their selections overlap or they are the same spot.
+// Selections that only touch are fine.
+static bool cursors_clash(const BufferCursor* a, const BufferCursor* b)
 {
-    if (line < buf->line_gap_start) {
-        return buf->line_offsets[line];
-    } else {
-        return buf->line_offsets[line + (buf->line_gap_end - buf->line_gap_start)];
-    }
+    size_t a_start = cursor_start(a), a_end = cursor_end(a);
+    size_t b_start = cursor_start(b), b_end = cursor_end(b);
+    return (a_start < b_end && b_start < a_end) || (a_start == b_start && a_end == b_end);
 }
 
-// Move the line offset gap to a specific position
-static void move_line_gap(Buffer* buf, size_t line_pos)
+// The anchor can be left past the end by an undo
+static BufferCursor primary_cursor(Buffer* buf)
 {
-    if (line_pos == buf->line_gap_start)
-        return;
-
-    size_t gap_size = buf->line_gap_end - buf->line_gap_start;
-
-    if (line_pos < buf->line_gap_start) {
-        // Move gap left: shift elements right into gap
-        size_t count = buf->line_gap_start - line_pos;
-        memmove(&buf->line_offsets[buf->line_gap_end - count],
-                &buf->line_offsets[line_pos],
-                count * sizeof(size_t));
-        buf->line_gap_start = line_pos;
-        buf->line_gap_end = line_pos + gap_size;
-    } else {
-        // Move gap right: shift elements left from after gap
-        size_t count = line_pos - buf->line_gap_start;
-        memmove(&buf->line_offsets[buf->line_gap_start],
-                &buf->line_offsets[buf->line_gap_end],
-                count * sizeof(size_t));
-        buf->line_gap_start = line_pos;
-        buf->line_gap_end = line_pos + gap_size;
-    }
+    size_t len    = buffer_length(buf);
+    size_t anchor = buf->has_selection ? buf->sel_anchor : buf->cursor;
+    return (BufferCursor) { buf->cursor, anchor < len ? anchor : len };
 }
 
-// O(1) line index delta tracking
-// Instead of updating all line offsets, we track a delta that gets applied on read
-static void line_index_on_insert(Buffer* buf, size_t pos, char c)
+// First extra cursor whose selection ends at or after pos
+static size_t cursors_lower_bound(Buffer* buf, size_t pos)
 {
-    if (buf->line_count == 0 || buf->line_offsets == NULL)
-        return;
-
-    // Find which line this position is on (use line_offset_at for gap buffer)
-    size_t lo = 0, hi = buf->line_count;
+    size_t lo = 0, hi = buf->cursor_count;
     while (lo < hi) {
         size_t mid = lo + (hi - lo) / 2;
-        i64 offset = line_offset_at(buf, mid);
-        if (mid >= buf->dirty_from_line)
-            offset += buf->offset_delta;
-        if ((size_t)offset <= pos)
+        if (cursor_end(&buf->cursors[mid]) < pos)
             lo = mid + 1;
         else
             hi = mid;
     }
-    size_t current_line = (lo > 0) ? lo - 1 : 0;
+    return lo;
+}
 
-    if (c == '\n') {
-        // Newline: update count and mark index as stale from current line
-        buf->line_count++;
-        // Don't invalidate - just mark where staleness starts
-        // When reading offsets past this point, we'll recalculate incrementally
-        if (buf->line_offsets != NULL) {
-            if (buf->dirty_from_line == 0 || current_line + 1 < buf->dirty_from_line) {
-                buf->dirty_from_line = current_line + 1;
-            }
-            // Delta is now invalid for newlines - set special marker
-            buf->offset_delta = (i64)0x7FFFFFFF; // Marker meaning "recalc needed"
-        }
-    } else {
-        // Regular char: just track delta (O(1))
-        // But if we're in "recalc needed" mode from a newline, stay in that mode
-        if (buf->offset_delta == (i64)0x7FFFFFFF) {
-            // Already in recalc mode, just update dirty region if needed
-            if (current_line + 1 < buf->dirty_from_line) {
-                buf->dirty_from_line = current_line + 1;
-            }
-        } else {
-            if (buf->dirty_from_line == 0 || current_line + 1 < buf->dirty_from_line) {
-                buf->dirty_from_line = current_line + 1;
-            }
-            buf->offset_delta++;
-        }
+static bool cursors_reserve(Buffer* buf, size_t count)
+{
+    if (count <= buf->cursor_capacity)
+        return true;
+    size_t capacity = buf->cursor_capacity ? buf->cursor_capacity * 2 : 16;
+    while (capacity < count)
+        capacity *= 2;
+    BufferCursor* grown = realloc(buf->cursors, capacity * sizeof(BufferCursor));
+    if (!grown)
+        return false;
+    buf->cursors         = grown;
+    buf->cursor_capacity = capacity;
+    return true;
+}
+
+static bool cursor_taken(Buffer* buf, const BufferCursor* c)
+{
+    BufferCursor primary = primary_cursor(buf);
+    if (cursors_clash(c, &primary))
+        return true;
+    for (size_t i = cursors_lower_bound(buf, cursor_start(c)); i < buf->cursor_count; i++) {
+        if (cursor_start(&buf->cursors[i]) > cursor_end(c))
+            break;
+        if (cursors_clash(c, &buf->cursors[i]))
+            return true;
     }
+    return false;
 }
 
-static void line_index_on_delete(Buffer* buf, size_t pos, char c)
+bool buffer_add_cursor(Buffer* buf, size_t pos, size_t anchor)
 {
-    if (buf->line_count == 0 || buf->line_offsets == NULL)
-        return;
+    size_t       len = buffer_length(buf);
+    BufferCursor c   = { pos < len ? pos : len, anchor < len ? anchor : len };
+    if (cursor_taken(buf, &c) || !cursors_reserve(buf, buf->cursor_count + 1))
+        return false;
 
-    // Find which line this position is on (use line_offset_at for gap buffer)
-    size_t lo = 0, hi = buf->line_count;
-    while (lo < hi) {
-        size_t mid = lo + (hi - lo) / 2;
-        i64 offset = line_offset_at(buf, mid);
-        if (mid >= buf->dirty_from_line)
-            offset += buf->offset_delta;
-        if ((size_t)offset <= pos)
-            lo = mid + 1;
-        else
-            hi = mid;
+    size_t at = cursors_lower_bound(buf, cursor_start(&c));
+    memmove(buf->cursors + at + 1, buf->cursors + at, (buf->cursor_count - at) * sizeof(BufferCursor));
+    buf->cursors[at] = c;
+    buf->cursor_count++;
+    return true;
+}
+
+void buffer_clear_cursors(Buffer* buf) { buf->cursor_count = 0; }
+
+size_t buffer_cursor_count(Buffer* buf) { return buf->cursor_count + 1; }
+
+bool buffer_add_cursor_at_next_match(Buffer* buf)
+{
+    if (!buffer_has_selection(buf)) {
+        buffer_select_word(buf);
+        return buffer_has_selection(buf);
     }
-    size_t current_line = (lo > 0) ? lo - 1 : 0;
 
-    if (c == '\n') {
-        // Newline delete: update count and mark stale
-        if (buf->line_count > 1)
-            buf->line_count--;
-        if (buf->line_offsets != NULL) {
-            if (buf->dirty_from_line == 0 || current_line + 1 < buf->dirty_from_line) {
-                buf->dirty_from_line = current_line + 1;
-            }
-            buf->offset_delta = (i64)0x7FFFFFFF;
-        }
-    } else {
-        // Regular char: just track delta (O(1))
-        // But if we're in "recalc needed" mode from a newline, stay in that mode
-        if (buf->offset_delta == (i64)0x7FFFFFFF) {
-            if (current_line + 1 < buf->dirty_from_line) {
-                buf->dirty_from_line = current_line + 1;
-            }
-        } else {
-            if (buf->dirty_from_line == 0 || current_line + 1 < buf->dirty_from_line) {
-                buf->dirty_from_line = current_line + 1;
-            }
-            buf->offset_delta--;
+    size_t   len;
+    char*    needle = buffer_get_selection(buf, &len);
+    Searcher s;
+    bool     ok = needle && search_init(&s, needle, len, 0);
+    free(needle);
+    if (!ok)
+        return false;
+
+    // After the selection, then wrapping round to it, skipping occurrences
+    // that already have a cursor
+    size_t ranges[2][2] = { { buf->sel_end, buffer_length(buf) }, { 0, buf->sel_start } };
+    i64    hit          = -1;
+    for (int r = 0; r < 2 && hit < 0; r++) {
+        size_t from = ranges[r][0];
+        while ((hit = search_forward(&s, buf, from, ranges[r][1])) >= 0) {
+            BufferCursor c = { (size_t)hit + len, (size_t)hit };
+            if (!cursor_taken(buf, &c))
+                break;
+            from = (size_t)hit + 1;
         }
     }
+    search_free(&s);
+    if (hit < 0 || !cursors_reserve(buf, buf->cursor_count + 1))
+        return false;
+
+    BufferCursor old = primary_cursor(buf);
+    buffer_move_cursor_to(buf, (size_t)hit);
+    buffer_start_selection(buf);
+    buffer_move_cursor_to(buf, (size_t)hit + len);
+    buffer_update_selection(buf);
+    buffer_add_cursor(buf, old.pos, old.anchor);
+    return true;
 }
 
-// Line index for fast scrolling
-void buffer_rebuild_line_index(Buffer* buf)
+size_t buffer_add_cursors_on_lines(Buffer* buf)
 {
-    size_t len = buffer_length(buf);
+    if (!buffer_has_selection(buf))
+        return buffer_cursor_count(buf);
+    if (buf->line_count == 0)
+        buffer_rebuild_line_index(buf);
+
+    // A selection ending right at a line start doesn't take in that line
+    size_t last_start;
+    size_t first = lineindex_line_at(buf->lines, buf->sel_start, NULL);
+    size_t last  = lineindex_line_at(buf->lines, buf->sel_end, &last_start);
+    if (last > first && buf->sel_end == last_start)
+        last--;
+    if (!cursors_reserve(buf, last - first))
+        return buffer_cursor_count(buf);
+
+    // Line ends come from the index; each is the start of the next line,
+    // less its newline
+    buf->cursor_count = 0;
+    for (size_t line = first; line < last; line++) {
+        size_t end = lineindex_offset(buf->lines, line + 1) - 1;
+        buf->cursors[buf->cursor_count++] = (BufferCursor) { end, end };
+    }
+    size_t end = last + 1 < buf->line_count ? lineindex_offset(buf->lines, last + 1) - 1 : buffer_length(buf);
+    buffer_clear_selection(buf);
+    buffer_move_cursor_to(buf, end);
+    return buffer_cursor_count(buf);
+}
 
-    // Count lines first
-    size_t count = 1;
-    for (size_t i = 0; i < len; i++) {
-        if (buffer_char_at(buf, i) == '\n') {
-            count++;
+// Every cursor, the primary one included, in order; *primary gets its
+// index. Extras that clash with the primary (it moved onto them) are left
+// out.
+static BufferCursor* cursors_all(Buffer* buf, size_t* count, size_t* primary)
+{
+    BufferCursor* all = malloc((buf->cursor_count + 1) * sizeof(BufferCursor));
+    if (!all)
+        return NULL;
+
+    BufferCursor main = primary_cursor(buf);
+    size_t       n    = 0;
+    *primary          = SIZE_MAX;
+    for (size_t i = 0; i < buf->cursor_count; i++) {
+        if (cursors_clash(&buf->cursors[i], &main))
+            continue;
+        if (*primary == SIZE_MAX && cursor_start(&buf->cursors[i]) >= cursor_start(&main)) {
+            *primary = n;
+            all[n++] = main;
         }
+        all[n++] = buf->cursors[i];
     }
-
-    // Allocate/reallocate
-    if (count > buf->line_capacity) {
-        buf->line_capacity = count + 1024; // Some headroom
-        buf->line_offsets  = realloc(buf->line_offsets, buf->line_capacity * sizeof(size_t));
+    if (*primary == SIZE_MAX) {
+        *primary = n;
+        all[n++] = main;
     }
+    *count = n;
+    return all;
+}
 
-    // Build index (no gap initially, gap at end)
-    buf->line_offsets[0] = 0;
-    size_t line          = 1;
-    for (size_t i = 0; i < len; i++) {
-        if (buffer_char_at(buf, i) == '\n' && line < count) {
-            buf->line_offsets[line++] = i + 1;
+// Cursors at ends (ascending), with the primary at ends[primary]. Cursors
+// that ended up on the same spot merge.
+static void cursors_place(Buffer* buf, const size_t* ends, size_t count, size_t primary)
+{
+    buf->cursor_count = 0;
+    if (cursors_reserve(buf, count)) {
+        for (size_t i = 0; i < count; i++) {
+            if (i == primary || ends[i] == ends[primary])
+                continue;
+            if (buf->cursor_count > 0 && buf->cursors[buf->cursor_count - 1].pos == ends[i])
+                continue;
+            buf->cursors[buf->cursor_count++] = (BufferCursor) { ends[i], ends[i] };
         }
     }
-    buf->line_count      = count;
-    buf->line_gap_start  = count;  // Gap starts after all lines
-    buf->line_gap_end    = buf->line_capacity;  // Gap ends at capacity
-    buf->dirty_from_line = 0;
-    buf->offset_delta    = 0;
+    buffer_clear_selection(buf);
+    buffer_move_cursor_to(buf, ends[primary]);
 }
 
-// Flush stale line offsets - rebuilds from dirty_from_line onwards
-// Call this before operations that need correct line offsets (like binary search)
-static void buffer_flush_line_index(Buffer* buf)
-{
-    if (buf->offset_delta != (i64)0x7FFFFFFF)
-        return; // Not in recalc mode, nothing to flush
+typedef enum {
+    MULTI_INSERT,
+    MULTI_BACKSPACE,
+    MULTI_DELETE,
+} MultiEdit;
 
-    if (buf->line_offsets == NULL || buf->line_count == 0)
+// One edit per cursor - its selection, or the byte before/after it - all
+// made in a single batch
+static void buffer_multi_edit(Buffer* buf, MultiEdit kind, const char* text, size_t len)
+{
+    size_t        count, primary;
+    BufferCursor* all = cursors_all(buf, &count, &primary);
+    if (!all)
+        return;
+    BatchOp* batch = calloc(1, sizeof(BatchOp));
+    size_t*  ends  = malloc(count * sizeof(size_t));
+    if (batch)
+        batch->edits = malloc(count * sizeof(BatchEdit));
+    if (!batch || !batch->edits || !ends) {
+        free(all);
+        free(ends);
+        undo_free_batch(batch);
         return;
+    }
 
-    // Ensure we have capacity for potentially more lines
-    if (buf->line_count + 1024 > buf->line_capacity) {
-        buf->line_capacity = buf->line_count + 2048;
-        buf->line_offsets = realloc(buf->line_offsets, buf->line_capacity * sizeof(size_t));
+    size_t total    = buffer_length(buf);
+    size_t prev_end = 0;
+    size_t removed  = 0;
+    size_t new_len  = kind == MULTI_INSERT ? len : 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t start = cursor_start(&all[i]);
+        size_t end   = cursor_end(&all[i]);
+        if (start == end && kind == MULTI_BACKSPACE && start > 0)
+            start = buffer_prev_char(buf, start);
+        else if (start == end && kind == MULTI_DELETE && end < total)
+            end = buffer_next_char(buf, end);
+        if (start < prev_end) // Reaching into the edit before
+            start = prev_end;
+        if (end < start)
+            end = start;
+
+        batch->edits[i] = (BatchEdit) { start, end - start, new_len };
+        prev_end        = end;
+        removed += end - start;
+    }
+    batch->count    = count;
+    batch->old_text = malloc(removed ? removed : 1);
+    batch->new_text = malloc(new_len ? count * new_len : 1);
+    if (!batch->old_text || !batch->new_text) {
+        free(all);
+        free(ends);
+        undo_free_batch(batch);
+        return;
+    }
+    size_t off = 0;
+    for (size_t i = 0; i < count; i++) {
+        off += buffer_extract(buf, batch->edits[i].pos, batch->edits[i].old_len, batch->old_text + off);
+        if (new_len > 0)
+            memcpy(batch->new_text + i * new_len, text, new_len);
     }
 
-    // Collapse the gap first so we can write directly to array indices
-    // Move elements after gap to fill the gap
-    if (buf->line_gap_start < buf->line_gap_end && buf->line_gap_end < buf->line_capacity) {
-        size_t elements_after = buf->line_capacity - buf->line_gap_end;
-        if (elements_after > 0) {
-            memmove(buf->line_offsets + buf->line_gap_start,
-                    buf->line_offsets + buf->line_gap_end,
-                    elements_after * sizeof(size_t));
-        }
+    if (storage_batch(buf, batch, false, ends)) {
+        undo_push_batch(buf->undo, batch);
+        cursors_place(buf, ends, count, primary);
+        buf->modified = true;
+    } else {
+        undo_free_batch(batch);
     }
-    // Gap is now collapsed - all elements are contiguous
-    buf->line_gap_start = buf->line_capacity;
-    buf->line_gap_end = buf->line_capacity;
+    free(all);
+    free(ends);
+}
 
-    // Find start position from last known good line
-    size_t start_line = buf->dirty_from_line > 0 ? buf->dirty_from_line - 1 : 0;
-    size_t start_pos = buf->line_offsets[start_line]; // Direct access since gap is collapsed
-    size_t buf_len = buffer_length(buf);
+void buffer_multi_insert(Buffer* buf, const char* text, size_t len)
+{
+    buffer_multi_edit(buf, MULTI_INSERT, text, len);
+}
 
-    // Re-scan from start_pos and rebuild offsets
-    size_t line = start_line;
-    for (size_t pos = start_pos; pos < buf_len; pos++) {
-        if (buffer_char_at(buf, pos) == '\n') {
-            line++;
-            if (line < buf->line_capacity) {
-                buf->line_offsets[line] = pos + 1;
-            }
-        }
+void buffer_paste(Buffer* buf, const char* text, size_t len)
+{
+    if (buffer_cursor_count(buf) > 1)
+        buffer_multi_insert(buf, text, len);
+    else
+        buffer_insert_text(buf, text, len); // Takes the selection with it
+}
+
+void buffer_multi_backspace(Buffer* buf) { buffer_multi_edit(buf, MULTI_BACKSPACE, NULL, 0); }
+
+void buffer_multi_delete(Buffer* buf) { buffer_multi_edit(buf, MULTI_DELETE, NULL, 0); }
+
+// Start of the character delta characters away from pos
+static size_t step_chars(Buffer* buf, size_t pos, i32 delta)
+{
+    for (; delta < 0 && pos > 0; delta++)
+        pos = buffer_prev_char(buf, pos);
+    for (; delta > 0; delta--)
+        pos = buffer_next_char(buf, pos);
+    return pos;
+}
+
+void buffer_multi_move(Buffer* buf, i32 delta)
+{
+    size_t n = 0;
+    buffer_clear_selection(buf);
+    buffer_move_char(buf, delta);
+    for (size_t i = 0; i < buf->cursor_count; i++) {
+        size_t pos = step_chars(buf, buf->cursors[i].pos, delta);
+        if (n > 0 && buf->cursors[n - 1].pos == pos)
+            continue;
+        if (pos == buf->cursor)
+            continue;
+        buf->cursors[n++] = (BufferCursor) { pos, pos };
+    }
+    buf->cursor_count = n;
+}
+
+// Line index maintenance. Edits made while the index is invalid are
+// picked up by the next rebuild instead.
+// Index the text in slices, so even a huge paste makes a single pass over
+// the text and needs only a bounded scratch array. Returns the newlines.
+#define LINE_SCAN_SLICE (256 * 1024)
+
+static size_t line_index_on_insert(Buffer* buf, size_t pos, const char* text, size_t len)
+{
+    if (buf->line_count == 0)
+        return newline_count(text, len);
+
+    size_t  stack[64];
+    size_t  slice  = len < LINE_SCAN_SLICE ? len : LINE_SCAN_SLICE;
+    size_t* starts = slice <= 64 ? stack : malloc(slice * sizeof(size_t));
+    if (!starts) {
+        buf->line_count = 0;
+        return newline_count(text, len);
+    }
+
+    size_t newlines = 0;
+    bool   ok       = true;
+    for (size_t done = 0; done < len; done += slice) {
+        if (slice > len - done)
+            slice = len - done;
+        size_t count = newline_collect(text + done, slice, pos + done, starts);
+        ok           = ok && lineindex_insert(buf->lines, pos + done, slice, starts, count);
+        newlines += count;
+    }
+    buf->line_count = ok ? lineindex_count(buf->lines) : 0;
+
+    if (starts != stack)
+        free(starts);
+    return newlines;
+}
+
+static void line_index_on_delete(Buffer* buf, size_t pos, size_t len)
+{
+    if (buf->line_count == 0)
+        return;
+
+    buf->line_count = lineindex_delete(buf->lines, pos, len) ? lineindex_count(buf->lines) : 0;
+}
+
+// Index the text in [indexed length, end), a slice at a time
+static void line_index_extend(Buffer* buf, size_t end)
+{
+    size_t* starts = malloc(LINE_SCAN_SLICE * sizeof(size_t));
+    if (!starts) {
+        buf->line_count = 0;
+        return;
     }
 
-    // Update state
-    buf->line_count = line + 1;
-    buf->line_gap_start = buf->line_count;
-    buf->line_gap_end = buf->line_capacity;
-    buf->dirty_from_line = 0;
-    buf->offset_delta = 0;
+    size_t pos = lineindex_length(buf->lines);
+    bool   ok  = true;
+    while (ok && pos < end) {
+        size_t len = end - pos;
+        if (len > LINE_SCAN_SLICE)
+            len = LINE_SCAN_SLICE;
+        size_t count = storage_collect_line_starts(buf, pos, pos + len, starts);
+        ok           = lineindex_insert(buf->lines, pos, len, starts, count);
+        pos += len;
+    }
+    free(starts);
+    buf->line_count = ok ? lineindex_count(buf->lines) : 0;
 }
 
+// Line index for fast scrolling
+void buffer_rebuild_line_index(Buffer* buf)
+{
+    lineindex_clear(buf->lines);
+    colindex_clear(&buf->cols);
+    line_index_extend(buf, buffer_length(buf));
+}
 
 size_t buffer_get_line_offset(Buffer* buf, size_t line)
 {
-    // Rebuild if needed
-    if (buf->line_offsets == NULL || buf->line_count == 0) {
+    if (buf->line_count == 0) {
         buffer_rebuild_line_index(buf);
-        buf->dirty_from_line = 0;
-        buf->offset_delta = 0;
     }
 
     if (line >= buf->line_count) {
         return buffer_length(buf);
     }
+    return lineindex_offset(buf->lines, line);
+}
+
+// Extend the index over text that was appended past the end of what it
+// covers. Used while a file streams in; starts are the new line starts.
+void buffer_append_line_starts(Buffer* buf, const size_t* starts, size_t count)
+{
+    if (buf->line_count == 0) {
+        buffer_rebuild_line_index(buf);
+        return;
+    }
+
+    size_t indexed = lineindex_length(buf->lines);
+    size_t added   = buffer_length(buf) - indexed;
+    if (!lineindex_insert(buf->lines, indexed, added, starts, count)) {
+        buf->line_count = 0; // Rebuilt when next needed
+        colindex_clear(&buf->cols);
+        return;
+    }
+    buf->line_count = lineindex_count(buf->lines);
+
+    // The text lengthens the last line, or splits it when it has newlines
+    if (count > 0)
+        colindex_clear(&buf->cols);
+    else
+        colindex_edit(&buf->cols, indexed, 0, added, NULL, 0);
+}
+
+// Columns. Short lines are simply walked from their start; long ones go
+// through the checkpoints in buf->cols, kept up to date here.
+
+// Start of line and its length without the '\n'
+static size_t line_bounds(Buffer* buf, size_t line, size_t* len)
+{
+    size_t start = lineindex_offset(buf->lines, line);
+    size_t end   = line + 1 < buf->line_count ? lineindex_offset(buf->lines, line + 1) - 1 : buffer_length(buf);
+    *len         = end - start;
+    return start;
+}
 
-    // Check if line is in the stale region (after a newline edit)
-    if (line >= buf->dirty_from_line && buf->offset_delta == (i64)0x7FFFFFFF) {
-        // Incremental recalc: scan from last known good line
-        // O(lines_between) not O(file_size)
-        size_t start_line = buf->dirty_from_line > 0 ? buf->dirty_from_line - 1 : 0;
-        size_t start_pos = line_offset_at(buf, start_line);
-        size_t buf_len = buffer_length(buf);
-
-        size_t current = start_line;
-        size_t pos = start_pos;
-        while (current < line && pos < buf_len) {
-            if (buffer_char_at(buf, pos) == '\n') {
-                current++;
-            }
-            pos++;
+// Walk the line at start (len bytes) from *at towards target in the given
+// unit, as utf8_walk does, a sample at a time. Contiguous runs of storage
+// are walked in place, the rest through a small copy.
+static void col_walk(Buffer* buf, size_t start, size_t len, Utf8Pos* at, Utf8Unit unit, size_t target)
+{
+    char chunk[COL_SAMPLE + UTF8_MAX];
+    while (at->byte < len) {
+        size_t      left  = len - at->byte;
+        size_t      stop  = left < COL_SAMPLE ? left : COL_SAMPLE;
+        size_t      avail = left < stop + UTF8_MAX - 1 ? left : stop + UTF8_MAX - 1;
+        size_t      run;
+        const char* text = storage_span_at(buf, start + at->byte, &run);
+        if (run < avail) {
+            buffer_extract(buf, start + at->byte, avail, chunk);
+            text = chunk;
         }
-        return pos;
+        if (utf8_walk(text, avail, stop, unit, target, at) < stop)
+            return;
+    }
+}
+
+// Measure the stretch an edit left after points[stale_at] and bring the
+// points past it up to date, laying fresh ones across the stretch
+static void col_resolve(Buffer* buf, ColLine* cl)
+{
+    if (!cl->stale)
+        return;
+    cl->stale = false;
+
+    size_t   a     = cl->stale_at;
+    Utf8Pos  from  = cl->points[a];
+    Utf8Pos  to    = cl->points[a + 1];
+    size_t   cap   = (to.byte - from.byte) / (COL_SAMPLE - UTF8_MAX) + 1;
+    Utf8Pos* fresh = malloc(cap * sizeof(Utf8Pos));
+    size_t   n     = 0;
+    Utf8Pos  at    = from;
+    while (fresh) {
+        size_t goal = to.byte - at.byte > COL_SAMPLE ? at.byte + COL_SAMPLE : to.byte;
+        col_walk(buf, cl->start, cl->len, &at, UTF8_BYTES, goal);
+        if (goal == to.byte)
+            break;
+        fresh[n++] = at;
+    }
+
+    // If the edit moved character boundaries past it (joining up a
+    // malformed sequence, say), the points after it are rebuilt instead
+    Utf8Pos old_span = { to.byte - from.byte, to.cp - from.cp, to.col - from.col };
+    Utf8Pos new_span = { at.byte - from.byte, at.cp - from.cp, at.col - from.col };
+    if (!fresh || at.byte != to.byte || !colindex_splice(cl, a, a + 1, fresh, n, old_span, new_span)) {
+        cl->count    = a + 1;
+        cl->complete = false;
+    }
+    free(fresh);
+}
+
+// Lay points past the last one until they reach target in the given unit,
+// or the line end
+static void col_extend(Buffer* buf, ColLine* cl, Utf8Unit unit, size_t target)
+{
+    while (!cl->complete) {
+        Utf8Pos at = cl->points[cl->count - 1];
+        if (utf8_pos_get(&at, unit) >= target)
+            return;
+        col_walk(buf, cl->start, cl->len, &at, UTF8_BYTES, at.byte + COL_SAMPLE);
+        if (at.byte >= cl->len)
+            cl->complete = true;
+        else if (!colindex_push(cl, at))
+            return;
     }
+}
 
-    // Apply delta for regular char edits
-    i64 offset = line_offset_at(buf, line);
-    if (line >= buf->dirty_from_line) {
-        offset += buf->offset_delta;
+// Walk the line at start (len bytes) to target, starting from the nearest
+// checkpoint for long lines
+static Utf8Pos col_seek(Buffer* buf, size_t start, size_t len, Utf8Unit unit, size_t target)
+{
+    Utf8Pos at = { 0, 0, 0 };
+    if (len >= COL_INDEX_MIN) {
+        ColLine* cl = colindex_get(&buf->cols, start);
+        if (cl && cl->len != len)
+            colindex_drop(cl);
+        if (!cl || !cl->count)
+            cl = colindex_claim(&buf->cols, start, len);
+        if (cl) {
+            col_resolve(buf, cl);
+            col_extend(buf, cl, unit, target);
+            at = cl->points[colindex_find(cl, unit, target)];
+        }
+    }
+    col_walk(buf, start, len, &at, unit, target);
+    return at;
+}
+
+static Utf8Pos line_pos(Buffer* buf, size_t pos, size_t* line)
+{
+    size_t len = buffer_length(buf);
+    if (pos > len)
+        pos = len;
+    if (buf->line_count == 0)
+        buffer_rebuild_line_index(buf);
+
+    size_t line_len;
+    *line        = lineindex_line_at(buf->lines, pos, NULL);
+    size_t start = line_bounds(buf, *line, &line_len);
+    return col_seek(buf, start, line_len, UTF8_BYTES, pos - start);
+}
+
+Utf8Pos buffer_line_pos(Buffer* buf, size_t pos)
+{
+    size_t line;
+    return line_pos(buf, pos, &line);
+}
+
+Utf8Pos buffer_line_seek(Buffer* buf, size_t line, Utf8Unit unit, size_t target)
+{
+    size_t count = buffer_line_count(buf);
+    if (line >= count)
+        line = count - 1;
+
+    size_t len;
+    size_t start = line_bounds(buf, line, &len);
+    return col_seek(buf, start, len, unit, target);
+}
+
+size_t buffer_next_char(Buffer* buf, size_t pos)
+{
+    size_t len = buffer_length(buf);
+    if (pos >= len)
+        return len;
+
+    char   c[UTF8_MAX];
+    size_t n = buffer_extract(buf, pos, len - pos < UTF8_MAX ? len - pos : UTF8_MAX, c);
+    u32    cp;
+    return pos + utf8_decode(c, n, &cp);
+}
+
+size_t buffer_prev_char(Buffer* buf, size_t pos)
+{
+    if (pos == 0)
+        return 0;
+
+    // The sequence ending at pos starts at the nearest byte that isn't a
+    // continuation, if it decodes to reach pos; otherwise the byte before
+    // pos stands alone
+    char   c[UTF8_MAX];
+    size_t back = pos < UTF8_MAX ? pos : UTF8_MAX;
+    buffer_extract(buf, pos - back, back, c);
+    for (size_t k = 1; k <= back; k++) {
+        if (((u8)c[back - k] & 0xC0) != 0x80) {
+            u32 cp;
+            if (utf8_decode(c + back - k, k, &cp) == k)
+                return pos - k;
+            break;
+        }
     }
-    return (size_t)offset;
+    return pos - 1;
 }
@@ -0,0 +1,169 @@
+#include "colindex.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_POINTS 64
+
+void colindex_init(ColIndex* ci) { memset(ci, 0, sizeof(*ci)); }
+
+void colindex_free(ColIndex* ci)
+{
+    for (int i = 0; i < COL_CACHE_LINES; i++)
+        free(ci->lines[i].points);
+    colindex_init(ci);
+}
+
+void colindex_clear(ColIndex* ci)
+{
+    for (int i = 0; i < COL_CACHE_LINES; i++)
+        colindex_drop(&ci->lines[i]);
+}
+
+ColLine* colindex_get(ColIndex* ci, size_t start)
+{
+    for (int i = 0; i < COL_CACHE_LINES; i++) {
+        ColLine* cl = &ci->lines[i];
+        if (cl->count && cl->start == start) {
+            cl->used = ++ci->clock;
+            return cl;
+        }
+    }
+    return NULL;
+}
+
+ColLine* colindex_claim(ColIndex* ci, size_t start, size_t len)
+{
+    ColLine* cl = &ci->lines[0];
+    for (int i = 1; i < COL_CACHE_LINES; i++) {
+        if (ci->lines[i].used < cl->used)
+            cl = &ci->lines[i];
+    }
+
+    colindex_drop(cl);
+    cl->start = start;
+    cl->len   = len;
+    if (!colindex_push(cl, (Utf8Pos) { 0, 0, 0 }))
+        return NULL;
+    cl->used = ++ci->clock;
+    return cl;
+}
+
+void colindex_drop(ColLine* cl)
+{
+    cl->count    = 0;
+    cl->complete = false;
+    cl->stale    = false;
+    cl->used     = 0;
+}
+
+static bool colindex_reserve(ColLine* cl, size_t count)
+{
+    if (count <= cl->capacity)
+        return true;
+
+    size_t capacity = cl->capacity ? cl->capacity : INITIAL_POINTS;
+    while (capacity < count)
+        capacity *= 2;
+    Utf8Pos* points = realloc(cl->points, capacity * sizeof(Utf8Pos));
+    if (!points)
+        return false;
+    cl->points   = points;
+    cl->capacity = capacity;
+    return true;
+}
+
+bool colindex_push(ColLine* cl, Utf8Pos at)
+{
+    if (!colindex_reserve(cl, cl->count + 1))
+        return false;
+    cl->points[cl->count++] = at;
+    return true;
+}
+
+// An edit inside the line: the points between the last one at or before it
+// and the first one past it go, along with any left from an earlier edit
+// not measured yet, so every point after the gap is off by the same amount
+static void colindex_edit_line(ColLine* cl, size_t rel, size_t removed, size_t inserted)
+{
+    size_t a = colindex_find(cl, UTF8_BYTES, rel);
+    size_t b = a + 1;
+    while (b < cl->count && cl->points[b].byte < rel + removed)
+        b++;
+    cl->len = cl->len - removed + inserted;
+
+    if (b == cl->count) {
+        // Nothing left past the edit: the points are rebuilt from a on
+        cl->count    = a + 1;
+        cl->complete = false;
+        if (cl->stale && cl->stale_at >= a)
+            cl->stale = false;
+        return;
+    }
+
+    size_t lo = a, hi = b;
+    if (cl->stale) {
+        lo = cl->stale_at < lo ? cl->stale_at : lo;
+        hi = cl->stale_at + 1 > hi ? cl->stale_at + 1 : hi;
+    }
+    memmove(cl->points + lo + 1, cl->points + hi, (cl->count - hi) * sizeof(Utf8Pos));
+    cl->count -= hi - lo - 1;
+    for (size_t i = lo + 1; i < cl->count; i++)
+        cl->points[i].byte = cl->points[i].byte - removed + inserted;
+    cl->stale    = true;
+    cl->stale_at = lo;
+}
+
+void colindex_edit(ColIndex* ci, size_t pos, size_t removed, size_t inserted, const char* text, size_t text_len)
+{
+    for (int i = 0; i < COL_CACHE_LINES; i++) {
+        ColLine* cl = &ci->lines[i];
+        if (!cl->count)
+            continue;
+
+        size_t start = cl->start;
+        size_t end   = start + cl->len;
+        if (pos + removed < start) {
+            cl->start = start - removed + inserted;
+        } else if (pos > end) {
+            continue;
+        } else if (pos < start || pos + removed > end || (text_len > 0 && memchr(text, '\n', text_len))) {
+            colindex_drop(cl); // Joined with a neighbour or split
+        } else {
+            colindex_edit_line(cl, pos - start, removed, inserted);
+        }
+    }
+}
+
+size_t colindex_find(const ColLine* cl, Utf8Unit unit, size_t target)
+{
+    // Every unit grows along the line, so any of them can be searched
+    size_t lo = 0, hi = cl->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (utf8_pos_get(&cl->points[mid], unit) <= target)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool colindex_splice(ColLine* cl, size_t a, size_t b, const Utf8Pos* fresh, size_t n, Utf8Pos old_span,
+    Utf8Pos new_span)
+{
+    size_t removed = b - a - 1;
+    if (n > removed && !colindex_reserve(cl, cl->count + n - removed))
+        return false;
+
+    memmove(cl->points + a + 1 + n, cl->points + b, (cl->count - b) * sizeof(Utf8Pos));
+    memcpy(cl->points + a + 1, fresh, n * sizeof(Utf8Pos));
+    cl->count = cl->count - removed + n;
+
+    for (size_t i = a + 1 + n; i < cl->count; i++) {
+        Utf8Pos* p = &cl->points[i];
+        p->byte    = p->byte - old_span.byte + new_span.byte;
+        p->cp      = p->cp - old_span.cp + new_span.cp;
+        p->col     = p->col - old_span.col + new_span.col;
+    }
+    return true;
+}
@@ -3,8 +3,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 
+// Files at least this large are mapped through a piece table instead of
+// being read into the gap buffer, so opening them costs no RSS up front
+#define MMAP_THRESHOLD (16 * 1024 * 1024)
+
+// The find prompt scans for this long per keystroke or frame, a slice at a
+// time; bigger files are finished over the following frames
+#define FIND_STEP_MS     8
+#define FIND_SLICE_BYTES (4 * 1024 * 1024)
+
+// Columns moved per notch of the horizontal wheel (or Shift+wheel)
+#define SCROLL_COLS 8
+
 // Convert screen x,y to buffer position
 static size_t screen_to_buffer_pos(Editor* ed, int x, int y)
 {
@@ -38,22 +51,13 @@ static size_t screen_to_buffer_pos(Editor* ed, int x, int y)
 
     size_t target_line = ed->renderer.scroll_y + clicked_line;
     size_t target_col  = ed->renderer.scroll_x + clicked_col;
+    if (target_line >= total_lines)
+        return buffer_length(ed->buffer);
 
-    // Use line index for O(1) jump to target line
-    size_t pos     = buffer_get_line_offset(ed->buffer, target_line);
-    size_t buf_len = buffer_length(ed->buffer);
-
-    // Move to target column (only scan within the line)
-    size_t col = 0;
-    while (col < target_col && pos < buf_len) {
-        char c = buffer_char_at(ed->buffer, pos);
-        if (c == '\n')
-            break;
-        col++;
-        pos++;
-    }
-
-    return pos;
+    // The character under the click, found through the line and column
+    // indexes
+    Utf8Pos at = buffer_line_seek(ed->buffer, target_line, UTF8_COLUMNS, target_col);
+    return buffer_get_line_offset(ed->buffer, target_line) + at.byte;
 }
 
 static void editor_scroll_to_cursor(Editor* ed)
@@ -111,6 +115,20 @@ static void editor_jump_forward(Editor* ed)
     editor_scroll_to_cursor(ed);
 }
 
+// Keeps the find matches in step with every edit, undo and redo included
+static void editor_on_edit(void* ctx, size_t pos, size_t removed, size_t inserted)
+{
+    Editor* ed = ctx;
+    findset_edit(&ed->find, ed->buffer, pos, removed, inserted);
+}
+
+static void editor_watch_buffer(Editor* ed)
+{
+    findset_clear(&ed->find);
+    ed->buffer->on_edit     = editor_on_edit;
+    ed->buffer->on_edit_ctx = ed;
+}
+
 bool editor_init(Editor* ed, int width, int height)
 {
     memset(ed, 0, sizeof(Editor));
@@ -127,7 +145,11 @@ bool editor_init(Editor* ed, int width, int height)
         return false;
     }
 
+    findset_init(&ed->find);
+    editor_watch_buffer(ed);
+
     render_init(&ed->renderer, &ed->window);
+    ed->renderer.find  = &ed->find;
     ed->mode           = MODE_INSERT;
     ed->running        = true;
     ed->syntax_enabled = true;
@@ -138,6 +160,10 @@ bool editor_init(Editor* ed, int width, int height)
 
 void editor_destroy(Editor* ed)
 {
+    regex_free(ed->find_regex);
+    findset_free(&ed->find);
+    saver_destroy(ed->saver);
+    loader_destroy(ed->loader);
     buffer_destroy(ed->buffer);
     window_destroy(&ed->window);
     free(ed->clipboard);
@@ -151,9 +177,25 @@ void editor_set_status(Editor* ed, const char* msg)
 
 void editor_open_file(Editor* ed, const char* filename)
 {
-    if (buffer_load_file(ed->buffer, filename)) {
+    // The buffer is about to be replaced; let a pending save land first
+    saver_destroy(ed->saver);
+    ed->saver = NULL;
+
+    struct stat st;
+    if (stat(filename, &st) == 0 && st.st_size >= MMAP_THRESHOLD && ed->buffer->storage != STORAGE_PIECE) {
+        Buffer* mapped = buffer_create_with_storage(0, STORAGE_PIECE);
+        if (mapped) {
+            buffer_destroy(ed->buffer);
+            ed->buffer = mapped;
+        }
+    }
+    editor_watch_buffer(ed);
+
+    loader_destroy(ed->loader);
+    ed->loader = loader_start(ed->buffer, filename);
+    if (ed->loader) {
         char msg[256];
-        snprintf(msg, sizeof(msg), "Opened: %s", filename);
+        snprintf(msg, sizeof(msg), "Opening: %s", filename);
         editor_set_status(ed, msg);
     } else {
         // New file
@@ -163,6 +205,187 @@ void editor_open_file(Editor* ed, const char* filename)
     }
 }
 
+// "Find [Aa]: query", then the match count once there is one
+static void editor_find_status(Editor* ed)
+{
+    char msg[300];
+    int  len = snprintf(msg, sizeof(msg), "Find%s%s%s: %s", (ed->find_flags & SEARCH_IGNORE_CASE) ? " [Aa]" : "",
+        (ed->find_flags & SEARCH_WHOLE_WORD) ? " [Word]" : "", (ed->find_flags & SEARCH_REGEX) ? " [Re]" : "",
+        ed->input_buf);
+    if (ed->find.active && len > 0 && (size_t)len < sizeof(msg)) {
+        bool done = findset_done(&ed->find, ed->buffer);
+        snprintf(msg + len, sizeof(msg) - len, "  (%zu%s match%s)", ed->find.total, done ? "" : "+",
+            ed->find.total == 1 && done ? "" : "es");
+    }
+    editor_set_status(ed, msg);
+}
+
+// Scans for up to FIND_STEP_MS
+static void editor_find_step(Editor* ed)
+{
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!findset_step(&ed->find, ed->buffer, FIND_SLICE_BYTES)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (ms >= FIND_STEP_MS)
+            break;
+    }
+}
+
+// Selects the first match at or after where the prompt opened, or goes
+// back there if there's none. Waits (find_pending) while that isn't known.
+static void editor_find_jump(Editor* ed)
+{
+    Buffer* buf = ed->buffer;
+    i64     pos = findset_next(&ed->find, buf, ed->find_origin);
+
+    ed->find_pending = pos == FINDSET_PENDING;
+    if (ed->find_pending)
+        return;
+    buffer_clear_selection(buf);
+    if (pos < 0) {
+        buffer_move_cursor_to(buf, ed->find_origin);
+    } else {
+        buffer_move_cursor_to(buf, (size_t)pos);
+        buffer_start_selection(buf);
+        buffer_move_cursor(buf, (i32)ed->find.searcher.len);
+        buffer_update_selection(buf);
+    }
+    editor_scroll_to_cursor(ed);
+}
+
+// Query or flags changed. Literal queries are matched as they're typed;
+// a regex waits for Enter.
+static void editor_find_prompt(Editor* ed)
+{
+    ed->find_counted = false;
+    regex_free(ed->find_regex);
+    ed->find_regex = NULL;
+
+    if (!(ed->find_flags & SEARCH_REGEX)
+        && findset_query(&ed->find, ed->buffer, ed->input_buf, ed->input_len, ed->find_flags)) {
+        editor_find_step(ed);
+        editor_find_jump(ed);
+    } else {
+        bool had_query = ed->find.active;
+        findset_clear(&ed->find);
+        ed->find_pending = false;
+        if (had_query && ed->input_len == 0) {
+            buffer_clear_selection(ed->buffer);
+            buffer_move_cursor_to(ed->buffer, ed->find_origin);
+            editor_scroll_to_cursor(ed);
+        }
+    }
+    editor_find_status(ed);
+}
+
+// Carries on scanning for the find prompt, a slice per frame
+static void editor_poll_find(Editor* ed)
+{
+    if (!ed->find.active || findset_done(&ed->find, ed->buffer))
+        return;
+
+    editor_find_step(ed);
+    if (ed->mode != MODE_FIND)
+        return;
+    if (ed->find_pending)
+        editor_find_jump(ed);
+    editor_find_status(ed);
+}
+
+// Regex mode: as below, but matches have their own lengths and whole-word
+// mode doesn't apply
+static i64 editor_find_regex(Editor* ed, bool backward, size_t* match_len)
+{
+    if (!ed->find_regex) {
+        const char* error;
+        ed->find_regex = regex_compile(ed->input_buf, ed->input_len, ed->find_flags, &error);
+        if (!ed->find_regex) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Bad pattern: %s", error);
+            editor_set_status(ed, msg);
+            return -2;
+        }
+    }
+
+    Regex*  re     = ed->find_regex;
+    Buffer* buf    = ed->buffer;
+    size_t  len    = buffer_length(buf);
+    size_t  anchor = buf->has_selection ? buf->sel_start : buf->cursor;
+    size_t  from   = buf->has_selection ? anchor + 1 : anchor;
+    size_t  a, b;
+    bool    found;
+
+    if (backward)
+        found = regex_search_backward(re, buf, 0, anchor, &a, &b)
+            || regex_search_backward(re, buf, anchor, len + 1, &a, &b);
+    else
+        found = regex_search_forward(re, buf, from, len, &a, &b) || regex_search_forward(re, buf, 0, len, &a, &b);
+    if (!found)
+        return -1;
+
+    if (!ed->find_counted || ed->find_count_revision != buf->revision) {
+        ed->find_count          = regex_count(re, buf, 0, len);
+        ed->find_count_revision = buf->revision;
+        ed->find_counted        = true;
+    }
+    *match_len = b - a;
+    return (i64)a;
+}
+
+// Next match after the current one (or the cursor), or the previous one
+// before it. The wrapped second pass only covers what the first skipped.
+static i64 editor_find(Editor* ed, bool backward, size_t* match_len)
+{
+    if (ed->find_flags & SEARCH_REGEX)
+        return editor_find_regex(ed, backward, match_len);
+
+    Searcher s;
+    if (!search_init(&s, ed->input_buf, ed->input_len, ed->find_flags))
+        return -1;
+
+    Buffer* buf    = ed->buffer;
+    size_t  len    = buffer_length(buf);
+    size_t  anchor = buf->has_selection ? buf->sel_start : buf->cursor;
+    size_t  reach  = anchor + s.len - 1 < len ? anchor + s.len - 1 : len; // Matches starting before anchor
+    i64     pos;
+
+    if (backward) {
+        pos = search_backward(&s, buf, 0, reach);
+        if (pos < 0)
+            pos = search_backward(&s, buf, anchor, len);
+    } else {
+        size_t from = buf->has_selection ? anchor + 1 : anchor;
+        pos         = search_forward_parallel(&s, buf, from, len, 0);
+        if (pos < 0)
+            pos = search_forward_parallel(&s, buf, 0, from + s.len - 1 < len ? from + s.len - 1 : len, 0);
+    }
+
+    // The find set counts as it goes, and keeps up with edits
+    ed->find_count   = ed->find.total;
+    ed->find_counted = findset_done(&ed->find, buf);
+
+    *match_len = s.len;
+    search_free(&s);
+    return pos;
+}
+
+// Length of a prompt's text without its last character
+static size_t prompt_trim_char(const char* text, size_t len)
+{
+    while (len > 0 && ((u8)text[--len] & 0xC0) == 0x80)
+        ;
+    return len;
+}
+
+static void editor_replace_prompt(Editor* ed)
+{
+    char msg[600];
+    snprintf(msg, sizeof(msg), "Replace all \"%s\" with: %s", ed->input_buf, ed->replace_buf);
+    editor_set_status(ed, msg);
+}
+
 static void editor_handle_find_mode(Editor* ed, InputEvent* ev)
 {
     if (ev->type != EVENT_KEY)
@@ -175,38 +398,122 @@ static void editor_handle_find_mode(Editor* ed, InputEvent* ev)
         break;
     case KEY_ENTER: {
         ed->input_buf[ed->input_len] = '\0';
-        i64 pos                      = buffer_find(ed->buffer, ed->input_buf, ed->buffer->cursor + 1);
-        if (pos < 0)
-            pos = buffer_find(ed->buffer, ed->input_buf, 0); // Wrap
+        ed->find_pending             = false; // Stepping takes over from typing
+        size_t match_len             = 0;
+        i64    pos                   = editor_find(ed, ev->key.shift, &match_len);
         if (pos >= 0) {
             editor_push_position(ed);
+            buffer_clear_selection(ed->buffer);
             buffer_move_cursor_to(ed->buffer, pos);
             buffer_start_selection(ed->buffer);
-            buffer_move_cursor(ed->buffer, ed->input_len);
+            buffer_move_cursor(ed->buffer, (i32)match_len);
             buffer_update_selection(ed->buffer);
             editor_scroll_to_cursor(ed);
-            editor_set_status(ed, "Found. Enter: next, Esc: done");
-        } else {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "%zu%s match%s. Enter: next, Shift+Enter: previous, Esc: done",
+                ed->find_count, ed->find_counted ? "" : "+", ed->find_count == 1 && ed->find_counted ? "" : "es");
+            editor_set_status(ed, msg);
+        } else if (pos == -1) {
             editor_set_status(ed, "Not found");
         }
         break;
     }
     case KEY_BACKSPACE:
         if (ed->input_len > 0) {
-            ed->input_len--;
+            ed->input_len                = prompt_trim_char(ed->input_buf, ed->input_len);
             ed->input_buf[ed->input_len] = '\0';
-            char msg[300];
-            snprintf(msg, sizeof(msg), "Find: %s", ed->input_buf);
-            editor_set_status(ed, msg);
+            editor_find_prompt(ed);
         }
         break;
     case KEY_CHAR:
-        if (ed->input_len < sizeof(ed->input_buf) - 1) {
-            ed->input_buf[ed->input_len++] = ev->key.c;
-            ed->input_buf[ed->input_len]   = '\0';
-            char msg[300];
-            snprintf(msg, sizeof(msg), "Find: %s", ed->input_buf);
-            editor_set_status(ed, msg);
+        // Alt+C: match case, Alt+W: whole words, Alt+R: regular expression
+        if (ev->key.alt && (ev->key.c == 'c' || ev->key.c == 'w' || ev->key.c == 'r')) {
+            ed->find_flags ^= ev->key.c == 'c' ? SEARCH_IGNORE_CASE
+                : ev->key.c == 'w'             ? SEARCH_WHOLE_WORD
+                                               : SEARCH_REGEX;
+            editor_find_prompt(ed);
+        } else if (ed->input_len + ev->key.text_len < sizeof(ed->input_buf)) {
+            memcpy(ed->input_buf + ed->input_len, ev->key.text, ev->key.text_len);
+            ed->input_len += ev->key.text_len;
+            ed->input_buf[ed->input_len] = '\0';
+            editor_find_prompt(ed);
+        }
+        break;
+    case KEY_CTRL_R:
+        if (ed->find_flags & SEARCH_REGEX) {
+            editor_set_status(ed, "Replace works on plain-text queries only");
+        } else if (ed->input_len > 0) {
+            ed->mode           = MODE_REPLACE;
+            ed->replace_len    = 0;
+            ed->replace_buf[0] = '\0';
+            editor_replace_prompt(ed);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Every match of the find query at once, as one undo step
+static void editor_replace_all(Editor* ed)
+{
+    Buffer*  buf = ed->buffer;
+    Searcher s;
+    if (!search_init(&s, ed->input_buf, ed->input_len, ed->find_flags))
+        return;
+
+    SearchHits hits     = { 0 };
+    size_t     replaced = 0;
+    bool       ok       = search_collect(&s, buf, 0, buffer_length(buf), &hits);
+    if (ok && hits.count > 0) {
+        editor_push_position(ed);
+        replaced = buffer_replace_all(buf, hits.pos, hits.count, s.len, ed->replace_buf, ed->replace_len);
+        ok       = replaced > 0;
+        editor_scroll_to_cursor(ed);
+    }
+    free(hits.pos);
+    search_free(&s);
+
+    char msg[128];
+    if (!ok && hits.count > 0)
+        snprintf(msg, sizeof(msg), "Error: Out of memory, nothing replaced");
+    else
+        snprintf(msg, sizeof(msg), "Replaced %zu occurrence%s", replaced, replaced == 1 ? "" : "s");
+    editor_set_status(ed, msg);
+}
+
+static void editor_handle_replace_mode(Editor* ed, InputEvent* ev)
+{
+    if (ev->type != EVENT_KEY)
+        return;
+
+    switch (ev->key.type) {
+    case KEY_ESCAPE:
+        ed->mode = MODE_FIND;
+        editor_find_status(ed);
+        break;
+    case KEY_ENTER:
+        if (ed->buffer->loading) {
+            editor_set_status(ed, "Still loading - file is read-only until done");
+            break;
+        }
+        editor_replace_all(ed);
+        findset_clear(&ed->find);
+        ed->mode = MODE_INSERT;
+        break;
+    case KEY_BACKSPACE:
+        if (ed->replace_len > 0) {
+            ed->replace_len                  = prompt_trim_char(ed->replace_buf, ed->replace_len);
+            ed->replace_buf[ed->replace_len] = '\0';
+            editor_replace_prompt(ed);
+        }
+        break;
+    case KEY_CHAR:
+        if (ed->replace_len + ev->key.text_len < sizeof(ed->replace_buf)) {
+            memcpy(ed->replace_buf + ed->replace_len, ev->key.text, ev->key.text_len);
+            ed->replace_len += ev->key.text_len;
+            ed->replace_buf[ed->replace_len] = '\0';
+            editor_replace_prompt(ed);
         }
         break;
     default:
@@ -261,18 +568,119 @@ static void editor_handle_goto_mode(Editor* ed, InputEvent* ev)
     }
 }
 
+// Typing over a selection replaces it, as one undo step. Text goes in a
+// byte at a time, so multi-byte characters merge into the same undo step as
+// the typing around them.
+static void editor_type(Editor* ed, const char* text, size_t len)
+{
+    bool replace = buffer_has_selection(ed->buffer);
+    if (replace) {
+        buffer_begin_group(ed->buffer);
+        buffer_delete_selection(ed->buffer);
+    }
+    for (size_t i = 0; i < len; i++)
+        buffer_insert_char(ed->buffer, text[i]);
+    if (replace)
+        buffer_end_group(ed->buffer);
+}
+
+// Alt+N / Alt+L
+static void editor_add_cursors(Editor* ed, bool next_match)
+{
+    Buffer* buf = ed->buffer;
+    if (next_match && !buffer_add_cursor_at_next_match(buf)) {
+        editor_set_status(ed, "No more matches");
+        return;
+    }
+    if (!next_match)
+        buffer_add_cursors_on_lines(buf);
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%zu cursor%s. Esc: back to one", buffer_cursor_count(buf),
+        buffer_cursor_count(buf) == 1 ? "" : "s");
+    editor_set_status(ed, msg);
+    editor_scroll_to_cursor(ed);
+}
+
+// Keys that change the buffer (or write it out) - ignored while loading
+static bool editor_key_modifies(KeyType key)
+{
+    switch (key) {
+    case KEY_CHAR:
+    case KEY_ENTER:
+    case KEY_TAB:
+    case KEY_BACKSPACE:
+    case KEY_DELETE:
+    case KEY_CTRL_S:
+    case KEY_CTRL_Z:
+    case KEY_CTRL_Y:
+    case KEY_CTRL_X:
+    case KEY_CTRL_V:
+    case KEY_CTRL_D:
+    case KEY_CTRL_K:
+    case KEY_CTRL_BACKSPACE:
+    case KEY_CTRL_DELETE:
+    case KEY_ALT_UP:
+    case KEY_ALT_DOWN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void editor_poll_loader(Editor* ed)
+{
+    if (!ed->loader)
+        return;
+
+    LoadStatus status = loader_poll(ed->loader);
+    if (status == LOAD_RUNNING)
+        return;
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), status == LOAD_DONE ? "Opened: %s" : "Error: Could not fully read %s",
+        ed->buffer->filename);
+    editor_set_status(ed, msg);
+    loader_destroy(ed->loader);
+    ed->loader = NULL;
+}
+
+static void editor_poll_saver(Editor* ed)
+{
+    if (!ed->saver)
+        return;
+
+    SaveStatus status = saver_poll(ed->saver);
+    if (status == SAVE_RUNNING)
+        return;
+
+    editor_set_status(ed, status == SAVE_DONE ? "Saved" : "Error: Could not save file");
+    saver_destroy(ed->saver);
+    ed->saver = NULL;
+}
+
 void editor_handle_event(Editor* ed, InputEvent* ev)
 {
-    // Handle special modes
+    // Handle special modes. Their prompts take keys while loading; only
+    // replacing is held back.
     if (ed->mode == MODE_FIND) {
         editor_handle_find_mode(ed, ev);
         return;
     }
+    if (ed->mode == MODE_REPLACE) {
+        editor_handle_replace_mode(ed, ev);
+        return;
+    }
     if (ed->mode == MODE_GOTO) {
         editor_handle_goto_mode(ed, ev);
         return;
     }
 
+    if (ed->buffer->loading && ev->type == EVENT_KEY && editor_key_modifies(ev->key.type)) {
+        editor_set_status(ed, "Still loading - file is read-only until done");
+        return;
+    }
+
     switch (ev->type) {
     case EVENT_KEY:
         switch (ev->key.type) {
@@ -281,8 +689,13 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             break;
 
         case KEY_CTRL_S:
-            if (buffer_save_file(ed->buffer)) {
-                editor_set_status(ed, "Saved");
+            // Written by a worker thread, so editing carries on meanwhile
+            if (ed->buffer->loading) {
+                editor_set_status(ed, "Still loading - can't save a partial file");
+            } else if (ed->saver) {
+                editor_set_status(ed, "Still saving");
+            } else if ((ed->saver = saver_start(ed->buffer))) {
+                editor_set_status(ed, "Saving...");
             } else {
                 editor_set_status(ed, "Error: Could not save file");
             }
@@ -323,10 +736,7 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
 
         case KEY_CTRL_V:
             if (ed->clipboard && ed->clipboard_len > 0) {
-                if (buffer_has_selection(ed->buffer)) {
-                    buffer_delete_selection(ed->buffer);
-                }
-                buffer_insert_text(ed->buffer, ed->clipboard, ed->clipboard_len);
+                buffer_paste(ed->buffer, ed->clipboard, ed->clipboard_len);
                 editor_scroll_to_cursor(ed);
                 editor_set_status(ed, "Pasted");
             }
@@ -341,10 +751,13 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             break;
 
         case KEY_CTRL_F:
+        case KEY_CTRL_R: // Find first, then Ctrl+R again for the replacement
+            editor_push_position(ed);
             ed->mode         = MODE_FIND;
             ed->input_len    = 0;
             ed->input_buf[0] = '\0';
-            editor_set_status(ed, "Find: ");
+            ed->find_origin  = ed->buffer->has_selection ? ed->buffer->sel_start : ed->buffer->cursor;
+            editor_find_prompt(ed);
             break;
 
         case KEY_CTRL_G:
@@ -461,33 +874,52 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             break;
 
         case KEY_CHAR:
-            if (buffer_has_selection(ed->buffer)) {
-                buffer_delete_selection(ed->buffer);
+            // Alt+N: cursor at the next match, Alt+L: cursor on every line
+            if (ev->key.alt && (ev->key.c == 'n' || ev->key.c == 'l')) {
+                editor_add_cursors(ed, ev->key.c == 'n');
+                break;
             }
-            buffer_insert_char(ed->buffer, ev->key.c);
+            if (buffer_cursor_count(ed->buffer) > 1) {
+                buffer_multi_insert(ed->buffer, ev->key.text, ev->key.text_len);
+                editor_scroll_to_cursor(ed);
+                break;
+            }
+            editor_type(ed, ev->key.text, ev->key.text_len);
             editor_scroll_to_cursor(ed);
             break;
 
         case KEY_ENTER:
-            if (buffer_has_selection(ed->buffer)) {
-                buffer_delete_selection(ed->buffer);
+            if (buffer_cursor_count(ed->buffer) > 1) {
+                buffer_multi_insert(ed->buffer, "\n", 1);
+                editor_scroll_to_cursor(ed);
+                break;
             }
-            buffer_insert_char(ed->buffer, '\n');
+            editor_type(ed, "\n", 1);
             editor_scroll_to_cursor(ed);
             break;
 
         case KEY_TAB:
+            if (buffer_cursor_count(ed->buffer) > 1) {
+                buffer_multi_insert(ed->buffer, "        ", TAB_WIDTH);
+                editor_scroll_to_cursor(ed);
+                break;
+            }
+            // One undo step of its own, even after typing
+            buffer_begin_group(ed->buffer);
             if (buffer_has_selection(ed->buffer)) {
                 buffer_delete_selection(ed->buffer);
             }
             for (int i = 0; i < TAB_WIDTH; i++) {
                 buffer_insert_char(ed->buffer, ' ');
             }
+            buffer_end_group(ed->buffer);
             editor_scroll_to_cursor(ed);
             break;
 
         case KEY_BACKSPACE:
-            if (buffer_has_selection(ed->buffer)) {
+            if (buffer_cursor_count(ed->buffer) > 1) {
+                buffer_multi_backspace(ed->buffer);
+            } else if (buffer_has_selection(ed->buffer)) {
                 buffer_delete_selection(ed->buffer);
             } else {
                 buffer_backspace(ed->buffer);
@@ -496,7 +928,9 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             break;
 
         case KEY_DELETE:
-            if (buffer_has_selection(ed->buffer)) {
+            if (buffer_cursor_count(ed->buffer) > 1) {
+                buffer_multi_delete(ed->buffer);
+            } else if (buffer_has_selection(ed->buffer)) {
                 buffer_delete_selection(ed->buffer);
             } else {
                 buffer_delete_char(ed->buffer);
@@ -508,11 +942,13 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             if (ev->key.shift) {
                 if (!ed->buffer->has_selection)
                     buffer_start_selection(ed->buffer);
-                buffer_move_cursor(ed->buffer, -1);
+                buffer_move_char(ed->buffer, -1);
                 buffer_update_selection(ed->buffer);
+            } else if (buffer_cursor_count(ed->buffer) > 1) {
+                buffer_multi_move(ed->buffer, -1);
             } else {
                 buffer_clear_selection(ed->buffer);
-                buffer_move_cursor(ed->buffer, -1);
+                buffer_move_char(ed->buffer, -1);
             }
             editor_scroll_to_cursor(ed);
             break;
@@ -521,11 +957,13 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             if (ev->key.shift) {
                 if (!ed->buffer->has_selection)
                     buffer_start_selection(ed->buffer);
-                buffer_move_cursor(ed->buffer, 1);
+                buffer_move_char(ed->buffer, 1);
                 buffer_update_selection(ed->buffer);
+            } else if (buffer_cursor_count(ed->buffer) > 1) {
+                buffer_multi_move(ed->buffer, 1);
             } else {
                 buffer_clear_selection(ed->buffer);
-                buffer_move_cursor(ed->buffer, 1);
+                buffer_move_char(ed->buffer, 1);
             }
             editor_scroll_to_cursor(ed);
             break;
@@ -654,8 +1092,27 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             }
             break;
 
+        case KEY_SCROLL_LEFT:
+        case KEY_SCROLL_RIGHT:
+            // Columns are found through the column index, so this is as
+            // cheap at column 400,000,000 as at column 0
+            if (ev->key.type == KEY_SCROLL_RIGHT)
+                ed->renderer.scroll_x += SCROLL_COLS;
+            else if (ed->renderer.scroll_x >= SCROLL_COLS)
+                ed->renderer.scroll_x -= SCROLL_COLS;
+            else
+                ed->renderer.scroll_x = 0;
+            if (ed->dragging_selection) {
+                size_t pos = screen_to_buffer_pos(ed, ed->last_mouse_x, ed->last_mouse_y);
+                buffer_move_cursor_to(ed->buffer, pos);
+                buffer_update_selection(ed->buffer);
+            }
+            break;
+
         case KEY_ESCAPE:
             buffer_clear_selection(ed->buffer);
+            buffer_clear_cursors(ed->buffer);
+            findset_clear(&ed->find); // Matches stay highlighted until now
             editor_set_status(ed, "");
             break;
 
@@ -689,6 +1146,7 @@ void editor_handle_event(Editor* ed, InputEvent* ev)
             } else {
                 // Click in text area
                 size_t pos = screen_to_buffer_pos(ed, ev->mouse.x, ev->mouse.y);
+                buffer_clear_cursors(ed->buffer);
                 buffer_move_cursor_to(ed->buffer, pos);
 
                 if (ev->mouse.click_count == 3) {
@@ -793,6 +1251,11 @@ void editor_run(Editor* ed)
             editor_handle_event(ed, &ev);
         }
 
+        // Make whatever the loader has read so far visible
+        editor_poll_loader(ed);
+        editor_poll_saver(ed);
+        editor_poll_find(ed);
+
         // Render
         render_clear(&ed->renderer);
         render_buffer(&ed->renderer, ed->buffer);
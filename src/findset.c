@@ -0,0 +1,293 @@
+#include "findset.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Beyond this many matches positions aren't kept, only counted. Narrowing
+// touches the text at every match, a cache miss each on a big file, so
+// more than this wouldn't fit in a frame.
+#define FINDSET_MAX_HITS (1 << 17)
+
+// How far findset_next looks on its own before waiting for the scan
+#define FINDSET_PEEK (4 * 1024 * 1024)
+
+void findset_init(FindSet* fs) { memset(fs, 0, sizeof(*fs)); }
+
+void findset_free(FindSet* fs)
+{
+    findset_clear(fs);
+    free(fs->hits.pos);
+    memset(fs, 0, sizeof(*fs));
+}
+
+void findset_clear(FindSet* fs)
+{
+    if (fs->active)
+        search_free(&fs->searcher);
+    fs->active     = false;
+    fs->hits.count = 0;
+    fs->total      = 0;
+    fs->scanned    = 0;
+    fs->overflow   = false;
+}
+
+static void findset_restart(FindSet* fs)
+{
+    fs->hits.count = 0;
+    fs->total      = 0;
+    fs->scanned    = 0;
+    fs->overflow   = false;
+}
+
+// First hit at or after pos
+static size_t hits_lower_bound(const SearchHits* hits, size_t pos)
+{
+    size_t lo = 0;
+    size_t hi = hits->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (hits->pos[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Does needle[from..] match text, which holds the bytes at pos + from?
+static bool tail_equal(const Searcher* s, const char* text, size_t from)
+{
+    if (!(s->flags & SEARCH_IGNORE_CASE))
+        return memcmp(text, s->needle + from, s->len - from) == 0;
+    // ASCII only, as the searcher folds: tolower would follow the locale
+    for (size_t i = from; i < s->len; i++) {
+        u8 c = (u8)text[i - from];
+        if ((c >= 'A' && c <= 'Z' ? c + 32 : c) != s->needle[i])
+            return false;
+    }
+    return true;
+}
+
+// Keeps the hits where needle[from..] also matches. They're in order, so one
+// walk over the spans reaches them all; a tail across a seam is copied out.
+static void narrow_hits(const Searcher* s, Buffer* buf, SearchHits* hits, size_t from)
+{
+    size_t     len  = buffer_length(buf);
+    size_t     n    = s->len - from;
+    size_t     kept = 0;
+    BufferIter it;
+    buffer_iter_init(&it, buf, 0, len);
+    bool more = buffer_iter_next(&it);
+    for (size_t i = 0; i < hits->count; i++) {
+        size_t at = hits->pos[i] + from;
+        if (at + n > len)
+            break;
+        while (more && it.pos + it.len <= at)
+            more = buffer_iter_next(&it);
+
+        bool match;
+        if (at + n <= it.pos + it.len) {
+            match = tail_equal(s, it.text + (at - it.pos), from);
+        } else {
+            char  small[256];
+            char* tail = n <= sizeof(small) ? small : malloc(n);
+            match      = tail && buffer_extract(buf, at, n, tail) == n && tail_equal(s, tail, from);
+            if (tail != small)
+                free(tail);
+        }
+        if (match)
+            hits->pos[kept++] = hits->pos[i];
+    }
+    hits->count = kept;
+}
+
+bool findset_query(FindSet* fs, Buffer* buf, const char* needle, size_t len, u32 flags)
+{
+    Searcher s;
+    if (!search_init(&s, needle, len, flags)) {
+        findset_clear(fs);
+        return false;
+    }
+
+    // A longer needle only matches where the shorter one did. Whole words
+    // don't narrow that way: "ca" isn't a word in "cat", "cat" is.
+    const Searcher* old    = &fs->searcher;
+    bool            narrow = fs->active && !fs->overflow && old->flags == s.flags
+        && !(s.flags & SEARCH_WHOLE_WORD) && s.len > old->len && memcmp(s.needle, old->needle, old->len) == 0;
+
+    if (narrow) {
+        narrow_hits(&s, buf, &fs->hits, old->len);
+        fs->total = fs->hits.count;
+
+        // While loading, the longer needle can't be checked as near the end.
+        // The hits there were dropped, and get scanned again once more text
+        // is in.
+        size_t len   = buffer_length(buf);
+        size_t limit = len >= s.len - 1 ? len - (s.len - 1) : 0;
+        if (buf->loading && fs->scanned > limit)
+            fs->scanned = limit;
+    } else {
+        findset_restart(fs);
+    }
+
+    if (fs->active)
+        search_free(&fs->searcher);
+    fs->searcher = s;
+    fs->active   = true;
+    return true;
+}
+
+static void findset_overflow(FindSet* fs)
+{
+    free(fs->hits.pos);
+    memset(&fs->hits, 0, sizeof(fs->hits));
+    fs->overflow = true;
+}
+
+bool findset_step(FindSet* fs, Buffer* buf, size_t budget)
+{
+    if (!fs->active)
+        return true;
+
+    // While loading, a match may still run on into text not read yet
+    size_t len   = buffer_length(buf);
+    size_t m     = fs->searcher.len;
+    size_t limit = !buf->loading ? len : len >= m - 1 ? len - (m - 1) : 0;
+    if (limit > fs->scanned) {
+        size_t to  = limit - fs->scanned > budget ? fs->scanned + budget : limit;
+        size_t end = to + m - 1 < len ? to + m - 1 : len;
+        if (fs->overflow) {
+            fs->total += search_count(&fs->searcher, buf, fs->scanned, end, 0);
+        } else {
+            size_t before = fs->hits.count;
+            bool   ok     = search_collect(&fs->searcher, buf, fs->scanned, end, &fs->hits);
+            fs->total += fs->hits.count - before;
+            if (!ok || fs->hits.count > FINDSET_MAX_HITS)
+                findset_overflow(fs);
+        }
+        fs->scanned = to;
+    }
+    return findset_done(fs, buf);
+}
+
+bool findset_done(const FindSet* fs, Buffer* buf)
+{
+    return !fs->active || (!buf->loading && fs->scanned >= buffer_length(buf));
+}
+
+i64 findset_next(FindSet* fs, Buffer* buf, size_t from)
+{
+    if (!fs->active)
+        return -1;
+
+    const Searcher* s   = &fs->searcher;
+    size_t          len = buffer_length(buf);
+    if (fs->overflow) {
+        // Matches are everywhere; searching directly finds one soon
+        i64 pos = search_forward_parallel(s, buf, from, len, 0);
+        return pos >= 0 ? pos : search_forward_parallel(s, buf, 0, len, 0);
+    }
+
+    size_t i = hits_lower_bound(&fs->hits, from);
+    if (i < fs->hits.count)
+        return (i64)fs->hits.pos[i];
+    if (findset_done(fs, buf))
+        return fs->hits.count > 0 ? (i64)fs->hits.pos[0] : -1;
+
+    // Past what's been scanned: look a little way ahead before waiting
+    size_t start = from > fs->scanned ? from : fs->scanned;
+    size_t end   = len - start > FINDSET_PEEK ? start + FINDSET_PEEK + s->len - 1 : len;
+    i64    pos   = search_forward(s, buf, start, end);
+    return pos >= 0 ? pos : FINDSET_PENDING;
+}
+
+size_t findset_visible(FindSet* fs, Buffer* buf, size_t start, size_t end, size_t* out, size_t max)
+{
+    if (!fs->active || start >= end)
+        return 0;
+
+    size_t m  = fs->searcher.len;
+    size_t lo = start >= m - 1 ? start - (m - 1) : 0;
+    size_t n  = 0;
+    if (!fs->overflow && end <= fs->scanned) {
+        for (size_t i = hits_lower_bound(&fs->hits, lo); i < fs->hits.count && fs->hits.pos[i] < end && n < max; i++)
+            out[n++] = fs->hits.pos[i];
+        return n;
+    }
+
+    // Not scanned that far yet: a screenful is quick to search directly
+    SearchHits found = { 0 };
+    search_collect(&fs->searcher, buf, lo, end + m - 1, &found);
+    for (size_t i = 0; i < found.count && n < max; i++)
+        out[n++] = found.pos[i];
+    free(found.pos);
+    return n;
+}
+
+void findset_edit(FindSet* fs, Buffer* buf, size_t pos, size_t removed, size_t inserted)
+{
+    if (!fs->active)
+        return;
+
+    // Matches starting in [lo, hi) may have changed: those overlapping the
+    // edit, and for whole words, those right next to it
+    size_t m    = fs->searcher.len;
+    size_t edge = (fs->searcher.flags & SEARCH_WHOLE_WORD) ? 1 : 0;
+    size_t lo   = pos >= m - 1 + edge ? pos - (m - 1) - edge : 0;
+    size_t hi   = pos + removed + edge;
+    if (fs->scanned <= lo)
+        return; // Only touches what's still to be scanned
+
+    if (fs->overflow) {
+        findset_restart(fs); // Not kept, so count again
+        fs->overflow = true;
+        return;
+    }
+
+    SearchHits* hits = &fs->hits;
+    size_t      i    = hits_lower_bound(hits, lo);
+    size_t      j    = hits_lower_bound(hits, hi);
+    if (fs->scanned < hi) {
+        // The edit reaches into the unscanned part: rescan from lo
+        hits->count = i;
+        fs->total   = i;
+        fs->scanned = lo;
+        return;
+    }
+
+    // Shift what follows, then splice in the matches found around the edit
+    for (size_t k = j; k < hits->count; k++)
+        hits->pos[k] = hits->pos[k] - removed + inserted;
+    fs->scanned = fs->scanned - removed + inserted;
+
+    SearchHits found = { 0 };
+    size_t     len   = buffer_length(buf);
+    size_t     end   = pos + inserted + edge + m - 1;
+    if (!search_collect(&fs->searcher, buf, lo, end < len ? end : len, &found)) {
+        free(found.pos);
+        hits->count = i;
+        fs->total   = i;
+        fs->scanned = lo;
+        return;
+    }
+
+    size_t count = hits->count - (j - i) + found.count;
+    if (count > hits->capacity) {
+        size_t* grown = realloc(hits->pos, count * sizeof(size_t));
+        if (!grown) {
+            free(found.pos);
+            hits->count = i;
+            fs->total   = i;
+            fs->scanned = lo;
+            return;
+        }
+        hits->pos      = grown;
+        hits->capacity = count;
+    }
+    if (hits->count > j)
+        memmove(hits->pos + i + found.count, hits->pos + j, (hits->count - j) * sizeof(size_t));
+    if (found.count > 0)
+        memcpy(hits->pos + i, found.pos, found.count * sizeof(size_t));
+    hits->count = count;
+    fs->total   = count;
+    free(found.pos);
+}
@@ -302,3 +302,14 @@ const u8* font_get_glyph(char c)
     }
     return font_data[c - 32];
 }
+
+// Drawn for characters the font doesn't cover
+static const u8 box_glyph[16] = { 0x00, 0x00, 0x00, 0x7e, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x7e, 0x00, 0x00,
+    0x00, 0x00 };
+
+const u8* font_get_codepoint_glyph(u32 cp)
+{
+    if (cp < 0x80)
+        return font_get_glyph((char)cp);
+    return box_glyph;
+}
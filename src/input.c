@@ -1,6 +1,8 @@
 #include "input.h"
+#include "utf8.h"
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
+#include <string.h>
 #include <time.h>
 
 // For double/triple click detection
@@ -11,6 +13,24 @@ static int     last_click_y    = 0;
 #define DOUBLE_CLICK_TIME 300  // ms
 #define CLICK_DISTANCE    5    // pixels
 
+// The text a key press types, as UTF-8. With no input method, X gives
+// Latin-1, which is widened here. Returns its length.
+static int lookup_text(Window_State* win, XKeyEvent* key, char* out, int size, KeySym* keysym)
+{
+    if (win->ic) {
+        Status status;
+        int    len = Xutf8LookupString(win->ic, key, out, size, keysym, &status);
+        return status == XLookupChars || status == XLookupBoth ? len : 0;
+    }
+
+    char latin[8];
+    int  len = XLookupString(key, latin, sizeof(latin), keysym, NULL);
+    int  n   = 0;
+    for (int i = 0; i < len && n + UTF8_MAX <= size; i++)
+        n += (int)utf8_encode((u8)latin[i], out + n);
+    return n;
+}
+
 InputEvent input_poll(Window_State* win)
 {
     InputEvent ev = { 0 };
@@ -23,6 +43,10 @@ InputEvent input_poll(Window_State* win)
     XEvent xev;
     XNextEvent(win->display, &xev);
 
+    // Keys that only feed a composition in the input method
+    if (XFilterEvent(&xev, None))
+        return ev;
+
     switch (xev.type) {
     case KeyPress: {
         ev.type = EVENT_KEY;
@@ -33,8 +57,8 @@ InputEvent input_poll(Window_State* win)
         ev.key.alt     = (key->state & Mod1Mask) != 0;
 
         char   buf[32];
-        KeySym keysym;
-        int    len = XLookupString(key, buf, sizeof(buf), &keysym, NULL);
+        KeySym keysym = NoSymbol;
+        int    len    = lookup_text(win, key, buf, sizeof(buf), &keysym);
 
         // Handle control keys
         if (ev.key.ctrl) {
@@ -75,6 +99,10 @@ InputEvent input_poll(Window_State* win)
             case XK_F:
                 ev.key.type = KEY_CTRL_F;
                 return ev;
+            case XK_r:
+            case XK_R:
+                ev.key.type = KEY_CTRL_R;
+                return ev;
             case XK_g:
             case XK_G:
                 ev.key.type = KEY_CTRL_G;
@@ -187,9 +215,11 @@ InputEvent input_poll(Window_State* win)
             ev.key.type = KEY_ESCAPE;
             break;
         default:
-            if (len > 0 && buf[0] >= 32 && buf[0] < 127) {
-                ev.key.type = KEY_CHAR;
-                ev.key.c    = buf[0];
+            if (len > 0 && ((u8)buf[0] >= 32 && buf[0] != 127)) {
+                ev.key.type     = KEY_CHAR;
+                ev.key.c        = buf[0];
+                ev.key.text_len = (u8)len;
+                memcpy(ev.key.text, buf, len);
             } else {
                 ev.key.type = KEY_NONE;
             }
@@ -199,8 +229,18 @@ InputEvent input_poll(Window_State* win)
     }
 
     case ButtonPress: {
-        // Button 4/5 are scroll wheel in X11
-        if (xev.xbutton.button == 4) {
+        // Button 4/5 are scroll wheel in X11, 6/7 the horizontal wheel;
+        // Shift turns the vertical wheel sideways
+        bool shift = (xev.xbutton.state & ShiftMask) != 0;
+        if (xev.xbutton.button == 6 || (xev.xbutton.button == 4 && shift)) {
+            ev.type     = EVENT_KEY;
+            ev.key.type = KEY_SCROLL_LEFT;
+            break;
+        } else if (xev.xbutton.button == 7 || (xev.xbutton.button == 5 && shift)) {
+            ev.type     = EVENT_KEY;
+            ev.key.type = KEY_SCROLL_RIGHT;
+            break;
+        } else if (xev.xbutton.button == 4) {
             ev.type     = EVENT_KEY;
             ev.key.type = KEY_SCROLL_UP;
             ev.key.ctrl = (xev.xbutton.state & ControlMask) != 0;
@@ -241,8 +281,8 @@ InputEvent input_poll(Window_State* win)
     }
 
     case ButtonRelease: {
-        // Ignore scroll wheel release (buttons 4/5)
-        if (xev.xbutton.button == 4 || xev.xbutton.button == 5) {
+        // Ignore scroll wheel release (buttons 4-7)
+        if (xev.xbutton.button >= 4 && xev.xbutton.button <= 7) {
             break;
         }
         ev.type          = EVENT_MOUSE;
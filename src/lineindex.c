@@ -0,0 +1,376 @@
+#include "lineindex.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Lengths of the lines that replace an edited range: the first starts at
+// base, the last ends at end, and the ones between begin at starts[].
+typedef struct
+{
+    size_t        base;
+    size_t        end;
+    const size_t* starts;
+    size_t        count; // Yields count + 1 lines
+} LineRun;
+
+static inline size_t run_len(const LineRun* run, size_t i)
+{
+    size_t from = i == 0 ? run->base : run->starts[i - 1];
+    size_t to   = i == run->count ? run->end : run->starts[i];
+    return to - from;
+}
+
+static u32 line_random(LineIndex* li)
+{
+    // xorshift32 - only used for treap priorities
+    u32 x = li->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    li->seed = x;
+    return x;
+}
+
+static inline size_t node_lines(LineNode* n) { return n ? n->subtree_lines : 0; }
+static inline size_t node_bytes(LineNode* n) { return n ? n->subtree_bytes : 0; }
+
+static inline void node_update(LineNode* n)
+{
+    n->subtree_lines = node_lines(n->left) + n->count + node_lines(n->right);
+    n->subtree_bytes = node_bytes(n->left) + n->bytes + node_bytes(n->right);
+}
+
+static void block_sum(LineNode* n)
+{
+    size_t bytes = 0;
+    for (u32 i = 0; i < n->count; i++)
+        bytes += n->lens[i];
+    n->bytes = bytes;
+}
+
+static LineNode* node_new(LineIndex* li, u32 priority)
+{
+    LineNode* n = malloc(sizeof(LineNode));
+    if (!n)
+        return NULL;
+    n->count         = 0;
+    n->priority      = priority;
+    n->bytes         = 0;
+    n->subtree_lines = 0;
+    n->subtree_bytes = 0;
+    n->left          = NULL;
+    n->right         = NULL;
+    li->node_count++;
+    return n;
+}
+
+static void node_free_tree(LineIndex* li, LineNode* n)
+{
+    while (n) {
+        node_free_tree(li, n->left);
+        LineNode* right = n->right;
+        free(n);
+        li->node_count--;
+        n = right;
+    }
+}
+
+static LineNode* line_merge(LineNode* a, LineNode* b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (a->priority > b->priority) {
+        a->right = line_merge(a->right, b);
+        node_update(a);
+        return a;
+    }
+    b->left = line_merge(a, b->left);
+    node_update(b);
+    return b;
+}
+
+// Split n so that *l holds the first k lines and *r the rest.
+// A block straddling k is cut in two. False if there's no memory for the
+// cut: then the split falls at the end of that block instead, so merging
+// *l and *r puts the tree back as it was.
+static bool line_split(LineIndex* li, LineNode* n, size_t k, LineNode** l, LineNode** r)
+{
+    if (!n) {
+        *l = NULL;
+        *r = NULL;
+        return true;
+    }
+
+    bool   ok;
+    size_t left_lines = node_lines(n->left);
+    if (k <= left_lines) {
+        ok = line_split(li, n->left, k, l, &n->left);
+        node_update(n);
+        *r = n;
+    } else if (k >= left_lines + n->count) {
+        ok = line_split(li, n->right, k - left_lines - n->count, &n->right, r);
+        node_update(n);
+        *l = n;
+    } else {
+        // Tail inherits our priority so the heap order below it still holds
+        u32       cut  = (u32)(k - left_lines);
+        LineNode* tail = node_new(li, n->priority);
+        if (!tail) {
+            *l = n;
+            *r = NULL;
+            return false;
+        }
+        tail->count = n->count - cut;
+        memcpy(tail->lens, n->lens + cut, tail->count * sizeof(size_t));
+        tail->right = n->right;
+        n->right    = NULL;
+        n->count    = cut;
+        block_sum(tail);
+        block_sum(n);
+        node_update(tail);
+        node_update(n);
+        *l = n;
+        *r = tail;
+        ok = true;
+    }
+    return ok;
+}
+
+// Pack the run into full blocks. NULL if out of memory.
+static LineNode* run_build(LineIndex* li, const LineRun* run)
+{
+    LineNode* root  = NULL;
+    size_t    total = run->count + 1;
+
+    for (size_t i = 0; i < total;) {
+        LineNode* n = node_new(li, line_random(li));
+        if (!n) {
+            node_free_tree(li, root);
+            return NULL;
+        }
+        while (i < total && n->count < LINE_BLOCK) {
+            n->lens[n->count] = run_len(run, i++);
+            n->bytes += n->lens[n->count++];
+        }
+        node_update(n);
+        root = line_merge(root, n);
+    }
+    return root;
+}
+
+// Fast path: the edit stays inside one block that has room for the result
+static bool block_replace(LineNode* n, size_t line, size_t remove, const LineRun* run)
+{
+    if (!n)
+        return false;
+
+    size_t left_lines = node_lines(n->left);
+    bool   done;
+    if (line < left_lines) {
+        done = block_replace(n->left, line, remove, run);
+    } else if (line - left_lines < n->count) {
+        size_t i   = line - left_lines;
+        size_t add = run->count + 1;
+        if (i + remove > n->count || n->count - remove + add > LINE_BLOCK)
+            return false;
+
+        for (size_t k = 0; k < remove; k++)
+            n->bytes -= n->lens[i + k];
+        memmove(n->lens + i + add, n->lens + i + remove, (n->count - i - remove) * sizeof(size_t));
+        for (size_t k = 0; k < add; k++) {
+            n->lens[i + k] = run_len(run, k);
+            n->bytes += n->lens[i + k];
+        }
+        n->count = (u32)(n->count - remove + add);
+        done     = true;
+    } else {
+        done = block_replace(n->right, line - left_lines - n->count, remove, run);
+    }
+
+    if (done)
+        node_update(n);
+    return done;
+}
+
+// Replace lines [line, line + remove) with the run. False if out of
+// memory, leaving the index as it was.
+static bool line_replace(LineIndex* li, size_t line, size_t remove, const LineRun* run)
+{
+    if (block_replace(li->root, line, remove, run))
+        return true;
+
+    LineNode* built = run_build(li, run);
+    if (!built)
+        return false;
+
+    LineNode *l, *rest, *mid, *r;
+    if (!line_split(li, li->root, line, &l, &rest)) {
+        li->root = line_merge(l, rest);
+        node_free_tree(li, built);
+        return false;
+    }
+    if (!line_split(li, rest, remove, &mid, &r)) {
+        li->root = line_merge(l, line_merge(mid, r));
+        node_free_tree(li, built);
+        return false;
+    }
+    node_free_tree(li, mid);
+    li->root = line_merge(line_merge(l, built), r);
+    return true;
+}
+
+// Line containing pos, with its start and length
+static size_t line_locate(LineIndex* li, size_t pos, size_t* out_start, size_t* out_len)
+{
+    size_t total = node_bytes(li->root);
+    if (pos >= total) {
+        // End of the document is on the last line
+        size_t    line  = node_lines(li->root) - 1;
+        size_t    start = lineindex_offset(li, line);
+        *out_start      = start;
+        *out_len        = total - start;
+        return line;
+    }
+
+    LineNode* n     = li->root;
+    size_t    line  = 0;
+    size_t    start = 0;
+    while (n) {
+        size_t left_bytes = node_bytes(n->left);
+        if (pos < left_bytes) {
+            n = n->left;
+            continue;
+        }
+        pos -= left_bytes;
+        start += left_bytes;
+        line += node_lines(n->left);
+
+        if (pos < n->bytes) {
+            u32 i = 0;
+            while (pos >= n->lens[i]) {
+                pos -= n->lens[i];
+                start += n->lens[i];
+                i++;
+            }
+            *out_start = start;
+            *out_len   = n->lens[i];
+            return line + i;
+        }
+        pos -= n->bytes;
+        start += n->bytes;
+        line += n->count;
+        n = n->right;
+    }
+
+    // Unreachable while subtree sums are consistent
+    *out_start = start;
+    *out_len   = 0;
+    return line;
+}
+
+LineIndex* lineindex_create(void)
+{
+    LineIndex* li = malloc(sizeof(LineIndex));
+    if (!li)
+        return NULL;
+
+    li->root       = NULL;
+    li->node_count = 0;
+    li->seed       = 0x2545f491;
+    lineindex_clear(li);
+    if (!li->root) {
+        free(li);
+        return NULL;
+    }
+    return li;
+}
+
+void lineindex_destroy(LineIndex* li)
+{
+    if (!li)
+        return;
+    node_free_tree(li, li->root);
+    free(li);
+}
+
+void lineindex_clear(LineIndex* li)
+{
+    // The root stays on as the one block, so only the first clear allocates
+    if (!li->root) {
+        li->root = node_new(li, line_random(li));
+        if (!li->root)
+            return;
+    }
+    node_free_tree(li, li->root->left);
+    node_free_tree(li, li->root->right);
+    li->root->left    = NULL;
+    li->root->right   = NULL;
+    li->root->lens[0] = 0;
+    li->root->count   = 1;
+    block_sum(li->root);
+    node_update(li->root);
+}
+
+bool lineindex_insert(LineIndex* li, size_t pos, size_t len, const size_t* starts, size_t count)
+{
+    if (len == 0)
+        return true;
+
+    size_t  start, line_len;
+    size_t  line = line_locate(li, pos, &start, &line_len);
+    LineRun run  = { start, start + line_len + len, starts, count };
+    return line_replace(li, line, 1, &run);
+}
+
+bool lineindex_delete(LineIndex* li, size_t pos, size_t len)
+{
+    if (len == 0)
+        return true;
+
+    // The first and last touched lines merge into one
+    size_t  first_start, first_len, last_start, last_len;
+    size_t  first = line_locate(li, pos, &first_start, &first_len);
+    size_t  last  = line_locate(li, pos + len, &last_start, &last_len);
+    LineRun run   = { first_start, last_start + last_len - len, NULL, 0 };
+    return line_replace(li, first, last - first + 1, &run);
+}
+
+size_t lineindex_count(LineIndex* li) { return node_lines(li->root); }
+
+size_t lineindex_length(LineIndex* li) { return node_bytes(li->root); }
+
+size_t lineindex_offset(LineIndex* li, size_t line)
+{
+    LineNode* n      = li->root;
+    size_t    offset = 0;
+    while (n) {
+        size_t left_lines = node_lines(n->left);
+        if (line < left_lines) {
+            n = n->left;
+            continue;
+        }
+        line -= left_lines;
+        offset += node_bytes(n->left);
+
+        if (line < n->count) {
+            for (size_t i = 0; i < line; i++)
+                offset += n->lens[i];
+            return offset;
+        }
+        line -= n->count;
+        offset += n->bytes;
+        n = n->right;
+    }
+    return offset;
+}
+
+size_t lineindex_line_at(LineIndex* li, size_t pos, size_t* line_start)
+{
+    size_t start, len;
+    size_t line = line_locate(li, pos, &start, &len);
+    if (line_start)
+        *line_start = start;
+    return line;
+}
@@ -0,0 +1,239 @@
+#include "loader.h"
+#include "newline.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Small first chunk so the first screen is ready almost immediately,
+// then large chunks to keep locking overhead negligible
+#define FIRST_CHUNK_SIZE (64 * 1024)
+#define CHUNK_SIZE       (8 * 1024 * 1024)
+
+static LoadChunk* chunk_scan(const char* data, size_t base, size_t len)
+{
+    size_t     capacity = newline_count(data + base, len);
+    LoadChunk* chunk    = malloc(sizeof(LoadChunk) + capacity * sizeof(size_t));
+    if (!chunk)
+        return NULL;
+    chunk->next     = NULL;
+    chunk->capacity = capacity;
+    chunk->count    = newline_collect(data + base, len, base, chunk->starts);
+    chunk->loaded   = base + len;
+    return chunk;
+}
+
+static void loader_publish(Loader* ld, LoadChunk* chunk)
+{
+    pthread_mutex_lock(&ld->lock);
+    if (ld->ready_tail)
+        ld->ready_tail->next = chunk;
+    else
+        ld->ready_head = chunk;
+    ld->ready_tail = chunk;
+    pthread_mutex_unlock(&ld->lock);
+}
+
+static bool loader_cancelled(Loader* ld)
+{
+    pthread_mutex_lock(&ld->lock);
+    bool cancel = ld->cancel;
+    pthread_mutex_unlock(&ld->lock);
+    return cancel;
+}
+
+static void* loader_thread(void* arg)
+{
+    Loader* ld     = arg;
+    size_t  pos    = 0;
+    size_t  step   = FIRST_CHUNK_SIZE;
+    bool    failed = false;
+
+    while (pos < ld->total && !loader_cancelled(ld)) {
+        size_t len = ld->total - pos;
+        if (len > step)
+            len = step;
+        step = CHUNK_SIZE;
+
+        if (!ld->mapped) {
+            size_t got = 0;
+            while (got < len) {
+                ssize_t r = read(ld->fd, ld->dest + pos + got, len - got);
+                if (r <= 0)
+                    break;
+                got += r;
+            }
+            if (got < len) {
+                // File shrank or read error: publish what we have and stop
+                failed = true;
+                len    = got;
+            }
+        }
+
+        LoadChunk* chunk = chunk_scan(ld->dest, pos, len);
+        if (!chunk) {
+            failed = true;
+            break;
+        }
+        loader_publish(ld, chunk);
+        pos += len;
+
+        if (failed)
+            break;
+    }
+
+    pthread_mutex_lock(&ld->lock);
+    ld->failed   = failed;
+    ld->finished = true;
+    pthread_mutex_unlock(&ld->lock);
+    return NULL;
+}
+
+Loader* loader_start(Buffer* buf, const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    Loader* ld = calloc(1, sizeof(Loader));
+    if (!ld) {
+        close(fd);
+        return NULL;
+    }
+    ld->buf    = buf;
+    ld->fd     = fd;
+    ld->total  = (size_t)st.st_size;
+    ld->mapped = buf->storage == STORAGE_PIECE;
+
+    if (ld->mapped) {
+        char* map = NULL;
+        if (ld->total > 0) {
+            map = mmap(NULL, ld->total, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                close(fd);
+                free(ld);
+                return NULL;
+            }
+            madvise(map, ld->total, MADV_SEQUENTIAL);
+            madvise(map, ld->total, MADV_WILLNEED);
+        }
+        piece_set_original_mapped(buf->pieces, map, ld->total, dup(fd));
+        piece_set_original_visible(buf->pieces, 0);
+        ld->dest = map;
+    } else {
+        buf->gap_start = 0;
+        buf->gap_end   = buf->capacity;
+        buffer_reserve(buf, ld->total);
+        if (buf->gap_end - buf->gap_start < ld->total) {
+            close(fd);
+            free(ld);
+            return NULL;
+        }
+        // The worker fills the gap; the UI sees it as the gap shrinks
+        ld->dest = buf->data;
+    }
+
+    buf->cursor   = 0;
+    buf->line     = 0;
+    buf->col      = 0;
+    buf->modified = false;
+    buffer_clear_selection(buf);
+
+    free(buf->filename);
+    buf->filename = strdup(filename);
+
+    buffer_rebuild_line_index(buf);
+    buf->loading    = true;
+    buf->load_total = ld->total;
+
+    pthread_mutex_init(&ld->lock, NULL);
+    if (pthread_create(&ld->thread, NULL, loader_thread, ld) != 0) {
+        pthread_mutex_destroy(&ld->lock);
+        buf->loading = false;
+        close(fd);
+        free(ld);
+        return NULL;
+    }
+    ld->running = true;
+
+    return ld;
+}
+
+static void loader_apply(Loader* ld, LoadChunk* chunk)
+{
+    Buffer* buf = ld->buf;
+    if (ld->mapped)
+        piece_set_original_visible(buf->pieces, chunk->loaded);
+    else
+        buf->gap_start = chunk->loaded;
+
+    buffer_append_line_starts(buf, chunk->starts, chunk->count);
+}
+
+LoadStatus loader_poll(Loader* ld)
+{
+    pthread_mutex_lock(&ld->lock);
+    LoadChunk* chunk = ld->ready_head;
+    bool       done  = ld->finished;
+    ld->ready_head   = NULL;
+    ld->ready_tail   = NULL;
+    pthread_mutex_unlock(&ld->lock);
+
+    while (chunk) {
+        LoadChunk* next = chunk->next;
+        loader_apply(ld, chunk);
+        free(chunk);
+        chunk = next;
+    }
+
+    if (!done)
+        return LOAD_RUNNING;
+
+    // Finished: anything published before the flag has been applied above
+    pthread_join(ld->thread, NULL);
+    ld->running = false;
+
+    Buffer* buf = ld->buf;
+    buf->loading    = false;
+    buf->load_total = buffer_length(buf);
+    if (ld->mapped && ld->total > 0)
+        madvise(ld->dest, ld->total, MADV_NORMAL);
+
+    return ld->failed ? LOAD_FAILED : LOAD_DONE;
+}
+
+void loader_destroy(Loader* ld)
+{
+    if (!ld)
+        return;
+
+    if (ld->running) {
+        pthread_mutex_lock(&ld->lock);
+        ld->cancel = true;
+        pthread_mutex_unlock(&ld->lock);
+        pthread_join(ld->thread, NULL);
+
+        // Keep whatever prefix made it in so the buffer stays consistent
+        LoadChunk* chunk = ld->ready_head;
+        while (chunk) {
+            LoadChunk* next = chunk->next;
+            loader_apply(ld, chunk);
+            free(chunk);
+            chunk = next;
+        }
+        ld->buf->loading    = false;
+        ld->buf->load_total = buffer_length(ld->buf);
+    }
+
+    pthread_mutex_destroy(&ld->lock);
+    close(ld->fd);
+    free(ld);
+}
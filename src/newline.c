@@ -0,0 +1,191 @@
+#include "newline.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NEWLINE_X86 1
+#endif
+
+// ---------------------------------------------------------------- scalar
+
+static size_t count_scalar(const char* p, size_t len)
+{
+    size_t      count = 0;
+    const char* end   = p + len;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+static size_t collect_scalar(const char* p, size_t len, size_t base, size_t* out)
+{
+    size_t      count = 0;
+    const char* start = p;
+    const char* end   = p + len;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        p++;
+        out[count++] = base + (size_t)(p - start);
+    }
+    return count;
+}
+
+#ifdef NEWLINE_X86
+
+// Emit one entry per set bit of a compare mask
+static inline size_t emit_mask(u32 mask, size_t at, size_t* out)
+{
+    size_t count = 0;
+    while (mask) {
+        out[count++] = at + (size_t)__builtin_ctz(mask) + 1;
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+// ------------------------------------------------------------------ SSE2
+
+__attribute__((target("sse2,popcnt"))) static size_t count_sse2(const char* p, size_t len)
+{
+    const __m128i nl    = _mm_set1_epi8('\n');
+    size_t        count = 0;
+    size_t        i     = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        u32 m0 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), nl));
+        u32 m1 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 16)), nl));
+        u32 m2 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 32)), nl));
+        u32 m3 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 48)), nl));
+        count += __builtin_popcountll((u64)m0 | (u64)m1 << 16 | (u64)m2 << 32 | (u64)m3 << 48);
+    }
+    for (; i + 16 <= len; i += 16) {
+        u32 m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), nl));
+        count += __builtin_popcount(m);
+    }
+    return count + count_scalar(p + i, len - i);
+}
+
+__attribute__((target("sse2"))) static size_t collect_sse2(const char* p, size_t len, size_t base,
+    size_t* out)
+{
+    const __m128i nl    = _mm_set1_epi8('\n');
+    size_t        count = 0;
+    size_t        i     = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        u32 m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), nl));
+        if (m)
+            count += emit_mask(m, base + i, out + count);
+    }
+    return count + collect_scalar(p + i, len - i, base + i, out + count);
+}
+
+// ------------------------------------------------------------------ AVX2
+
+__attribute__((target("avx2,popcnt"))) static size_t count_avx2(const char* p, size_t len)
+{
+    const __m256i nl    = _mm256_set1_epi8('\n');
+    size_t        count = 0;
+    size_t        i     = 0;
+
+    for (; i + 128 <= len; i += 128) {
+        __m256i a  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), nl);
+        __m256i b  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 32)), nl);
+        __m256i c  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 64)), nl);
+        __m256i d  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 96)), nl);
+        u64     ab = (u32)_mm256_movemask_epi8(a) | (u64)(u32)_mm256_movemask_epi8(b) << 32;
+        u64     cd = (u32)_mm256_movemask_epi8(c) | (u64)(u32)_mm256_movemask_epi8(d) << 32;
+        count += __builtin_popcountll(ab) + __builtin_popcountll(cd);
+    }
+    for (; i + 32 <= len; i += 32) {
+        u32 m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), nl));
+        count += __builtin_popcount(m);
+    }
+    return count + count_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t collect_avx2(const char* p, size_t len, size_t base,
+    size_t* out)
+{
+    const __m256i nl    = _mm256_set1_epi8('\n');
+    size_t        count = 0;
+    size_t        i     = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        u32 m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), nl));
+        if (m)
+            count += emit_mask(m, base + i, out + count);
+    }
+    return count + collect_scalar(p + i, len - i, base + i, out + count);
+}
+
+#endif // NEWLINE_X86
+
+// -------------------------------------------------------------- dispatch
+
+typedef struct
+{
+    NewlineKernel kind;
+    size_t (*count)(const char*, size_t);
+    size_t (*collect)(const char*, size_t, size_t, size_t*);
+} NewlineKernels;
+
+static const NewlineKernels kernel_table[] = {
+    { NEWLINE_SCALAR, count_scalar, collect_scalar },
+#ifdef NEWLINE_X86
+    { NEWLINE_SSE2, count_sse2, collect_sse2 },
+    { NEWLINE_AVX2, count_avx2, collect_avx2 },
+#endif
+};
+
+static const NewlineKernels* kernels = &kernel_table[0];
+
+static bool kernel_supported(NewlineKernel kernel)
+{
+    switch (kernel) {
+    case NEWLINE_SCALAR:
+        return true;
+#ifdef NEWLINE_X86
+    case NEWLINE_SSE2:
+        return __builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt");
+    case NEWLINE_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool newline_use_kernel(NewlineKernel kernel)
+{
+    if (!kernel_supported(kernel))
+        return false;
+
+    for (size_t i = 0; i < sizeof(kernel_table) / sizeof(kernel_table[0]); i++) {
+        if (kernel_table[i].kind == kernel) {
+            kernels = &kernel_table[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+NewlineKernel newline_active_kernel(void) { return kernels->kind; }
+
+// Pick the kernel before main() so worker threads never race the choice
+__attribute__((constructor)) static void newline_select_kernel(void)
+{
+#ifdef NEWLINE_X86
+    __builtin_cpu_init();
+#endif
+    if (!newline_use_kernel(NEWLINE_AVX2))
+        newline_use_kernel(NEWLINE_SSE2);
+}
+
+size_t newline_count(const char* p, size_t len) { return kernels->count(p, len); }
+
+size_t newline_collect(const char* p, size_t len, size_t base, size_t* out)
+{
+    return kernels->collect(p, len, base, out);
+}
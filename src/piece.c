@@ -0,0 +1,475 @@
+#include "piece.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ADD_CHUNK_SIZE (1024 * 1024)
+
+static u32 piece_random(PieceTable* pt)
+{
+    // xorshift32 - only used for treap priorities
+    u32 x = pt->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pt->seed = x;
+    return x;
+}
+
+static inline size_t node_len(PieceNode* n) { return n ? n->subtree_len : 0; }
+
+static inline void node_update(PieceNode* n)
+{
+    n->subtree_len = node_len(n->left) + n->len + node_len(n->right);
+}
+
+static PieceNode* node_new(PieceTable* pt, const char* text, size_t len, u32 priority)
+{
+    PieceNode* n = pt->spare;
+    if (n) {
+        pt->spare = n->right;
+        pt->spare_count--;
+    } else {
+        n = malloc(sizeof(PieceNode));
+        if (!n)
+            return NULL;
+    }
+    n->text        = text;
+    n->len         = len;
+    n->subtree_len = len;
+    n->priority    = priority;
+    n->left        = NULL;
+    n->right       = NULL;
+    pt->piece_count++;
+    return n;
+}
+
+static void node_free_tree(PieceTable* pt, PieceNode* n)
+{
+    while (n) {
+        node_free_tree(pt, n->left);
+        PieceNode* right = n->right;
+        free(n);
+        pt->piece_count--;
+        n = right;
+    }
+}
+
+static PieceNode* piece_merge(PieceNode* a, PieceNode* b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (a->priority > b->priority) {
+        a->right = piece_merge(a->right, b);
+        node_update(a);
+        return a;
+    }
+    b->left = piece_merge(a, b->left);
+    node_update(b);
+    return b;
+}
+
+// Split n so that *l holds the first pos bytes and *r the rest.
+// A piece straddling pos is cut in two. False if there's no memory for the
+// cut: then the split falls at the end of that piece instead, so merging
+// *l and *r puts the tree back as it was.
+static bool piece_split(PieceTable* pt, PieceNode* n, size_t pos, PieceNode** l, PieceNode** r)
+{
+    if (!n) {
+        *l = NULL;
+        *r = NULL;
+        return true;
+    }
+
+    bool   ok;
+    size_t left_len = node_len(n->left);
+    if (pos <= left_len) {
+        ok = piece_split(pt, n->left, pos, l, &n->left);
+        node_update(n);
+        *r = n;
+    } else if (pos >= left_len + n->len) {
+        ok = piece_split(pt, n->right, pos - left_len - n->len, &n->right, r);
+        node_update(n);
+        *l = n;
+    } else {
+        // Tail inherits our priority so the heap order below it still holds
+        size_t     cut  = pos - left_len;
+        PieceNode* tail = node_new(pt, n->text + cut, n->len - cut, n->priority);
+        if (!tail) {
+            *l = n;
+            *r = NULL;
+            return false;
+        }
+        tail->right = n->right;
+        n->right    = NULL;
+        n->len      = cut;
+        node_update(tail);
+        node_update(n);
+        *l = n;
+        *r = tail;
+        ok = true;
+    }
+    return ok;
+}
+
+PieceTable* piece_create(void)
+{
+    PieceTable* pt = malloc(sizeof(PieceTable));
+    if (!pt)
+        return NULL;
+
+    pt->original        = NULL;
+    pt->original_len    = 0;
+    pt->original_owned  = false;
+    pt->original_mapped = false;
+    pt->original_fd     = -1;
+    pt->add             = NULL;
+    pt->root            = NULL;
+    pt->piece_count     = 0;
+    pt->seed            = 0x9e3779b9;
+    pt->spare           = NULL;
+    pt->spare_count     = 0;
+    pt->cache_node      = NULL;
+    pt->cache_start     = 0;
+
+    return pt;
+}
+
+static void piece_release_original(PieceTable* pt)
+{
+    if (pt->original_mapped)
+        munmap((void*)pt->original, pt->original_len);
+    else if (pt->original_owned)
+        free((char*)pt->original);
+    if (pt->original_fd >= 0)
+        close(pt->original_fd);
+
+    pt->original        = NULL;
+    pt->original_len    = 0;
+    pt->original_owned  = false;
+    pt->original_mapped = false;
+    pt->original_fd     = -1;
+}
+
+void piece_destroy(PieceTable* pt)
+{
+    if (!pt)
+        return;
+
+    node_free_tree(pt, pt->root);
+    while (pt->spare) {
+        PieceNode* next = pt->spare->right;
+        free(pt->spare);
+        pt->spare = next;
+    }
+
+    AddChunk* chunk = pt->add;
+    while (chunk) {
+        AddChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    piece_release_original(pt);
+    free(pt);
+}
+
+void piece_set_original(PieceTable* pt, const char* data, size_t len, bool owned)
+{
+    node_free_tree(pt, pt->root);
+    pt->root       = NULL;
+    pt->cache_node = NULL;
+
+    piece_release_original(pt);
+
+    pt->original       = data;
+    pt->original_len   = len;
+    pt->original_owned = owned;
+
+    if (len > 0)
+        pt->root = node_new(pt, data, len, piece_random(pt));
+}
+
+void piece_set_original_mapped(PieceTable* pt, const char* data, size_t len, int fd)
+{
+    piece_set_original(pt, data, len, false);
+    pt->original_mapped = true;
+    pt->original_fd     = fd;
+}
+
+void piece_set_original_visible(PieceTable* pt, size_t len)
+{
+    if (!pt->root)
+        return;
+    if (len > pt->original_len)
+        len = pt->original_len;
+
+    pt->root->len         = len;
+    pt->root->subtree_len = len;
+    pt->cache_node        = NULL;
+}
+
+// A chunk with room for len more bytes at the front of the add buffer
+static AddChunk* add_room(PieceTable* pt, size_t len)
+{
+    AddChunk* chunk = pt->add;
+    if (!chunk || chunk->capacity - chunk->used < len) {
+        size_t capacity = len > ADD_CHUNK_SIZE ? len : ADD_CHUNK_SIZE;
+        chunk           = malloc(sizeof(AddChunk) + capacity);
+        if (!chunk)
+            return NULL;
+        chunk->next     = pt->add;
+        chunk->used     = 0;
+        chunk->capacity = capacity;
+        pt->add         = chunk;
+    }
+    return chunk;
+}
+
+bool piece_reserve(PieceTable* pt, size_t nodes, size_t bytes)
+{
+    if (bytes > 0 && !add_room(pt, bytes))
+        return false;
+    while (pt->spare_count < nodes) {
+        PieceNode* n = malloc(sizeof(PieceNode));
+        if (!n)
+            return false; // Those made so far stay spare
+        n->right  = pt->spare;
+        pt->spare = n;
+        pt->spare_count++;
+    }
+    return true;
+}
+
+char* piece_add_reserve(PieceTable* pt, size_t len)
+{
+    AddChunk* chunk = add_room(pt, len);
+    if (!chunk)
+        return NULL;
+
+    char* dest = chunk->data + chunk->used;
+    chunk->used += len;
+    return dest;
+}
+
+// Append text to the add buffer, returning where it was stored
+static const char* add_append(PieceTable* pt, const char* text, size_t len)
+{
+    char* dest = piece_add_reserve(pt, len);
+    if (dest)
+        memcpy(dest, text, len);
+    return dest;
+}
+
+// Cartesian tree over the spans with random priorities: each new piece
+// takes over the part of the right spine it outranks as its left child.
+// A node leaves the spine only once its subtree is final, so that's when
+// its length is summed.
+bool piece_set_spans(PieceTable* pt, const PieceSpan* spans, size_t count)
+{
+    PieceNode** spine = malloc((count + 1) * sizeof(PieceNode*));
+    if (!spine)
+        return false;
+
+    size_t depth = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (spans[i].len == 0)
+            continue;
+        PieceNode* n = node_new(pt, spans[i].text, spans[i].len, piece_random(pt));
+        if (!n) {
+            if (depth > 0)
+                node_free_tree(pt, spine[0]); // Everything built hangs off it
+            free(spine);
+            return false;
+        }
+        PieceNode* last = NULL;
+        while (depth > 0 && spine[depth - 1]->priority < n->priority) {
+            last = spine[--depth];
+            node_update(last);
+        }
+        n->left = last;
+        if (depth > 0)
+            spine[depth - 1]->right = n;
+        spine[depth++] = n;
+    }
+    PieceNode* root = depth > 0 ? spine[0] : NULL;
+    while (depth > 0)
+        node_update(spine[--depth]);
+    free(spine);
+
+    node_free_tree(pt, pt->root);
+    pt->root       = root;
+    pt->cache_node = NULL;
+    return true;
+}
+
+// Find the piece containing pos, and the document offset it starts at
+static PieceNode* piece_find(PieceTable* pt, size_t pos, size_t* out_start)
+{
+    PieceNode* c = pt->cache_node;
+    if (c && pos >= pt->cache_start && pos < pt->cache_start + c->len) {
+        *out_start = pt->cache_start;
+        return c;
+    }
+
+    PieceNode* n    = pt->root;
+    size_t     base = 0;
+    while (n) {
+        size_t left_len = node_len(n->left);
+        if (pos < base + left_len) {
+            n = n->left;
+        } else if (pos < base + left_len + n->len) {
+            base += left_len;
+            pt->cache_node  = n;
+            pt->cache_start = base;
+            *out_start      = base;
+            return n;
+        } else {
+            base += left_len + n->len;
+            n = n->right;
+        }
+    }
+    return NULL;
+}
+
+// Typing fast path: if the piece ending at pos is directly followed in the
+// add buffer by the new text, grow that piece instead of adding a new one.
+static bool piece_try_extend(PieceTable* pt, size_t pos, const char* stored, size_t len)
+{
+    size_t     start;
+    PieceNode* prev = piece_find(pt, pos - 1, &start);
+    if (!prev || start + prev->len != pos || prev->text + prev->len != stored)
+        return false;
+
+    PieceNode* n    = pt->root;
+    size_t     base = 0;
+    while (n) {
+        n->subtree_len += len;
+        if (n == prev)
+            break;
+        size_t left_len = node_len(n->left);
+        if (pos - 1 < base + left_len) {
+            n = n->left;
+        } else {
+            base += left_len + n->len;
+            n = n->right;
+        }
+    }
+    prev->len += len;
+    return true;
+}
+
+bool piece_insert(PieceTable* pt, size_t pos, const char* text, size_t len)
+{
+    if (len == 0)
+        return true;
+
+    size_t total = piece_length(pt);
+    if (pos > total)
+        pos = total;
+
+    const char* stored = add_append(pt, text, len);
+    if (!stored)
+        return false;
+
+    if (pos > 0 && piece_try_extend(pt, pos, stored, len))
+        return true;
+
+    pt->cache_node = NULL;
+
+    PieceNode* node = node_new(pt, stored, len, piece_random(pt));
+    if (!node)
+        return false;
+
+    PieceNode *l, *r;
+    if (!piece_split(pt, pt->root, pos, &l, &r)) {
+        pt->root = piece_merge(l, r);
+        node_free_tree(pt, node);
+        return false;
+    }
+    pt->root = piece_merge(piece_merge(l, node), r);
+    return true;
+}
+
+bool piece_delete(PieceTable* pt, size_t pos, size_t len)
+{
+    size_t total = piece_length(pt);
+    if (pos >= total || len == 0)
+        return true;
+    if (len > total - pos)
+        len = total - pos;
+
+    pt->cache_node = NULL;
+
+    PieceNode *l, *m, *r;
+    if (!piece_split(pt, pt->root, pos, &l, &m)) {
+        pt->root = piece_merge(l, m);
+        return false;
+    }
+    if (!piece_split(pt, m, len, &m, &r)) {
+        pt->root = piece_merge(l, piece_merge(m, r));
+        return false;
+    }
+    node_free_tree(pt, m);
+    pt->root = piece_merge(l, r);
+    return true;
+}
+
+size_t piece_length(PieceTable* pt) { return node_len(pt->root); }
+
+char piece_char_at(PieceTable* pt, size_t pos)
+{
+    size_t     start;
+    PieceNode* n = piece_find(pt, pos, &start);
+    return n ? n->text[pos - start] : '\0';
+}
+
+const char* piece_span_at(PieceTable* pt, size_t pos, size_t* out_len)
+{
+    size_t     start;
+    PieceNode* n = piece_find(pt, pos, &start);
+    if (!n) {
+        *out_len = 0;
+        return NULL;
+    }
+    *out_len = n->len - (pos - start);
+    return n->text + (pos - start);
+}
+
+const char* piece_span_before(PieceTable* pt, size_t pos, size_t* out_len)
+{
+    size_t     start;
+    PieceNode* n = pos > 0 ? piece_find(pt, pos - 1, &start) : NULL;
+    if (!n) {
+        *out_len = 0;
+        return NULL;
+    }
+    *out_len = pos - start;
+    return n->text;
+}
+
+size_t piece_extract(PieceTable* pt, size_t start, size_t len, char* dest)
+{
+    size_t total = piece_length(pt);
+    if (start >= total)
+        return 0;
+    if (len > total - start)
+        len = total - start;
+
+    size_t done = 0;
+    while (done < len) {
+        size_t      span_len;
+        const char* span = piece_span_at(pt, start + done, &span_len);
+        if (!span)
+            break;
+        if (span_len > len - done)
+            span_len = len - done;
+        memcpy(dest + done, span, span_len);
+        done += span_len;
+    }
+    return done;
+}
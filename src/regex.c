@@ -0,0 +1,986 @@
+#include "regex.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Patterns come from a one-line prompt; these only stop pathological input
+#define REGEX_MAX_NODES 4096
+#define REGEX_MAX_INSTS (3 * REGEX_MAX_NODES + 1)
+#define REGEX_MAX_PREFIX 64
+
+// The DFA cache is dropped and rebuilt from the current state when it
+// reaches this many states, which bounds memory for any pattern
+#define DFA_MAX_STATES 4096
+#define DFA_UNKNOWN    UINT32_MAX
+#define DFA_SPECIAL    (1u << 31) // In a transition: the next state has a flag in Dfa.special
+
+// ---------------------------------------------------------------- parsing
+
+typedef struct
+{
+    u8 bits[32];
+} ByteSet;
+
+static inline bool set_has(const ByteSet* set, u8 c) { return set->bits[c >> 3] & (1u << (c & 7)); }
+static inline void set_add(ByteSet* set, u8 c) { set->bits[c >> 3] |= (u8)(1u << (c & 7)); }
+
+static void set_add_range(ByteSet* set, u8 lo, u8 hi)
+{
+    for (int c = lo; c <= hi; c++)
+        set_add(set, (u8)c);
+}
+
+static void set_invert(ByteSet* set)
+{
+    for (int i = 0; i < 32; i++)
+        set->bits[i] = (u8)~set->bits[i];
+}
+
+static void set_union(ByteSet* set, const ByteSet* other)
+{
+    for (int i = 0; i < 32; i++)
+        set->bits[i] |= other->bits[i];
+}
+
+typedef enum {
+    NODE_EMPTY,
+    NODE_CLASS, // One byte from sets[set]
+    NODE_CAT,
+    NODE_ALT,
+    NODE_STAR,
+    NODE_PLUS,
+    NODE_QUEST,
+    NODE_BOL,
+    NODE_EOL,
+} NodeType;
+
+typedef struct
+{
+    u8   type;
+    bool greedy;
+    int  left;
+    int  right;
+    int  set;
+} Node;
+
+typedef struct
+{
+    const char* p;
+    const char* end;
+    u32         flags;
+    Node*       nodes;
+    int         node_count;
+    ByteSet*    sets;
+    int         set_count;
+    const char* error;
+} Parser;
+
+static int node_new(Parser* ps, u8 type, int left, int right)
+{
+    if (ps->node_count == REGEX_MAX_NODES) {
+        ps->error = "pattern too long";
+        return -1;
+    }
+    Node* n   = &ps->nodes[ps->node_count];
+    n->type   = type;
+    n->greedy = true;
+    n->left   = left;
+    n->right  = right;
+    n->set    = -1;
+    return ps->node_count++;
+}
+
+// Case is folded before a negated class is inverted, so [^a] leaves out
+// "A" as well
+static int class_new(Parser* ps, ByteSet set, bool negate)
+{
+    if (ps->flags & SEARCH_IGNORE_CASE) {
+        for (int c = 'a'; c <= 'z'; c++) {
+            if (set_has(&set, (u8)c) || set_has(&set, (u8)(c - 32))) {
+                set_add(&set, (u8)c);
+                set_add(&set, (u8)(c - 32));
+            }
+        }
+    }
+    if (negate)
+        set_invert(&set);
+    int n = node_new(ps, NODE_CLASS, -1, -1);
+    if (n < 0)
+        return -1;
+    ps->sets[ps->set_count] = set;
+    ps->nodes[n].set        = ps->set_count++;
+    return n;
+}
+
+static void class_word(ByteSet* set)
+{
+    set_add_range(set, 'a', 'z');
+    set_add_range(set, 'A', 'Z');
+    set_add_range(set, '0', '9');
+    set_add(set, '_');
+}
+
+// After a backslash: the bytes the escape stands for
+static bool parse_escape(Parser* ps, ByteSet* set)
+{
+    if (ps->p == ps->end) {
+        ps->error = "trailing backslash";
+        return false;
+    }
+    char    c     = *ps->p++;
+    ByteSet class = { { 0 } };
+    switch (c) {
+    case 'd':
+    case 'D':
+        set_add_range(&class, '0', '9');
+        break;
+    case 'w':
+    case 'W':
+        class_word(&class);
+        break;
+    case 's':
+    case 'S':
+        set_add_range(&class, '\t', '\r');
+        set_add(&class, ' ');
+        break;
+    case 'n':
+        set_add(&class, '\n');
+        break;
+    case 't':
+        set_add(&class, '\t');
+        break;
+    case 'r':
+        set_add(&class, '\r');
+        break;
+    default:
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+            ps->error = "unknown escape";
+            return false;
+        }
+        set_add(&class, (u8)c);
+        break;
+    }
+    if (c == 'D' || c == 'W' || c == 'S')
+        set_invert(&class);
+    set_union(set, &class);
+    return true;
+}
+
+// After '['
+static int parse_class(Parser* ps)
+{
+    ByteSet set    = { { 0 } };
+    bool    negate = ps->p < ps->end && *ps->p == '^';
+    if (negate)
+        ps->p++;
+
+    bool first = true;
+    for (;;) {
+        if (ps->p == ps->end) {
+            ps->error = "missing ]";
+            return -1;
+        }
+        u8 c = (u8)*ps->p++;
+        if (c == ']' && !first)
+            break;
+        first = false;
+
+        if (c == '\\') {
+            const char* at = ps->p;
+            if (!parse_escape(ps, &set))
+                return -1;
+            if (ps->p - at != 1 || strchr("dDwWsS", *at))
+                continue;
+            c = (u8)(*at == 'n' ? '\n' : *at == 't' ? '\t' : *at == 'r' ? '\r' : *at);
+        }
+        if (ps->end - ps->p >= 2 && ps->p[0] == '-' && ps->p[1] != ']') {
+            u8 hi = (u8)ps->p[1];
+            ps->p += 2;
+            if (hi < c) {
+                ps->error = "bad range";
+                return -1;
+            }
+            set_add_range(&set, c, hi);
+        } else {
+            set_add(&set, c);
+        }
+    }
+    return class_new(ps, set, negate);
+}
+
+static int parse_alt(Parser* ps);
+
+static int parse_atom(Parser* ps)
+{
+    char    c   = *ps->p++;
+    ByteSet set = { { 0 } };
+    switch (c) {
+    case '(': {
+        if (ps->end - ps->p >= 2 && ps->p[0] == '?' && ps->p[1] == ':')
+            ps->p += 2;
+        int inner = parse_alt(ps);
+        if (inner < 0)
+            return -1;
+        if (ps->p == ps->end || *ps->p != ')') {
+            ps->error = "missing )";
+            return -1;
+        }
+        ps->p++;
+        return inner;
+    }
+    case '[':
+        return parse_class(ps);
+    case '.':
+        set_invert(&set);
+        set.bits['\n' >> 3] &= (u8) ~(1u << ('\n' & 7));
+        return class_new(ps, set, false);
+    case '^':
+        return node_new(ps, NODE_BOL, -1, -1);
+    case '$':
+        return node_new(ps, NODE_EOL, -1, -1);
+    case '\\':
+        if (!parse_escape(ps, &set))
+            return -1;
+        return class_new(ps, set, false);
+    case '*':
+    case '+':
+    case '?':
+        ps->error = "nothing to repeat";
+        return -1;
+    default:
+        set_add(&set, (u8)c);
+        return class_new(ps, set, false);
+    }
+}
+
+static int parse_repeat(Parser* ps)
+{
+    int n = parse_atom(ps);
+    while (n >= 0 && ps->p < ps->end && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?')) {
+        char op = *ps->p++;
+        n       = node_new(ps, op == '*' ? NODE_STAR : op == '+' ? NODE_PLUS : NODE_QUEST, n, -1);
+        if (n >= 0 && ps->p < ps->end && *ps->p == '?') {
+            ps->nodes[n].greedy = false;
+            ps->p++;
+        }
+    }
+    return n;
+}
+
+static int parse_concat(Parser* ps)
+{
+    int left = -1;
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        int right = parse_repeat(ps);
+        if (right < 0)
+            return -1;
+        left = left < 0 ? right : node_new(ps, NODE_CAT, left, right);
+        if (left < 0)
+            return -1;
+    }
+    return left < 0 ? node_new(ps, NODE_EMPTY, -1, -1) : left;
+}
+
+static int parse_alt(Parser* ps)
+{
+    int left = parse_concat(ps);
+    while (left >= 0 && ps->p < ps->end && *ps->p == '|') {
+        ps->p++;
+        int right = parse_concat(ps);
+        if (right < 0)
+            return -1;
+        left = node_new(ps, NODE_ALT, left, right);
+    }
+    return left;
+}
+
+// ---------------------------------------------------------------- program
+
+typedef enum {
+    OP_CLASS,     // Consume a byte in sets[set], continue at pc + 1
+    OP_MATCH,
+    OP_JMP,       // Continue at x
+    OP_SPLIT,     // Continue at x, then (lower priority) at y
+    OP_LOOK_PREV, // Continue if the byte last scanned was '\n', or none was
+    OP_LOOK_NEXT, // Continue if the byte about to be scanned is '\n', or none is
+} OpCode;
+
+typedef struct
+{
+    u8  op;
+    int x;
+    int y;
+    int set;
+} Inst;
+
+typedef struct
+{
+    Inst* insts;
+    int   count;
+} Program;
+
+static int emit(Program* prog, u8 op)
+{
+    Inst* in = &prog->insts[prog->count];
+    in->op   = op;
+    in->x    = 0;
+    in->y    = 0;
+    in->set  = -1;
+    return prog->count++;
+}
+
+// Thompson construction. Reversed, concatenations run backward and the
+// anchors trade places, which gives the program for the reversed text.
+static void compile_node(const Parser* ps, Program* prog, int n, bool reverse)
+{
+    const Node* node = &ps->nodes[n];
+    int         split;
+    switch (node->type) {
+    case NODE_EMPTY:
+        break;
+    case NODE_CLASS:
+        prog->insts[emit(prog, OP_CLASS)].set = node->set;
+        break;
+    case NODE_CAT:
+        compile_node(ps, prog, reverse ? node->right : node->left, reverse);
+        compile_node(ps, prog, reverse ? node->left : node->right, reverse);
+        break;
+    case NODE_ALT: {
+        split                  = emit(prog, OP_SPLIT);
+        prog->insts[split].x   = split + 1;
+        compile_node(ps, prog, node->left, reverse);
+        int jmp                = emit(prog, OP_JMP);
+        prog->insts[split].y   = prog->count;
+        compile_node(ps, prog, node->right, reverse);
+        prog->insts[jmp].x     = prog->count;
+        break;
+    }
+    case NODE_STAR:
+    case NODE_QUEST: {
+        split = emit(prog, OP_SPLIT);
+        compile_node(ps, prog, node->left, reverse);
+        if (node->type == NODE_STAR)
+            prog->insts[emit(prog, OP_JMP)].x = split;
+        int body              = split + 1;
+        int out               = prog->count;
+        prog->insts[split].x  = node->greedy ? body : out;
+        prog->insts[split].y  = node->greedy ? out : body;
+        break;
+    }
+    case NODE_PLUS: {
+        int body             = prog->count;
+        compile_node(ps, prog, node->left, reverse);
+        split                = emit(prog, OP_SPLIT);
+        prog->insts[split].x = node->greedy ? body : split + 1;
+        prog->insts[split].y = node->greedy ? split + 1 : body;
+        break;
+    }
+    case NODE_BOL:
+        emit(prog, reverse ? OP_LOOK_NEXT : OP_LOOK_PREV);
+        break;
+    case NODE_EOL:
+        emit(prog, reverse ? OP_LOOK_PREV : OP_LOOK_NEXT);
+        break;
+    }
+}
+
+// -------------------------------------------------------------------- DFA
+
+// A DFA state is an ordered list of program positions: the threads still
+// alive, highest priority first, each stopped at a byte test, a match or
+// an unresolved $. Its transitions are computed the first time each byte
+// class is seen. A state's match flag means a match ended just before the
+// byte that led to it, which is when a trailing $ can be decided.
+enum {
+    DFA_PREV_NL  = 1 << 0, // Byte leading here was '\n'
+    DFA_MATCH    = 1 << 1,
+    DFA_NO_START = 1 << 2, // No new threads are started at later positions
+    DFA_DEAD     = 1 << 3, // No threads left and none to start
+    DFA_START    = 1 << 4, // A start state; not part of the state's identity
+};
+
+typedef struct
+{
+    const Inst*    insts;
+    int            inst_count;
+    const ByteSet* sets;
+    bool           unanchored; // A thread starts at every position until a match
+    bool           longest;    // Keep going after a match (else leftmost-first)
+    u8             special;    // Flags the scan loops must stop for
+
+    u8  classes[256]; // Byte -> class; bytes no instruction tells apart share one
+    u8  class_rep[257];
+    int stride;       // Classes + 1, the last for end of text
+
+    u32*   trans; // state * stride + class -> next state * stride | DFA_SPECIAL, or DFA_UNKNOWN
+    u8*    flags;
+    u32*   list_start;
+    u32*   list_len;
+    u32    state_count;
+    u32    state_capacity;
+    u32*   pool; // State lists, back to back
+    size_t pool_len;
+    size_t pool_capacity;
+    u32*   table; // Open-addressed hash of states, holding id + 1
+    u32    table_size;
+    u32    start[2]; // By DFA_PREV_NL
+
+    // Scratch, inst_count entries each
+    u32* mark;
+    u32  mark_gen;
+    u32* list_a;
+    u32* list_b;
+} Dfa;
+
+// Splits bytes into classes that every byte test treats alike; '\n' always
+// gets its own since the anchors look at it
+static void dfa_classes(Dfa* d)
+{
+    int count = 1;
+    memset(d->classes, 0, sizeof(d->classes));
+    for (int i = -1; i < d->inst_count; i++) {
+        ByteSet newline = { { 0 } };
+        set_add(&newline, '\n');
+        const ByteSet* set;
+        if (i < 0)
+            set = &newline;
+        else if (d->insts[i].op == OP_CLASS)
+            set = &d->sets[d->insts[i].set];
+        else
+            continue;
+
+        int remap[256][2];
+        memset(remap, -1, sizeof(remap));
+        int next = 0;
+        for (int c = 0; c < 256; c++) {
+            int* slot = &remap[d->classes[c]][set_has(set, (u8)c)];
+            if (*slot < 0)
+                *slot = next++;
+            d->classes[c] = (u8)*slot;
+        }
+        count = next;
+    }
+    for (int c = 255; c >= 0; c--)
+        d->class_rep[d->classes[c]] = (u8)c;
+    d->stride = count + 1;
+}
+
+static u32 list_hash(u8 flags, const u32* list, u32 len)
+{
+    u32 h = 2166136261u ^ flags;
+    for (u32 i = 0; i < len; i++)
+        h = (h ^ list[i]) * 16777619u;
+    return h;
+}
+
+static void dfa_reset(Dfa* d)
+{
+    d->state_count = 0;
+    d->pool_len    = 0;
+    memset(d->table, 0, d->table_size * sizeof(u32));
+}
+
+// Id of the state with this list and flags, adding it if new; DFA_UNKNOWN
+// if out of memory. Adding to a full cache empties it first.
+static u32 dfa_state(Dfa* d, u8 flags, const u32* list, u32 len)
+{
+    if (len == 0 && (flags & DFA_NO_START))
+        flags |= DFA_DEAD;
+
+    u32 mask = d->table_size - 1;
+    u32 h    = list_hash(flags, list, len) & mask;
+    for (;; h = (h + 1) & mask) {
+        u32 id = d->table[h];
+        if (id == 0)
+            break;
+        id--;
+        if ((d->flags[id] & ~DFA_START) == flags && d->list_len[id] == len
+            && memcmp(d->pool + d->list_start[id], list, len * sizeof(u32)) == 0)
+            return id;
+    }
+
+    if (d->state_count == DFA_MAX_STATES) {
+        dfa_reset(d);
+        d->start[0] = d->start[1] = DFA_UNKNOWN; // Rebuilt on the next search
+        return dfa_state(d, flags, list, len);
+    }
+    if (d->pool_len + len > d->pool_capacity) {
+        size_t capacity = d->pool_capacity * 2 + len;
+        u32*   pool     = realloc(d->pool, capacity * sizeof(u32));
+        if (!pool)
+            return DFA_UNKNOWN;
+        d->pool          = pool;
+        d->pool_capacity = capacity;
+    }
+    if (d->state_count == d->state_capacity) {
+        u32  capacity = d->state_capacity * 2;
+        u32* trans    = realloc(d->trans, (size_t)capacity * d->stride * sizeof(u32));
+        if (!trans)
+            return DFA_UNKNOWN;
+        d->trans      = trans;
+        u8*  fl       = realloc(d->flags, capacity);
+        u32* start    = realloc(d->list_start, capacity * sizeof(u32));
+        u32* lens     = start ? realloc(d->list_len, capacity * sizeof(u32)) : NULL;
+        if (fl)
+            d->flags = fl;
+        if (start)
+            d->list_start = start;
+        if (lens)
+            d->list_len = lens;
+        if (!fl || !start || !lens)
+            return DFA_UNKNOWN;
+        d->state_capacity = capacity;
+    }
+
+    u32 id = d->state_count++;
+    memcpy(d->pool + d->pool_len, list, len * sizeof(u32));
+    d->list_start[id] = (u32)d->pool_len;
+    d->list_len[id]   = len;
+    d->flags[id]      = flags;
+    d->pool_len += len;
+    for (int c = 0; c < d->stride; c++)
+        d->trans[(size_t)id * d->stride + c] = DFA_UNKNOWN;
+    d->table[h] = id + 1;
+    return id;
+}
+
+// Follows jumps, splits and decidable assertions from pc, appending the
+// positions reached to out in priority order. next_nl is -1 while the next
+// byte is unknown.
+static void dfa_closure(Dfa* d, int pc, bool prev_nl, int next_nl, u32* out, u32* n)
+{
+    if (d->mark[pc] == d->mark_gen)
+        return;
+    d->mark[pc]    = d->mark_gen;
+    const Inst* in = &d->insts[pc];
+    switch (in->op) {
+    case OP_JMP:
+        dfa_closure(d, in->x, prev_nl, next_nl, out, n);
+        break;
+    case OP_SPLIT:
+        dfa_closure(d, in->x, prev_nl, next_nl, out, n);
+        dfa_closure(d, in->y, prev_nl, next_nl, out, n);
+        break;
+    case OP_LOOK_PREV:
+        if (prev_nl)
+            dfa_closure(d, pc + 1, prev_nl, next_nl, out, n);
+        break;
+    case OP_LOOK_NEXT:
+        if (next_nl < 0)
+            out[(*n)++] = (u32)pc;
+        else if (next_nl)
+            dfa_closure(d, pc + 1, prev_nl, next_nl, out, n);
+        break;
+    default:
+        out[(*n)++] = (u32)pc;
+        break;
+    }
+}
+
+static u32 dfa_start(Dfa* d, bool prev_nl)
+{
+    if (d->start[prev_nl] == DFA_UNKNOWN) {
+        u32 n = 0;
+        d->mark_gen++;
+        dfa_closure(d, 0, prev_nl, -1, d->list_a, &n);
+        u8 flags = (prev_nl ? DFA_PREV_NL : 0) | (d->unanchored ? 0 : DFA_NO_START);
+        // Not stored until it exists: a flush inside dfa_state resets both
+        u32 id            = dfa_state(d, flags, d->list_a, n);
+        d->start[prev_nl] = id;
+        if (id != DFA_UNKNOWN)
+            d->flags[id] |= DFA_START;
+    }
+    return d->start[prev_nl];
+}
+
+static inline u32 dfa_entry(const Dfa* d, u32 id)
+{
+    return id * (u32)d->stride | ((d->flags[id] & d->special) ? DFA_SPECIAL : 0);
+}
+
+// The transition from state s on byte class cls, computed and cached
+static u32 dfa_step(Dfa* d, u32 s, int cls)
+{
+    bool eoi     = cls == d->stride - 1;
+    bool nl      = eoi || d->class_rep[cls] == '\n';
+    u8   flags   = d->flags[s];
+    bool prev_nl = flags & DFA_PREV_NL;
+
+    // Decide any $ now that the next byte is known
+    u32        n    = 0;
+    const u32* list = d->pool + d->list_start[s];
+    d->mark_gen++;
+    for (u32 i = 0; i < d->list_len[s]; i++)
+        dfa_closure(d, (int)list[i], prev_nl, nl, d->list_a, &n);
+
+    // Advance every thread over the byte, highest priority first
+    u32  raw     = 0;
+    bool matched = false;
+    for (u32 i = 0; i < n; i++) {
+        const Inst* in = &d->insts[d->list_a[i]];
+        if (in->op == OP_MATCH) {
+            matched = true;
+            if (!d->longest)
+                break; // Lower priority threads can't win any more
+        } else if (!eoi && set_has(&d->sets[in->set], d->class_rep[cls])) {
+            d->list_b[raw++] = d->list_a[i] + 1;
+        }
+    }
+
+    u8 next_flags = (u8)((nl && !eoi ? DFA_PREV_NL : 0) | (matched ? DFA_MATCH : 0) | (flags & DFA_NO_START));
+    if (matched && !d->longest)
+        next_flags |= DFA_NO_START;
+
+    n = 0;
+    d->mark_gen++;
+    for (u32 i = 0; i < raw; i++)
+        dfa_closure(d, (int)d->list_b[i], next_flags & DFA_PREV_NL, -1, d->list_a, &n);
+    if (!(next_flags & DFA_NO_START))
+        dfa_closure(d, 0, next_flags & DFA_PREV_NL, -1, d->list_a, &n);
+
+    u32 count = d->state_count;
+    u32 next  = dfa_state(d, next_flags, d->list_a, n);
+    if (next != DFA_UNKNOWN && d->state_count >= count) // Not flushed: s is still valid
+        d->trans[(size_t)s * d->stride + cls] = dfa_entry(d, next);
+    return next;
+}
+
+static u32 dfa_next(Dfa* d, u32 s, int cls)
+{
+    u32 next = d->trans[(size_t)s * d->stride + cls];
+    return next != DFA_UNKNOWN ? (next & ~DFA_SPECIAL) / (u32)d->stride : dfa_step(d, s, cls);
+}
+
+static bool dfa_init(Dfa* d, const Program* prog, const ByteSet* sets, bool unanchored, bool longest, u8 special)
+{
+    memset(d, 0, sizeof(*d));
+    d->insts      = prog->insts;
+    d->inst_count = prog->count;
+    d->sets       = sets;
+    d->unanchored = unanchored;
+    d->longest    = longest;
+    d->special    = special;
+    dfa_classes(d);
+
+    d->state_capacity = 64;
+    d->pool_capacity  = 1024;
+    d->table_size     = 2 * DFA_MAX_STATES;
+    d->trans          = malloc((size_t)d->state_capacity * d->stride * sizeof(u32));
+    d->flags          = malloc(d->state_capacity);
+    d->list_start     = malloc(d->state_capacity * sizeof(u32));
+    d->list_len       = malloc(d->state_capacity * sizeof(u32));
+    d->pool           = malloc(d->pool_capacity * sizeof(u32));
+    d->table          = calloc(d->table_size, sizeof(u32));
+    d->mark           = calloc(prog->count, sizeof(u32));
+    d->list_a         = malloc(prog->count * sizeof(u32));
+    d->list_b         = malloc(prog->count * sizeof(u32));
+    d->start[0] = d->start[1] = DFA_UNKNOWN;
+    return d->trans && d->flags && d->list_start && d->list_len && d->pool && d->table && d->mark && d->list_a
+        && d->list_b;
+}
+
+static void dfa_free(Dfa* d)
+{
+    free(d->trans);
+    free(d->flags);
+    free(d->list_start);
+    free(d->list_len);
+    free(d->pool);
+    free(d->table);
+    free(d->mark);
+    free(d->list_a);
+    free(d->list_b);
+}
+
+// ------------------------------------------------------------------ regex
+
+struct Regex
+{
+    ByteSet* sets;
+    Program  forward_prog;
+    Program  reverse_prog;
+    Dfa      forward; // Unanchored, leftmost-first: finds match ends
+    Dfa      reverse; // Anchored at a match end, longest: finds its start
+    Searcher prefix;
+    bool     has_prefix;
+};
+
+// The literal every match begins with. Returns false once it can't grow.
+static bool prefix_collect(const Parser* ps, int n, char* out, size_t* len)
+{
+    const Node* node = &ps->nodes[n];
+    switch (node->type) {
+    case NODE_EMPTY:
+    case NODE_BOL:
+        return true;
+    case NODE_CAT:
+        return prefix_collect(ps, node->left, out, len) && prefix_collect(ps, node->right, out, len);
+    case NODE_PLUS:
+        prefix_collect(ps, node->left, out, len);
+        return false;
+    case NODE_CLASS: {
+        // One byte, or with ignore case the two cases of one letter
+        const ByteSet* set   = &ps->sets[node->set];
+        int            count = 0;
+        int            byte  = 0;
+        for (int c = 255; c >= 0; c--) {
+            if (set_has(set, (u8)c)) {
+                count++;
+                byte = c;
+            }
+        }
+        bool letter = count == 2 && byte >= 'A' && byte <= 'Z' && (ps->flags & SEARCH_IGNORE_CASE);
+        if (*len == REGEX_MAX_PREFIX || !(count == 1 || letter))
+            return false;
+        out[(*len)++] = (char)(letter ? byte + 32 : byte);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+Regex* regex_compile(const char* pattern, size_t len, u32 flags, const char** error)
+{
+    Parser ps = {
+        .p     = pattern,
+        .end   = pattern + len,
+        .flags = flags,
+        .nodes = malloc(REGEX_MAX_NODES * sizeof(Node)),
+        .sets  = malloc(REGEX_MAX_NODES * sizeof(ByteSet)),
+    };
+    Regex* re = calloc(1, sizeof(Regex));
+    if (!ps.nodes || !ps.sets || !re) {
+        free(ps.nodes);
+        free(ps.sets);
+        free(re);
+        *error = "out of memory";
+        return NULL;
+    }
+
+    int root = parse_alt(&ps);
+    if (root >= 0 && ps.p < ps.end) {
+        ps.error = "unmatched )";
+        root     = -1;
+    }
+    if (root < 0) {
+        free(ps.nodes);
+        free(ps.sets);
+        free(re);
+        *error = ps.error;
+        return NULL;
+    }
+
+    re->sets               = ps.sets;
+    re->forward_prog.insts = malloc(REGEX_MAX_INSTS * sizeof(Inst));
+    re->reverse_prog.insts = malloc(REGEX_MAX_INSTS * sizeof(Inst));
+    bool ok                = re->forward_prog.insts && re->reverse_prog.insts;
+    if (ok) {
+        compile_node(&ps, &re->forward_prog, root, false);
+        emit(&re->forward_prog, OP_MATCH);
+        compile_node(&ps, &re->reverse_prog, root, true);
+        emit(&re->reverse_prog, OP_MATCH);
+        ok = dfa_init(&re->forward, &re->forward_prog, re->sets, true, false, DFA_MATCH | DFA_DEAD)
+            && dfa_init(&re->reverse, &re->reverse_prog, re->sets, false, true, DFA_MATCH | DFA_DEAD);
+    }
+
+    char   prefix[REGEX_MAX_PREFIX];
+    size_t prefix_len = 0;
+    prefix_collect(&ps, root, prefix, &prefix_len);
+    if (ok && prefix_len > 0)
+        ok = re->has_prefix = search_init(&re->prefix, prefix, prefix_len, flags & SEARCH_IGNORE_CASE);
+    if (re->has_prefix)
+        re->forward.special |= DFA_START; // Back at the start: time to skip ahead
+
+    free(ps.nodes);
+    if (!ok) {
+        regex_free(re);
+        *error = "out of memory";
+        return NULL;
+    }
+    return re;
+}
+
+void regex_free(Regex* re)
+{
+    if (!re)
+        return;
+    if (re->forward_prog.insts)
+        dfa_free(&re->forward);
+    if (re->reverse_prog.insts)
+        dfa_free(&re->reverse);
+    if (re->has_prefix)
+        search_free(&re->prefix);
+    free(re->forward_prog.insts);
+    free(re->reverse_prog.insts);
+    free(re->sets);
+    free(re);
+}
+
+size_t regex_prefix_len(const Regex* re) { return re->has_prefix ? re->prefix.len : 0; }
+
+// ---------------------------------------------------------------- searching
+
+static bool newline_before(Buffer* buf, size_t pos) { return pos == 0 || buffer_char_at(buf, pos - 1) == '\n'; }
+
+// Class of the byte at pos, or end of text
+static int class_at(const Dfa* d, Buffer* buf, size_t pos)
+{
+    return pos < buffer_length(buf) ? d->classes[(u8)buffer_char_at(buf, pos)] : d->stride - 1;
+}
+
+// With nothing in progress, skips text[i, n) to where a match could begin:
+// the next occurrence of the prefix, or near enough to the end that one
+// could straddle into the next span
+static size_t prefix_skip(const Regex* re, const u8* text, size_t i, size_t n)
+{
+    const char* hit = search_block(&re->prefix, (const char*)text + i, n - i);
+    if (hit)
+        return (size_t)((const u8*)hit - text);
+    return n - i > re->prefix.len - 1 ? n - (re->prefix.len - 1) : i;
+}
+
+// End of the leftmost-first match inside [start, end), or -1
+static i64 match_end(Regex* re, Buffer* buf, size_t start, size_t end)
+{
+    Dfa* d = &re->forward;
+    if (dfa_start(d, false) == DFA_UNKNOWN || dfa_start(d, true) == DFA_UNKNOWN)
+        return -1;
+
+    // States are handled as their row in the transition table, which keeps
+    // the multiply out of the byte loop's dependency chain
+    const u32* trans   = d->trans;
+    const u8*  classes = d->classes;
+    u32        stride  = (u32)d->stride;
+    u32        row     = d->start[newline_before(buf, start)] * stride;
+    i64        found   = -1;
+
+    BufferIter it;
+    buffer_iter_init(&it, buf, start, end);
+    while (buffer_iter_next(&it)) {
+        const u8* text = (const u8*)it.text;
+        size_t    i    = 0;
+        if (re->has_prefix && (d->flags[row / stride] & DFA_START)) {
+            i = prefix_skip(re, text, 0, it.len);
+            if (i > 0)
+                row = d->start[text[i - 1] == '\n'] * stride;
+        }
+        for (; i < it.len; i++) {
+            u32 e = trans[row + classes[text[i]]];
+            if (e == DFA_UNKNOWN) {
+                u32 next = dfa_step(d, row / stride, classes[text[i]]);
+                // A full cache was flushed; the start states come back first
+                if (next == DFA_UNKNOWN || dfa_start(d, false) == DFA_UNKNOWN || dfa_start(d, true) == DFA_UNKNOWN)
+                    return -1;
+                trans = d->trans;
+                e     = dfa_entry(d, next);
+            }
+            row = e & ~DFA_SPECIAL;
+            if (!(e & DFA_SPECIAL))
+                continue;
+
+            u8 flags = d->flags[row / stride];
+            if (flags & DFA_MATCH)
+                found = (i64)(it.pos + i);
+            if (flags & DFA_DEAD)
+                return found;
+            if (flags & DFA_START) {
+                size_t skip = prefix_skip(re, text, i + 1, it.len);
+                if (skip > i + 1) {
+                    row = d->start[text[skip - 1] == '\n'] * stride;
+                    i   = skip - 1;
+                }
+            }
+        }
+    }
+
+    u32 s = dfa_next(d, row / stride, class_at(d, buf, end));
+    if (s != DFA_UNKNOWN && (d->flags[s] & DFA_MATCH))
+        found = (i64)end;
+    return found;
+}
+
+// Start of the longest match inside [start, end_pos) that ends at end_pos
+static size_t match_start(Regex* re, Buffer* buf, size_t start, size_t end_pos)
+{
+    Dfa*   d    = &re->reverse;
+    u32    s    = dfa_start(d, end_pos == buffer_length(buf) || buffer_char_at(buf, end_pos) == '\n');
+    size_t best = end_pos;
+    if (s == DFA_UNKNOWN)
+        return best;
+
+    const u32* trans   = d->trans;
+    const u8*  classes = d->classes;
+    u32        stride  = (u32)d->stride;
+    u32        row     = s * stride;
+
+    BufferIter it;
+    buffer_iter_init_reverse(&it, buf, start, end_pos);
+    while (buffer_iter_prev(&it)) {
+        const u8* text = (const u8*)it.text;
+        for (size_t i = it.len; i-- > 0;) {
+            u32 e = trans[row + classes[text[i]]];
+            if (e == DFA_UNKNOWN) {
+                u32 next = dfa_step(d, row / stride, classes[text[i]]);
+                if (next == DFA_UNKNOWN)
+                    return best;
+                trans = d->trans;
+                e     = dfa_entry(d, next);
+            }
+            row = e & ~DFA_SPECIAL;
+            if (!(e & DFA_SPECIAL))
+                continue;
+
+            u8 flags = d->flags[row / stride];
+            if (flags & DFA_MATCH)
+                best = it.pos + i + 1;
+            if (flags & DFA_DEAD)
+                return best;
+        }
+    }
+
+    s = dfa_next(d, row / stride, start > 0 ? d->classes[(u8)buffer_char_at(buf, start - 1)] : d->stride - 1);
+    if (s != DFA_UNKNOWN && (d->flags[s] & DFA_MATCH))
+        best = start;
+    return best;
+}
+
+bool regex_search_forward(Regex* re, Buffer* buf, size_t start, size_t end, size_t* out_start, size_t* out_end)
+{
+    size_t len = buffer_length(buf);
+    if (end > len)
+        end = len;
+    if (start > end)
+        return false;
+
+    i64 e = match_end(re, buf, start, end);
+    if (e < 0)
+        return false;
+    *out_start = match_start(re, buf, start, (size_t)e);
+    *out_end   = (size_t)e;
+    return true;
+}
+
+bool regex_search_backward(Regex* re, Buffer* buf, size_t start, size_t end, size_t* out_start, size_t* out_end)
+{
+    bool   found = false;
+    size_t len   = buffer_length(buf);
+    size_t a, b;
+    while (start < end && start <= len && regex_search_forward(re, buf, start, len, &a, &b) && a < end) {
+        *out_start = a;
+        *out_end   = b;
+        found      = true;
+        start      = b > a ? b : a + 1;
+    }
+    return found;
+}
+
+size_t regex_count(Regex* re, Buffer* buf, size_t start, size_t end)
+{
+    size_t count = 0;
+    size_t a, b;
+    while (start <= end && regex_search_forward(re, buf, start, end, &a, &b)) {
+        count++;
+        start = b > a ? b : a + 1;
+    }
+    return count;
+}
@@ -1,9 +1,14 @@
 #include "render.h"
 #include "font.h"
 #include "syntax.h"
+#include "utf8.h"
 #include <stdio.h>
 #include <string.h>
 
+// Bytes of each line extracted per frame: the visible columns at up to
+// UTF8_MAX bytes each, on windows up to 4096 columns wide
+#define RENDER_LINE_MAX (4096 * UTF8_MAX)
+
 void render_init(Renderer* r, Window_State* win)
 {
     r->win            = win;
@@ -11,6 +16,7 @@ void render_init(Renderer* r, Window_State* win)
     r->scroll_y       = 0;
     r->font_scale     = 1.0f;
     r->syntax_enabled = true;
+    r->find           = NULL;
 
     // Dark theme (VS Code inspired)
     r->theme.bg        = 0x1e1e1e;
@@ -20,6 +26,7 @@ void render_init(Renderer* r, Window_State* win)
     r->theme.status_bg = 0x007acc;
     r->theme.status_fg = 0xffffff;
     r->theme.selection = 0x264f78;
+    r->theme.match     = 0x613214;
 
     // Syntax colors
     r->theme.keyword  = 0xc586c0; // Purple - keywords
@@ -59,7 +66,11 @@ void render_rect(Renderer* r, int x, int y, int w, int h, u32 color)
 
 void render_char(Renderer* r, int x, int y, char c, u32 fg, u32 bg)
 {
-    const u8* glyph  = font_get_glyph(c);
+    render_glyph(r, x, y, font_get_glyph(c), fg, bg);
+}
+
+void render_glyph(Renderer* r, int x, int y, const u8* glyph, u32 fg, u32 bg)
+{
     u32*      pixels = r->win->pixels;
     int       stride = r->win->width;
     float     scale  = r->font_scale;
@@ -154,6 +165,21 @@ static u32 get_syntax_color(Renderer* r, TokenType type)
     }
 }
 
+// First extra cursor whose selection ends at or after pos
+static size_t first_cursor_from(Buffer* buf, size_t pos)
+{
+    size_t lo = 0, hi = buf->cursor_count;
+    while (lo < hi) {
+        size_t              mid = lo + (hi - lo) / 2;
+        const BufferCursor* c   = &buf->cursors[mid];
+        if ((c->pos > c->anchor ? c->pos : c->anchor) < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 void render_buffer(Renderer* r, Buffer* buf)
 {
     static SyntaxState syntax             = { 0 };
@@ -179,12 +205,9 @@ void render_buffer(Renderer* r, Buffer* buf)
     if (line_num_width < 4)
         line_num_width = 4; // Minimum 4 digits
 
-    int text_start_x  = (line_num_width + 1) * char_w;
-    int text_cols     = visible_cols - line_num_width - 1;
-    int max_render_col = r->scroll_x + text_cols;
-
-    size_t cursor_line, cursor_col;
-    buffer_get_line_col(buf, &cursor_line, &cursor_col);
+    int    text_start_x   = (line_num_width + 1) * char_w;
+    int    text_cols      = visible_cols - line_num_width - 1;
+    size_t max_render_col = r->scroll_x + (size_t)text_cols;
 
     size_t buf_len = buffer_length(buf);
 
@@ -192,7 +215,7 @@ void render_buffer(Renderer* r, Buffer* buf)
     syntax.in_multiline_comment = false;
 
     // Line buffer for syntax highlighting (only need visible portion + some context)
-    static char line_buf[4096];
+    static char line_buf[RENDER_LINE_MAX];
 
     // Render visible lines - use line index for O(1) line jumps
     for (int screen_line = 0; screen_line < visible_lines; screen_line++) {
@@ -207,14 +230,25 @@ void render_buffer(Renderer* r, Buffer* buf)
                               : buf_len;
         size_t line_len   = line_end - line_start;
 
-        // Extract only the visible portion we need (scroll_x to max_render_col)
-        size_t extract_len = (size_t)max_render_col + 1;
-        if (extract_len > line_len)
-            extract_len = line_len;
+        // The first visible character, through the column index on long
+        // lines. The extract runs from the line start when it can reach the
+        // visible columns from there, so highlighting sees the whole token;
+        // otherwise it starts at the visible character.
+        Utf8Pos vis  = { 0, 0, 0 };
+        size_t  from = 0;
+        if (r->scroll_x > 0)
+            vis = buffer_line_seek(buf, current_line, UTF8_COLUMNS, r->scroll_x);
+        size_t extract_len = (size_t)(text_cols + 1) * UTF8_MAX;
+        if (vis.byte + extract_len > sizeof(line_buf) - 1)
+            from = vis.byte;
         if (extract_len > sizeof(line_buf) - 1)
             extract_len = sizeof(line_buf) - 1;
+        extract_len += vis.byte - from;
+        if (extract_len > line_len - from)
+            extract_len = line_len - from;
 
-        size_t extracted = buffer_extract(buf, line_start, extract_len, line_buf);
+        size_t base         = line_start + from; // Buffer position of line_buf[0]
+        size_t extracted    = buffer_extract(buf, base, extract_len, line_buf);
         line_buf[extracted] = '\0';
 
         // Run syntax highlighting (if enabled)
@@ -242,41 +276,83 @@ void render_buffer(Renderer* r, Buffer* buf)
         // Draw separator
         render_char(r, line_num_width * char_w, y, ' ', r->theme.line_num, r->theme.bg);
 
-        // Draw text - use line_buf directly, only visible columns
-        size_t render_start = r->scroll_x < extracted ? r->scroll_x : extracted;
-        size_t render_end   = (size_t)max_render_col < extracted ? (size_t)max_render_col : extracted;
+        // Draw text - use line_buf directly, only the characters in the
+        // visible columns; offsets below are from the extract start
+        vis.byte -= from;
+        Utf8Pos end = vis;
+        utf8_walk(line_buf, extracted, extracted, UTF8_COLUMNS, max_render_col, &end);
+        size_t render_start = vis.byte;
+        size_t render_end   = end.byte;
+
+        // Find matches on the visible part of the line; hit walks along them
+        size_t matches[1024];
+        size_t match_count = 0;
+        size_t match_len   = 0;
+        size_t hit         = 0;
+        if (r->find && r->find->active) {
+            match_len   = r->find->searcher.len;
+            match_count = findset_visible(r->find, buf, base + render_start, base + render_end, matches,
+                sizeof(matches) / sizeof(matches[0]));
+        }
+
+        // Extra cursors on the line; extra walks along them like hit
+        size_t extra = first_cursor_from(buf, base + render_start);
 
-        for (size_t col = render_start; col < render_end; col++) {
-            int  screen_col = col - r->scroll_x;
-            int  x          = text_start_x + screen_col * char_w;
-            char c          = line_buf[col];
+        size_t col = vis.col;
+        for (size_t i = render_start; i < render_end;) {
+            u32    cp;
+            size_t n = utf8_decode(line_buf + i, extracted - i, &cp);
+            size_t w = (size_t)utf8_width(cp);
 
-            size_t buf_pos     = line_start + col;
-            bool   is_cursor   = (current_line == cursor_line && col == cursor_col);
+            size_t buf_pos     = base + i;
+            bool   is_cursor   = buf_pos == buf->cursor;
             bool   is_selected = buf->has_selection && buf_pos >= buf->sel_start && buf_pos < buf->sel_end;
+            while (hit + 1 < match_count && matches[hit + 1] <= buf_pos)
+                hit++;
+            bool is_match = match_count > 0 && matches[hit] <= buf_pos && buf_pos < matches[hit] + match_len;
+            while (extra < buf->cursor_count && buf->cursors[extra].pos < buf_pos
+                && buf->cursors[extra].anchor <= buf_pos)
+                extra++;
+            if (extra < buf->cursor_count) {
+                const BufferCursor* c = &buf->cursors[extra];
+                is_cursor |= c->pos == buf_pos;
+                is_selected |= (c->anchor <= buf_pos && buf_pos < c->pos) || (c->pos < buf_pos && buf_pos < c->anchor);
+            }
 
             // Get syntax color
             u32 syntax_fg = r->theme.fg;
             if (r->syntax_enabled) {
-                TokenType token_type = syntax_get_token_at(&syntax, col);
+                TokenType token_type = syntax_get_token_at(&syntax, i);
                 syntax_fg            = get_syntax_color(r, token_type);
             }
 
-            u32 bg = is_cursor ? r->theme.cursor : (is_selected ? r->theme.selection : r->theme.bg);
+            u32 bg = is_cursor ? r->theme.cursor
+                : is_selected  ? r->theme.selection
+                : is_match     ? r->theme.match
+                               : r->theme.bg;
             u32 fg = is_cursor ? r->theme.bg : syntax_fg;
 
-            if (c == '\t') {
-                render_char(r, x, y, ' ', fg, bg);
-            } else {
-                render_char(r, x, y, c, fg, bg);
+            // Zero-width characters draw nothing; wide ones take two cells,
+            // unless cut by the left edge
+            if (w > 0 && col >= r->scroll_x) {
+                int       x     = text_start_x + (int)(col - r->scroll_x) * char_w;
+                const u8* glyph = cp == '\t' ? font_get_glyph(' ') : font_get_codepoint_glyph(cp);
+                render_glyph(r, x, y, glyph, fg, bg);
+                if (w == 2)
+                    render_glyph(r, x + char_w, y, font_get_glyph(' '), fg, bg);
             }
+            i += n;
+            col += w;
         }
 
-        // Draw cursor at end of line if needed
-        if (current_line == cursor_line && cursor_col == line_len) {
-            int screen_col = cursor_col - r->scroll_x;
-            if (screen_col >= 0 && screen_col < text_cols) {
-                int x = text_start_x + screen_col * char_w;
+        // Draw cursor at end of line if needed, when the walk reached it
+        while (extra < buf->cursor_count && buf->cursors[extra].pos < line_end)
+            extra++;
+        bool extra_at_end = extra < buf->cursor_count && buf->cursors[extra].pos == line_end;
+        if ((buf->cursor == line_end || extra_at_end) && from + render_end == line_len && end.col >= r->scroll_x) {
+            size_t screen_col = end.col - r->scroll_x;
+            if (screen_col < (size_t)text_cols) {
+                int x = text_start_x + (int)screen_col * char_w;
                 render_char(r, x, y, ' ', r->theme.bg, r->theme.cursor);
             }
         }
@@ -301,8 +377,20 @@ void render_status_bar(Renderer* r, Buffer* buf)
     const char* filename = buf->filename ? buf->filename : "[No Name]";
     const char* modified = buf->modified ? " [+]" : "";
 
-    snprintf(status, sizeof(status), " %s%s  Ln %zu, Col %zu  [%.1fx]", filename, modified, line + 1,
-        col + 1, r->font_scale);
+    int len = snprintf(status, sizeof(status), " %s%s  Ln %zu, Col %zu  [%.1fx]", filename, modified,
+        line + 1, col + 1, r->font_scale);
+    if (buf->cursor_count > 0 && len > 0 && (size_t)len < sizeof(status))
+        len += snprintf(status + len, sizeof(status) - len, "  %zu cursors", buffer_cursor_count(buf));
+
+    if (buf->loading && len > 0 && (size_t)len < sizeof(status)) {
+        size_t loaded  = buffer_length(buf);
+        int    percent = buf->load_total ? (int)(loaded * 100 / buf->load_total) : 100;
+        snprintf(status + len, sizeof(status) - len, "  Loading %d%% (%zu lines)", percent,
+            buffer_line_count(buf));
+    } else if (buf->saving && len > 0 && (size_t)len < sizeof(status)) {
+        int percent = buf->save_total ? (int)(buf->save_done * 100 / buf->save_total) : 100;
+        snprintf(status + len, sizeof(status) - len, "  Saving %d%%", percent);
+    }
 
     // Draw status text
     int x = 0;
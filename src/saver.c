@@ -0,0 +1,98 @@
+#include "saver.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void* saver_thread(void* arg)
+{
+    Saver* sv = arg;
+    bool   ok = buffer_snapshot_save(sv->snap, sv->filename, &sv->written);
+
+    pthread_mutex_lock(&sv->lock);
+    sv->ok       = ok;
+    sv->finished = true;
+    pthread_mutex_unlock(&sv->lock);
+    return NULL;
+}
+
+Saver* saver_start(Buffer* buf)
+{
+    if (!buf->filename || buf->saving)
+        return NULL;
+
+    Saver* sv = calloc(1, sizeof(Saver));
+    if (!sv)
+        return NULL;
+    sv->buf      = buf;
+    sv->revision = buf->revision;
+    sv->filename = strdup(buf->filename);
+    sv->snap     = buffer_snapshot(buf);
+    if (!sv->filename || !sv->snap) {
+        buffer_snapshot_release(sv->snap);
+        free(sv->filename);
+        free(sv);
+        return NULL;
+    }
+
+    pthread_mutex_init(&sv->lock, NULL);
+    if (pthread_create(&sv->thread, NULL, saver_thread, sv) != 0) {
+        pthread_mutex_destroy(&sv->lock);
+        buffer_snapshot_release(sv->snap);
+        free(sv->filename);
+        free(sv);
+        return NULL;
+    }
+    sv->running = true;
+
+    buf->saving     = true;
+    buf->save_done  = 0;
+    buf->save_total = sv->snap->length;
+    return sv;
+}
+
+static void saver_finish(Saver* sv)
+{
+    pthread_join(sv->thread, NULL);
+    sv->running = false;
+
+    Buffer* buf = sv->buf;
+    buffer_snapshot_release(sv->snap);
+    sv->snap = NULL;
+
+    buf->saving    = false;
+    buf->save_done = buf->save_total;
+
+    // Edits made while the save ran are not in the file
+    if (sv->ok && buf->revision == sv->revision)
+        buf->modified = false;
+}
+
+SaveStatus saver_poll(Saver* sv)
+{
+    pthread_mutex_lock(&sv->lock);
+    bool done = sv->finished;
+    pthread_mutex_unlock(&sv->lock);
+
+    if (!sv->running)
+        return sv->ok ? SAVE_DONE : SAVE_FAILED;
+
+    if (!done) {
+        sv->buf->save_done = __atomic_load_n(&sv->written, __ATOMIC_RELAXED);
+        return SAVE_RUNNING;
+    }
+
+    saver_finish(sv);
+    return sv->ok ? SAVE_DONE : SAVE_FAILED;
+}
+
+void saver_destroy(Saver* sv)
+{
+    if (!sv)
+        return;
+
+    if (sv->running)
+        saver_finish(sv);
+
+    pthread_mutex_destroy(&sv->lock);
+    free(sv->filename);
+    free(sv);
+}
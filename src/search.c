@@ -0,0 +1,861 @@
+#define _GNU_SOURCE // memrchr
+#include "search.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86 1
+#endif
+
+// Without vector compares, needles longer than this skip ahead with
+// Horspool, which beats a memchr filter once shifts get long. The vector
+// filter stays ahead of Horspool at every length, so it is used throughout.
+#define SEARCH_SHORT_MAX 32
+
+// Matches straddling two spans are searched in a copy of the seam; this
+// covers the find prompt's needles without touching the heap
+#define SEARCH_WINDOW_STACK 512
+
+static u8 fold_none[256];  // Identity
+static u8 fold_lower[256]; // ASCII tolower
+
+static inline const u8* fold_table(const Searcher* s)
+{
+    return (s->flags & SEARCH_IGNORE_CASE) ? fold_lower : fold_none;
+}
+
+static bool is_word_byte(u8 c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Compare n text bytes against the (already folded) needle bytes
+static inline bool equal_at(const Searcher* s, const char* text, const u8* needle, size_t n)
+{
+    if (!(s->flags & SEARCH_IGNORE_CASE))
+        return memcmp(text, needle, n) == 0;
+    for (size_t i = 0; i < n; i++) {
+        if (fold_lower[(u8)text[i]] != needle[i])
+            return false;
+    }
+    return true;
+}
+
+// The filter already matched the first and last bytes
+static inline bool middle_matches(const Searcher* s, const char* at)
+{
+    return s->len <= 2 || equal_at(s, at + 1, s->needle + 1, s->len - 2);
+}
+
+// -------------------------------------------------------------- horspool
+
+static const char* horspool_first(const Searcher* s, const char* p, size_t n)
+{
+    size_t    m    = s->len;
+    const u8* fold = fold_table(s);
+    u8        last = s->needle[m - 1];
+
+    for (size_t i = 0; i + m <= n;) {
+        u8 c = fold[(u8)p[i + m - 1]];
+        if (c == last && equal_at(s, p + i, s->needle, m - 1))
+            return p + i;
+        i += s->shift[c];
+    }
+    return NULL;
+}
+
+static const char* horspool_last(const Searcher* s, const char* p, size_t n)
+{
+    size_t    m     = s->len;
+    const u8* fold  = fold_table(s);
+    u8        first = s->needle[0];
+    if (n < m)
+        return NULL;
+
+    for (size_t i = n - m;;) {
+        u8 c = fold[(u8)p[i]];
+        if (c == first && equal_at(s, p + i + 1, s->needle + 1, m - 1))
+            return p + i;
+        if (i < s->shift_back[c])
+            return NULL;
+        i -= s->shift_back[c];
+    }
+}
+
+// ---------------------------------------------------------------- scalar
+
+static const char* first_scalar(const Searcher* s, const char* p, size_t n)
+{
+    size_t m = s->len;
+    if (n < m)
+        return NULL;
+    if (m > SEARCH_SHORT_MAX)
+        return horspool_first(s, p, n);
+
+    const char* end = p + n - m + 1; // One past the last possible start
+    u8          c0  = s->needle[0];
+    if (!(s->flags & SEARCH_IGNORE_CASE)) {
+        for (const char* q = p; (q = memchr(q, c0, end - q)) != NULL; q++) {
+            if (memcmp(q + 1, s->needle + 1, m - 1) == 0)
+                return q;
+        }
+        return NULL;
+    }
+    for (const char* q = p; q < end; q++) {
+        if (fold_lower[(u8)*q] == c0 && equal_at(s, q + 1, s->needle + 1, m - 1))
+            return q;
+    }
+    return NULL;
+}
+
+static const char* last_scalar(const Searcher* s, const char* p, size_t n)
+{
+    size_t m = s->len;
+    if (n < m)
+        return NULL;
+    if (m > SEARCH_SHORT_MAX)
+        return horspool_last(s, p, n);
+
+    u8     c0 = s->needle[0];
+    size_t i  = n - m + 1; // Candidate starts are [0, i)
+    if (!(s->flags & SEARCH_IGNORE_CASE)) {
+        const char* q;
+        while (i > 0 && (q = memrchr(p, c0, i)) != NULL) {
+            if (memcmp(q + 1, s->needle + 1, m - 1) == 0)
+                return q;
+            i = (size_t)(q - p);
+        }
+        return NULL;
+    }
+    while (i-- > 0) {
+        if (fold_lower[(u8)p[i]] == c0 && equal_at(s, p + i + 1, s->needle + 1, m - 1))
+            return p + i;
+    }
+    return NULL;
+}
+
+#ifdef SEARCH_X86
+
+// Byte to OR into the text before comparing with needle[i]: folds case
+// only where the needle has a letter, so no other byte can alias
+static inline char case_bit(const Searcher* s, size_t i)
+{
+    u8 c = s->needle[i];
+    return ((s->flags & SEARCH_IGNORE_CASE) && c >= 'a' && c <= 'z') ? 0x20 : 0;
+}
+
+// ------------------------------------------------------------------ SSE2
+
+__attribute__((target("sse2"))) static const char* first_sse2(const Searcher* s, const char* p, size_t n)
+{
+    size_t m = s->len;
+    if (n < m)
+        return NULL;
+
+    const __m128i first      = _mm_set1_epi8((char)s->needle[0]);
+    const __m128i last       = _mm_set1_epi8((char)s->needle[m - 1]);
+    const __m128i first_case = _mm_set1_epi8(case_bit(s, 0));
+    const __m128i last_case  = _mm_set1_epi8(case_bit(s, m - 1));
+    size_t        i          = 0;
+
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a    = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i)), first_case);
+        __m128i b    = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i + m - 1)), last_case);
+        u32     mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            const char* at = p + i + __builtin_ctz(mask);
+            if (middle_matches(s, at))
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    return first_scalar(s, p + i, n - i);
+}
+
+__attribute__((target("sse2"))) static const char* last_sse2(const Searcher* s, const char* p, size_t n)
+{
+    size_t m = s->len;
+    if (n < m)
+        return NULL;
+
+    const __m128i first      = _mm_set1_epi8((char)s->needle[0]);
+    const __m128i last       = _mm_set1_epi8((char)s->needle[m - 1]);
+    const __m128i first_case = _mm_set1_epi8(case_bit(s, 0));
+    const __m128i last_case  = _mm_set1_epi8(case_bit(s, m - 1));
+    size_t        i          = n - m + 1; // Candidate starts left to check are [0, i)
+
+    while (i >= 16) {
+        i -= 16;
+        __m128i a    = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i)), first_case);
+        __m128i b    = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i + m - 1)), last_case);
+        u32     mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            if (middle_matches(s, p + i + bit))
+                return p + i + bit;
+            mask &= ~(1u << bit);
+        }
+    }
+    return last_scalar(s, p, i + m - 1);
+}
+
+// ------------------------------------------------------------------ AVX2
+
+__attribute__((target("avx2"))) static const char* first_avx2(const Searcher* s, const char* p, size_t n)
+{
+    size_t m = s->len;
+    if (n < m)
+        return NULL;
+
+    const __m256i first      = _mm256_set1_epi8((char)s->needle[0]);
+    const __m256i last       = _mm256_set1_epi8((char)s->needle[m - 1]);
+    const __m256i first_case = _mm256_set1_epi8(case_bit(s, 0));
+    const __m256i last_case  = _mm256_set1_epi8(case_bit(s, m - 1));
+    size_t        i          = 0;
+
+    // Two vectors per step; candidates are rare, so one test covers both
+    for (; i + m - 1 + 64 <= n; i += 64) {
+        __m256i a0 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i)), first_case);
+        __m256i b0 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i + m - 1)), last_case);
+        __m256i a1 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i + 32)), first_case);
+        __m256i b1 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i + 32 + m - 1)), last_case);
+        __m256i c0 = _mm256_and_si256(_mm256_cmpeq_epi8(a0, first), _mm256_cmpeq_epi8(b0, last));
+        __m256i c1 = _mm256_and_si256(_mm256_cmpeq_epi8(a1, first), _mm256_cmpeq_epi8(b1, last));
+        if (_mm256_testz_si256(_mm256_or_si256(c0, c1), _mm256_or_si256(c0, c1)))
+            continue;
+
+        u64 mask = (u32)_mm256_movemask_epi8(c0) | (u64)(u32)_mm256_movemask_epi8(c1) << 32;
+        while (mask) {
+            const char* at = p + i + __builtin_ctzll(mask);
+            if (middle_matches(s, at))
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i)), first_case);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i + m - 1)), last_case);
+        u32     mask
+            = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            const char* at = p + i + __builtin_ctz(mask);
+            if (middle_matches(s, at))
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    return first_scalar(s, p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static const char* last_avx2(const Searcher* s, const char* p, size_t n)
+{
+    size_t m = s->len;
+    if (n < m)
+        return NULL;
+
+    const __m256i first      = _mm256_set1_epi8((char)s->needle[0]);
+    const __m256i last       = _mm256_set1_epi8((char)s->needle[m - 1]);
+    const __m256i first_case = _mm256_set1_epi8(case_bit(s, 0));
+    const __m256i last_case  = _mm256_set1_epi8(case_bit(s, m - 1));
+    size_t        i          = n - m + 1;
+
+    while (i >= 32) {
+        i -= 32;
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i)), first_case);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + i + m - 1)), last_case);
+        u32     mask
+            = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            if (middle_matches(s, p + i + bit))
+                return p + i + bit;
+            mask &= ~(1u << bit);
+        }
+    }
+    return last_scalar(s, p, i + m - 1);
+}
+
+#endif // SEARCH_X86
+
+// -------------------------------------------------------------- dispatch
+
+typedef struct
+{
+    SearchKernel kind;
+    const char* (*first)(const Searcher*, const char*, size_t);
+    const char* (*last)(const Searcher*, const char*, size_t);
+} SearchKernels;
+
+static const SearchKernels kernel_table[] = {
+    { SEARCH_SCALAR, first_scalar, last_scalar },
+#ifdef SEARCH_X86
+    { SEARCH_SSE2, first_sse2, last_sse2 },
+    { SEARCH_AVX2, first_avx2, last_avx2 },
+#endif
+};
+
+static const SearchKernels* kernels = &kernel_table[0];
+
+static bool kernel_supported(SearchKernel kernel)
+{
+    switch (kernel) {
+    case SEARCH_SCALAR:
+        return true;
+#ifdef SEARCH_X86
+    case SEARCH_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SEARCH_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool search_use_kernel(SearchKernel kernel)
+{
+    if (!kernel_supported(kernel))
+        return false;
+
+    for (size_t i = 0; i < sizeof(kernel_table) / sizeof(kernel_table[0]); i++) {
+        if (kernel_table[i].kind == kernel) {
+            kernels = &kernel_table[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+SearchKernel search_active_kernel(void) { return kernels->kind; }
+
+// Pick the kernel before main() so worker threads never race the choice
+__attribute__((constructor)) static void search_select_kernel(void)
+{
+    for (int c = 0; c < 256; c++) {
+        fold_none[c]  = (u8)c;
+        fold_lower[c] = (c >= 'A' && c <= 'Z') ? (u8)(c + 32) : (u8)c;
+    }
+#ifdef SEARCH_X86
+    __builtin_cpu_init();
+#endif
+    if (!search_use_kernel(SEARCH_AVX2))
+        search_use_kernel(SEARCH_SSE2);
+}
+
+// ------------------------------------------------------------ searching
+
+bool search_init(Searcher* s, const char* needle, size_t len, u32 flags)
+{
+    if (len == 0)
+        return false;
+
+    s->needle = malloc(len);
+    if (!s->needle)
+        return false;
+    s->len   = len;
+    s->flags = flags;
+
+    const u8* fold = fold_table(s);
+    for (size_t i = 0; i < len; i++)
+        s->needle[i] = fold[(u8)needle[i]];
+
+    // Horspool: how far the window may move when c is under its last
+    // (or, scanning backward, its first) byte
+    for (int c = 0; c < 256; c++) {
+        s->shift[c]      = len;
+        s->shift_back[c] = len;
+    }
+    for (size_t i = 0; i + 1 < len; i++)
+        s->shift[s->needle[i]] = len - 1 - i;
+    for (size_t i = len - 1; i > 0; i--)
+        s->shift_back[s->needle[i]] = i;
+    return true;
+}
+
+void search_free(Searcher* s)
+{
+    free(s->needle);
+    s->needle = NULL;
+    s->len    = 0;
+}
+
+const char* search_block(const Searcher* s, const char* p, size_t len) { return kernels->first(s, p, len); }
+
+const char* search_block_last(const Searcher* s, const char* p, size_t len) { return kernels->last(s, p, len); }
+
+// ------------------------------------------------------------- the text
+
+// A slice of the buffer as a flat list of runs. It is collected on the
+// calling thread, so workers never touch the buffer itself (piece lookups
+// update a cache). One byte either side is kept for whole-word checks.
+typedef struct
+{
+    const char* text;
+    size_t      pos;
+    size_t      len;
+} SearchRun;
+
+typedef struct
+{
+    SearchRun* runs;
+    size_t     count;
+    size_t     start; // Matches must lie inside [start, end)
+    size_t     end;
+} SearchText;
+
+static bool text_load(SearchText* t, Buffer* buf, size_t start, size_t end)
+{
+    size_t len = buffer_length(buf);
+    t->start   = start;
+    t->end     = end;
+    t->runs    = NULL;
+    t->count   = 0;
+
+    size_t     capacity = 0;
+    BufferIter it;
+    buffer_iter_init(&it, buf, start > 0 ? start - 1 : 0, end < len ? end + 1 : end);
+    while (buffer_iter_next(&it)) {
+        if (t->count == capacity) {
+            capacity        = capacity ? capacity * 2 : 4;
+            SearchRun* runs = realloc(t->runs, capacity * sizeof(SearchRun));
+            if (!runs) {
+                free(t->runs);
+                return false;
+            }
+            t->runs = runs;
+        }
+        t->runs[t->count++] = (SearchRun) { it.text, it.pos, it.len };
+    }
+    return true;
+}
+
+// Index of the run holding pos
+static size_t text_run_at(const SearchText* t, size_t pos)
+{
+    size_t lo = 0;
+    size_t hi = t->count;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (t->runs[mid].pos <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static u8 text_byte(const SearchText* t, size_t pos)
+{
+    const SearchRun* run = &t->runs[text_run_at(t, pos)];
+    return (u8)run->text[pos - run->pos];
+}
+
+static void text_extract(const SearchText* t, size_t pos, size_t len, char* dest)
+{
+    for (size_t r = text_run_at(t, pos); len > 0; r++) {
+        const SearchRun* run = &t->runs[r];
+        size_t           off = pos - run->pos;
+        size_t           n   = run->len - off < len ? run->len - off : len;
+        memcpy(dest, run->text + off, n);
+        dest += n;
+        pos += n;
+        len -= n;
+    }
+}
+
+static bool search_accept(const Searcher* s, const SearchText* t, size_t pos)
+{
+    if (!(s->flags & SEARCH_WHOLE_WORD))
+        return true;
+    if (pos > 0 && pos > t->runs[0].pos && is_word_byte(text_byte(t, pos - 1)))
+        return false;
+    const SearchRun* last = &t->runs[t->count - 1];
+    size_t           end  = pos + s->len;
+    return end >= last->pos + last->len || !is_word_byte(text_byte(t, end));
+}
+
+// ------------------------------------------------------------- scanning
+
+// First / last accepted match in a block at text position base, or how
+// many there are
+static i64 block_first(const Searcher* s, const SearchText* t, const char* p, size_t len, size_t base)
+{
+    const char* q = p;
+    const char* hit;
+    while ((hit = search_block(s, q, len - (size_t)(q - p))) != NULL) {
+        size_t pos = base + (size_t)(hit - p);
+        if (search_accept(s, t, pos))
+            return (i64)pos;
+        q = hit + 1;
+    }
+    return -1;
+}
+
+static i64 block_last(const Searcher* s, const SearchText* t, const char* p, size_t len, size_t base)
+{
+    const char* hit;
+    while ((hit = search_block_last(s, p, len)) != NULL) {
+        size_t pos = base + (size_t)(hit - p);
+        if (search_accept(s, t, pos))
+            return (i64)pos;
+        len = (size_t)(hit - p) + s->len - 1; // Only starts before hit remain
+    }
+    return -1;
+}
+
+// What counting scans add up, and collect if asked
+typedef struct
+{
+    size_t      count;
+    SearchHits* hits;   // Or NULL
+    bool        failed; // Out of memory collecting
+} ScanTally;
+
+static void block_tally(const Searcher* s, const SearchText* t, const char* p, size_t len, size_t base,
+    ScanTally* tally)
+{
+    const char* q = p;
+    const char* hit;
+    while ((hit = search_block(s, q, len - (size_t)(q - p))) != NULL) {
+        size_t pos = base + (size_t)(hit - p);
+        q          = hit + 1;
+        if (!search_accept(s, t, pos))
+            continue;
+        tally->count++;
+
+        SearchHits* hits = tally->hits;
+        if (!hits)
+            continue;
+        if (hits->count == hits->capacity) {
+            size_t  capacity = hits->capacity ? hits->capacity * 2 : 64;
+            size_t* grown    = realloc(hits->pos, capacity * sizeof(size_t));
+            if (!grown) {
+                tally->failed = true;
+                continue;
+            }
+            hits->pos      = grown;
+            hits->capacity = capacity;
+        }
+        hits->pos[hits->count++] = pos;
+    }
+}
+
+typedef enum {
+    SCAN_FIRST,
+    SCAN_LAST,
+    SCAN_COUNT,
+} ScanMode;
+
+static i64 block_scan(const Searcher* s, const SearchText* t, const char* p, size_t len, size_t base,
+    ScanMode mode, ScanTally* tally)
+{
+    if (mode == SCAN_COUNT) {
+        block_tally(s, t, p, len, base, tally);
+        return -1;
+    }
+    return mode == SCAN_FIRST ? block_first(s, t, p, len, base) : block_last(s, t, p, len, base);
+}
+
+// Matches crossing the seam between two runs, within [from, limit). They
+// are found in a copy of at most 2 * (len - 1) bytes around it. Only those
+// starting in the run before the seam count here: one starting further back
+// crosses an earlier seam too, and is found there.
+static i64 seam_scan(const Searcher* s, const SearchText* t, const SearchRun* run, size_t from, size_t limit,
+    ScanMode mode, ScanTally* tally)
+{
+    size_t seam  = run->pos + run->len;
+    size_t first = run->pos > from ? run->pos : from;
+    size_t a     = seam - first > s->len - 1 ? seam - (s->len - 1) : first;
+    size_t b = limit - seam > s->len - 1 ? seam + (s->len - 1) : limit;
+    if (b - a < s->len)
+        return -1;
+
+    char  stack[SEARCH_WINDOW_STACK];
+    char* window = b - a <= sizeof(stack) ? stack : malloc(b - a);
+    if (!window)
+        return -1;
+    text_extract(t, a, b - a, window);
+    i64 pos = block_scan(s, t, window, b - a, a, mode, tally);
+    if (window != stack)
+        free(window);
+    return pos;
+}
+
+// Matches starting in [from, to) and ending by t->end
+static i64 text_scan(const Searcher* s, const SearchText* t, size_t from, size_t to, ScanMode mode, ScanTally* tally)
+{
+    size_t m     = s->len;
+    size_t limit = to - 1 + m < t->end ? to - 1 + m : t->end; // No match can start at to or later
+    if (from >= to || limit < from || limit - from < m)
+        return -1;
+
+    size_t first = text_run_at(t, from);
+    size_t last  = text_run_at(t, limit - 1);
+    for (size_t i = 0; i <= last - first; i++) {
+        // Within a run, then across its seam with the next; backward, the
+        // seam comes first
+        size_t           r    = mode == SCAN_LAST ? last - i : first + i;
+        const SearchRun* run  = &t->runs[r];
+        size_t           seam = run->pos + run->len;
+        size_t           a    = run->pos > from ? run->pos : from;
+        size_t           b    = seam < limit ? seam : limit;
+        i64              pos  = -1;
+
+        if (mode == SCAN_LAST && seam < limit && m > 1)
+            pos = seam_scan(s, t, run, from, limit, mode, tally);
+        if (pos < 0 && b > a)
+            pos = block_scan(s, t, run->text + (a - run->pos), b - a, a, mode, tally);
+        if (pos < 0 && mode != SCAN_LAST && seam < limit && m > 1)
+            pos = seam_scan(s, t, run, from, limit, mode, tally);
+        if (pos >= 0)
+            return pos;
+    }
+    return -1;
+}
+
+// ------------------------------------------------------------ searching
+
+// Ranges are scanned a chunk at a time; this is also the unit parallel
+// workers claim, and how far one may run past a match found by another
+#define SEARCH_CHUNK (1024 * 1024)
+
+static i64 search_range(const Searcher* s, Buffer* buf, size_t start, size_t end, ScanMode mode, ScanTally* tally)
+{
+    size_t len = buffer_length(buf);
+    if (end > len)
+        end = len;
+    if (s->len == 0 || start >= end || end - start < s->len)
+        return -1;
+
+    // Candidate starts in [start, end - len], a chunk of them at a time
+    size_t last_start = end - s->len + 1;
+    size_t chunks     = (last_start - start + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+    for (size_t i = 0; i < chunks; i++) {
+        size_t c    = mode == SCAN_LAST ? chunks - 1 - i : i;
+        size_t from = start + c * SEARCH_CHUNK;
+        size_t to   = from + SEARCH_CHUNK < last_start ? from + SEARCH_CHUNK : last_start;
+
+        SearchText t;
+        if (!text_load(&t, buf, from, to - 1 + s->len))
+            return -1;
+        i64 pos = text_scan(s, &t, from, to, mode, tally);
+        free(t.runs);
+        if (pos >= 0)
+            return pos;
+    }
+    return -1;
+}
+
+i64 search_forward(const Searcher* s, Buffer* buf, size_t start, size_t end)
+{
+    return search_range(s, buf, start, end, SCAN_FIRST, NULL);
+}
+
+i64 search_backward(const Searcher* s, Buffer* buf, size_t start, size_t end)
+{
+    return search_range(s, buf, start, end, SCAN_LAST, NULL);
+}
+
+bool search_collect(const Searcher* s, Buffer* buf, size_t start, size_t end, SearchHits* hits)
+{
+    ScanTally tally = { .hits = hits };
+    search_range(s, buf, start, end, SCAN_COUNT, &tally);
+    return !tally.failed;
+}
+
+// ----------------------------------------------------------- thread pool
+
+// Workers are started on first use and then parked, so a parallel search
+// costs a broadcast rather than thread creation. The calling thread takes
+// part too. One parallel search runs at a time.
+#define SEARCH_MAX_THREADS 64
+
+typedef struct
+{
+    pthread_mutex_t call_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+    int             started;
+    u64             generation;
+    int             participants; // Caller included
+    int             busy;         // Workers still running the job
+    void (*job)(void*);
+    void* arg;
+} SearchPool;
+
+static SearchPool pool = {
+    .call_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock      = PTHREAD_MUTEX_INITIALIZER,
+    .wake      = PTHREAD_COND_INITIALIZER,
+    .done      = PTHREAD_COND_INITIALIZER,
+};
+
+static void* pool_worker(void* arg)
+{
+    int index = (int)(intptr_t)arg; // 1-based; the caller is 0
+    u64 seen  = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+        if (index >= pool.participants)
+            continue;
+
+        void (*job)(void*) = pool.job;
+        void* job_arg      = pool.arg;
+        pthread_mutex_unlock(&pool.lock);
+        job(job_arg);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
+
+// Run job on up to threads threads, returning once all have finished
+static void pool_run(int threads, void (*job)(void*), void* arg)
+{
+    pthread_mutex_lock(&pool.call_lock);
+    while (pool.started < threads - 1) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, (void*)(intptr_t)(pool.started + 1)) != 0)
+            break;
+        pthread_detach(thread);
+        pool.started++;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.participants = threads - 1 < pool.started ? threads : pool.started + 1;
+    pool.busy         = pool.participants - 1;
+    pool.job          = job;
+    pool.arg          = arg;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    job(arg);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.call_lock);
+}
+
+// ------------------------------------------------------ parallel search
+
+typedef struct
+{
+    const Searcher*   s;
+    const SearchText* t;
+    size_t            last_start; // One past the last candidate start
+    size_t            chunks;
+    bool              counting;
+
+    // Updated atomically by the workers
+    size_t next;  // Next chunk to claim
+    size_t found; // Lowest match so far, or SIZE_MAX
+    size_t count;
+} SearchJob;
+
+static void search_job(void* arg)
+{
+    SearchJob* job = arg;
+    for (;;) {
+        size_t c = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (c >= job->chunks)
+            break;
+        size_t from = job->t->start + c * SEARCH_CHUNK;
+        size_t to   = from + SEARCH_CHUNK < job->last_start ? from + SEARCH_CHUNK : job->last_start;
+
+        if (job->counting) {
+            ScanTally tally = { 0 };
+            text_scan(job->s, job->t, from, to, SCAN_COUNT, &tally);
+            __atomic_add_fetch(&job->count, tally.count, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // Chunks are claimed in order, so once any match is known, every
+        // chunk still unclaimed lies after it
+        if (from > __atomic_load_n(&job->found, __ATOMIC_RELAXED))
+            break;
+        i64 pos = text_scan(job->s, job->t, from, to, SCAN_FIRST, NULL);
+        if (pos < 0)
+            continue;
+        size_t seen = __atomic_load_n(&job->found, __ATOMIC_RELAXED);
+        while ((size_t)pos < seen
+            && !__atomic_compare_exchange_n(&job->found, &seen, (size_t)pos, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static int search_threads(int threads)
+{
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+    return threads < SEARCH_MAX_THREADS ? threads : SEARCH_MAX_THREADS;
+}
+
+static bool search_parallel(const Searcher* s, Buffer* buf, size_t start, size_t end, int threads, SearchJob* job)
+{
+    SearchText t;
+    if (!text_load(&t, buf, start, end))
+        return false;
+
+    job->s          = s;
+    job->t          = &t;
+    job->last_start = end - s->len + 1;
+    job->chunks     = (job->last_start - start + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+    job->next       = 0;
+    job->found      = SIZE_MAX;
+    job->count      = 0;
+
+    pool_run(threads, search_job, job);
+    free(t.runs);
+    return true;
+}
+
+i64 search_forward_parallel(const Searcher* s, Buffer* buf, size_t start, size_t end, int threads)
+{
+    size_t len = buffer_length(buf);
+    if (end > len)
+        end = len;
+    threads = search_threads(threads);
+    if (threads == 1 || start >= end || end - start < 2 * SEARCH_CHUNK)
+        return search_forward(s, buf, start, end);
+
+    SearchJob job = { .counting = false };
+    if (!search_parallel(s, buf, start, end, threads, &job))
+        return -1;
+    return job.found == SIZE_MAX ? -1 : (i64)job.found;
+}
+
+size_t search_count(const Searcher* s, Buffer* buf, size_t start, size_t end, int threads)
+{
+    size_t len = buffer_length(buf);
+    if (end > len)
+        end = len;
+    if (s->len == 0 || start >= end || end - start < s->len)
+        return 0;
+
+    threads = search_threads(threads);
+    if (threads == 1 || end - start < 2 * SEARCH_CHUNK) {
+        ScanTally tally = { 0 };
+        search_range(s, buf, start, end, SCAN_COUNT, &tally);
+        return tally.count;
+    }
+
+    SearchJob job = { .counting = true };
+    if (!search_parallel(s, buf, start, end, threads, &job))
+        return 0;
+    return job.count;
+}
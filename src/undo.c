@@ -1,6 +1,11 @@
+#define _GNU_SOURCE // O_TMPFILE, fallocate
 #include "undo.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define INITIAL_CAPACITY 256
 
@@ -19,18 +24,213 @@ UndoStack* undo_create(void)
     stack->count    = 0;
     stack->capacity = INITIAL_CAPACITY;
     stack->current  = 0;
+    stack->open     = false;
+    stack->last_ms  = 0;
+    memset(&stack->arena, 0, sizeof(stack->arena));
+    stack->memory       = 0;
+    stack->pending      = 0;
+    stack->spill_fd     = -1;
+    stack->spill_start  = 0;
+    stack->spill_end    = 0;
+    stack->memory_limit = UNDO_MEMORY_LIMIT;
+    stack->spill_min    = UNDO_SPILL_MIN;
+    stack->disk_limit   = UNDO_DISK_LIMIT;
+    stack->group_depth  = 0;
+    stack->group_start  = 0;
+    stack->group_cursor = 0;
 
     return stack;
 }
 
+void undo_set_limits(UndoStack* stack, size_t memory_limit, size_t spill_min, size_t disk_limit)
+{
+    stack->memory_limit = memory_limit;
+    stack->spill_min    = spill_min;
+    stack->disk_limit   = disk_limit;
+}
+
+// Take n bytes from the arena: from the top chunk if they fit, otherwise
+// from the next one, made big enough for them
+static char* arena_alloc(UndoArena* a, size_t n)
+{
+    if (a->top < a->count && a->chunks[a->top].size - a->used >= n) {
+        char* p = a->chunks[a->top].data + a->used;
+        a->used += n;
+        return p;
+    }
+
+    size_t next = a->count ? a->top + 1 : 0;
+    if (next < a->count && a->chunks[next].size < n) {
+        a->bytes -= a->chunks[next].size;
+        free(a->chunks[next].data);
+        a->count = next;
+    }
+    if (next == a->count) {
+        if (a->count == a->capacity) {
+            size_t     capacity = a->capacity ? a->capacity * 2 : 16;
+            UndoChunk* chunks   = realloc(a->chunks, capacity * sizeof(UndoChunk));
+            if (!chunks)
+                return NULL;
+            a->chunks   = chunks;
+            a->capacity = capacity;
+        }
+        size_t size = n > UNDO_CHUNK ? n : UNDO_CHUNK;
+        char*  data = malloc(size);
+        if (!data)
+            return NULL;
+        a->chunks[a->count++] = (UndoChunk) { data, size };
+        a->bytes += size;
+    }
+
+    a->top  = next;
+    a->used = n;
+    return a->chunks[next].data;
+}
+
+// Widen the block of size bytes at p by extra bytes, if it was the last
+// taken and its chunk has room
+static bool arena_extend(UndoArena* a, const char* p, size_t size, size_t extra)
+{
+    if (a->top >= a->count)
+        return false;
+    UndoChunk* c = &a->chunks[a->top];
+    if (p + size != c->data + a->used || c->size - a->used < extra)
+        return false;
+    a->used += extra;
+    return true;
+}
+
+// Give back everything taken since the top was at chunk, used. The chunk
+// after it is kept for reuse unless it was sized for one big text.
+static void arena_reset(UndoArena* a, size_t chunk, size_t used)
+{
+    size_t keep = chunk + 2;
+    if (chunk + 1 < a->count && a->chunks[chunk + 1].size != UNDO_CHUNK)
+        keep = chunk + 1;
+    while (a->count > keep) {
+        a->count--;
+        a->bytes -= a->chunks[a->count].size;
+        free(a->chunks[a->count].data);
+    }
+    a->top  = chunk;
+    a->used = used;
+}
+
+// Free the first n chunks, which only dropped operations used
+static void arena_drop_front(UndoArena* a, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        a->bytes -= a->chunks[i].size;
+        free(a->chunks[i].data);
+    }
+    if (n > 0)
+        memmove(a->chunks, a->chunks + n, (a->count - n) * sizeof(UndoChunk));
+    a->count -= n;
+    a->top -= n;
+}
+
+static bool spill_open(UndoStack* stack)
+{
+    if (stack->spill_fd >= 0)
+        return true;
+
+    const char* dir = getenv("TMPDIR");
+    if (!dir || !*dir)
+        dir = "/tmp";
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        // No O_TMPFILE support there: a named file, unlinked at once
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/ksedit-undo-XXXXXX", dir);
+        fd = mkstemp(path);
+        if (fd >= 0)
+            unlink(path);
+    }
+    stack->spill_fd = fd;
+    return fd >= 0;
+}
+
+static bool spill_write(int fd, const char* data, size_t len, size_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= (size_t)n;
+        offset += (size_t)n;
+    }
+    return true;
+}
+
+static bool spill_read(int fd, char* out, size_t len, size_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, out, len, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        out += n;
+        len -= (size_t)n;
+        offset += (size_t)n;
+    }
+    return true;
+}
+
+// The live part of the spill file is now start to end: give the disk space
+// outside it back. Failing to is harmless, as later texts write over it.
+static void spill_trim(UndoStack* stack, size_t start, size_t end)
+{
+    int fd = stack->spill_fd;
+    if (start == end)
+        start = end = 0; // Nothing live, so the file starts over
+    if (fd >= 0 && end < stack->spill_end)
+        ftruncate(fd, (off_t)end);
+    if (fd >= 0 && start > stack->spill_start && start < end)
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)stack->spill_start,
+            (off_t)(start - stack->spill_start));
+    stack->spill_start = start;
+    stack->spill_end   = end;
+}
+
+// Bytes op holds in memory outside the arena
+static size_t op_bytes(const Operation* op)
+{
+    size_t bytes = sizeof(Operation);
+    if (op->replace) {
+        const ReplaceOp* r = op->replace;
+        bytes += sizeof(ReplaceOp) + r->count * sizeof(size_t) + r->old_len * (r->old_each ? r->count : 1) + r->new_len;
+    }
+    if (op->batch) {
+        const BatchOp* b = op->batch;
+        bytes += sizeof(BatchOp) + b->count * sizeof(BatchEdit);
+        for (size_t i = 0; i < b->count; i++)
+            bytes += b->edits[i].old_len + b->edits[i].new_len;
+    }
+    return bytes;
+}
+
+static void op_free(Operation* op)
+{
+    undo_free_replace(op->replace);
+    undo_free_batch(op->batch);
+}
+
 void undo_destroy(UndoStack* stack)
 {
     if (!stack)
         return;
 
-    for (size_t i = 0; i < stack->count; i++) {
-        free(stack->ops[i].text);
-    }
+    for (size_t i = 0; i < stack->count; i++)
+        op_free(&stack->ops[i]);
+    for (size_t i = 0; i < stack->arena.count; i++)
+        free(stack->arena.chunks[i].data);
+    free(stack->arena.chunks);
+    if (stack->spill_fd >= 0)
+        close(stack->spill_fd);
     free(stack->ops);
     free(stack);
 }
@@ -45,49 +245,580 @@ static void undo_ensure_capacity(UndoStack* stack)
 
 static void undo_truncate(UndoStack* stack)
 {
-    // Remove any redo history when new operation is pushed
-    for (size_t i = stack->current; i < stack->count; i++) {
-        free(stack->ops[i].text);
+    // Remove any redo history when new operation is pushed. Their text was
+    // all taken after the first of them began, in the arena and the file.
+    if (stack->current < stack->count) {
+        Operation* first = &stack->ops[stack->current];
+        size_t     end   = stack->spill_end;
+        for (size_t i = stack->count; i-- > stack->current;) {
+            Operation* op = &stack->ops[i];
+            if (op->spill >= 0)
+                end = (size_t)op->spill;
+            stack->memory -= op_bytes(op);
+            op_free(op);
+        }
+        arena_reset(&stack->arena, first->chunk, first->used);
+        spill_trim(stack, stack->spill_start, end);
     }
-    stack->count = stack->current;
+    stack->count   = stack->current;
+    stack->open    = false;
+    stack->pending = 0;
 }
 
-void undo_push_insert(UndoStack* stack, size_t pos, const char* text, size_t len)
+// Drop every operation
+static void undo_clear(UndoStack* stack)
 {
+    stack->current = 0;
     undo_truncate(stack);
-    undo_ensure_capacity(stack);
+}
 
-    Operation* op = &stack->ops[stack->count];
-    op->type      = OP_INSERT;
-    op->pos       = pos;
-    op->len       = len;
-    op->text      = malloc(len + 1);
-    memcpy(op->text, text, len);
-    op->text[len] = '\0';
+// Drop the oldest operations while the history is over a limit, down to
+// three quarters of it so the rest move seldom. The top one always stays.
+static void undo_evict(UndoStack* stack)
+{
+    UndoArena* a = &stack->arena;
+    if (stack->memory + a->bytes <= stack->memory_limit && stack->spill_end - stack->spill_start <= stack->disk_limit)
+        return;
 
-    stack->count++;
-    stack->current++;
+    size_t memory_goal = stack->memory_limit / 4 * 3;
+    size_t disk_goal   = stack->disk_limit / 4 * 3;
+    size_t memory      = stack->memory;
+    size_t arena       = a->bytes;
+    size_t start       = stack->spill_start;
+    size_t k = 0, chunks = 0;
+    while (k + 1 < stack->count && (memory + arena > memory_goal || stack->spill_end - start > disk_goal)) {
+        Operation* op = &stack->ops[k++];
+        memory -= op_bytes(op);
+        if (op->spill >= 0)
+            start = (size_t)op->spill + op->len; // Spilled texts follow one another
+        op_free(op);
+
+        // Chunks before the first kept operation's mark are free to go
+        for (; chunks < stack->ops[k].chunk; chunks++)
+            arena -= a->chunks[chunks].size;
+    }
+    if (k == 0)
+        return;
+
+    arena_drop_front(a, chunks);
+    memmove(stack->ops, stack->ops + k, (stack->count - k) * sizeof(Operation));
+    stack->count -= k;
+    stack->current -= k;
+    stack->group_start = stack->group_start > k ? stack->group_start - k : 0;
+    for (size_t i = 0; i < stack->count; i++)
+        stack->ops[i].chunk -= chunks;
+    stack->memory = memory;
+    spill_trim(stack, start, stack->spill_end);
+
+    if (stack->capacity > INITIAL_CAPACITY && stack->count < stack->capacity / 4) {
+        Operation* ops = realloc(stack->ops, sizeof(Operation) * (stack->capacity / 2));
+        if (ops) {
+            stack->ops = ops;
+            stack->capacity /= 2;
+        }
+    }
 }
 
-void undo_push_delete(UndoStack* stack, size_t pos, const char* text, size_t len)
+// A new operation on top, with no text yet
+static Operation* undo_push_op(UndoStack* stack, OpType type, size_t pos)
 {
     undo_truncate(stack);
     undo_ensure_capacity(stack);
 
     Operation* op = &stack->ops[stack->count];
-    op->type      = OP_DELETE;
+    op->type      = type;
     op->pos       = pos;
-    op->len       = len;
-    op->text      = malloc(len + 1);
-    memcpy(op->text, text, len);
-    op->text[len] = '\0';
+    op->text      = NULL;
+    op->len       = 0;
+    op->lead      = 0;
+    op->capacity  = 0;
+    op->chunk     = stack->arena.top;
+    op->used      = stack->arena.used;
+    op->spill     = -1;
+    op->joined    = false;
+    op->replace   = NULL;
+    op->batch     = NULL;
 
     stack->count++;
     stack->current++;
+    stack->memory += sizeof(Operation);
+    return op;
+}
+
+bool undo_push_begin(UndoStack* stack, OpType type, size_t pos, size_t len)
+{
+    Operation* op = undo_push_op(stack, type, pos);
+    if (len >= stack->spill_min && len <= stack->disk_limit && spill_open(stack)) {
+        op->spill = (i64)stack->spill_end;
+        stack->spill_end += len;
+    } else {
+        // Small, or no file to spill to
+        op->text = len < stack->memory_limit ? arena_alloc(&stack->arena, len + 1) : NULL;
+        if (!op->text) {
+            undo_clear(stack);
+            return false;
+        }
+        op->capacity  = len + 1;
+        op->text[len] = '\0';
+    }
+    op->len        = len;
+    stack->pending = len;
+    undo_evict(stack);
+    return true;
+}
+
+void undo_push_piece(UndoStack* stack, const char* text, size_t len)
+{
+    if (len > stack->pending)
+        len = stack->pending;
+    if (len == 0)
+        return;
+
+    Operation* op = &stack->ops[stack->count - 1];
+    size_t     at = op->len - stack->pending;
+    stack->pending -= len;
+    if (op->spill < 0)
+        memcpy(op->text + at, text, len);
+    else if (!spill_write(stack->spill_fd, text, len, (size_t)op->spill + at))
+        undo_clear(stack);
+}
+
+void undo_drop(UndoStack* stack)
+{
+    if (stack->current == 0 || stack->current != stack->count)
+        return;
+    stack->current--;
+    undo_truncate(stack);
+}
+
+bool undo_read_text(UndoStack* stack, const Operation* op, size_t offset, char* out, size_t n)
+{
+    if (op->spill < 0) {
+        memcpy(out, op->text + offset, n);
+        return true;
+    }
+    return spill_read(stack->spill_fd, out, n, (size_t)op->spill + offset);
+}
+
+static void undo_push_text(UndoStack* stack, OpType type, size_t pos, const char* text, size_t len)
+{
+    if (undo_push_begin(stack, type, pos, len))
+        undo_push_piece(stack, text, len);
+}
+
+void undo_push_insert(UndoStack* stack, size_t pos, const char* text, size_t len)
+{
+    undo_push_text(stack, OP_INSERT, pos, text, len);
+}
+
+void undo_push_delete(UndoStack* stack, size_t pos, const char* text, size_t len)
+{
+    undo_push_text(stack, OP_DELETE, pos, text, len);
+}
+
+// Word characters for step boundaries; bytes of multi-byte characters count
+// as word characters
+static bool is_word_byte(char c)
+{
+    unsigned char u = (unsigned char)c;
+    return u >= 0x80 || ((unsigned char)((u | 0x20) - 'a') < 26) || ((unsigned char)(u - '0') < 10) || u == '_';
+}
+
+// Add text to the front or back of op. When the spare room on that side
+// runs out the block at least doubles, in place if nothing was taken from
+// the arena after it, or else as a new block, leaving the old one unused.
+static bool op_grow(UndoArena* arena, Operation* op, const char* text, size_t len, bool front)
+{
+    size_t tail = op->capacity - op->lead - op->len - 1;
+    if (front ? op->lead < len : tail < len) {
+        size_t extra = op->len + len + 1;
+        char*  block = op->text - op->lead;
+        if (arena_extend(arena, block, op->capacity, extra)) {
+            if (front) {
+                memmove(op->text + extra, op->text, op->len + 1);
+                op->text += extra;
+                op->lead += extra;
+            }
+            op->capacity += extra;
+        } else {
+            size_t capacity = extra * 2;
+            size_t lead     = front ? capacity - op->len - 1 : 0;
+            block           = arena_alloc(arena, capacity);
+            if (!block)
+                return false;
+            memcpy(block + lead, op->text, op->len + 1);
+            op->text     = block + lead;
+            op->lead     = lead;
+            op->capacity = capacity;
+        }
+    }
+
+    if (front) {
+        op->text -= len;
+        op->lead -= len;
+        memcpy(op->text, text, len);
+    } else {
+        memcpy(op->text + op->len, text, len);
+        op->text[op->len + len] = '\0';
+    }
+    op->len += len;
+    return true;
+}
+
+void undo_push_typed(UndoStack* stack, OpType type, size_t pos, const char* text, size_t len, u64 now_ms)
+{
+    Operation* op     = stack->open && stack->count > 0 ? &stack->ops[stack->count - 1] : NULL;
+    bool       recent = op && now_ms - stack->last_ms < UNDO_MERGE_MS;
+    bool       joined = false;
+    stack->last_ms    = now_ms;
+    if (recent && len > 0 && op->type == type && op->spill < 0) {
+        // Where the new text goes in op's text: after it when typing or
+        // deleting forward, before it when backspacing
+        bool front = type == OP_DELETE && pos + len == op->pos;
+        bool back  = type == OP_INSERT ? pos == op->pos + op->len : pos == op->pos;
+        if (front || back) {
+            char left  = front ? text[len - 1] : op->text[op->len - 1];
+            char right = front ? op->text[0] : text[0];
+            bool split = op->len >= UNDO_STEP_MIN && !is_word_byte(left) && is_word_byte(right);
+            if (!split && op_grow(&stack->arena, op, text, len, front)) {
+                if (front)
+                    op->pos = pos;
+                joined = true;
+            }
+        }
+    }
+
+    if (!joined)
+        undo_push_text(stack, type, pos, text, len);
+    else
+        undo_evict(stack);
+    stack->open = stack->count > 0;
+}
+
+void undo_seal(UndoStack* stack) { stack->open = false; }
+
+// A group being composed: edits to the text as it was when the group
+// began, ascending and apart, each with its own copy of the old and new text
+typedef struct
+{
+    size_t pos;
+    char*  old_text;
+    size_t old_len;
+    char*  new_text;
+    size_t new_len;
+} GroupEdit;
+
+typedef struct
+{
+    GroupEdit* edits;
+    size_t     count;
+    size_t     capacity;
+} Group;
+
+static char* join(const char* a, size_t a_len, const char* b, size_t b_len, const char* c, size_t c_len)
+{
+    char* s = malloc(a_len + b_len + c_len + 1);
+    if (!s)
+        return NULL;
+    memcpy(s, a, a_len);
+    memcpy(s + a_len, b, b_len);
+    memcpy(s + a_len + b_len, c, c_len);
+    return s;
+}
+
+// A new edit at index i
+static bool group_add(Group* g, size_t i, size_t pos, const char* old_text, size_t old_len, const char* new_text,
+    size_t new_len)
+{
+    if (g->count == g->capacity) {
+        size_t     capacity = g->capacity ? g->capacity * 2 : 8;
+        GroupEdit* edits    = realloc(g->edits, capacity * sizeof(GroupEdit));
+        if (!edits)
+            return false;
+        g->edits    = edits;
+        g->capacity = capacity;
+    }
+
+    GroupEdit e = { pos, join(old_text, old_len, "", 0, "", 0), old_len, NULL, new_len };
+    e.new_text  = join(new_text, new_len, "", 0, "", 0);
+    if (!e.old_text || !e.new_text) {
+        free(e.old_text);
+        free(e.new_text);
+        return false;
+    }
+    memmove(g->edits + i + 1, g->edits + i, (g->count - i) * sizeof(GroupEdit));
+    g->edits[i] = e;
+    g->count++;
+    return true;
+}
+
+// Text inserted at pos, in the text as the edits so far left it. The
+// unsigned sums below wrap where an edit shrank the text, and come out
+// right.
+static bool group_insert(Group* g, size_t pos, const char* text, size_t len)
+{
+    size_t shift = 0; // Growth from the edits before i
+    size_t i     = 0;
+    for (; i < g->count; i++) {
+        GroupEdit* e     = &g->edits[i];
+        size_t     start = e->pos + shift;
+        if (pos < start)
+            break;
+        if (pos <= start + e->new_len) {
+            // Into the edit's own new text
+            size_t at = pos - start;
+            char*  s  = join(e->new_text, at, text, len, e->new_text + at, e->new_len - at);
+            if (!s)
+                return false;
+            free(e->new_text);
+            e->new_text = s;
+            e->new_len += len;
+            return true;
+        }
+        shift += e->new_len - e->old_len;
+    }
+    return group_add(g, i, pos - shift, "", 0, text, len);
+}
+
+// The len bytes at pos, which were text, removed from the text as the
+// edits so far left it. Every edit the range touches becomes one.
+static bool group_delete(Group* g, size_t pos, const char* text, size_t len)
+{
+    size_t shift = 0;
+    size_t i     = 0;
+    while (i < g->count && g->edits[i].pos + shift + g->edits[i].new_len < pos) {
+        shift += g->edits[i].new_len - g->edits[i].old_len;
+        i++;
+    }
+    size_t end = pos + len;
+    size_t j = i, last_shift = shift, after = shift;
+    while (j < g->count && g->edits[j].pos + after <= end) {
+        last_shift = after;
+        after += g->edits[j].new_len - g->edits[j].old_len;
+        j++;
+    }
+    if (i == j)
+        return group_add(g, i, pos - shift, text, len, "", 0);
+
+    // Edits i to j - 1 merge, with the text between them and any the range
+    // takes on either side
+    GroupEdit* first     = &g->edits[i];
+    GroupEdit* last      = &g->edits[j - 1];
+    size_t     first_at  = first->pos + shift;
+    size_t     last_at   = last->pos + last_shift;
+    size_t     last_end  = last_at + last->new_len;
+    size_t     head      = pos > first_at ? pos - first_at : 0; // New text of first kept before the range,
+    size_t     tail      = end < last_end ? last_end - end : 0; // and of last after it
+    size_t     old_start = pos < first_at ? pos - shift : first->pos;
+    size_t     old_end   = last->pos + last->old_len + (end > last_end ? end - last_end : 0);
+
+    char* old_text = malloc(old_end - old_start + 1);
+    char* new_text = join(first->new_text, head, "", 0, last->new_text + last->new_len - tail, tail);
+    if (!old_text || !new_text) {
+        free(old_text);
+        free(new_text);
+        return false;
+    }
+    size_t o = 0;
+    if (pos < first_at) {
+        memcpy(old_text, text, first_at - pos);
+        o = first_at - pos;
+    }
+    size_t at = first_at; // Walks the range, in the text as it is now
+    for (size_t k = i; k < j; k++) {
+        GroupEdit* e = &g->edits[k];
+        memcpy(old_text + o, e->old_text, e->old_len);
+        o += e->old_len;
+        at += e->new_len;
+        shift += e->new_len - e->old_len;
+
+        // Unchanged text up to the next edit, or to the end of the range
+        size_t next = k + 1 < j ? g->edits[k + 1].pos + shift : end;
+        if (next > at) {
+            memcpy(old_text + o, text + (at - pos), next - at);
+            o += next - at;
+            at = next;
+        }
+        free(e->old_text);
+        free(e->new_text);
+    }
+
+    g->edits[i] = (GroupEdit) { old_start, old_text, old_end - old_start, new_text, head + tail };
+    memmove(g->edits + i + 1, g->edits + j, (g->count - j) * sizeof(GroupEdit));
+    g->count -= j - i - 1;
+    return true;
+}
+
+// Add op to the group, a batch or replace as its edits one after another
+static bool group_op(Group* g, const Operation* op)
+{
+    if (op->spill >= 0)
+        return false;
+    if (op->type == OP_INSERT)
+        return group_insert(g, op->pos, op->text, op->len);
+    if (op->type == OP_DELETE)
+        return group_delete(g, op->pos, op->text, op->len);
+
+    size_t shift = 0, old_at = 0, new_at = 0;
+    if (op->type == OP_BATCH) {
+        const BatchOp* b = op->batch;
+        for (size_t i = 0; i < b->count; i++) {
+            const BatchEdit* e  = &b->edits[i];
+            size_t           at = e->pos + shift;
+            if (e->old_len && !group_delete(g, at, b->old_text + old_at, e->old_len))
+                return false;
+            if (e->new_len && !group_insert(g, at, b->new_text + new_at, e->new_len))
+                return false;
+            old_at += e->old_len;
+            new_at += e->new_len;
+            shift += e->new_len - e->old_len;
+        }
+        return true;
+    }
+
+    const ReplaceOp* r = op->replace;
+    for (size_t i = 0; i < r->count; i++) {
+        size_t at = r->positions[i] + shift;
+        if (r->old_len && !group_delete(g, at, r->old_text + (r->old_each ? i * r->old_len : 0), r->old_len))
+            return false;
+        if (r->new_len && !group_insert(g, at, r->new_text, r->new_len))
+            return false;
+        shift += r->new_len - r->old_len;
+    }
+    return true;
+}
+
+// The group's edits as one batch, leaving out any that cancelled out
+static BatchOp* group_batch(const Group* g, size_t cursor_old, size_t cursor_new)
+{
+    size_t old_total = 0, new_total = 0;
+    for (size_t i = 0; i < g->count; i++) {
+        old_total += g->edits[i].old_len;
+        new_total += g->edits[i].new_len;
+    }
+
+    BatchOp* b = calloc(1, sizeof(BatchOp));
+    if (!b)
+        return NULL;
+    b->edits    = malloc((g->count ? g->count : 1) * sizeof(BatchEdit));
+    b->old_text = malloc(old_total + 1);
+    b->new_text = malloc(new_total + 1);
+    if (!b->edits || !b->old_text || !b->new_text) {
+        undo_free_batch(b);
+        return NULL;
+    }
+
+    size_t old_at = 0, new_at = 0;
+    for (size_t i = 0; i < g->count; i++) {
+        const GroupEdit* e = &g->edits[i];
+        if (e->old_len == 0 && e->new_len == 0)
+            continue;
+        b->edits[b->count++] = (BatchEdit) { e->pos, e->old_len, e->new_len };
+        memcpy(b->old_text + old_at, e->old_text, e->old_len);
+        memcpy(b->new_text + new_at, e->new_text, e->new_len);
+        old_at += e->old_len;
+        new_at += e->new_len;
+    }
+    b->one_cursor = true;
+    b->cursor_old = cursor_old;
+    b->cursor_new = cursor_new;
+    return b;
+}
+
+void undo_begin_group(UndoStack* stack, size_t cursor)
+{
+    if (stack->group_depth++ > 0)
+        return;
+    stack->group_start  = stack->current; // Redo history past it goes at the first push
+    stack->group_cursor = cursor;
+    stack->open         = false;
+}
+
+void undo_end_group(UndoStack* stack, size_t cursor)
+{
+    if (stack->group_depth == 0 || --stack->group_depth > 0)
+        return;
+    stack->open = false;
+
+    size_t start = stack->group_start;
+    if (stack->count < start + 2 || stack->current != stack->count)
+        return; // One step already, or undone since
+
+    Group g  = { NULL, 0, 0 };
+    bool  ok = true;
+    for (size_t i = start; i < stack->count && ok; i++)
+        ok = group_op(&g, &stack->ops[i]);
+    BatchOp* batch = ok ? group_batch(&g, stack->group_cursor, cursor) : NULL;
+    for (size_t i = 0; i < g.count; i++) {
+        free(g.edits[i].old_text);
+        free(g.edits[i].new_text);
+    }
+    free(g.edits);
+
+    if (!batch) {
+        // Undo still takes them together, one at a time
+        for (size_t i = start + 1; i < stack->count; i++)
+            stack->ops[i].joined = true;
+        return;
+    }
+
+    // The batch takes the place of the group, holding its arena marks so
+    // dropping it frees the group's text too
+    Operation first = stack->ops[start];
+    for (size_t i = start; i < stack->count; i++) {
+        stack->memory -= op_bytes(&stack->ops[i]);
+        op_free(&stack->ops[i]);
+    }
+    stack->count = stack->current = start;
+
+    Operation* op = undo_push_op(stack, OP_BATCH, batch->count ? batch->edits[0].pos : 0);
+    op->chunk     = first.chunk;
+    op->used      = first.used;
+    op->batch     = batch;
+    stack->memory += op_bytes(op) - sizeof(Operation);
+    undo_evict(stack);
+}
+
+void undo_push_replace(UndoStack* stack, ReplaceOp* replace)
+{
+    Operation* op = undo_push_op(stack, OP_REPLACE, replace->count ? replace->positions[0] : 0);
+    op->replace   = replace;
+    stack->memory += op_bytes(op) - sizeof(Operation);
+    undo_evict(stack);
+}
+
+void undo_free_replace(ReplaceOp* replace)
+{
+    if (!replace)
+        return;
+    free(replace->positions);
+    free(replace->old_text);
+    free(replace->new_text);
+    free(replace);
+}
+
+void undo_push_batch(UndoStack* stack, BatchOp* batch)
+{
+    Operation* op = undo_push_op(stack, OP_BATCH, batch->count ? batch->edits[0].pos : 0);
+    op->batch     = batch;
+    stack->memory += op_bytes(op) - sizeof(Operation);
+    undo_evict(stack);
+}
+
+void undo_free_batch(BatchOp* batch)
+{
+    if (!batch)
+        return;
+    free(batch->edits);
+    free(batch->old_text);
+    free(batch->new_text);
+    free(batch);
 }
 
 Operation* undo_pop(UndoStack* stack)
 {
+    stack->open        = false;
+    stack->group_depth = 0;
     if (stack->current == 0)
         return NULL;
     stack->current--;
@@ -96,6 +827,8 @@ Operation* undo_pop(UndoStack* stack)
 
 Operation* redo_pop(UndoStack* stack)
 {
+    stack->open        = false;
+    stack->group_depth = 0;
     if (stack->current >= stack->count)
         return NULL;
     Operation* op = &stack->ops[stack->current];
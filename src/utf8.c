@@ -0,0 +1,324 @@
+#include "utf8.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86 1
+#endif
+
+// ---------------------------------------------------------------- decode
+
+size_t utf8_decode(const char* p, size_t len, u32* cp)
+{
+    const u8* s = (const u8*)p;
+    u8        c = s[0];
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    }
+
+    // Bounds on the second byte rule out overlong forms, surrogates and
+    // values past U+10FFFF
+    size_t n;
+    u32    v;
+    u8     lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+        v = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        v = c & 0x0F;
+        if (c == 0xE0)
+            lo = 0xA0;
+        else if (c == 0xED)
+            hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        v = c & 0x07;
+        if (c == 0xF0)
+            lo = 0x90;
+        else if (c == 0xF4)
+            hi = 0x8F;
+    } else {
+        goto malformed;
+    }
+
+    if (len < n || s[1] < lo || s[1] > hi)
+        goto malformed;
+    v = v << 6 | (s[1] & 0x3F);
+    for (size_t i = 2; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80)
+            goto malformed;
+        v = v << 6 | (s[i] & 0x3F);
+    }
+    *cp = v;
+    return n;
+
+malformed:
+    *cp = UTF8_REPLACEMENT;
+    return 1;
+}
+
+size_t utf8_encode(u32 cp, char* out)
+{
+    u8* o = (u8*)out;
+    if (cp < 0x80) {
+        o[0] = (u8)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        o[0] = 0xC0 | cp >> 6;
+        o[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp >= 0xD800 && cp <= 0xDFFF)
+        return 0;
+    if (cp < 0x10000) {
+        o[0] = 0xE0 | cp >> 12;
+        o[1] = 0x80 | (cp >> 6 & 0x3F);
+        o[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    if (cp <= 0x10FFFF) {
+        o[0] = 0xF0 | cp >> 18;
+        o[1] = 0x80 | (cp >> 12 & 0x3F);
+        o[2] = 0x80 | (cp >> 6 & 0x3F);
+        o[3] = 0x80 | (cp & 0x3F);
+        return 4;
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------- width
+
+typedef struct
+{
+    u32 first;
+    u32 last;
+} Utf8Range;
+
+// Combining marks, joiners and other characters that take no cell
+static const Utf8Range zero_width[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
+    { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x0670, 0x0670 },
+    { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 },
+    { 0x0730, 0x074A }, { 0x07A6, 0x07B0 }, { 0x07EB, 0x07F3 }, { 0x0816, 0x082D }, { 0x0859, 0x085B },
+    { 0x08D3, 0x08FF }, { 0x0900, 0x0902 }, { 0x093A, 0x093A }, { 0x093C, 0x093C }, { 0x0941, 0x0948 },
+    { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 }, { 0x0981, 0x0981 }, { 0x09BC, 0x09BC },
+    { 0x09C1, 0x09C4 }, { 0x09CD, 0x09CD }, { 0x09E2, 0x09E3 }, { 0x0A01, 0x0A02 }, { 0x0A3C, 0x0A3C },
+    { 0x0A41, 0x0A51 }, { 0x0A70, 0x0A71 }, { 0x0A81, 0x0A82 }, { 0x0ABC, 0x0ABC }, { 0x0AC1, 0x0AC8 },
+    { 0x0ACD, 0x0ACD }, { 0x0B01, 0x0B01 }, { 0x0B3C, 0x0B3C }, { 0x0B3F, 0x0B3F }, { 0x0B41, 0x0B44 },
+    { 0x0B4D, 0x0B4D }, { 0x0BC0, 0x0BC0 }, { 0x0BCD, 0x0BCD }, { 0x0C3E, 0x0C40 }, { 0x0C46, 0x0C56 },
+    { 0x0CBC, 0x0CBC }, { 0x0CCC, 0x0CCD }, { 0x0D41, 0x0D44 }, { 0x0D4D, 0x0D4D }, { 0x0DCA, 0x0DCA },
+    { 0x0DD2, 0x0DD6 }, { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x0EB1, 0x0EB1 },
+    { 0x0EB4, 0x0EBC }, { 0x0EC8, 0x0ECD }, { 0x0F18, 0x0F19 }, { 0x0F35, 0x0F39 }, { 0x0F71, 0x0F84 },
+    { 0x0F86, 0x0F87 }, { 0x0F8D, 0x0FBC }, { 0x102D, 0x1030 }, { 0x1032, 0x1037 }, { 0x1039, 0x103A },
+    { 0x1160, 0x11FF }, { 0x135D, 0x135F }, { 0x1712, 0x1714 }, { 0x17B4, 0x17B5 }, { 0x17B7, 0x17BD },
+    { 0x17C6, 0x17C6 }, { 0x17C9, 0x17D3 }, { 0x180B, 0x180F }, { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF },
+    { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2064 }, { 0x20D0, 0x20F0 }, { 0x2CEF, 0x2CF1 },
+    { 0x2DE0, 0x2DFF }, { 0x302A, 0x302D }, { 0x3099, 0x309A }, { 0xA66F, 0xA672 }, { 0xA674, 0xA67D },
+    { 0xA69E, 0xA69F }, { 0xA6F0, 0xA6F1 }, { 0xA8E0, 0xA8F1 }, { 0xFB1E, 0xFB1E }, { 0xFE00, 0xFE0F },
+    { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF }, { 0x101FD, 0x101FD }, { 0x10A01, 0x10A0F }, { 0x10A38, 0x10A3F },
+    { 0x11001, 0x11001 }, { 0x11038, 0x11046 }, { 0x1D167, 0x1D169 }, { 0x1D17B, 0x1D182 },
+    { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD }, { 0x1E8D0, 0x1E8D6 }, { 0x1F3FB, 0x1F3FF },
+};
+
+// East Asian wide and fullwidth characters, and emoji shown as pictures
+static const Utf8Range wide[] = {
+    { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A }, { 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 },
+    { 0x23F3, 0x23F3 }, { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 }, { 0x267F, 0x267F },
+    { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 }, { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+    { 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA }, { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 },
+    { 0x26FA, 0x26FA }, { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B }, { 0x2728, 0x2728 },
+    { 0x274C, 0x274C }, { 0x274E, 0x274E }, { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+    { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C }, { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 },
+    { 0x2E80, 0x3029 }, { 0x302E, 0x303E }, { 0x3041, 0x3098 }, { 0x309B, 0x33FF }, { 0x3400, 0x4DBF },
+    { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF }, { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+    { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 },
+    { 0x17000, 0x18CFF }, { 0x1B000, 0x1B2FF }, { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF },
+    { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F251 }, { 0x1F300, 0x1F320 },
+    { 0x1F32D, 0x1F335 }, { 0x1F337, 0x1F37C }, { 0x1F37E, 0x1F393 }, { 0x1F3A0, 0x1F3CA },
+    { 0x1F3CF, 0x1F3D3 }, { 0x1F3E0, 0x1F3F0 }, { 0x1F3F4, 0x1F3F4 }, { 0x1F3F8, 0x1F3FA },
+    { 0x1F400, 0x1F43E }, { 0x1F440, 0x1F440 }, { 0x1F442, 0x1F4FC }, { 0x1F4FF, 0x1F53D },
+    { 0x1F54B, 0x1F54E }, { 0x1F550, 0x1F567 }, { 0x1F57A, 0x1F57A }, { 0x1F595, 0x1F596 },
+    { 0x1F5A4, 0x1F5A4 }, { 0x1F5FB, 0x1F64F }, { 0x1F680, 0x1F6C5 }, { 0x1F6CC, 0x1F6CC },
+    { 0x1F6D0, 0x1F6D2 }, { 0x1F6D5, 0x1F6D7 }, { 0x1F6EB, 0x1F6EC }, { 0x1F6F4, 0x1F6FC },
+    { 0x1F7E0, 0x1F7EB }, { 0x1F90C, 0x1F93A }, { 0x1F93C, 0x1F945 }, { 0x1F947, 0x1F9FF },
+    { 0x1FA70, 0x1FAFF },
+};
+
+// Bit sets over the BMP and plane 1, built once from the tables above, so a
+// width costs two loads
+#define WIDTH_PLANES 0x20000
+
+static u8 zero_bits[WIDTH_PLANES / 8];
+static u8 wide_bits[WIDTH_PLANES / 8];
+
+static void mark_ranges(u8* bits, const Utf8Range* ranges, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        for (u32 cp = ranges[i].first; cp <= ranges[i].last; cp++)
+            bits[cp >> 3] |= (u8)(1 << (cp & 7));
+    }
+}
+
+int utf8_width(u32 cp)
+{
+    if (cp < 0x300)
+        return 1;
+    if (cp < WIDTH_PLANES) {
+        if (zero_bits[cp >> 3] >> (cp & 7) & 1)
+            return 0;
+        return 1 + (wide_bits[cp >> 3] >> (cp & 7) & 1);
+    }
+    if (cp < 0x40000) // Supplementary and tertiary ideographic planes
+        return 2;
+    if (cp >= 0xE0000 && cp <= 0xE0FFF) // Tags and variation selectors
+        return 0;
+    return 1;
+}
+
+// ---------------------------------------------------------------- scalar
+
+static size_t ascii_run_scalar(const char* p, size_t len)
+{
+    size_t i = 0;
+    while (i < len && (u8)p[i] < 0x80)
+        i++;
+    return i;
+}
+
+#ifdef UTF8_X86
+
+// ------------------------------------------------------------------ SSE2
+
+__attribute__((target("sse2"))) static size_t ascii_run_sse2(const char* p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        u32 m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + ascii_run_scalar(p + i, len - i);
+}
+
+// ------------------------------------------------------------------ AVX2
+
+__attribute__((target("avx2"))) static size_t ascii_run_avx2(const char* p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 32));
+        u64     m = (u32)_mm256_movemask_epi8(a) | (u64)(u32)_mm256_movemask_epi8(b) << 32;
+        if (m)
+            return i + __builtin_ctzll(m);
+    }
+    for (; i + 16 <= len; i += 16) {
+        u32 m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i)));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    return i + ascii_run_scalar(p + i, len - i);
+}
+
+#endif // UTF8_X86
+
+// -------------------------------------------------------------- dispatch
+
+typedef struct
+{
+    Utf8Kernel kind;
+    size_t (*ascii_run)(const char*, size_t);
+} Utf8Kernels;
+
+static const Utf8Kernels kernel_table[] = {
+    { UTF8_SCALAR, ascii_run_scalar },
+#ifdef UTF8_X86
+    { UTF8_SSE2, ascii_run_sse2 },
+    { UTF8_AVX2, ascii_run_avx2 },
+#endif
+};
+
+static const Utf8Kernels* kernels = &kernel_table[0];
+
+static bool kernel_supported(Utf8Kernel kernel)
+{
+    switch (kernel) {
+    case UTF8_SCALAR:
+        return true;
+#ifdef UTF8_X86
+    case UTF8_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case UTF8_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool utf8_use_kernel(Utf8Kernel kernel)
+{
+    if (!kernel_supported(kernel))
+        return false;
+
+    for (size_t i = 0; i < sizeof(kernel_table) / sizeof(kernel_table[0]); i++) {
+        if (kernel_table[i].kind == kernel) {
+            kernels = &kernel_table[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+Utf8Kernel utf8_active_kernel(void) { return kernels->kind; }
+
+// Pick the kernel and build the width sets before main() so worker threads
+// never race them
+__attribute__((constructor)) static void utf8_init(void)
+{
+#ifdef UTF8_X86
+    __builtin_cpu_init();
+#endif
+    if (!utf8_use_kernel(UTF8_AVX2))
+        utf8_use_kernel(UTF8_SSE2);
+
+    mark_ranges(zero_bits, zero_width, sizeof(zero_width) / sizeof(zero_width[0]));
+    mark_ranges(wide_bits, wide, sizeof(wide) / sizeof(wide[0]));
+}
+
+size_t utf8_ascii_run(const char* p, size_t len) { return kernels->ascii_run(p, len); }
+
+// ------------------------------------------------------------------ walk
+
+size_t utf8_walk(const char* p, size_t len, size_t stop, Utf8Unit unit, size_t target, Utf8Pos* at)
+{
+    if (stop > len)
+        stop = len;
+
+    size_t i = 0;
+    while (i < stop) {
+        // ASCII is one of every unit, so a run can be taken whole
+        size_t room = target - utf8_pos_get(at, unit);
+        size_t run  = kernels->ascii_run(p + i, stop - i < room ? stop - i : room);
+        at->byte += run;
+        at->cp += run;
+        at->col += run;
+        i += run;
+        if (i >= stop)
+            break;
+
+        u32    cp;
+        size_t n    = utf8_decode(p + i, len - i, &cp);
+        size_t w    = (size_t)utf8_width(cp);
+        size_t step = unit == UTF8_BYTES ? n : unit == UTF8_CODEPOINTS ? 1 : w;
+        if (step > target - utf8_pos_get(at, unit))
+            break;
+        at->byte += n;
+        at->cp++;
+        at->col += w;
+        i += n;
+    }
+    return i;
+}
@@ -1,10 +1,38 @@
 #include "window.h"
 #include <X11/Xutil.h>
+#include <locale.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Open the user's input method so keys arrive as UTF-8 text. Without one,
+// input falls back to Latin-1 (see input.c).
+static void window_open_im(Window_State* win, long* event_mask)
+{
+    win->im = XOpenIM(win->display, NULL, NULL, NULL);
+    win->ic = NULL;
+    if (!win->im)
+        return;
+
+    win->ic = XCreateIC(win->im, XNInputStyle, XIMPreeditNothing | XIMStatusNothing, XNClientWindow, win->window,
+        XNFocusWindow, win->window, NULL);
+    if (!win->ic) {
+        XCloseIM(win->im);
+        win->im = NULL;
+        return;
+    }
+
+    long filter = 0;
+    XGetICValues(win->ic, XNFilterEvents, &filter, NULL);
+    *event_mask |= filter;
+    XSetICFocus(win->ic);
+}
+
 bool window_init(Window_State* win, int width, int height, const char* title)
 {
+    // Input methods follow the locale
+    setlocale(LC_CTYPE, "");
+    XSetLocaleModifiers("");
+
     win->display = XOpenDisplay(NULL);
     if (!win->display)
         return false;
@@ -20,8 +48,10 @@ bool window_init(Window_State* win, int width, int height, const char* title)
 
     XStoreName(win->display, win->window, title);
 
-    XSelectInput(win->display, win->window,
-        ExposureMask | KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | StructureNotifyMask | PointerMotionMask);
+    long event_mask = ExposureMask | KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask
+        | StructureNotifyMask | PointerMotionMask;
+    window_open_im(win, &event_mask);
+    XSelectInput(win->display, win->window, event_mask);
 
     win->gc = XCreateGC(win->display, win->window, 0, NULL);
 
@@ -65,6 +95,10 @@ void window_destroy(Window_State* win)
         XDestroyImage(win->backbuffer);
     }
     free(win->pixels);
+    if (win->ic)
+        XDestroyIC(win->ic);
+    if (win->im)
+        XCloseIM(win->im);
     XFreeGC(win->display, win->gc);
     XDestroyWindow(win->display, win->window);
     XCloseDisplay(win->display);
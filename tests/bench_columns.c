@@ -0,0 +1,103 @@
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// One long line of mostly ASCII with a multi-byte character every so often
+static Buffer* make_buffer(BufferStorage storage, size_t line_len)
+{
+    Buffer* buf  = buffer_create_with_storage(64, storage);
+    char*   line = malloc(line_len);
+    for (size_t i = 0; i < line_len; i++)
+        line[i] = (char)('a' + i % 26);
+    for (size_t i = 0; i + 3 <= line_len; i += 97)
+        memcpy(line + i, "\xe4\xb8\xad", 3);
+    buffer_insert_text(buf, line, line_len);
+    free(line);
+    return buf;
+}
+
+static void bench(const char* title, BufferStorage storage, size_t line_len)
+{
+    printf("%s, %zu MB line:\n", title, line_len >> 20);
+    Buffer* buf = make_buffer(storage, line_len);
+    double  t;
+    size_t  sink = 0;
+
+    buffer_rebuild_line_index(buf); // Forgets the checkpoints the insert built
+    t = get_time_ms();
+    sink += buffer_line_pos(buf, line_len - 1).col;
+    printf("  %-34s %8.2f ms\n", "first lookup (builds checkpoints)", get_time_ms() - t);
+
+    srand(1);
+    t = get_time_ms();
+    for (int i = 0; i < 100000; i++)
+        sink += buffer_line_pos(buf, (size_t)rand() % line_len).col;
+    printf("  %-34s %8.2f us\n", "byte -> column", (get_time_ms() - t) * 1000.0 / 100000);
+
+    t = get_time_ms();
+    for (int i = 0; i < 100000; i++)
+        sink += buffer_line_seek(buf, 0, UTF8_COLUMNS, (size_t)rand() % line_len).byte;
+    printf("  %-34s %8.2f us\n", "column -> byte", (get_time_ms() - t) * 1000.0 / 100000);
+
+    // Typing in the middle, each keystroke followed by a lookup at the far end
+    buffer_move_cursor_to(buf, line_len / 2);
+    t = get_time_ms();
+    for (int i = 0; i < 10000; i++) {
+        buffer_insert_char(buf, (i & 7) ? 'x' : ' ');
+        sink += buffer_line_pos(buf, buffer_length(buf)).col;
+    }
+    printf("  %-34s %8.2f us\n", "keystroke + lookup past it", (get_time_ms() - t) * 1000.0 / 10000);
+
+    printf("  (%zu)\n", sink & 1);
+    buffer_destroy(buf);
+}
+
+// A 512 MB line scrolled to column 400,000,000: what a frame, a click and
+// Home/End there cost once the line has been indexed
+static void bench_far_column(void)
+{
+    size_t  line_len = (size_t)512 << 20;
+    size_t  target   = 400000000;
+    Buffer* buf      = make_buffer(STORAGE_GAP, line_len);
+    double  t;
+    size_t  sink = 0;
+    printf("Gap buffer, 512 MB line, column %zu:\n", target);
+
+    buffer_rebuild_line_index(buf);
+    t = get_time_ms();
+    sink += buffer_line_seek(buf, 0, UTF8_COLUMNS, target).byte;
+    printf("  %-34s %8.2f ms\n", "first seek (indexes the line)", get_time_ms() - t);
+
+    t = get_time_ms();
+    for (int i = 0; i < 1000; i++)
+        sink += buffer_line_seek(buf, 0, UTF8_COLUMNS, target + (size_t)i * 8).byte;
+    printf("  %-34s %8.2f us\n", "seek (scrolling)", (get_time_ms() - t) * 1000.0 / 1000);
+
+    buffer_move_cursor_to(buf, line_len / 2);
+    t = get_time_ms();
+    for (int i = 0; i < 1000; i++) {
+        buffer_move_to_line_end(buf);
+        buffer_move_to_line_start(buf);
+    }
+    printf("  %-34s %8.2f us\n", "End + Home", (get_time_ms() - t) * 1000.0 / 1000);
+
+    printf("  (%zu)\n", sink & 1);
+    buffer_destroy(buf);
+}
+
+int main(void)
+{
+    bench("Gap buffer", STORAGE_GAP, 64 << 20);
+    bench("Piece table", STORAGE_PIECE, 64 << 20);
+    bench_far_column();
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "buffer.h"
+#include "findset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Log-like text, as in bench_search
+static char* make_text(size_t len)
+{
+    static const char* words[] = { "INFO", "request", "served", "in", "ms", "user", "id", "session", "cache",
+        "hit", "miss", "GET", "/api/v1/items", "200", "latency", "worker" };
+    char*              text    = malloc(len);
+    size_t             pos     = 0;
+    srand(1);
+    while (pos < len) {
+        const char* w = words[rand() % 16];
+        size_t      n = strlen(w);
+        for (size_t i = 0; i < n && pos < len; i++)
+            text[pos++] = w[i];
+        if (pos < len)
+            text[pos++] = (rand() % 12 == 0) ? '\n' : ' ';
+    }
+    return text;
+}
+
+// One frame of scanning, as the editor does it: 4 MB slices for 8 ms
+static bool step_frame(FindSet* fs, Buffer* buf)
+{
+    double start = get_time_ms();
+    while (!findset_step(fs, buf, 4 << 20)) {
+        if (get_time_ms() - start >= 8)
+            return false;
+    }
+    return true;
+}
+
+// What the find prompt does per keystroke: update the query, scan one
+// slice, look for the match to jump to
+static void bench_typing(Buffer* buf, const char* query)
+{
+    FindSet fs;
+    findset_init(&fs);
+    printf("  typing \"%s\"\n", query);
+    for (size_t n = 1; n <= strlen(query); n++) {
+        double start = get_time_ms();
+        findset_query(&fs, buf, query, n, 0);
+        step_frame(&fs, buf);
+        i64    pos = findset_next(&fs, buf, 0);
+        double ms  = get_time_ms() - start;
+
+        size_t frames = 1;
+        double rest   = get_time_ms();
+        while (!step_frame(&fs, buf))
+            frames++;
+        rest = get_time_ms() - rest;
+        printf("    %-12.*s keystroke %7.2f ms  first %10lld  %9zu%s matches after %4zu frames (%.0f ms)\n", (int)n,
+            query, ms, (long long)pos, fs.total, fs.overflow ? " (counted)" : "", frames, ms + rest);
+    }
+    findset_free(&fs);
+}
+
+// Typing into the buffer with every match of a frequent word kept
+static void bench_edits(Buffer* buf, const char* needle)
+{
+    FindSet fs;
+    findset_init(&fs);
+    findset_query(&fs, buf, needle, strlen(needle), 0);
+    while (!findset_step(&fs, buf, 4 << 20))
+        ;
+
+    size_t len   = buffer_length(buf);
+    double start = get_time_ms();
+    for (int i = 0; i < 1000; i++) {
+        size_t pos = (size_t)rand() % len;
+        buffer_move_cursor_to(buf, pos);
+        buffer_insert_char(buf, 'x');
+        findset_edit(&fs, buf, pos, 0, 1);
+    }
+    double ms = get_time_ms() - start;
+    printf("  1000 inserts with %zu \"%s\" matches kept: %.3f ms each\n", fs.total, needle, ms / 1000);
+    findset_free(&fs);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb  = argc > 1 ? (size_t)atoi(argv[1]) : 512;
+    size_t len = mb << 20;
+
+    printf("Generating %zu MB of text...\n\n", mb);
+    char*   text = make_text(len);
+    Buffer* buf  = buffer_create_with_storage(0, STORAGE_PIECE);
+    buffer_insert_text(buf, text, len);
+    free(text);
+
+    printf("=== Find as you type (%zu MB) ===\n", mb);
+    bench_typing(buf, "session timeout");
+    bench_typing(buf, "latency 200");
+
+    printf("\n=== Edits ===\n");
+    bench_edits(buf, "worker 200 miss");
+
+    buffer_destroy(buf);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Short lines around one long one, the cursor on the long line
+static Buffer* make_buffer(BufferStorage storage, size_t line_len)
+{
+    Buffer* buf  = buffer_create_with_storage(64, storage);
+    char*   line = malloc(line_len);
+    memset(line, 'x', line_len);
+    for (int i = 0; i < 20; i++)
+        buffer_insert_text(buf, "a short line\n", 13);
+    size_t start = buffer_length(buf);
+    buffer_insert_text(buf, line, line_len);
+    for (int i = 0; i < 20; i++)
+        buffer_insert_text(buf, "\nanother short line", 19);
+    buffer_move_cursor_to(buf, start + line_len / 2);
+    free(line);
+    return buf;
+}
+
+// Moving the line up the old way: cut it out, then paste it and a newline
+// back in above, three edits and three undo steps
+static void move_up_by_calls(Buffer* buf)
+{
+    size_t line      = buf->line;
+    size_t start     = buffer_get_line_offset(buf, line);
+    size_t end       = buffer_get_line_offset(buf, line + 1) - 1;
+    size_t above     = buffer_get_line_offset(buf, line - 1);
+    size_t offset    = buf->cursor - start;
+    char*  text      = buffer_get_range(buf, start, end);
+    buffer_delete_range(buf, start - 1, end);
+    buffer_move_cursor_to(buf, above);
+    buffer_insert_text(buf, text, end - start);
+    buffer_insert_text(buf, "\n", 1);
+    buffer_move_cursor_to(buf, above + offset);
+    free(text);
+}
+
+static void bench(const char* title, BufferStorage storage, size_t line_len)
+{
+    printf("%s, %zu MB line:\n", title, line_len >> 20);
+    Buffer* buf = make_buffer(storage, line_len);
+    double  t;
+
+    t = get_time_ms();
+    for (int i = 0; i < 10; i++)
+        move_up_by_calls(buf);
+    printf("  %-34s %8.2f ms\n", "move up, delete + 2 inserts", (get_time_ms() - t) / 10);
+
+    t = get_time_ms();
+    for (int i = 0; i < 10; i++)
+        buffer_move_line_up(buf);
+    printf("  %-34s %8.2f ms\n", "buffer_move_line_up", (get_time_ms() - t) / 10);
+
+    t = get_time_ms();
+    for (int i = 0; i < 10; i++)
+        buffer_move_line_down(buf);
+    printf("  %-34s %8.2f ms\n", "buffer_move_line_down", (get_time_ms() - t) / 10);
+
+    t = get_time_ms();
+    for (int i = 0; i < 10; i++)
+        buffer_undo(buf);
+    printf("  %-34s %8.2f ms\n", "undo a move", (get_time_ms() - t) / 10);
+
+    t = get_time_ms();
+    buffer_duplicate_line(buf);
+    printf("  %-34s %8.2f ms\n", "buffer_duplicate_line", get_time_ms() - t);
+
+    buffer_destroy(buf);
+}
+
+int main(void)
+{
+    bench("Gap buffer", STORAGE_GAP, 10 << 20);
+    bench("Piece table", STORAGE_PIECE, 10 << 20);
+    return 0;
+}
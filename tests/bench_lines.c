@@ -0,0 +1,64 @@
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Vertical motion and line operations on a file of short lines
+static void bench(const char* title, BufferStorage storage, size_t lines)
+{
+    printf("%s, %zu lines:\n", title, lines);
+    Buffer* buf  = buffer_create_with_storage(64, storage);
+    char*   text = malloc(lines * 41);
+    size_t  len  = 0;
+    for (size_t i = 0; i < lines; i++) {
+        len += (size_t)sprintf(text + len, "line %-10zu some text after it", i);
+        text[len++] = '\n';
+    }
+    buffer_insert_text(buf, text, len);
+    free(text);
+    buffer_goto_line(buf, 0);
+    buffer_move_cursor(buf, 12);
+
+    double t = get_time_ms();
+    for (int i = 0; i < 1000; i++)
+        buffer_move_line(buf, i & 1 ? -1000000 : 1000000);
+    printf("  %-30s %8.2f us\n", "move 1,000,000 lines", (get_time_ms() - t) * 1000.0 / 1000);
+
+    t = get_time_ms();
+    for (int i = 0; i < 100000; i++)
+        buffer_move_line(buf, i & 1 ? -40 : 40);
+    printf("  %-30s %8.2f us\n", "page down / up", (get_time_ms() - t) * 1000.0 / 100000);
+
+    buffer_goto_line(buf, lines / 2);
+    t = get_time_ms();
+    for (int i = 0; i < 100000; i++) {
+        buffer_move_to_line_end(buf);
+        buffer_move_to_line_start(buf);
+    }
+    printf("  %-30s %8.2f us\n", "End + Home", (get_time_ms() - t) * 1000.0 / 100000);
+
+    t = get_time_ms();
+    for (int i = 0; i < 10000; i++) {
+        buffer_select_line(buf);
+        buffer_clear_selection(buf);
+        buffer_move_line(buf, -1);
+    }
+    printf("  %-30s %8.2f us\n", "select line", (get_time_ms() - t) * 1000.0 / 10000);
+
+    buffer_destroy(buf);
+}
+
+int main(void)
+{
+    bench("Gap buffer", STORAGE_GAP, 2000000);
+    bench("Piece table", STORAGE_PIECE, 2000000);
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "buffer.h"
+#include "undo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Current or peak resident set in MB
+static size_t rss_mb(const char* field)
+{
+    FILE*  f  = fopen("/proc/self/status", "r");
+    size_t kb = 0;
+    char   line[256];
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, strlen(field)) == 0)
+            kb = strtoul(line + strlen(field) + 1, NULL, 10);
+    }
+    if (f)
+        fclose(f);
+    return kb >> 10;
+}
+
+// Only the buffer's own memory is of interest, not the undo copies
+static void drop_undo(Buffer* buf)
+{
+    undo_destroy(buf->undo);
+    buf->undo = undo_create();
+}
+
+// Grow a gap buffer to len bytes in chunk-sized pastes, then Ctrl+A, Delete
+static void run(size_t len, size_t chunk)
+{
+    char* text = malloc(chunk);
+    memset(text, 'a', chunk);
+    for (size_t i = 79; i < chunk; i += 80)
+        text[i] = '\n';
+
+    size_t  base = rss_mb("VmRSS");
+    Buffer* buf  = buffer_create(64);
+    for (size_t done = 0; done < len; done += chunk) {
+        buffer_insert_text(buf, text, chunk);
+        drop_undo(buf);
+    }
+    size_t full = rss_mb("VmRSS");
+    size_t peak = rss_mb("VmHWM");
+
+    buffer_delete_range(buf, 0, buffer_length(buf));
+    drop_undo(buf);
+    size_t after = rss_mb("VmRSS");
+
+    printf("  %4zu MB in %4zu MB pastes: peak %5zu MB, full %5zu MB, after delete %4zu MB\n",
+        len >> 20, chunk >> 20, peak - base, full - base, after - base);
+
+    buffer_destroy(buf);
+    free(text);
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Ctrl+A, Delete and Ctrl+Z on len bytes with the undo history kept, then
+// a session of big pastes and deletes, which the history must not let grow
+// without bound
+static void run_undo(size_t len, size_t chunk)
+{
+    char* text = malloc(chunk);
+    memset(text, 'a', chunk);
+    for (size_t i = 79; i < chunk; i += 80)
+        text[i] = '\n';
+
+    Buffer* buf = buffer_create(64);
+    for (size_t done = 0; done < len; done += chunk) {
+        buffer_insert_text(buf, text, chunk);
+        drop_undo(buf);
+    }
+    size_t base = rss_mb("VmRSS");
+
+    double t0 = seconds();
+    buffer_delete_range(buf, 0, buffer_length(buf));
+    double t1     = seconds();
+    size_t delete = rss_mb("VmRSS");
+    buffer_undo(buf);
+    double t2   = seconds();
+    size_t undo = rss_mb("VmRSS");
+    printf("  %4zu MB: delete all %+5ld MB RSS in %6.0f ms, undo %+5ld MB in %6.0f ms\n", len >> 20,
+        (long)delete - (long)base, (t1 - t0) * 1000, (long)undo - (long)base, (t2 - t1) * 1000);
+
+    // On a small buffer, so its own growth doesn't count: pastes just
+    // under the spill size, keeping the history in memory
+    buffer_destroy(buf);
+    buf          = buffer_create(64);
+    buffer_insert_text(buf, text, chunk);
+    base         = rss_mb("VmRSS");
+    size_t paste = UNDO_SPILL_MIN / 2;
+    size_t most  = 0;
+    for (int i = 0; i < 400; i++) {
+        buffer_move_cursor_to(buf, buffer_length(buf) / 2);
+        buffer_insert_text(buf, text, paste);
+        buffer_delete_range(buf, buffer_length(buf) / 3, buffer_length(buf) / 3 + paste);
+        size_t rss = rss_mb("VmRSS");
+        most       = rss > most ? rss : most;
+    }
+    printf("  400 pastes and deletes of %zu KB: RSS at most %+ld MB, %zu undo steps kept\n", paste >> 10,
+        (long)most - (long)base, buf->undo->count);
+
+    buffer_destroy(buf);
+    free(text);
+}
+
+// Each case in its own process so peak RSS is per case
+static void bench(size_t len, size_t chunk)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        run(len, chunk);
+        exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+static void bench_undo(size_t len, size_t chunk)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_undo(len, chunk);
+        exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb  = argc > 1 ? (size_t)atoi(argv[1]) : 512;
+    size_t len = mb << 20;
+
+    printf("=== Gap buffer memory ===\n");
+    bench(len, 1 << 20);
+    bench(len, 64 << 20);
+    bench(len, len);
+
+    printf("=== Undo memory ===\n");
+    bench_undo(len, 1 << 20);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Typing at a cursor on each of `cursors` lines spread over mb of text
+static void bench_typing(BufferStorage storage, const char* label, size_t mb, size_t cursors)
+{
+    size_t len       = mb << 20;
+    size_t line_len  = len / cursors;
+    char*  text      = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        text[i] = (i % line_len == line_len - 1) ? '\n' : 'a' + i % 23;
+
+    Buffer* buf = buffer_create_with_storage(storage == STORAGE_GAP ? len + 4096 : 0, storage);
+    buffer_insert_text(buf, text, len);
+    free(text);
+
+    buffer_move_cursor_to(buf, 0);
+    buffer_start_selection(buf);
+    buffer_move_cursor_to(buf, len);
+    buffer_update_selection(buf);
+    double start = get_time_ms();
+    size_t count = buffer_add_cursors_on_lines(buf);
+    double add_ms = get_time_ms() - start;
+
+    const char* typed = "hello, world";
+    double      worst = 0;
+    start             = get_time_ms();
+    for (size_t i = 0; typed[i]; i++) {
+        double key = get_time_ms();
+        buffer_multi_insert(buf, typed + i, 1);
+        key = get_time_ms() - key;
+        if (key > worst)
+            worst = key;
+    }
+    double type_ms = get_time_ms() - start;
+
+    start = get_time_ms();
+    for (int i = 0; i < 5; i++)
+        buffer_multi_backspace(buf);
+    double back_ms = get_time_ms() - start;
+
+    start = get_time_ms();
+    buffer_undo(buf);
+    double undo_ms = get_time_ms() - start;
+
+    printf("  %-6s %4zu MB, %6zu cursors: add %6.2f ms  keystroke %6.2f ms avg %6.2f ms worst  backspace %6.2f ms  "
+           "undo %6.2f ms\n",
+        label, mb, count, add_ms, type_ms / strlen(typed), worst, back_ms / 5, undo_ms);
+    buffer_destroy(buf);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? (size_t)atoi(argv[1]) : 64;
+
+    printf("=== Multi-cursor typing ===\n");
+    bench_typing(STORAGE_GAP, "gap", 1, 10000);
+    bench_typing(STORAGE_PIECE, "piece", 1, 10000);
+    bench_typing(STORAGE_GAP, "gap", mb, 10000);
+    bench_typing(STORAGE_PIECE, "piece", mb, 10000);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Source-code-like text: lines of 20-100 bytes
+static char* make_text(size_t len)
+{
+    char* text = malloc(len);
+    srand(1);
+    size_t line_len = 0;
+    size_t target   = 60;
+    for (size_t i = 0; i < len; i++) {
+        if (line_len == target) {
+            text[i]  = '\n';
+            line_len = 0;
+            target   = 20 + rand() % 80;
+        } else {
+            text[i] = 'a' + (i % 26);
+            line_len++;
+        }
+    }
+    return text;
+}
+
+static void bench_paste(const char* label, BufferStorage storage, const char* text, size_t len,
+    size_t existing, bool warm)
+{
+    Buffer* buf = buffer_create_with_storage(1024, storage);
+
+    // Existing document, cursor in the middle of it
+    if (existing > 0) {
+        buffer_insert_text(buf, text, existing);
+        buffer_goto_line(buf, buffer_line_count(buf) / 2);
+    }
+    buffer_line_count(buf); // Index is live, as it is while editing
+
+    // Paste and delete once first so the gap's pages are already faulted in
+    if (warm) {
+        size_t at = buf->cursor;
+        buffer_insert_text(buf, text, len);
+        buffer_delete_range(buf, at, at + len);
+    }
+
+    double start = get_time_ms();
+    buffer_insert_text(buf, text, len);
+    double end = get_time_ms();
+
+    double secs = (end - start) / 1000.0;
+    printf("  %-28s %6zu MB in %8.1f ms  %6.2f GB/s  (%zu lines)\n", label, len >> 20,
+        end - start, len / secs / 1e9, buffer_line_count(buf));
+
+    buffer_destroy(buf);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb  = argc > 1 ? (size_t)atoi(argv[1]) : 256;
+    size_t len = mb << 20;
+
+    printf("Generating %zu MB of text...\n\n", mb);
+    char* text = make_text(len);
+
+    printf("=== Paste benchmark ===\n");
+    bench_paste("gap, empty buffer", STORAGE_GAP, text, len, 0, false);
+    bench_paste("gap, middle of 64 MB", STORAGE_GAP, text, len, 64 << 20, false);
+    bench_paste("gap, middle of 64 MB, warm", STORAGE_GAP, text, len, 64 << 20, true);
+    bench_paste("piece, empty buffer", STORAGE_PIECE, text, len, 0, false);
+    bench_paste("piece, middle of 64 MB", STORAGE_PIECE, text, len, 64 << 20, false);
+
+    free(text);
+    return 0;
+}
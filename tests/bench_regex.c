@@ -0,0 +1,115 @@
+#include "buffer.h"
+#include "regex.h"
+#include "search.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Log-like text, as in bench_search: lines of words from a small vocabulary
+static char* make_text(size_t len)
+{
+    static const char* words[] = { "INFO", "request", "served", "in", "ms", "user", "id", "session", "cache",
+        "hit", "miss", "GET", "/api/v1/items", "200", "latency", "worker" };
+    char*              text    = malloc(len);
+    size_t             pos     = 0;
+    srand(1);
+    while (pos < len) {
+        const char* w = words[rand() % 16];
+        size_t      n = strlen(w);
+        for (size_t i = 0; i < n && pos < len; i++)
+            text[pos++] = w[i];
+        if (pos < len)
+            text[pos++] = (rand() % 12 == 0) ? '\n' : ' ';
+    }
+    return text;
+}
+
+static double rate(size_t bytes, double ms) { return bytes / (ms / 1000.0) / 1e9; }
+
+// Time to the first match (or through the whole buffer), then for every match
+static void bench_regex(Buffer* buf, const char* label, const char* pattern, u32 flags)
+{
+    size_t      len = buffer_length(buf);
+    const char* error;
+    Regex*      re = regex_compile(pattern, strlen(pattern), flags, &error);
+    if (!re) {
+        printf("  %-34s %s\n", label, error);
+        return;
+    }
+
+    size_t a = 0, b = 0;
+    double start   = get_time_ms();
+    bool   found   = regex_search_forward(re, buf, 0, len, &a, &b);
+    double find_ms = get_time_ms() - start;
+
+    start           = get_time_ms();
+    size_t count    = regex_count(re, buf, 0, len);
+    double count_ms = get_time_ms() - start;
+
+    printf("  %-34s find %6.2f GB/s  count %6.2f GB/s  %8zu matches  prefix %zu\n", label,
+        rate(found ? b : len, find_ms), rate(len, count_ms), count, regex_prefix_len(re));
+    regex_free(re);
+}
+
+static void bench_literal(Buffer* buf, const char* label, const char* needle, u32 flags)
+{
+    size_t   len = buffer_length(buf);
+    Searcher s;
+    search_init(&s, needle, strlen(needle), flags);
+
+    double start   = get_time_ms();
+    i64    pos     = search_forward(&s, buf, 0, len);
+    double find_ms = get_time_ms() - start;
+
+    start           = get_time_ms();
+    size_t count    = search_count(&s, buf, 0, len, 1);
+    double count_ms = get_time_ms() - start;
+
+    printf("  %-34s find %6.2f GB/s  count %6.2f GB/s  %8zu matches\n", label,
+        rate(pos < 0 ? len : (size_t)pos + s.len, find_ms), rate(len, count_ms), count);
+    search_free(&s);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb  = argc > 1 ? (size_t)atoi(argv[1]) : 256;
+    size_t len = mb << 20;
+
+    printf("Generating %zu MB of text...\n\n", mb);
+    char*   text = make_text(len);
+    Buffer* buf  = buffer_create(len + 64);
+    buffer_insert_text(buf, text, len / 2);
+    buffer_insert_text(buf, text + len / 2, len - len / 2);
+    buffer_move_cursor_to(buf, len / 2); // Gap in the middle
+    buffer_insert_char(buf, ' ');
+    free(text);
+
+    printf("=== Literal vs regex, no match (%zu MB) ===\n", mb);
+    bench_literal(buf, "literal \"timeout\"", "timeout", 0);
+    bench_regex(buf, "regex \"timeout\"", "timeout", 0);
+    bench_literal(buf, "literal \"TIMEOUT\", ignore case", "TIMEOUT", SEARCH_IGNORE_CASE);
+    bench_regex(buf, "regex \"TIMEOUT\", ignore case", "TIMEOUT", SEARCH_IGNORE_CASE);
+    bench_regex(buf, "regex \"ERROR.*timeout\"", "ERROR.*timeout", 0);
+    bench_regex(buf, "regex \"(ERROR|WARN).*timeout\"", "(ERROR|WARN).*timeout", 0);
+    bench_regex(buf, "regex \"[0-9]+ms timeout\"", "[0-9]+ms timeout", 0);
+
+    printf("\n=== Literal vs regex, frequent matches ===\n");
+    bench_literal(buf, "literal \"session cache\"", "session cache", 0);
+    bench_regex(buf, "regex \"session cache\"", "session cache", 0);
+    bench_regex(buf, "regex \"session (cache|hit)\"", "session (cache|hit)", 0);
+    bench_regex(buf, "regex \"^GET [^ ]+\"", "^GET [^ ]+", 0);
+    bench_regex(buf, "regex \"(cache|session) miss\"", "(cache|session) miss", 0);
+    bench_regex(buf, "regex \"latency \\d+\"", "latency \\d+", 0);
+    bench_regex(buf, "regex \"worker.*200$\"", "worker.*200$", 0);
+
+    buffer_destroy(buf);
+    return 0;
+}
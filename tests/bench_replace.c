@@ -0,0 +1,77 @@
+#include "buffer.h"
+#include "search.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Lines of filler with a needle planted every spacing bytes
+static char* make_text(size_t len, size_t spacing, const char* needle)
+{
+    char*  text = malloc(len);
+    size_t n    = strlen(needle);
+    for (size_t i = 0; i < len; i++)
+        text[i] = (i % 64 == 63) ? '\n' : 'a' + i % 23;
+    for (size_t i = spacing / 2; i + n <= len; i += spacing)
+        memcpy(text + i, needle, n);
+    return text;
+}
+
+static void bench_replace(BufferStorage storage, const char* label, size_t mb, size_t spacing)
+{
+    size_t len  = mb << 20;
+    char*  text = make_text(len, spacing, "needle");
+
+    Buffer* buf = buffer_create_with_storage(storage == STORAGE_GAP ? len + 64 : 0, storage);
+    buffer_insert_text(buf, text, len);
+    free(text);
+    buffer_get_line_offset(buf, 0); // Index built up front, as after loading
+
+    Searcher s;
+    search_init(&s, "needle", 6, 0);
+    SearchHits hits  = { 0 };
+    double     start = get_time_ms();
+    search_collect(&s, buf, 0, len, &hits);
+    double find_ms = get_time_ms() - start;
+
+    start           = get_time_ms();
+    size_t replaced = buffer_replace_all(buf, hits.pos, hits.count, 6, "thread", 6);
+    double same_ms  = get_time_ms() - start;
+    buffer_undo(buf);
+
+    start           = get_time_ms();
+    replaced        = buffer_replace_all(buf, hits.pos, hits.count, 6, "pin", 3);
+    double short_ms = get_time_ms() - start;
+
+    start          = get_time_ms();
+    buffer_undo(buf);
+    double undo_ms = get_time_ms() - start;
+
+    printf("  %-6s %4zu MB, %8zu matches: find %6.0f ms  replace %6.0f ms (same length) %6.0f ms (shorter)  undo "
+           "%6.0f ms\n",
+        label, mb, replaced, find_ms, same_ms, short_ms, undo_ms);
+
+    free(hits.pos);
+    search_free(&s);
+    buffer_destroy(buf);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? (size_t)atoi(argv[1]) : 1024;
+
+    // 1M matches in a GB: one every KB
+    printf("=== Replace all ===\n");
+    bench_replace(STORAGE_GAP, "gap", mb, 1024);
+    bench_replace(STORAGE_PIECE, "piece", mb, 1024);
+    bench_replace(STORAGE_GAP, "gap", mb, 64);
+    bench_replace(STORAGE_PIECE, "piece", mb, 64);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "buffer.h"
+#include "search.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Log-like text: lines of words from a small vocabulary, so the filter
+// bytes of every needle show up all the time
+static char* make_text(size_t len)
+{
+    static const char* words[] = { "INFO", "request", "served", "in", "ms", "user", "id", "session", "cache",
+        "hit", "miss", "GET", "/api/v1/items", "200", "latency", "worker" };
+    char*              text    = malloc(len);
+    size_t             pos     = 0;
+    srand(1);
+    while (pos < len) {
+        const char* w = words[rand() % 16];
+        size_t      n = strlen(w);
+        for (size_t i = 0; i < n && pos < len; i++)
+            text[pos++] = w[i];
+        if (pos < len)
+            text[pos++] = (rand() % 12 == 0) ? '\n' : ' ';
+    }
+    return text;
+}
+
+static void bench(Buffer* buf, const char* label, const char* needle, u32 flags)
+{
+    static const char* names[] = { "scalar", "sse2", "avx2" };
+    size_t             len     = buffer_length(buf);
+
+    printf("  %-34s", label);
+    for (SearchKernel k = SEARCH_SCALAR; k <= SEARCH_AVX2; k++) {
+        if (!search_use_kernel(k))
+            continue;
+        Searcher s;
+        search_init(&s, needle, strlen(needle), flags);
+        double start = get_time_ms();
+        i64    pos   = search_forward(&s, buf, 0, len);
+        double ms    = get_time_ms() - start;
+        search_free(&s);
+
+        size_t scanned = pos < 0 ? len : (size_t)pos;
+        printf("  %s %6.2f GB/s", names[k], scanned / (ms / 1000.0) / 1e9);
+    }
+    printf("\n");
+}
+
+// Forward search with no match, and a full count, per thread count
+static void bench_threads(Buffer* buf, const char* needle)
+{
+    static const int threads[] = { 1, 2, 4, 8 };
+    size_t           len       = buffer_length(buf);
+    Searcher         s;
+    search_init(&s, needle, strlen(needle), 0);
+
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        double start = get_time_ms();
+        i64    pos     = search_forward_parallel(&s, buf, 0, len, threads[i]);
+        double find_ms = get_time_ms() - start;
+
+        start           = get_time_ms();
+        size_t count    = search_count(&s, buf, 0, len, threads[i]);
+        double count_ms = get_time_ms() - start;
+        size_t scanned  = pos < 0 ? len : (size_t)pos + 1;
+
+        printf("  %d thread%s  find %6.2f GB/s   count %6.2f GB/s (%zu matches)\n", threads[i],
+            threads[i] == 1 ? " " : "s", scanned / (find_ms / 1000.0) / 1e9, len / (count_ms / 1000.0) / 1e9,
+            count);
+    }
+    search_free(&s);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb  = argc > 1 ? (size_t)atoi(argv[1]) : 1024;
+    size_t len = mb << 20;
+
+    printf("Generating %zu MB of text...\n\n", mb);
+    char*   text = make_text(len);
+    Buffer* buf  = buffer_create(len + 64);
+    buffer_insert_text(buf, text, len / 2);
+    buffer_insert_text(buf, text + len / 2, len - len / 2);
+    buffer_move_cursor_to(buf, len / 2); // Gap in the middle
+    buffer_insert_char(buf, ' ');
+    free(text);
+
+    printf("=== Find benchmark (%zu MB, no match unless noted) ===\n", mb);
+    bench(buf, "3 bytes \"ERR\"", "ERR", 0);
+    bench(buf, "7 bytes \"timeout\"", "timeout", 0);
+    bench(buf, "14 bytes \"request served\"", "request served", 0);
+    bench(buf, "14 bytes, frequent prefix/suffix", "session cachen", 0);
+    bench(buf, "7 bytes, ignore case", "TIMEOUT", SEARCH_IGNORE_CASE);
+    bench(buf, "7 bytes, whole word", "timeout", SEARCH_WHOLE_WORD);
+    bench(buf, "40 bytes", "connection reset by peer while reading x", 0);
+    bench(buf, "40 bytes, ignore case", "CONNECTION RESET BY PEER WHILE READING X", SEARCH_IGNORE_CASE);
+
+    printf("\n=== Threads: \"timeout\" (none), \"session\" (frequent) ===\n");
+    bench_threads(buf, "timeout");
+    bench_threads(buf, "session");
+
+    buffer_destroy(buf);
+    return 0;
+}
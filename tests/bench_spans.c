@@ -0,0 +1,106 @@
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Two long lines, each one long word followed by spaces, with the gap
+// parked in the middle of the first so every scan has to cross it
+static Buffer* make_buffer(BufferStorage storage, size_t line_len)
+{
+    Buffer* buf  = buffer_create_with_storage(64, storage);
+    char*   line = malloc(line_len + 1);
+    memset(line, 'w', line_len - 64);
+    memset(line + line_len - 64, ' ', 64);
+    line[line_len] = '\n';
+
+    buffer_insert_text(buf, line, line_len + 1);
+    buffer_insert_text(buf, line, line_len);
+    buffer_move_cursor_to(buf, line_len / 2);
+    buffer_insert_char(buf, 'w');
+    free(line);
+    return buf;
+}
+
+static void report(const char* label, double ms, size_t bytes)
+{
+    printf("  %-26s %8.2f ms  %7.2f GB/s\n", label, ms, bytes / (ms / 1000.0) / 1e9);
+}
+
+static void bench(const char* title, BufferStorage storage, size_t line_len)
+{
+    printf("%s, %zu MB lines:\n", title, line_len >> 20);
+    Buffer* buf = make_buffer(storage, line_len);
+    size_t  mid = line_len / 2;
+    double  t;
+
+    t = get_time_ms();
+    i64 hit = buffer_find(buf, "wx", 0);
+    report("buffer_find (miss)", get_time_ms() - t, buffer_length(buf));
+    if (hit >= 0)
+        printf("  unexpected match\n");
+
+    buffer_move_cursor_to(buf, 0);
+    t = get_time_ms();
+    buffer_move_word_right(buf);
+    report("buffer_move_word_right", get_time_ms() - t, line_len);
+
+    buffer_move_cursor_to(buf, line_len - 64);
+    t = get_time_ms();
+    buffer_move_word_left(buf);
+    report("buffer_move_word_left", get_time_ms() - t, line_len);
+
+    buffer_move_cursor_to(buf, mid);
+    t = get_time_ms();
+    buffer_select_word(buf);
+    report("buffer_select_word", get_time_ms() - t, line_len);
+    buffer_clear_selection(buf);
+
+    buffer_move_cursor_to(buf, mid);
+    t = get_time_ms();
+    buffer_move_to_line_end(buf);
+    buffer_move_to_line_start(buf);
+    report("line end + line start", get_time_ms() - t, 2 * line_len);
+
+    buffer_move_cursor_to(buf, mid);
+    t = get_time_ms();
+    buffer_select_line(buf);
+    report("buffer_select_line", get_time_ms() - t, line_len);
+    buffer_clear_selection(buf);
+
+    buffer_move_cursor_to(buf, mid);
+    t = get_time_ms();
+    buffer_duplicate_line(buf);
+    report("buffer_duplicate_line", get_time_ms() - t, line_len);
+    buffer_undo(buf);
+    buffer_undo(buf);
+
+    buffer_move_cursor_to(buf, line_len + 1 + mid);
+    t = get_time_ms();
+    buffer_move_line_up(buf);
+    report("buffer_move_line_up", get_time_ms() - t, 2 * line_len);
+
+    buffer_move_cursor_to(buf, mid);
+    t = get_time_ms();
+    buffer_move_line_down(buf);
+    report("buffer_move_line_down", get_time_ms() - t, 2 * line_len);
+
+    buffer_destroy(buf);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? (size_t)atoi(argv[1]) : 16;
+
+    printf("=== Span scan benchmark ===\n");
+    bench("gap", STORAGE_GAP, mb << 20);
+    bench("piece", STORAGE_PIECE, mb << 20);
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "undo.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Count every allocation by wrapping glibc's allocator
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+
+static size_t allocs;
+
+void* malloc(size_t size)
+{
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    allocs++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    allocs++;
+    return __libc_realloc(p, size);
+}
+
+static size_t heap_used(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd; // Small blocks and mmapped ones
+}
+
+// Current resident set in MB
+static double rss_mb(void)
+{
+    FILE*  f  = fopen("/proc/self/status", "r");
+    size_t kb = 0;
+    char   line[256];
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+            kb = strtoul(line + 6, NULL, 10);
+    }
+    if (f)
+        fclose(f);
+    return kb / 1024.0;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* words[] = { "lorem ", "ipsum ", "dolor ", "sit ", "amet, ", "consectetur ", "adipiscing ",
+    "elit.\n" };
+
+// The undo history of typing len bytes of prose without a pause, fixing a
+// typo every 200 bytes: one operation per keystroke, or merged keystrokes
+static void bench(const char* label, size_t len, bool merge)
+{
+    size_t     a0    = allocs;
+    size_t     h0    = heap_used();
+    UndoStack* stack = undo_create();
+    size_t     pos   = 0;
+    u64        now   = 0;
+    for (size_t w = 0; pos < len; w++) {
+        for (const char* p = words[w % 8]; *p; p++, pos++, now += 100) {
+            if (merge)
+                undo_push_typed(stack, OP_INSERT, pos, p, 1, now);
+            else
+                undo_push_insert(stack, pos, p, 1);
+        }
+        if (w % 30 == 29) {
+            pos--;
+            if (merge)
+                undo_push_typed(stack, OP_DELETE, pos, " ", 1, now);
+            else
+                undo_push_delete(stack, pos, " ", 1);
+        }
+    }
+    printf("  %-22s %8zu steps %8zu allocations %8.2f MB heap\n", label, stack->count, allocs - a0,
+        (heap_used() - h0) / 1048576.0);
+    undo_destroy(stack);
+}
+
+// A long session of edits: keystrokes with pauses between bursts, pastes
+// and deleted selections of up to a few hundred bytes, and every so often a
+// few undos followed by new edits, which cut off the redo history
+static void session(size_t edits)
+{
+    static char text[512];
+    memset(text, 'x', sizeof(text));
+    srand(42);
+
+    double     rss0  = rss_mb();
+    size_t     a0    = allocs;
+    double     t0    = now_sec();
+    UndoStack* stack = undo_create();
+    size_t     pos   = 1000;
+    u64        now   = 0;
+    for (size_t i = 0; i < edits; i++) {
+        int r = rand() % 100;
+        now += r < 2 ? UNDO_MERGE_MS : 50;
+        if (r < 75) {
+            undo_push_typed(stack, OP_INSERT, pos, words[i % 8] + i % 4, 1, now);
+            pos++;
+        } else if (r < 85) {
+            pos--;
+            undo_push_typed(stack, OP_DELETE, pos, "x", 1, now);
+        } else if (r < 93) {
+            size_t n = 1 + rand() % 300;
+            undo_push_insert(stack, pos, text, n);
+            pos += n;
+        } else {
+            size_t n = 1 + rand() % 100;
+            pos -= n;
+            undo_push_delete(stack, pos, text, n);
+        }
+        if (i % 1000 == 999) {
+            for (int k = rand() % 30; k > 0; k--)
+                undo_pop(stack);
+        }
+    }
+    double t1   = now_sec();
+    size_t ops  = stack->count;
+    size_t a1   = allocs;
+    double rss1 = rss_mb();
+    undo_destroy(stack);
+    double t2   = now_sec();
+    double rss2 = rss_mb();
+
+    printf("  %zu edits: %zu steps, %zu allocations, %.1f ms\n", edits, ops, a1 - a0, (t1 - t0) * 1000);
+    printf("  RSS %+.1f MB after the session, %+.1f MB after freeing it (%.1f ms)\n", rss1 - rss0, rss2 - rss0,
+        (t2 - t1) * 1000);
+}
+
+int main(void)
+{
+    printf("Typing 100 KB:\n");
+    bench("a step per keystroke", 100 * 1024, false);
+    bench("merged keystrokes", 100 * 1024, true);
+    printf("Typing 10 MB:\n");
+    bench("a step per keystroke", 10 << 20, false);
+    bench("merged keystrokes", 10 << 20, true);
+
+    // In a child of its own, so the heap starts clean
+    printf("Editing session:\n");
+    fflush(stdout);
+    if (fork() == 0) {
+        session(1000000);
+        fflush(stdout);
+        _exit(0);
+    }
+    wait(NULL);
+    return 0;
+}
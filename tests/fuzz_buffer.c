@@ -26,7 +26,7 @@ int main(int argc, char* argv[])
     }
 
     for (int i = 0; i < iterations; i++) {
-        int op = rand() % 20;
+        int op = rand() % 25;
 
         switch (op) {
         case 0:
@@ -101,6 +101,40 @@ int main(int argc, char* argv[])
             // Clear selection
             buffer_clear_selection(buf);
             break;
+        case 20:
+            // Extra cursor somewhere, or at the next match
+            if (rand() % 2)
+                buffer_add_cursor(buf, rand() % (buffer_length(buf) + 1), rand() % (buffer_length(buf) + 1));
+            else
+                buffer_add_cursor_at_next_match(buf);
+            break;
+        case 21:
+            // Type at every cursor
+            buffer_multi_insert(buf, rand() % 4 ? "x" : "\n", 1);
+            break;
+        case 22:
+            // Delete at every cursor
+            if (rand() % 2)
+                buffer_multi_backspace(buf);
+            else
+                buffer_multi_delete(buf);
+            break;
+        case 23:
+            // Move every cursor
+            buffer_multi_move(buf, rand() % 5 - 2);
+            break;
+        case 24:
+            // A few edits as one undo step
+            buffer_begin_group(buf);
+            for (int k = rand() % 4; k >= 0; k--) {
+                buffer_move_cursor_to(buf, rand() % (buffer_length(buf) + 1));
+                if (rand() % 2)
+                    buffer_insert_text(buf, "ab\ncd", 1 + rand() % 5);
+                else
+                    buffer_delete_char(buf);
+            }
+            buffer_end_group(buf);
+            break;
         }
 
         // Periodically verify buffer integrity
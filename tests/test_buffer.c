@@ -1,6 +1,8 @@
 #include "test.h"
 #include "../include/buffer.h"
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 TEST(test_buffer_create)
 {
@@ -1010,6 +1012,1126 @@ TEST(test_large_line_count)
     buffer_destroy(buf);
 }
 
+TEST(test_line_index_matches_rebuild)
+{
+    Buffer* buf = buffer_create(64);
+
+    // Enough lines for the index to span many blocks
+    for (int i = 0; i < 5000; i++) {
+        buffer_insert_text(buf, "line\n", 5);
+    }
+
+    // Edits near the top must not disturb offsets further down
+    buffer_goto_line(buf, 3);
+    buffer_insert_char(buf, '\n');
+    buffer_insert_text(buf, "a\nb\nc", 5);
+    buffer_goto_line(buf, 4000);
+    buffer_delete_range(buf, buf->cursor, buf->cursor + 23);
+    buffer_goto_line(buf, 1);
+    buffer_backspace(buf);
+
+    size_t lines     = buffer_line_count(buf);
+    size_t sample[8] = { 0, 1, 2, 3, 4, 6, 3990, lines - 1 };
+    size_t offsets[8];
+    for (int i = 0; i < 8; i++)
+        offsets[i] = buffer_get_line_offset(buf, sample[i]);
+
+    buffer_rebuild_line_index(buf);
+    ASSERT_EQ(buffer_line_count(buf), lines);
+    for (int i = 0; i < 8; i++)
+        ASSERT_EQ(buffer_get_line_offset(buf, sample[i]), offsets[i]);
+
+    buffer_destroy(buf);
+}
+
+TEST(test_undo_redo_keep_line_index)
+{
+    Buffer* buf = buffer_create(64);
+
+    for (int i = 0; i < 2000; i++) {
+        buffer_insert_text(buf, "abc\n", 4);
+    }
+    buffer_goto_line(buf, 10);
+    buffer_insert_text(buf, "x\ny\nz", 5);
+    buffer_goto_line(buf, 500);
+    buffer_delete_range(buf, buf->cursor, buf->cursor + 10);
+    ASSERT_EQ(buffer_line_count(buf), 2001);
+
+    // The index is updated in place, never dropped for a rebuild
+    buffer_undo(buf);
+    ASSERT_EQ(buf->line_count, 2003);
+    ASSERT_EQ(buf->line, 500);
+    buffer_undo(buf);
+    ASSERT_EQ(buf->line_count, 2001);
+    ASSERT_EQ(buf->line, 10);
+    ASSERT_EQ(buffer_get_line_offset(buf, 1999), 1999 * 4);
+
+    buffer_redo(buf);
+    ASSERT_EQ(buf->line_count, 2003);
+    ASSERT_EQ(buf->line, 12);
+    ASSERT_EQ(buf->col, 1);
+    buffer_redo(buf);
+    ASSERT_EQ(buf->line_count, 2001);
+
+    size_t offset = buffer_get_line_offset(buf, 1500);
+    buffer_rebuild_line_index(buf);
+    ASSERT_EQ(buffer_line_count(buf), 2001);
+    ASSERT_EQ(buffer_get_line_offset(buf, 1500), offset);
+
+    buffer_destroy(buf);
+}
+
+TEST(test_gap_growth_keeps_text)
+{
+    // Grows well past the point where the array is remapped rather than
+    // copied, inserting all over so the text after the gap has to slide
+    Buffer* buf   = buffer_create(64);
+    char*   model = malloc(16 << 20);
+    size_t  len   = 0;
+    char    chunk[300000];
+    srand(5);
+
+    for (int i = 0; len + sizeof(chunk) <= (16 << 20); i++) {
+        for (size_t j = 0; j < sizeof(chunk); j++)
+            chunk[j] = (j % 50 == 49) ? '\n' : 'a' + (i + j) % 26;
+        size_t pos = len ? (size_t)rand() % len : 0;
+        memmove(model + pos + sizeof(chunk), model + pos, len - pos);
+        memcpy(model + pos, chunk, sizeof(chunk));
+        len += sizeof(chunk);
+        buf->cursor = pos;
+        buffer_insert_text(buf, chunk, sizeof(chunk));
+    }
+
+    ASSERT_EQ(buffer_length(buf), len);
+    char* text = buffer_get_range(buf, 0, len);
+    ASSERT(memcmp(text, model, len) == 0);
+    ASSERT_EQ(buffer_line_count(buf), len / 50 + 1);
+
+    free(text);
+    free(model);
+    buffer_destroy(buf);
+}
+
+TEST(test_gap_released_after_big_delete)
+{
+    Buffer* buf = buffer_create(64);
+    char*   big = malloc(8 << 20);
+    memset(big, 'x', 8 << 20);
+    buffer_insert_text(buf, big, 8 << 20);
+
+    buffer_delete_range(buf, 0, 8 << 20);
+    ASSERT_EQ(buffer_length(buf), 0);
+
+    // Apart from some headroom, the gap's pages are no longer resident
+    size_t         page     = (size_t)sysconf(_SC_PAGESIZE);
+    size_t         pages    = buf->capacity / page;
+    unsigned char* resident = malloc(pages);
+    ASSERT(mincore(buf->data, pages * page, resident) == 0);
+    size_t count = 0;
+    for (size_t i = 0; i < pages; i++)
+        count += resident[i] & 1;
+    free(resident);
+    ASSERT(count * page <= (1 << 20));
+
+    // Released pages are usable again, and undo brings the text back
+    buffer_insert_text(buf, "after", 5);
+    buffer_undo(buf);
+    buffer_undo(buf);
+    ASSERT_EQ(buffer_length(buf), 8 << 20);
+    char* text = buffer_get_range(buf, 0, 8 << 20);
+    ASSERT(memcmp(text, big, 8 << 20) == 0);
+
+    free(text);
+    free(big);
+    buffer_destroy(buf);
+}
+
+// Concatenate the iterator's spans over [start, end), in either direction
+static bool iter_matches(Buffer* buf, const char* text, size_t start, size_t end)
+{
+    BufferIter it;
+    size_t     pos = start;
+    buffer_iter_init(&it, buf, start, end);
+    while (buffer_iter_next(&it)) {
+        if (it.pos != pos || it.len == 0 || memcmp(it.text, text + pos, it.len) != 0)
+            return false;
+        pos += it.len;
+    }
+    if (pos != end)
+        return false;
+
+    buffer_iter_init_reverse(&it, buf, start, end);
+    while (buffer_iter_prev(&it)) {
+        if (it.pos + it.len != pos || it.len == 0 || memcmp(it.text, text + it.pos, it.len) != 0)
+            return false;
+        pos = it.pos;
+    }
+    return pos == start;
+}
+
+TEST(test_iter_spans)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        char    text[600];
+        for (int i = 0; i < 600; i++)
+            text[i] = 'a' + i % 26;
+
+        // Several pieces, and a gap in the middle
+        for (int i = 0; i < 6; i++) {
+            buf->cursor = (size_t)i * 50;
+            buffer_insert_text(buf, text + i * 100, 100);
+        }
+        char* content = buffer_get_range(buf, 0, 600);
+
+        ASSERT(iter_matches(buf, content, 0, 600));
+        ASSERT(iter_matches(buf, content, 37, 412));
+        ASSERT(iter_matches(buf, content, 250, 251));
+        ASSERT(iter_matches(buf, content, 300, 300));
+
+        free(content);
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_find_byte)
+{
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "ab\ncd\nef", 8);
+    buf->cursor = 4;
+    buffer_insert_char(buf, 'x'); // Gap at 5: "ab\ncdx\nef"
+
+    ASSERT_EQ(buffer_find_byte(buf, '\n', 0, 9), 2);
+    ASSERT_EQ(buffer_find_byte(buf, '\n', 3, 9), 6);
+    ASSERT_EQ(buffer_find_byte(buf, '\n', 7, 9), -1);
+    ASSERT_EQ(buffer_find_byte(buf, '\n', 3, 6), -1);
+    ASSERT_EQ(buffer_rfind_byte(buf, '\n', 0, 9), 6);
+    ASSERT_EQ(buffer_rfind_byte(buf, '\n', 0, 6), 2);
+    ASSERT_EQ(buffer_rfind_byte(buf, '\n', 3, 6), -1);
+    ASSERT_EQ(buffer_rfind_byte(buf, 'a', 0, 9), 0);
+    buffer_destroy(buf);
+}
+
+TEST(test_find_across_gap)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "one needle two", 14);
+
+        // Split "needle" at every point, so the match straddles the gap or
+        // a piece boundary
+        for (size_t split = 5; split < 10; split++) {
+            buf->cursor = split;
+            buffer_insert_char(buf, 'x');
+            buffer_backspace(buf);
+            ASSERT_EQ(buffer_find(buf, "needle", 0), 4);
+            ASSERT_EQ(buffer_find(buf, "needle", 5), -1);
+            ASSERT_EQ(buffer_find(buf, "e two", 0), 9);
+        }
+        buffer_destroy(buf);
+    }
+}
+
+static bool buffer_is(Buffer* buf, const char* expect)
+{
+    size_t len = strlen(expect);
+    if (buffer_length(buf) != len)
+        return false;
+    char* content = buffer_get_range(buf, 0, len);
+    bool  same    = len == 0 || (content && memcmp(content, expect, len) == 0);
+    free(content);
+    return same;
+}
+
+TEST(test_replace_all)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "foo bar\nfoo\nbarfoo", 18);
+        buf->cursor = 9; // Inside the second foo
+        buffer_insert_char(buf, 'x');
+        buffer_backspace(buf);
+
+        size_t at[] = { 0, 8, 15 };
+        ASSERT_EQ(buffer_replace_all(buf, at, 3, 3, "quux\n", 5), 3);
+        ASSERT(buffer_is(buf, "quux\n bar\nquux\n\nbarquux\n"));
+        ASSERT_EQ(buffer_line_count(buf), 6);
+        ASSERT_EQ(buffer_get_line_offset(buf, 4), 16);
+        ASSERT_EQ(buf->cursor, 10);
+
+        // One undo step puts every match back, and redo replaces them again
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "foo bar\nfoo\nbarfoo"));
+        ASSERT_EQ(buffer_line_count(buf), 3);
+        buffer_redo(buf);
+        ASSERT(buffer_is(buf, "quux\n bar\nquux\n\nbarquux\n"));
+        buffer_undo(buf);
+
+        // Editing goes on normally afterwards
+        buf->cursor = 0;
+        buffer_insert_text(buf, ">", 1);
+        ASSERT(buffer_is(buf, ">foo bar\nfoo\nbarfoo"));
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_replace_all_overlaps_and_case)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        // Overlapping matches of "aa" in "aaaaa": the second and fourth are
+        // skipped
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "aaaaa", 5);
+        size_t at[] = { 0, 1, 2, 3 };
+        ASSERT_EQ(buffer_replace_all(buf, at, 4, 2, "", 0), 2);
+        ASSERT(buffer_is(buf, "a"));
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "aaaaa"));
+        buffer_destroy(buf);
+
+        // Matches that differ in case each get their own text back
+        buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "Cat cat CAT", 11);
+        size_t words[] = { 0, 4, 8 };
+        ASSERT_EQ(buffer_replace_all(buf, words, 3, 3, "dog", 3), 3);
+        ASSERT(buffer_is(buf, "dog dog dog"));
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "Cat cat CAT"));
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_replace_all_many)
+{
+    // Many matches across many pieces, against a plain string rebuild
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        size_t len  = 20000;
+        char*  text = malloc(len);
+        srand(9);
+        for (size_t i = 0; i < len; i++)
+            text[i] = "ab\n"[rand() % 3];
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        for (size_t i = 0; i < len; i += 1000) {
+            buf->cursor = i / 2;
+            buffer_insert_text(buf, text + i, 1000);
+        }
+        char* before = buffer_get_range(buf, 0, len);
+
+        size_t* at     = malloc(len * sizeof(size_t));
+        size_t  count  = 0;
+        char*   expect = malloc(len * 2 + 1);
+        size_t  n      = 0;
+        for (size_t i = 0; i < len;) {
+            if (i + 2 <= len && before[i] == 'a' && before[i + 1] == 'b') {
+                at[count++] = i;
+                memcpy(expect + n, "xyz", 3);
+                n += 3;
+                i += 2;
+            } else {
+                expect[n++] = before[i++];
+            }
+        }
+        expect[n] = '\0';
+
+        ASSERT_EQ(buffer_replace_all(buf, at, count, 2, "xyz", 3), count);
+        ASSERT(buffer_is(buf, expect));
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, before));
+        buffer_redo(buf);
+        ASSERT(buffer_is(buf, expect));
+
+        free(at);
+        free(expect);
+        free(before);
+        free(text);
+        buffer_destroy(buf);
+    }
+}
+
+// Line offsets from the incrementally kept index match a fresh rebuild
+static bool line_index_fresh(Buffer* buf)
+{
+    size_t  lines   = buffer_line_count(buf);
+    size_t* offsets = malloc(lines * sizeof(size_t));
+    for (size_t i = 0; i < lines; i++)
+        offsets[i] = buffer_get_line_offset(buf, i);
+    buffer_rebuild_line_index(buf);
+    bool same = buffer_line_count(buf) == lines;
+    for (size_t i = 0; same && i < lines; i++)
+        same = buffer_get_line_offset(buf, i) == offsets[i];
+    free(offsets);
+    return same;
+}
+
+TEST(test_multi_cursor_lines)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "one\ntwo\nthree\n", 14);
+        buffer_move_cursor_to(buf, 1);
+        buffer_start_selection(buf);
+        buffer_move_cursor_to(buf, 10);
+        buffer_update_selection(buf);
+
+        ASSERT_EQ(buffer_add_cursors_on_lines(buf), 3);
+        ASSERT_EQ(buf->cursor, 13);
+        ASSERT(!buffer_has_selection(buf));
+
+        buffer_multi_insert(buf, "!", 1);
+        ASSERT(buffer_is(buf, "one!\ntwo!\nthree!\n"));
+        buffer_multi_backspace(buf);
+        buffer_multi_backspace(buf);
+        ASSERT(buffer_is(buf, "on\ntw\nthre\n"));
+        buffer_multi_insert(buf, "\n", 1);
+        ASSERT(buffer_is(buf, "on\n\ntw\n\nthre\n\n"));
+        ASSERT_EQ(buffer_line_count(buf), 7);
+        ASSERT_EQ(buf->line, 5);
+        ASSERT(line_index_fresh(buf));
+
+        // One undo step per keystroke, cursors and all
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "on\ntw\nthre\n"));
+        ASSERT_EQ(buffer_cursor_count(buf), 3);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\nthree\n"));
+        buffer_redo(buf);
+        buffer_multi_delete(buf);
+        ASSERT(buffer_is(buf, "ontwthre"));
+        ASSERT(line_index_fresh(buf));
+
+        // A single-cursor edit drops the others
+        buffer_insert_char(buf, 'x');
+        ASSERT_EQ(buffer_cursor_count(buf), 1);
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_multi_cursor_next_match)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "foo bar foo\nfoo", 15);
+        buffer_move_cursor_to(buf, 9);
+
+        // The word under the cursor first, then each next one, wrapping
+        ASSERT(buffer_add_cursor_at_next_match(buf));
+        ASSERT_EQ(buf->sel_start, 8);
+        ASSERT(buffer_add_cursor_at_next_match(buf));
+        ASSERT_EQ(buf->sel_start, 12);
+        ASSERT(buffer_add_cursor_at_next_match(buf));
+        ASSERT_EQ(buf->sel_start, 0);
+        ASSERT_EQ(buffer_cursor_count(buf), 3);
+        ASSERT(!buffer_add_cursor_at_next_match(buf));
+
+        buffer_multi_insert(buf, "x", 1);
+        ASSERT(buffer_is(buf, "x bar x\nx"));
+        ASSERT_EQ(buf->cursor, 1);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "foo bar foo\nfoo"));
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_multi_cursor_merge)
+{
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "abcdef", 6);
+    buffer_move_cursor_to(buf, 3);
+    ASSERT(buffer_add_cursor(buf, 4, 4));
+    ASSERT(buffer_add_cursor(buf, 6, 5));
+    ASSERT(!buffer_add_cursor(buf, 3, 3));
+    ASSERT(!buffer_add_cursor(buf, 5, 6));
+    ASSERT_EQ(buffer_cursor_count(buf), 3);
+
+    // Backspace at 3 and 4 plus the selected "f": the two cursors meet
+    buffer_multi_backspace(buf);
+    ASSERT(buffer_is(buf, "abe"));
+    ASSERT_EQ(buffer_cursor_count(buf), 2);
+    buffer_multi_backspace(buf);
+    ASSERT(buffer_is(buf, "a"));
+    ASSERT_EQ(buffer_cursor_count(buf), 1);
+
+    // Moving onto each other merges too
+    buffer_insert_text(buf, "bcd", 3);
+    buffer_add_cursor(buf, 0, 0);
+    buffer_multi_move(buf, -10);
+    ASSERT_EQ(buffer_cursor_count(buf), 1);
+    buffer_destroy(buf);
+}
+
+TEST(test_multi_cursor_many)
+{
+    // A cursor on each of 5000 lines, typing and deleting, against a
+    // plain string model
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        for (int i = 0; i < 5000; i++)
+            buffer_insert_text(buf, "line\n", 5);
+        buffer_move_cursor_to(buf, 0);
+        buffer_start_selection(buf);
+        buffer_move_cursor_to(buf, buffer_length(buf));
+        buffer_update_selection(buf);
+        ASSERT_EQ(buffer_add_cursors_on_lines(buf), 5000); // Not the empty last line
+
+        buffer_multi_insert(buf, "ab;", 3);
+        buffer_multi_backspace(buf);
+        buffer_multi_move(buf, -1);
+        buffer_multi_delete(buf);
+        ASSERT_EQ(buffer_length(buf), 5000 * 6);
+        for (int i = 0; i < 5000; i += 999) {
+            char* line = buffer_get_range(buf, i * 6, i * 6 + 6);
+            ASSERT(memcmp(line, "linea\n", 6) == 0);
+            free(line);
+        }
+        ASSERT(line_index_fresh(buf));
+
+        buffer_undo(buf);
+        buffer_undo(buf);
+        buffer_undo(buf);
+        ASSERT_EQ(buffer_length(buf), 5000 * 5);
+        ASSERT_EQ(buffer_cursor_count(buf), 5000);
+        ASSERT(line_index_fresh(buf));
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_utf8_char_editing)
+{
+    // "aλ中é" with é as e plus a combining accent
+    const char* text = "a\xce\xbb\xe4\xb8\xad" "e\xcc\x81";
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, text, strlen(text));
+        ASSERT_EQ(buf->cursor, 9);
+        ASSERT_EQ(buf->col, 5); // The accent takes no column
+
+        buffer_move_char(buf, -1);
+        ASSERT_EQ(buf->cursor, 7);
+        buffer_move_char(buf, -2);
+        ASSERT_EQ(buf->cursor, 3);
+        ASSERT_EQ(buf->col, 2);
+
+        // Whole characters go at once
+        buffer_delete_char(buf);
+        ASSERT(buffer_is(buf, "a\xce\xbb" "e\xcc\x81"));
+        buffer_backspace(buf);
+        ASSERT(buffer_is(buf, "ae\xcc\x81"));
+        ASSERT_EQ(buf->cursor, 1);
+        ASSERT_EQ(buf->col, 1);
+
+        // Delete then Backspace at the same spot is one undo step
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, text));
+
+        // Typed bytes of a character end up with the right column
+        buffer_move_cursor_to(buf, 0);
+        buffer_insert_char(buf, (char)0xe4);
+        buffer_insert_char(buf, (char)0xb8);
+        buffer_insert_char(buf, (char)0xad);
+        ASSERT_EQ(buf->col, 2);
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_utf8_malformed_bytes)
+{
+    // Stray bytes are a character each
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "\xe4\xb8" "x\x80", 4);
+    ASSERT_EQ(buf->col, 4);
+    ASSERT_EQ(buffer_prev_char(buf, 4), 3);
+    ASSERT_EQ(buffer_prev_char(buf, 2), 1);
+    ASSERT_EQ(buffer_next_char(buf, 0), 1);
+    buffer_backspace(buf);
+    buffer_backspace(buf);
+    ASSERT(buffer_is(buf, "\xe4\xb8"));
+    ASSERT_EQ(buf->col, 2);
+    buffer_destroy(buf);
+}
+
+TEST(test_utf8_delete_keeps_column)
+{
+    // Delete at random spots in malformed text: the bytes before the cursor
+    // may join up with what follows, and the column must follow them
+    static const char* pieces[] = { "a", "\xe4", "\xb8", "\xad", "\xf0\x9f", "\x94", "\xc3", "\xa9", "\n" };
+    srand(23);
+    for (int round = 0; round < 300; round++) {
+        Buffer* buf = buffer_create(16);
+        for (int i = 0; i < 12; i++) {
+            const char* p = pieces[rand() % 9];
+            buffer_insert_text(buf, p, strlen(p));
+        }
+        while (buffer_length(buf) > 0) {
+            buffer_move_cursor_to(buf, (size_t)rand() % buffer_length(buf));
+            buffer_delete_char(buf);
+            ASSERT_EQ(buf->col, buffer_line_pos(buf, buf->cursor).col);
+        }
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_utf8_move_line_keeps_column)
+{
+    // Column 4 is after "中中" on the first line, after "abcd" on the
+    // second, and can't split the wide character on the third
+    Buffer* buf = buffer_create(16);
+    const char* text = "\xe4\xb8\xad\xe4\xb8\xadxy\nabcdef\na\xe4\xb8\xad\xe4\xb8\xad";
+    buffer_insert_text(buf, text, strlen(text));
+    buffer_move_cursor_to(buf, 6);
+    ASSERT_EQ(buf->col, 4);
+    buffer_move_line(buf, 1);
+    ASSERT_EQ(buf->cursor, 13);
+    ASSERT_EQ(buf->col, 4);
+    buffer_move_line(buf, 1);
+    ASSERT_EQ(buf->cursor, 20);
+    ASSERT_EQ(buf->col, 3);
+    buffer_move_line(buf, -2);
+    ASSERT_EQ(buf->cursor, 3);
+    ASSERT_EQ(buf->col, 2);
+    buffer_destroy(buf);
+}
+
+// Position of byte offset pos in text, decoding from the start
+static Utf8Pos brute_pos(const char* text, size_t pos)
+{
+    Utf8Pos at = { 0, 0, 0 };
+    while (at.byte < pos) {
+        u32    cp;
+        size_t n = utf8_decode(text + at.byte, strlen(text + at.byte), &cp);
+        if (at.byte + n > pos)
+            break;
+        at.byte += n;
+        at.cp++;
+        at.col += utf8_width(cp);
+    }
+    return at;
+}
+
+TEST(test_utf8_long_line_columns)
+{
+    // A line long enough for checkpoints, edited all over (some edits
+    // making or breaking multibyte characters) and checked against a
+    // plain decode after each
+    static const char* pieces[] = { "abc", "\xce\xbb", "\xe4\xb8\xad", "e\xcc\x81", "\xf0\x9f\x94\xa5", "\x80",
+        "\xe4" };
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(64, storages[s]);
+        buffer_insert_text(buf, "top\n", 4);
+        srand(5);
+        while (buffer_length(buf) < 100000) {
+            const char* p = pieces[rand() % 7];
+            buffer_insert_text(buf, p, strlen(p));
+        }
+        buffer_insert_text(buf, "\nbottom", 7);
+
+        for (int round = 0; round < 60; round++) {
+            size_t len   = buffer_get_line_offset(buf, 2) - 1 - 4;
+            size_t where = 4 + (size_t)rand() % len;
+            buffer_move_cursor_to(buf, where);
+            switch (round % 3) {
+            case 0: {
+                const char* p = pieces[rand() % 7];
+                buffer_insert_text(buf, p, strlen(p));
+                break;
+            }
+            case 1:
+                buffer_delete_range(buf, where, where + 1 + (size_t)rand() % 9000);
+                break;
+            default:
+                buffer_backspace(buf);
+            }
+
+            char* line = buffer_get_range(buf, 4, buffer_get_line_offset(buf, 2) - 1);
+            for (int probe = 0; probe < 4; probe++) {
+                size_t  pos      = (size_t)rand() % (strlen(line) + 1);
+                Utf8Pos expected = brute_pos(line, pos);
+                Utf8Pos got      = buffer_line_pos(buf, 4 + pos);
+                ASSERT_EQ(got.byte, expected.byte);
+                ASSERT_EQ(got.cp, expected.cp);
+                ASSERT_EQ(got.col, expected.col);
+
+                Utf8Pos seek = buffer_line_seek(buf, 1, UTF8_COLUMNS, expected.col);
+                ASSERT(seek.col == expected.col && seek.byte >= expected.byte);
+            }
+            ASSERT_EQ(buf->col, buffer_line_pos(buf, buf->cursor).col);
+            free(line);
+        }
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_far_column_seek)
+{
+    // A line past the checkpoint threshold between two short ones: seeks
+    // far along it, past its end, and Home/End from its middle
+    Buffer* buf  = buffer_create(64);
+    size_t  len  = 300000;
+    char*   line = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        line[i] = (char)('a' + i % 26);
+    memcpy(line + 1000, "\xe4\xb8\xad", 3); // One wide character early on
+    buffer_insert_text(buf, "x\n", 2);
+    buffer_insert_text(buf, line, len);
+    buffer_insert_text(buf, "\ny", 2);
+
+    Utf8Pos at = buffer_line_seek(buf, 1, UTF8_COLUMNS, 250000);
+    ASSERT_EQ(at.col, 250000);
+    ASSERT_EQ(at.byte, 250001); // The wide character is three bytes, two columns
+    ASSERT_EQ(at.cp, 249999);
+    at = buffer_line_seek(buf, 1, UTF8_COLUMNS, 10 * len);
+    ASSERT_EQ(at.byte, len);
+    ASSERT_EQ(at.col, len - 1);
+    at = buffer_line_seek(buf, 99, UTF8_COLUMNS, 5); // Clamped to the last line
+    ASSERT_EQ(at.byte, 1);
+
+    buffer_move_cursor_to(buf, 2 + len / 2);
+    buffer_move_to_line_end(buf);
+    ASSERT_EQ(buf->cursor, 2 + len);
+    ASSERT_EQ(buf->col, len - 1);
+    buffer_move_to_line_start(buf);
+    ASSERT_EQ(buf->cursor, 2);
+    ASSERT_EQ(buf->line, 1);
+    free(line);
+    buffer_destroy(buf);
+}
+
+TEST(test_move_many_lines)
+{
+    // Line i is i % 7 characters long; jumps of any size land on the
+    // right line, at the column kept or the line end
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf   = buffer_create_with_storage(64, storages[s]);
+        size_t  lines = 200000;
+        char*   text  = malloc(lines * 7);
+        size_t  len   = 0;
+        for (size_t i = 0; i < lines; i++) {
+            memcpy(text + len, "abcdef", i % 7);
+            len += i % 7;
+            text[len++] = '\n';
+        }
+        buffer_insert_text(buf, text, len);
+        free(text);
+        ASSERT_EQ(buffer_line_count(buf), lines + 1);
+
+        buffer_goto_line(buf, 3);
+        buffer_move_to_line_end(buf);
+        ASSERT_EQ(buf->col, 3);
+        buffer_move_line(buf, 100000);
+        ASSERT_EQ(buf->line, 100003);
+        ASSERT_EQ(buf->col, 100003 % 7 < 3 ? 100003 % 7 : 3);
+        ASSERT_EQ(buf->cursor, buffer_get_line_offset(buf, 100003) + buf->col);
+
+        buffer_move_line(buf, 1000000);
+        ASSERT_EQ(buf->line, lines);
+        buffer_move_line(buf, -1000000);
+        ASSERT_EQ(buf->line, 0);
+        ASSERT_EQ(buf->cursor, 0);
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_apply_edits)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "alpha\nbeta\ngamma\n", 17);
+        buffer_move_cursor_to(buf, 7);
+
+        BufferEdit edits[] = {
+            { 0, 5, "A", 1 },
+            { 6, 6, "new\n", 4 },
+            { 11, 17, "", 0 },
+        };
+        ASSERT(buffer_apply_edits(buf, edits, 3, 2));
+        ASSERT(buffer_is(buf, "A\nnew\nbeta\n"));
+        ASSERT_EQ(buf->cursor, 2);
+        ASSERT_EQ(buf->line, 1);
+        ASSERT(line_index_fresh(buf));
+
+        // One undo step, which puts the cursor back
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "alpha\nbeta\ngamma\n"));
+        ASSERT_EQ(buf->cursor, 7);
+        ASSERT(line_index_fresh(buf));
+        buffer_redo(buf);
+        ASSERT(buffer_is(buf, "A\nnew\nbeta\n"));
+        ASSERT_EQ(buf->cursor, 2);
+        ASSERT_EQ(buffer_cursor_count(buf), 1);
+
+        // Out of order or overlapping edits change nothing
+        BufferEdit bad[] = { { 4, 6, "x", 1 }, { 5, 7, "y", 1 } };
+        ASSERT(!buffer_apply_edits(buf, bad, 2, 0));
+        ASSERT(buffer_is(buf, "A\nnew\nbeta\n"));
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_line_ops_single_undo)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "one\ntwo\nthree", 13);
+        buffer_move_cursor_to(buf, 10); // "th|ree"
+
+        buffer_move_line_up(buf);
+        ASSERT(buffer_is(buf, "one\nthree\ntwo"));
+        ASSERT_EQ(buf->cursor, 6);
+        ASSERT_EQ(buf->line, 1);
+        buffer_move_line_up(buf);
+        ASSERT(buffer_is(buf, "three\none\ntwo"));
+        ASSERT_EQ(buf->cursor, 2);
+        buffer_move_line_up(buf);
+        ASSERT(buffer_is(buf, "three\none\ntwo"));
+
+        buffer_move_line_down(buf);
+        buffer_move_line_down(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\nthree"));
+        ASSERT_EQ(buf->cursor, 10);
+        buffer_move_line_down(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\nthree"));
+        ASSERT(line_index_fresh(buf));
+
+        // Each move was one undo step
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "one\nthree\ntwo"));
+        ASSERT_EQ(buf->cursor, 6);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "three\none\ntwo"));
+        ASSERT_EQ(buf->cursor, 2);
+        buffer_undo(buf);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\nthree"));
+        ASSERT_EQ(buf->cursor, 10);
+
+        buffer_move_cursor_to(buf, 5); // "t|wo"
+        buffer_duplicate_line(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\ntwo\nthree"));
+        ASSERT_EQ(buf->cursor, 9);
+        buffer_move_cursor_to(buf, 17);
+        buffer_duplicate_line(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\ntwo\nthree\nthree"));
+        buffer_undo(buf);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\nthree"));
+
+        buffer_move_cursor_to(buf, 5);
+        buffer_delete_line(buf);
+        ASSERT(buffer_is(buf, "one\nthree"));
+        ASSERT_EQ(buf->cursor, 4);
+        buffer_move_cursor_to(buf, 6);
+        buffer_delete_line(buf);
+        ASSERT(buffer_is(buf, "one"));
+        ASSERT(line_index_fresh(buf));
+        buffer_undo(buf);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "one\ntwo\nthree"));
+        ASSERT_EQ(buf->cursor, 5);
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_move_long_line)
+{
+    // Moving a long line past a short one copies the short one
+    Buffer* buf  = buffer_create(64);
+    size_t  len  = 100000;
+    char*   line = malloc(len);
+    memset(line, 'x', len);
+    buffer_insert_text(buf, "a\n", 2);
+    buffer_insert_text(buf, line, len);
+    buffer_insert_text(buf, "\nb", 2);
+    buffer_move_cursor_to(buf, 2 + 500);
+
+    buffer_move_line_up(buf);
+    ASSERT_EQ(buf->cursor, 500);
+    ASSERT_EQ(buffer_char_at(buf, len), '\n');
+    ASSERT_EQ(buffer_char_at(buf, len + 1), 'a');
+    buffer_move_line_down(buf);
+    buffer_move_line_down(buf);
+    ASSERT_EQ(buf->cursor, 4 + 500);
+    ASSERT_EQ(buffer_char_at(buf, 0), 'a');
+    ASSERT_EQ(buffer_char_at(buf, 2), 'b');
+    ASSERT_EQ(buffer_line_count(buf), 3);
+    ASSERT(line_index_fresh(buf));
+    free(line);
+    buffer_destroy(buf);
+}
+
+TEST(test_typing_undo_steps)
+{
+    Buffer* buf = buffer_create(16);
+    const char* text = "int main(void) { return 0; } // a comment long enough";
+    for (size_t i = 0; text[i]; i++)
+        buffer_insert_char(buf, text[i]);
+    buffer_backspace(buf);
+    buffer_backspace(buf);
+
+    // Typing goes back a few words at a time, not a byte at a time
+    buffer_undo(buf);
+    ASSERT(buffer_is(buf, "int main(void) { return 0; } // a comment long enough"));
+    buffer_undo(buf);
+    ASSERT(buffer_is(buf, "int main(void) { return 0; } // "));
+    buffer_undo(buf);
+    ASSERT(buffer_is(buf, ""));
+
+    // Moving the cursor starts a new step
+    buffer_redo(buf);
+    buffer_move_cursor_to(buf, 3);
+    buffer_insert_char(buf, 'x');
+    buffer_move_cursor_to(buf, 4);
+    buffer_insert_char(buf, 'y');
+    buffer_undo(buf);
+    ASSERT(buffer_is(buf, "intx main(void) { return 0; } // "));
+    buffer_destroy(buf);
+}
+
+TEST(test_typing_undo_model)
+{
+    // Random keystrokes and cursor moves, then undo all the way: each undo
+    // lands on a state seen before, going back in order
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf   = buffer_create_with_storage(16, storages[s]);
+        size_t  steps = 3000;
+        char**  seen  = malloc((steps + 1) * sizeof(char*));
+        seen[0]       = strdup("");
+        srand(17 + s);
+        for (size_t i = 1; i <= steps; i++) {
+            int r = rand() % 20;
+            if (r < 12)
+                buffer_insert_char(buf, " abcde\n"[rand() % 7]);
+            else if (r < 15)
+                buffer_backspace(buf);
+            else if (r < 17)
+                buffer_delete_char(buf);
+            else
+                buffer_move_cursor_to(buf, (size_t)rand() % (buffer_length(buf) + 1));
+            seen[i]           = malloc(buffer_length(buf) + 1);
+            seen[i][buffer_extract(buf, 0, buffer_length(buf), seen[i])] = '\0';
+        }
+
+        size_t at    = steps;
+        size_t undos = 0;
+        while (undo_can_undo(buf->undo)) {
+            buffer_undo(buf);
+            undos++;
+            char* now = malloc(buffer_length(buf) + 1);
+            now[buffer_extract(buf, 0, buffer_length(buf), now)] = '\0';
+            while (at > 0 && strcmp(seen[at - 1], now) != 0)
+                at--;
+            ASSERT(at > 0);
+            at--;
+            free(now);
+        }
+        ASSERT_EQ(buffer_length(buf), 0);
+        ASSERT(undos * 2 < steps); // Runs of the same keystroke merged
+        while (undo_can_redo(buf->undo))
+            buffer_redo(buf);
+        ASSERT(buffer_is(buf, seen[steps]));
+        ASSERT(line_index_fresh(buf));
+
+        for (size_t i = 0; i <= steps; i++)
+            free(seen[i]);
+        free(seen);
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_undo_spilled_delete)
+{
+    // Deleting everything sends the text to the spill file; undo streams it
+    // back in blocks
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    size_t        len        = 3 * 1024 * 1024 + 123;
+    char*         text       = malloc(len + 1);
+    for (size_t i = 0; i < len; i++)
+        text[i] = i % 61 == 60 ? '\n' : (char)('a' + i % 26);
+    text[len] = '\0';
+
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        undo_set_limits(buf->undo, UNDO_MEMORY_LIMIT, 4096, UNDO_DISK_LIMIT);
+        buffer_insert_text(buf, text, len);
+        buffer_insert_text(buf, "!", 1);
+
+        buffer_delete_range(buf, 0, buffer_length(buf));
+        ASSERT_EQ(buffer_length(buf), 0);
+        ASSERT(buf->undo->ops[buf->undo->count - 1].text == NULL);
+
+        buffer_undo(buf);
+        ASSERT_EQ(buffer_length(buf), len + 1);
+        char* got = buffer_get_range(buf, 0, len);
+        ASSERT(memcmp(got, text, len) == 0);
+        free(got);
+        ASSERT(line_index_fresh(buf));
+
+        buffer_redo(buf);
+        ASSERT_EQ(buffer_length(buf), 0);
+        buffer_undo(buf);
+        buffer_undo(buf); // The "!"
+        buffer_undo(buf); // The spilled insert, taken out again
+        ASSERT_EQ(buffer_length(buf), 0);
+        buffer_redo(buf);
+        ASSERT_EQ(buffer_length(buf), len);
+        ASSERT(line_index_fresh(buf));
+        buffer_destroy(buf);
+    }
+    free(text);
+}
+
+TEST(test_undo_groups)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "hello world\nline two\n", 21);
+
+        // Paste over a selection: one undo step, cursor back where it was
+        buffer_move_cursor_to(buf, 6);
+        buffer_start_selection(buf);
+        buffer_move_cursor_to(buf, 11);
+        buffer_update_selection(buf);
+        buffer_insert_text(buf, "there\nnew", 9);
+        ASSERT(buffer_is(buf, "hello there\nnew\nline two\n"));
+        ASSERT_EQ(buf->undo->count, 2);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "hello world\nline two\n"));
+        ASSERT_EQ(buf->cursor, 11);
+        ASSERT(line_index_fresh(buf));
+        buffer_redo(buf);
+        ASSERT(buffer_is(buf, "hello there\nnew\nline two\n"));
+        ASSERT_EQ(buf->cursor, 15);
+        ASSERT_EQ(buf->line, 1);
+        ASSERT(line_index_fresh(buf));
+
+        // Keystrokes and a nested group, undone in one go
+        buffer_begin_group(buf);
+        buffer_insert_char(buf, '!');
+        buffer_begin_group(buf);
+        buffer_move_cursor_to(buf, 0);
+        buffer_delete_char(buf);
+        buffer_end_group(buf);
+        buffer_insert_char(buf, 'H');
+        buffer_end_group(buf);
+        ASSERT(buffer_is(buf, "Hello there\nnew!\nline two\n"));
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "hello there\nnew\nline two\n"));
+        ASSERT_EQ(buf->cursor, 15);
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "hello world\nline two\n"));
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_paste_over_selection)
+{
+    // The editor's Ctrl+V: the selection and the paste undo together
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "hello world", 11);
+        buffer_move_cursor_to(buf, 0);
+        buffer_start_selection(buf);
+        buffer_move_cursor_to(buf, 5);
+        buffer_update_selection(buf);
+        buffer_paste(buf, "HEY", 3);
+        ASSERT(buffer_is(buf, "HEY world"));
+        ASSERT(!buffer_has_selection(buf));
+        buffer_undo(buf);
+        ASSERT(buffer_is(buf, "hello world"));
+        buffer_redo(buf);
+        ASSERT(buffer_is(buf, "HEY world"));
+        ASSERT_EQ(buf->cursor, 3);
+        ASSERT(line_index_fresh(buf));
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_undo_groups_model)
+{
+    // Groups of random edits undo to the text before them and redo to the
+    // text after, in one step each
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        buffer_insert_text(buf, "one\ntwo\nthree\n", 14);
+        srand(5 + s);
+        for (int g = 0; g < 200; g++) {
+            char*  before = buffer_get_range(buf, 0, buffer_length(buf));
+            size_t steps  = buf->undo->current;
+            buffer_begin_group(buf);
+            for (int k = rand() % 5; k >= 0; k--) {
+                buffer_move_cursor_to(buf, (size_t)rand() % (buffer_length(buf) + 1));
+                int r = rand() % 3;
+                if (r == 0)
+                    buffer_insert_text(buf, "xy\nz", 1 + rand() % 4);
+                else if (r == 1)
+                    buffer_backspace(buf);
+                else
+                    buffer_delete_char(buf);
+            }
+            buffer_end_group(buf);
+            char* after = buffer_get_range(buf, 0, buffer_length(buf));
+            if (buf->undo->current == steps) { // Nothing happened
+                free(before);
+                free(after);
+                continue;
+            }
+            ASSERT_EQ(buf->undo->current, steps + 1);
+
+            buffer_undo(buf);
+            ASSERT(buffer_is(buf, before ? before : ""));
+            ASSERT(line_index_fresh(buf));
+            buffer_redo(buf);
+            ASSERT(buffer_is(buf, after ? after : ""));
+            ASSERT(line_index_fresh(buf));
+            free(before);
+            free(after);
+        }
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_undo_group_spilled)
+{
+    // A paste over a selection big enough to spill undoes in one go too,
+    // op by op
+    Buffer* buf = buffer_create(16);
+    undo_set_limits(buf->undo, UNDO_MEMORY_LIMIT, 64, UNDO_DISK_LIMIT);
+    char text[200];
+    memset(text, 'a', sizeof(text));
+    buffer_insert_text(buf, text, sizeof(text));
+    buffer_move_cursor_to(buf, 0);
+    buffer_start_selection(buf);
+    buffer_move_cursor_to(buf, 150);
+    buffer_update_selection(buf);
+    buffer_insert_text(buf, "b\nc", 3);
+    ASSERT_EQ(buffer_length(buf), 53);
+    buffer_undo(buf);
+    ASSERT_EQ(buffer_length(buf), 200);
+    ASSERT(line_index_fresh(buf));
+    buffer_redo(buf);
+    ASSERT_EQ(buffer_length(buf), 53);
+    ASSERT_EQ(buf->line, 1);
+    buffer_undo(buf);
+    buffer_undo(buf);
+    ASSERT_EQ(buffer_length(buf), 0);
+    buffer_destroy(buf);
+}
+
 int main(void)
 {
     printf("Buffer tests:\n");
@@ -1070,6 +2192,37 @@ int main(void)
     RUN_TEST(test_insert_after_undo);
     RUN_TEST(test_cursor_column_preservation);
     RUN_TEST(test_large_line_count);
+    RUN_TEST(test_line_index_matches_rebuild);
+    RUN_TEST(test_undo_redo_keep_line_index);
+    RUN_TEST(test_gap_growth_keeps_text);
+    RUN_TEST(test_gap_released_after_big_delete);
+    RUN_TEST(test_iter_spans);
+    RUN_TEST(test_find_byte);
+    RUN_TEST(test_find_across_gap);
+    RUN_TEST(test_replace_all);
+    RUN_TEST(test_replace_all_overlaps_and_case);
+    RUN_TEST(test_replace_all_many);
+    RUN_TEST(test_multi_cursor_lines);
+    RUN_TEST(test_multi_cursor_next_match);
+    RUN_TEST(test_multi_cursor_merge);
+    RUN_TEST(test_multi_cursor_many);
+    RUN_TEST(test_utf8_char_editing);
+    RUN_TEST(test_utf8_malformed_bytes);
+    RUN_TEST(test_utf8_delete_keeps_column);
+    RUN_TEST(test_utf8_move_line_keeps_column);
+    RUN_TEST(test_utf8_long_line_columns);
+    RUN_TEST(test_far_column_seek);
+    RUN_TEST(test_move_many_lines);
+    RUN_TEST(test_apply_edits);
+    RUN_TEST(test_line_ops_single_undo);
+    RUN_TEST(test_move_long_line);
+    RUN_TEST(test_typing_undo_steps);
+    RUN_TEST(test_typing_undo_model);
+    RUN_TEST(test_undo_spilled_delete);
+    RUN_TEST(test_undo_groups);
+    RUN_TEST(test_paste_over_selection);
+    RUN_TEST(test_undo_groups_model);
+    RUN_TEST(test_undo_group_spilled);
 
     TEST_SUMMARY();
 }
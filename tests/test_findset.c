@@ -0,0 +1,307 @@
+#include "test.h"
+#include "../include/findset.h"
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every match in the buffer, the slow way
+static size_t fresh_scan(Buffer* buf, const char* needle, u32 flags, size_t* out, size_t max)
+{
+    Searcher s;
+    search_init(&s, needle, strlen(needle), flags);
+    SearchHits hits = { 0 };
+    search_collect(&s, buf, 0, buffer_length(buf), &hits);
+    size_t n = hits.count < max ? hits.count : max;
+    if (n > 0)
+        memcpy(out, hits.pos, n * sizeof(size_t));
+    free(hits.pos);
+    search_free(&s);
+    return n;
+}
+
+static bool same_as_fresh(FindSet* fs, Buffer* buf, const char* needle, u32 flags)
+{
+    static size_t expect[1 << 16];
+    size_t        n = fresh_scan(buf, needle, flags, expect, 1 << 16);
+    if (!findset_done(fs, buf) || fs->hits.count != n || fs->total != n)
+        return false;
+    return n == 0 || memcmp(fs->hits.pos, expect, n * sizeof(size_t)) == 0;
+}
+
+static void random_text(char* text, size_t len)
+{
+    static const char alphabet[] = "abAB _\n";
+    for (size_t i = 0; i < len; i++)
+        text[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+}
+
+static Buffer* make_buffer(const char* text, size_t len, BufferStorage storage)
+{
+    Buffer* buf = buffer_create_with_storage(64, storage);
+    buffer_insert_text(buf, text, len);
+    return buf;
+}
+
+TEST(test_findset_scan)
+{
+    Buffer* buf = make_buffer("abc abc ab abcabc", 17, STORAGE_GAP);
+    FindSet fs;
+    findset_init(&fs);
+    ASSERT(findset_query(&fs, buf, "abc", 3, 0));
+    ASSERT(!findset_done(&fs, buf));
+    ASSERT(findset_step(&fs, buf, 1 << 20));
+    ASSERT_EQ(fs.total, 4);
+    ASSERT_EQ(fs.hits.pos[0], 0);
+    ASSERT_EQ(fs.hits.pos[3], 14);
+
+    // An empty needle clears the set
+    ASSERT(!findset_query(&fs, buf, "", 0, 0));
+    ASSERT(!fs.active);
+    ASSERT_EQ(fs.total, 0);
+    findset_free(&fs);
+    buffer_destroy(buf);
+}
+
+TEST(test_findset_incremental_steps)
+{
+    // A few bytes a step, with matches straddling every step boundary
+    size_t len  = 20000;
+    char*  text = malloc(len);
+    srand(3);
+    random_text(text, len);
+    Buffer* buf = make_buffer(text, len, STORAGE_PIECE);
+
+    FindSet fs;
+    findset_init(&fs);
+    findset_query(&fs, buf, "ab a", 4, SEARCH_IGNORE_CASE);
+    size_t steps = 0;
+    while (!findset_step(&fs, buf, 7))
+        steps++;
+    ASSERT(steps > 1000);
+    ASSERT(same_as_fresh(&fs, buf, "ab a", SEARCH_IGNORE_CASE));
+    findset_free(&fs);
+    buffer_destroy(buf);
+    free(text);
+}
+
+TEST(test_findset_narrow)
+{
+    size_t len  = 50000;
+    char*  text = malloc(len);
+    srand(5);
+    random_text(text, len);
+    Buffer* buf = make_buffer(text, len, STORAGE_GAP);
+
+    // Typing the query a byte at a time ends up where a fresh scan would
+    const char* query = "aB_b";
+    for (u32 flags = 0; flags < 2; flags++) {
+        FindSet fs;
+        findset_init(&fs);
+        for (size_t n = 1; n <= strlen(query); n++) {
+            findset_query(&fs, buf, query, n, flags);
+            findset_step(&fs, buf, len);
+            char prefix[8] = { 0 };
+            memcpy(prefix, query, n);
+            ASSERT(same_as_fresh(&fs, buf, prefix, flags));
+        }
+        findset_free(&fs);
+    }
+    buffer_destroy(buf);
+    free(text);
+}
+
+TEST(test_findset_narrow_while_loading)
+{
+    // Narrowing drops the hit at 6, whose "cd" hasn't loaded yet; the scan
+    // goes back for it rather than running on past the text
+    Buffer* buf  = make_buffer("xxabcdab", 8, STORAGE_GAP);
+    buf->loading = true;
+    FindSet fs;
+    findset_init(&fs);
+    findset_query(&fs, buf, "ab", 2, 0);
+    findset_step(&fs, buf, 1 << 20);
+    ASSERT_EQ(fs.total, 2);
+    findset_query(&fs, buf, "abcd", 4, 0);
+    ASSERT_EQ(fs.total, 1);
+    ASSERT(!findset_step(&fs, buf, 1 << 20));
+    ASSERT(fs.scanned <= buffer_length(buf));
+
+    buf->cursor = 8;
+    buffer_insert_text(buf, "cdxx", 4);
+    ASSERT(!findset_step(&fs, buf, 1 << 20));
+    ASSERT(fs.scanned <= buffer_length(buf));
+    buf->loading = false;
+    ASSERT(findset_step(&fs, buf, 1 << 20));
+    ASSERT(same_as_fresh(&fs, buf, "abcd", 0));
+    ASSERT_EQ(fs.total, 2);
+    findset_free(&fs);
+    buffer_destroy(buf);
+}
+
+TEST(test_findset_narrow_high_bytes)
+{
+    // Only ASCII folds, whatever the locale says about Latin-1 letters
+    const char* locales[] = { "en_US.ISO-8859-1", "de_DE.ISO-8859-1", "fr_FR" };
+    for (size_t i = 0; i < 3; i++) {
+        if (setlocale(LC_CTYPE, locales[i]))
+            break;
+    }
+    Buffer* buf = make_buffer("x\xc9" "a X\xc9" "A x\xe9" "a", 11, STORAGE_GAP);
+    FindSet fs;
+    findset_init(&fs);
+    findset_query(&fs, buf, "x\xc9", 2, SEARCH_IGNORE_CASE);
+    findset_step(&fs, buf, 1 << 20);
+    ASSERT_EQ(fs.total, 2);
+    findset_query(&fs, buf, "x\xc9" "a", 3, SEARCH_IGNORE_CASE);
+    ASSERT(same_as_fresh(&fs, buf, "x\xc9" "a", SEARCH_IGNORE_CASE));
+    ASSERT_EQ(fs.total, 2);
+    findset_free(&fs);
+    buffer_destroy(buf);
+    setlocale(LC_CTYPE, "C");
+}
+
+TEST(test_findset_edits)
+{
+    // Random edits patch the set; it always matches a fresh scan
+    const char* needles[] = { "a", "ab", "b a", "aa" };
+    for (int storage = 0; storage < 2; storage++) {
+        for (size_t k = 0; k < 4; k++) {
+            for (u32 flags = 0; flags < 4; flags++) {
+                size_t len  = 3000;
+                char*  text = malloc(len);
+                srand(11 + k + flags);
+                random_text(text, len);
+                Buffer* buf = make_buffer(text, len, storage ? STORAGE_PIECE : STORAGE_GAP);
+
+                FindSet fs;
+                findset_init(&fs);
+                findset_query(&fs, buf, needles[k], strlen(needles[k]), flags);
+                findset_step(&fs, buf, len);
+                for (int i = 0; i < 200; i++) {
+                    size_t at = rand() % (buffer_length(buf) + 1);
+                    char   chunk[8];
+                    random_text(chunk, sizeof(chunk));
+                    buf->cursor = at;
+                    size_t before = buffer_length(buf);
+                    if (rand() % 2 || before < 10) {
+                        buffer_insert_text(buf, chunk, 1 + rand() % 8);
+                        findset_edit(&fs, buf, at, 0, buffer_length(buf) - before);
+                    } else {
+                        size_t n = 1 + rand() % 5;
+                        if (at + n > before)
+                            at = before - n;
+                        buffer_delete_range(buf, at, at + n);
+                        findset_edit(&fs, buf, at, n, 0);
+                    }
+                    findset_step(&fs, buf, 1 << 20);
+                    ASSERT(same_as_fresh(&fs, buf, needles[k], flags));
+                }
+                findset_free(&fs);
+                buffer_destroy(buf);
+                free(text);
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    FindSet* fs;
+    Buffer*  buf;
+} Watch;
+
+static void on_edit(void* ctx, size_t pos, size_t removed, size_t inserted)
+{
+    Watch* w = ctx;
+    findset_edit(w->fs, w->buf, pos, removed, inserted);
+}
+
+TEST(test_findset_edit_hook)
+{
+    // Edits reach the set through Buffer.on_edit, including ones made
+    // before the scan got there
+    Buffer* buf = make_buffer("one two one two one", 19, STORAGE_GAP);
+    FindSet fs;
+    findset_init(&fs);
+    findset_query(&fs, buf, "one", 3, 0);
+    findset_step(&fs, buf, 5);
+    ASSERT_EQ(fs.total, 1);
+
+    Watch watch      = { &fs, buf };
+    buf->on_edit     = on_edit;
+    buf->on_edit_ctx = &watch;
+    buf->cursor      = 19;
+    buffer_insert_text(buf, " one", 4); // Unscanned yet
+    buf->cursor = 0;
+    buffer_insert_text(buf, "xx", 2); // Shifts the match at 0
+    ASSERT_EQ(fs.hits.pos[0], 2);
+    ASSERT(findset_step(&fs, buf, 1 << 20));
+    ASSERT_EQ(fs.total, 4);
+    ASSERT_EQ(fs.hits.pos[3], 22);
+    findset_free(&fs);
+    buffer_destroy(buf);
+}
+
+TEST(test_findset_next_and_visible)
+{
+    Buffer* buf = make_buffer("x ab x ab x ab x", 16, STORAGE_GAP);
+    FindSet fs;
+    findset_init(&fs);
+    findset_query(&fs, buf, "ab", 2, 0);
+
+    // Before scanning the next match is found directly
+    ASSERT_EQ(findset_next(&fs, buf, 3), 7);
+    size_t out[8];
+    ASSERT_EQ(findset_visible(&fs, buf, 3, 9, out, 8), 2);
+    ASSERT_EQ(out[0], 2);
+    ASSERT_EQ(out[1], 7);
+
+    findset_step(&fs, buf, 1 << 20);
+    ASSERT_EQ(findset_next(&fs, buf, 0), 2);
+    ASSERT_EQ(findset_next(&fs, buf, 13), 2); // Wraps
+    ASSERT_EQ(findset_visible(&fs, buf, 3, 9, out, 8), 2);
+    ASSERT_EQ(findset_visible(&fs, buf, 0, 16, out, 1), 1);
+
+    findset_query(&fs, buf, "zz", 2, 0);
+    findset_step(&fs, buf, 1 << 20);
+    ASSERT_EQ(findset_next(&fs, buf, 0), -1);
+    findset_free(&fs);
+    buffer_destroy(buf);
+}
+
+TEST(test_findset_overflow)
+{
+    // Past the limit positions are dropped but the count carries on
+    size_t len  = (1 << 20) + 1000;
+    char*  text = malloc(len);
+    memset(text, 'a', len);
+    Buffer* buf = make_buffer(text, len, STORAGE_GAP);
+    FindSet fs;
+    findset_init(&fs);
+    findset_query(&fs, buf, "a", 1, 0);
+    while (!findset_step(&fs, buf, 100000))
+        ;
+    ASSERT(fs.overflow);
+    ASSERT_EQ(fs.total, len);
+    ASSERT_EQ(findset_next(&fs, buf, 500), 500);
+    size_t out[4];
+    ASSERT_EQ(findset_visible(&fs, buf, 10, 13, out, 4), 3);
+    findset_free(&fs);
+    buffer_destroy(buf);
+    free(text);
+}
+
+int main(void)
+{
+    printf("Find set tests:\n");
+    RUN_TEST(test_findset_scan);
+    RUN_TEST(test_findset_incremental_steps);
+    RUN_TEST(test_findset_narrow);
+    RUN_TEST(test_findset_narrow_while_loading);
+    RUN_TEST(test_findset_narrow_high_bytes);
+    RUN_TEST(test_findset_edits);
+    RUN_TEST(test_findset_edit_hook);
+    RUN_TEST(test_findset_next_and_visible);
+    RUN_TEST(test_findset_overflow);
+    TEST_SUMMARY();
+}
@@ -0,0 +1,142 @@
+#include "test.h"
+#include "../include/lineindex.h"
+#include <stdlib.h>
+
+// Reference model: the text itself, scanned byte by byte
+static char   model[1 << 16];
+static size_t model_len;
+
+static void model_insert(LineIndex* li, size_t pos, const char* text, size_t len)
+{
+    memmove(model + pos + len, model + pos, model_len - pos);
+    memcpy(model + pos, text, len);
+    model_len += len;
+
+    size_t starts[256];
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\n')
+            starts[count++] = pos + i + 1;
+    }
+    lineindex_insert(li, pos, len, starts, count);
+}
+
+static void model_delete(LineIndex* li, size_t pos, size_t len)
+{
+    memmove(model + pos, model + pos + len, model_len - pos - len);
+    model_len -= len;
+    lineindex_delete(li, pos, len);
+}
+
+static bool index_matches_model(LineIndex* li)
+{
+    if (lineindex_length(li) != model_len)
+        return false;
+
+    size_t line  = 0;
+    size_t start = 0;
+    for (size_t pos = 0; pos <= model_len; pos++) {
+        if (lineindex_offset(li, line) != start)
+            return false;
+        size_t got_start;
+        if (lineindex_line_at(li, pos, &got_start) != line || got_start != start)
+            return false;
+        if (pos < model_len && model[pos] == '\n') {
+            line++;
+            start = pos + 1;
+        }
+    }
+    return lineindex_count(li) == line + 1;
+}
+
+TEST(test_lineindex_empty)
+{
+    LineIndex* li = lineindex_create();
+    ASSERT_EQ(lineindex_count(li), 1);
+    ASSERT_EQ(lineindex_length(li), 0);
+    ASSERT_EQ(lineindex_offset(li, 0), 0);
+    ASSERT_EQ(lineindex_line_at(li, 0, NULL), 0);
+    lineindex_destroy(li);
+}
+
+TEST(test_lineindex_basic)
+{
+    LineIndex* li = lineindex_create();
+    model_len     = 0;
+
+    model_insert(li, 0, "abc\ndef\nghi", 11);
+    ASSERT_EQ(lineindex_count(li), 3);
+    ASSERT_EQ(lineindex_offset(li, 1), 4);
+    ASSERT_EQ(lineindex_offset(li, 2), 8);
+    ASSERT_EQ(lineindex_line_at(li, 3, NULL), 0);
+    ASSERT_EQ(lineindex_line_at(li, 4, NULL), 1);
+    ASSERT_EQ(lineindex_line_at(li, 11, NULL), 2);
+
+    // Join lines 0..2 by deleting both newlines' surroundings
+    model_delete(li, 2, 7);
+    ASSERT_EQ(lineindex_count(li), 1);
+    ASSERT_EQ(lineindex_length(li), 4);
+    ASSERT(index_matches_model(li));
+    lineindex_destroy(li);
+}
+
+TEST(test_lineindex_many_lines)
+{
+    // Enough lines to need many blocks, inserted in one go
+    LineIndex* li = lineindex_create();
+    model_len     = 0;
+
+    char text[200];
+    for (int i = 0; i < 200; i++)
+        text[i] = (i % 2) ? '\n' : 'x';
+    for (int i = 0; i < 20; i++)
+        model_insert(li, model_len / 2, text, sizeof(text));
+
+    ASSERT_EQ(lineindex_count(li), 2001);
+    ASSERT(index_matches_model(li));
+    lineindex_destroy(li);
+}
+
+TEST(test_lineindex_random)
+{
+    LineIndex* li = lineindex_create();
+    model_len     = 0;
+    srand(42);
+
+    for (int step = 0; step < 3000; step++) {
+        if (model_len > 20000 || (model_len > 0 && rand() % 3 == 0)) {
+            size_t pos = rand() % model_len;
+            size_t len = 1 + rand() % (model_len - pos < 300 ? model_len - pos : 300);
+            model_delete(li, pos, len);
+        } else {
+            char   text[200];
+            size_t len = 1 + rand() % sizeof(text);
+            for (size_t i = 0; i < len; i++)
+                text[i] = (rand() % 4 == 0) ? '\n' : 'a';
+            model_insert(li, model_len ? rand() % (model_len + 1) : 0, text, len);
+        }
+
+        if (step % 100 == 0)
+            ASSERT(index_matches_model(li));
+    }
+    ASSERT(index_matches_model(li));
+
+    // Clearing keeps the root block, so it needs no memory
+    LineNode* root = li->root;
+    lineindex_clear(li);
+    ASSERT(li->root == root);
+    ASSERT_EQ(li->node_count, 1);
+    ASSERT_EQ(lineindex_count(li), 1);
+    ASSERT_EQ(lineindex_length(li), 0);
+    lineindex_destroy(li);
+}
+
+int main(void)
+{
+    printf("Line index tests:\n");
+    RUN_TEST(test_lineindex_empty);
+    RUN_TEST(test_lineindex_basic);
+    RUN_TEST(test_lineindex_many_lines);
+    RUN_TEST(test_lineindex_random);
+    TEST_SUMMARY();
+}
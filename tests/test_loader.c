@@ -0,0 +1,139 @@
+#include "test.h"
+#include "../include/loader.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define LOADER_TEST_FILE "/tmp/ksedit_test_loader.txt"
+
+// ~20 MB so the load spans several chunks
+static void write_test_file(void)
+{
+    FILE* f = fopen(LOADER_TEST_FILE, "wb");
+    for (int i = 0; i < 400000; i++) {
+        fprintf(f, "line %d: the quick brown fox jumps\n", i);
+    }
+    fputs("last line without newline", f);
+    fclose(f);
+}
+
+static LoadStatus wait_for_load(Loader* ld)
+{
+    LoadStatus status;
+    while ((status = loader_poll(ld)) == LOAD_RUNNING) {
+        struct timespec ts = { 0, 100000 };
+        nanosleep(&ts, NULL);
+    }
+    return status;
+}
+
+static bool buffers_equal(Buffer* a, Buffer* b)
+{
+    size_t len = buffer_length(a);
+    if (len != buffer_length(b) || buffer_line_count(a) != buffer_line_count(b))
+        return false;
+
+    for (size_t line = 0; line < buffer_line_count(a); line += 997) {
+        if (buffer_get_line_offset(a, line) != buffer_get_line_offset(b, line))
+            return false;
+    }
+
+    char* ta = buffer_get_range(a, 0, len);
+    char* tb = buffer_get_range(b, 0, len);
+    bool  eq = memcmp(ta, tb, len) == 0;
+    free(ta);
+    free(tb);
+    return eq;
+}
+
+static void check_async_load(BufferStorage storage)
+{
+    Buffer* sync = buffer_create(64);
+    ASSERT(buffer_load_file(sync, LOADER_TEST_FILE));
+
+    Buffer* buf = buffer_create_with_storage(64, storage);
+    Loader* ld  = loader_start(buf, LOADER_TEST_FILE);
+    ASSERT(ld != NULL);
+    ASSERT(buf->loading);
+
+    // Whatever prefix is visible must always be self-consistent
+    while (loader_poll(ld) == LOAD_RUNNING) {
+        size_t lines = buffer_line_count(buf);
+        ASSERT(buffer_get_line_offset(buf, lines - 1) <= buffer_length(buf));
+    }
+    loader_destroy(ld);
+
+    ASSERT(!buf->loading);
+    ASSERT(buffers_equal(sync, buf));
+
+    // Fully usable afterwards
+    buffer_goto_line(buf, 1000);
+    buffer_insert_char(buf, 'X');
+    ASSERT_EQ(buffer_char_at(buf, buffer_get_line_offset(buf, 1000)), 'X');
+
+    buffer_destroy(sync);
+    buffer_destroy(buf);
+}
+
+TEST(test_loader_gap)
+{
+    check_async_load(STORAGE_GAP);
+}
+
+TEST(test_loader_piece)
+{
+    check_async_load(STORAGE_PIECE);
+}
+
+TEST(test_loader_missing_file)
+{
+    Buffer* buf = buffer_create(64);
+    ASSERT(loader_start(buf, "/tmp/ksedit_does_not_exist.txt") == NULL);
+    ASSERT(!buf->loading);
+    buffer_destroy(buf);
+}
+
+TEST(test_loader_cancel)
+{
+    Buffer* buf = buffer_create(64);
+    Loader* ld  = loader_start(buf, LOADER_TEST_FILE);
+    ASSERT(ld != NULL);
+    loader_destroy(ld);
+
+    // Cancelled mid-way: the prefix that made it in is a valid document
+    ASSERT(!buf->loading);
+    size_t len   = buffer_length(buf);
+    size_t lines = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (buffer_char_at(buf, i) == '\n')
+            lines++;
+    }
+    ASSERT_EQ(buffer_line_count(buf), lines);
+    buffer_destroy(buf);
+}
+
+TEST(test_loader_status)
+{
+    Buffer* buf = buffer_create(64);
+    Loader* ld  = loader_start(buf, LOADER_TEST_FILE);
+    ASSERT(ld != NULL);
+    ASSERT_EQ(wait_for_load(ld), LOAD_DONE);
+    ASSERT_EQ(buf->load_total, buffer_length(buf));
+    ASSERT_EQ(buffer_line_count(buf), 400001);
+    loader_destroy(ld);
+    buffer_destroy(buf);
+}
+
+int main(void)
+{
+    write_test_file();
+
+    printf("Loader tests:\n");
+    RUN_TEST(test_loader_gap);
+    RUN_TEST(test_loader_piece);
+    RUN_TEST(test_loader_missing_file);
+    RUN_TEST(test_loader_cancel);
+    RUN_TEST(test_loader_status);
+
+    remove(LOADER_TEST_FILE);
+    TEST_SUMMARY();
+}
@@ -0,0 +1,127 @@
+#include "test.h"
+#include "../include/newline.h"
+#include <stdlib.h>
+
+static const NewlineKernel all_kernels[] = { NEWLINE_SCALAR, NEWLINE_SSE2, NEWLINE_AVX2 };
+
+// Random text with a given newline density, long enough to hit every
+// unrolled loop and tail of the vector kernels
+static char* make_text(size_t len, int density, unsigned seed)
+{
+    char* text = malloc(len);
+    srand(seed);
+    for (size_t i = 0; i < len; i++) {
+        text[i] = (rand() % density == 0) ? '\n' : 'a' + rand() % 26;
+    }
+    return text;
+}
+
+static size_t reference_count(const char* p, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\n')
+            count++;
+    }
+    return count;
+}
+
+// Check every kernel against a byte loop at each alignment and length
+static bool kernels_agree(const char* text, size_t len)
+{
+    size_t* expected = malloc((len + 1) * sizeof(size_t));
+    size_t* got      = malloc((len + 1) * sizeof(size_t));
+    bool    ok       = true;
+
+    for (size_t k = 0; k < sizeof(all_kernels) / sizeof(all_kernels[0]) && ok; k++) {
+        if (!newline_use_kernel(all_kernels[k]))
+            continue;
+
+        for (size_t off = 0; off < 64 && off < len && ok; off++) {
+            const char* p = text + off;
+            size_t      n = len - off;
+
+            size_t count = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (p[i] == '\n')
+                    expected[count++] = 1000 + i + 1;
+            }
+
+            ok = newline_count(p, n) == count && newline_collect(p, n, 1000, got) == count
+                && memcmp(expected, got, count * sizeof(size_t)) == 0;
+        }
+    }
+
+    free(expected);
+    free(got);
+    return ok;
+}
+
+TEST(test_newline_empty)
+{
+    size_t out[1];
+    ASSERT_EQ(newline_count("", 0), 0);
+    ASSERT_EQ(newline_collect("", 0, 0, out), 0);
+}
+
+TEST(test_newline_sparse)
+{
+    char* text = make_text(5000, 300, 1);
+    ASSERT(kernels_agree(text, 5000));
+    free(text);
+}
+
+TEST(test_newline_dense)
+{
+    char* text = make_text(3000, 2, 2);
+    ASSERT(kernels_agree(text, 3000));
+    free(text);
+}
+
+TEST(test_newline_all_newlines)
+{
+    char text[700];
+    memset(text, '\n', sizeof(text));
+    ASSERT(kernels_agree(text, sizeof(text)));
+}
+
+TEST(test_newline_no_newlines)
+{
+    char* text = make_text(4096, 1 << 30, 3);
+    ASSERT_EQ(reference_count(text, 4096), 0);
+    ASSERT(kernels_agree(text, 4096));
+    free(text);
+}
+
+TEST(test_newline_short_runs)
+{
+    // Shorter than one vector: only the scalar tails run
+    for (size_t len = 1; len < 40; len++) {
+        char* text = make_text(len, 3, (unsigned)len);
+        ASSERT(kernels_agree(text, len));
+        free(text);
+    }
+}
+
+TEST(test_newline_default_kernel)
+{
+    // Whatever was picked at startup must be usable on this CPU
+    ASSERT(newline_use_kernel(NEWLINE_SCALAR));
+    ASSERT_EQ(newline_active_kernel(), NEWLINE_SCALAR);
+    if (newline_use_kernel(NEWLINE_AVX2))
+        ASSERT_EQ(newline_active_kernel(), NEWLINE_AVX2);
+    ASSERT_EQ(newline_count("a\nb\n", 4), 2);
+}
+
+int main(void)
+{
+    printf("Newline tests:\n");
+    RUN_TEST(test_newline_empty);
+    RUN_TEST(test_newline_sparse);
+    RUN_TEST(test_newline_dense);
+    RUN_TEST(test_newline_all_newlines);
+    RUN_TEST(test_newline_no_newlines);
+    RUN_TEST(test_newline_short_runs);
+    RUN_TEST(test_newline_default_kernel);
+    TEST_SUMMARY();
+}
@@ -0,0 +1,333 @@
+#include "test.h"
+#include "../include/buffer.h"
+#include "../include/piece.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void piece_to_string(PieceTable* pt, char* out)
+{
+    size_t len = piece_extract(pt, 0, piece_length(pt), out);
+    out[len]   = '\0';
+}
+
+TEST(test_piece_empty)
+{
+    PieceTable* pt = piece_create();
+    ASSERT(pt != NULL);
+    ASSERT_EQ(piece_length(pt), 0);
+    ASSERT_EQ(piece_char_at(pt, 0), '\0');
+    piece_destroy(pt);
+}
+
+TEST(test_piece_original)
+{
+    PieceTable* pt = piece_create();
+    piece_set_original(pt, "hello world", 11, false);
+    ASSERT_EQ(piece_length(pt), 11);
+    ASSERT_EQ(piece_char_at(pt, 6), 'w');
+    ASSERT_EQ(pt->piece_count, 1);
+    piece_destroy(pt);
+}
+
+TEST(test_piece_insert_middle)
+{
+    PieceTable* pt = piece_create();
+    char        out[64];
+    piece_set_original(pt, "hello world", 11, false);
+    piece_insert(pt, 5, ",", 1);
+    piece_insert(pt, 12, "!", 1);
+    piece_to_string(pt, out);
+    ASSERT_STR_EQ(out, "hello, world!");
+    piece_destroy(pt);
+}
+
+TEST(test_piece_typing_extends_piece)
+{
+    PieceTable* pt = piece_create();
+    piece_set_original(pt, "ac", 2, false);
+    piece_insert(pt, 1, "b", 1);
+    size_t pieces = pt->piece_count;
+    piece_insert(pt, 2, "b", 1);
+    piece_insert(pt, 3, "b", 1);
+    ASSERT_EQ(pt->piece_count, pieces);
+
+    char out[16];
+    piece_to_string(pt, out);
+    ASSERT_STR_EQ(out, "abbbc");
+    piece_destroy(pt);
+}
+
+TEST(test_piece_delete_across_pieces)
+{
+    PieceTable* pt = piece_create();
+    char        out[64];
+    piece_set_original(pt, "0123456789", 10, false);
+    piece_insert(pt, 3, "abc", 3);
+    piece_insert(pt, 8, "xyz", 3);
+    // "012abc34xyz56789"
+    piece_delete(pt, 4, 8);
+    piece_to_string(pt, out);
+    ASSERT_STR_EQ(out, "012a6789");
+    ASSERT_EQ(piece_length(pt), 8);
+    piece_destroy(pt);
+}
+
+TEST(test_piece_reserve)
+{
+    // Edits after a reserve take their pieces and text from it
+    PieceTable* pt = piece_create();
+    char        out[64];
+    piece_set_original(pt, "hello world", 11, false);
+    ASSERT(piece_reserve(pt, 8, 10));
+    ASSERT_EQ(pt->spare_count, 8);
+    AddChunk* chunk = pt->add;
+    ASSERT(piece_insert(pt, 5, ",", 1));
+    ASSERT(piece_delete(pt, 8, 2));
+    ASSERT(piece_insert(pt, 8, "r", 1));
+    ASSERT(pt->add == chunk);
+    ASSERT(pt->spare_count < 8);
+    piece_to_string(pt, out);
+    ASSERT_STR_EQ(out, "hello, wrld");
+    piece_destroy(pt);
+}
+
+TEST(test_piece_span_at)
+{
+    PieceTable* pt = piece_create();
+    piece_set_original(pt, "abcdef", 6, false);
+    piece_insert(pt, 3, "XY", 2);
+
+    size_t      len;
+    const char* span = piece_span_at(pt, 1, &len);
+    ASSERT_EQ(len, 2);
+    ASSERT_EQ(span[0], 'b');
+    span = piece_span_at(pt, 3, &len);
+    ASSERT_EQ(len, 2);
+    ASSERT_EQ(span[0], 'X');
+    span = piece_span_at(pt, 8, &len);
+    ASSERT(span == NULL);
+    piece_destroy(pt);
+}
+
+TEST(test_piece_buffer_basic)
+{
+    Buffer* buf = buffer_create_with_storage(0, STORAGE_PIECE);
+    ASSERT(buf != NULL);
+    buffer_insert_text(buf, "aaa\nbbb\nccc", 11);
+    ASSERT_EQ(buffer_length(buf), 11);
+    ASSERT_EQ(buffer_line_count(buf), 3);
+
+    buffer_move_cursor_to(buf, 5);
+    buffer_insert_char(buf, '\n');
+    ASSERT_EQ(buffer_line_count(buf), 4);
+    ASSERT_EQ(buffer_get_line_offset(buf, 2), 6);
+
+    buffer_backspace(buf);
+    ASSERT_EQ(buffer_line_count(buf), 3);
+
+    buffer_undo(buf);
+    ASSERT_EQ(buffer_length(buf), 12);
+    buffer_undo(buf);
+    ASSERT_EQ(buffer_length(buf), 11);
+
+    char* text = buffer_get_range(buf, 0, buffer_length(buf));
+    ASSERT_STR_EQ(text, "aaa\nbbb\nccc");
+    free(text);
+    buffer_destroy(buf);
+}
+
+TEST(test_piece_load_mapped)
+{
+    const char* path = "/tmp/ksedit_test_piece_load.txt";
+    FILE*       f    = fopen(path, "wb");
+    ASSERT(f != NULL);
+    fputs("first\nsecond\nthird", f);
+    fclose(f);
+
+    Buffer* buf = buffer_create_with_storage(0, STORAGE_PIECE);
+    ASSERT(buffer_load_file(buf, path));
+    ASSERT(buf->pieces->original_mapped);
+    ASSERT_EQ(buffer_length(buf), 18);
+    ASSERT_EQ(buffer_line_count(buf), 3);
+
+    // Editing must not copy the mapped text, only append the new bytes
+    buffer_move_cursor_to(buf, 6);
+    buffer_insert_text(buf, "2nd ", 4);
+    ASSERT_EQ(buf->pieces->add->used, 4);
+    ASSERT_EQ(buf->pieces->piece_count, 3);
+
+    // Saving replaces the file without disturbing the live mapping
+    ASSERT(buffer_save_file(buf));
+    ASSERT_EQ(buffer_char_at(buf, 0), 'f');
+    char* text = buffer_get_range(buf, 0, buffer_length(buf));
+    ASSERT_STR_EQ(text, "first\n2nd second\nthird");
+    free(text);
+    buffer_destroy(buf);
+
+    buf = buffer_create(64);
+    ASSERT(buffer_load_file(buf, path));
+    text = buffer_get_range(buf, 0, buffer_length(buf));
+    ASSERT_STR_EQ(text, "first\n2nd second\nthird");
+    free(text);
+    buffer_destroy(buf);
+    remove(path);
+}
+
+TEST(test_piece_load_empty_file)
+{
+    const char* path = "/tmp/ksedit_test_piece_empty.txt";
+    FILE*       f    = fopen(path, "wb");
+    ASSERT(f != NULL);
+    fclose(f);
+
+    Buffer* buf = buffer_create_with_storage(0, STORAGE_PIECE);
+    ASSERT(buffer_load_file(buf, path));
+    ASSERT_EQ(buffer_length(buf), 0);
+    ASSERT_EQ(buffer_line_count(buf), 1);
+    buffer_insert_char(buf, 'x');
+    ASSERT_EQ(buffer_char_at(buf, 0), 'x');
+    buffer_destroy(buf);
+    remove(path);
+}
+
+// Random edits applied to both storage engines must give identical text
+TEST(test_piece_matches_gap_buffer)
+{
+    Buffer* gap   = buffer_create(64);
+    Buffer* piece = buffer_create_with_storage(0, STORAGE_PIECE);
+    srand(1234);
+
+    for (int i = 0; i < 5000; i++) {
+        size_t len = buffer_length(gap);
+        size_t pos = rand() % (len + 1);
+        int    op  = rand() % 6;
+
+        buffer_move_cursor_to(gap, pos);
+        buffer_move_cursor_to(piece, pos);
+
+        if (op < 3) {
+            char c = (rand() % 8 == 0) ? '\n' : (char)('a' + rand() % 26);
+            buffer_insert_char(gap, c);
+            buffer_insert_char(piece, c);
+        } else if (op == 3) {
+            buffer_insert_text(gap, "xy\nz", 4);
+            buffer_insert_text(piece, "xy\nz", 4);
+        } else if (op == 4) {
+            buffer_backspace(gap);
+            buffer_backspace(piece);
+        } else if (len > 0) {
+            size_t end = pos + rand() % 10;
+            if (end > len)
+                end = len;
+            buffer_delete_range(gap, pos, end);
+            buffer_delete_range(piece, pos, end);
+        }
+    }
+
+    ASSERT_EQ(buffer_length(gap), buffer_length(piece));
+    size_t len = buffer_length(gap);
+    char*  a   = buffer_get_range(gap, 0, len);
+    char*  b   = buffer_get_range(piece, 0, len);
+    ASSERT(len == 0 || memcmp(a, b, len) == 0);
+    ASSERT_EQ(buffer_line_count(gap), buffer_line_count(piece));
+    free(a);
+    free(b);
+
+    buffer_destroy(gap);
+    buffer_destroy(piece);
+}
+
+static int count_dir_entries(const char* dir)
+{
+    DIR* d     = opendir(dir);
+    int  count = 0;
+    for (struct dirent* e; (e = readdir(d)) != NULL;) {
+        if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+            count++;
+    }
+    closedir(d);
+    return count;
+}
+
+// Saves go through a temp file renamed over the target: mode and symlinks
+// survive, nothing is left behind, and the result matches the buffer
+static void check_atomic_save(BufferStorage storage)
+{
+    const char* dir  = "/tmp/ksedit_test_save";
+    const char* path = "/tmp/ksedit_test_save/file.txt";
+    const char* link = "/tmp/ksedit_test_save/link.txt";
+    mkdir(dir, 0755);
+    unlink(path);
+    unlink(link);
+
+    // Big enough that the unchanged ranges take the file-to-file copy path
+    size_t size = 3 * 1024 * 1024;
+    char*  data = malloc(size);
+    for (size_t i = 0; i < size; i++)
+        data[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;
+    FILE* f = fopen(path, "wb");
+    fwrite(data, 1, size, f);
+    fclose(f);
+    chmod(path, 0640);
+    ASSERT(symlink("file.txt", link) == 0);
+
+    Buffer* buf = buffer_create_with_storage(64, storage);
+    ASSERT(buffer_load_file(buf, link));
+    buffer_move_cursor_to(buf, size / 2);
+    buffer_insert_text(buf, "edit", 4);
+    ASSERT(buffer_save_file(buf));
+    ASSERT(!buf->modified);
+
+    struct stat st;
+    ASSERT(lstat(link, &st) == 0 && S_ISLNK(st.st_mode));
+    ASSERT(stat(path, &st) == 0);
+    ASSERT_EQ(st.st_mode & 0777, 0640);
+    ASSERT_EQ((size_t)st.st_size, size + 4);
+    ASSERT_EQ(count_dir_entries(dir), 2);
+
+    Buffer* check = buffer_create(64);
+    ASSERT(buffer_load_file(check, path));
+    char* saved = buffer_get_range(check, 0, buffer_length(check));
+    ASSERT(memcmp(saved, data, size / 2) == 0);
+    ASSERT(memcmp(saved + size / 2, "edit", 4) == 0);
+    ASSERT(memcmp(saved + size / 2 + 4, data + size / 2, size - size / 2) == 0);
+
+    free(saved);
+    free(data);
+    buffer_destroy(check);
+    buffer_destroy(buf);
+    unlink(link);
+    unlink(path);
+    rmdir(dir);
+}
+
+TEST(test_save_atomic_gap)
+{
+    check_atomic_save(STORAGE_GAP);
+}
+
+TEST(test_save_atomic_piece)
+{
+    check_atomic_save(STORAGE_PIECE);
+}
+
+int main(void)
+{
+    printf("Piece table tests:\n");
+    RUN_TEST(test_piece_empty);
+    RUN_TEST(test_piece_original);
+    RUN_TEST(test_piece_insert_middle);
+    RUN_TEST(test_piece_typing_extends_piece);
+    RUN_TEST(test_piece_delete_across_pieces);
+    RUN_TEST(test_piece_reserve);
+    RUN_TEST(test_piece_span_at);
+    RUN_TEST(test_piece_buffer_basic);
+    RUN_TEST(test_piece_load_mapped);
+    RUN_TEST(test_piece_load_empty_file);
+    RUN_TEST(test_piece_matches_gap_buffer);
+    RUN_TEST(test_save_atomic_gap);
+    RUN_TEST(test_save_atomic_piece);
+    TEST_SUMMARY();
+}
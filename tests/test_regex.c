@@ -0,0 +1,206 @@
+#include "test.h"
+#include "../include/regex.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Match bounds as start * 1000 + end, or -1
+static i64 find_in(Buffer* buf, const char* pattern, u32 flags, size_t start)
+{
+    const char* error;
+    Regex*      re = regex_compile(pattern, strlen(pattern), flags, &error);
+    if (!re)
+        return -2;
+    size_t a, b;
+    bool   found = regex_search_forward(re, buf, start, buffer_length(buf), &a, &b);
+    regex_free(re);
+    return found ? (i64)(a * 1000 + b) : -1;
+}
+
+static i64 find(const char* text, const char* pattern, u32 flags)
+{
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, text, strlen(text));
+    i64 result = find_in(buf, pattern, flags, 0);
+    buffer_destroy(buf);
+    return result;
+}
+
+TEST(test_regex_syntax)
+{
+    ASSERT_EQ(find("aabbbc", "b+", 0), 2005);
+    ASSERT_EQ(find("aabbbc", "b+?", 0), 2003);
+    ASSERT_EQ(find("aabbbc", "ab*c", 0), 1006);
+    ASSERT_EQ(find("aabbbc", "a(b|c)?b", 0), 1004);
+    ASSERT_EQ(find("took 153ms", "[0-9]+ms", 0), 5010);
+    ASSERT_EQ(find("took 153ms", "\\d+", 0), 5008);
+    ASSERT_EQ(find("a-b_c d", "[\\w-]+", 0), 5);
+    ASSERT_EQ(find("x = y;", "[^a-z =]", 0), 5006);
+    ASSERT_EQ(find("a+b", "a\\+b", 0), 3);
+    ASSERT_EQ(find("ab\ncd", "b.c", 0), -1);
+    ASSERT_EQ(find("ab\ncd", "b\\nc", 0), 1004);
+    ASSERT_EQ(find("]x", "[]]", 0), 1);
+    ASSERT_EQ(find("abc", "x*", 0), 0);
+    ASSERT_EQ(find("abc", "(?:ab)+c", 0), 3);
+}
+
+TEST(test_regex_leftmost_first)
+{
+    ASSERT_EQ(find("xab", "a|ab", 0), 1002);
+    ASSERT_EQ(find("xab", "ab|a", 0), 1003);
+    ASSERT_EQ(find("abcde", "ab|bcde", 0), 2);
+    ASSERT_EQ(find("a b z", "a.*z|b", 0), 5);
+    ASSERT_EQ(find("<a><b>", "<.*>", 0), 6);
+    ASSERT_EQ(find("<a><b>", "<.*?>", 0), 3);
+}
+
+TEST(test_regex_anchors)
+{
+    ASSERT_EQ(find("xfoo\nfoo", "^foo", 0), 5008);
+    ASSERT_EQ(find("bar x\nbar", "bar$", 0), 6009);
+    ASSERT_EQ(find("bar\nx", "bar$", 0), 3);
+    ASSERT_EQ(find("a\n\nb", "^$", 0), 2002);
+    ASSERT_EQ(find("ab", "^b", 0), -1);
+
+    // Anchors look at the text outside the searched range
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "xab\nab", 6);
+    ASSERT_EQ(find_in(buf, "^ab", 0, 1), 4006);
+    buffer_destroy(buf);
+}
+
+TEST(test_regex_ignore_case)
+{
+    ASSERT_EQ(find("Error: Timeout", "ERROR.*TIMEOUT", SEARCH_IGNORE_CASE), 14);
+    ASSERT_EQ(find("Error: Timeout", "ERROR.*TIMEOUT", 0), -1);
+    ASSERT_EQ(find("xYz", "[a-y]+", SEARCH_IGNORE_CASE), 2);
+
+    // A negated class leaves out both cases
+    ASSERT_EQ(find("a", "[^a]", SEARCH_IGNORE_CASE), -1);
+    ASSERT_EQ(find("A", "[^a]", SEARCH_IGNORE_CASE), -1);
+    ASSERT_EQ(find("XXxab", "[^x]+", SEARCH_IGNORE_CASE), 3005);
+    ASSERT_EQ(find("aB1", "[^A-Z]", SEARCH_IGNORE_CASE), 2003);
+}
+
+TEST(test_regex_errors)
+{
+    const char* bad[] = { "(a", "a)", "*a", "a|+", "[a", "\\q", "a\\", "[z-a]" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        const char* error = NULL;
+        ASSERT(regex_compile(bad[i], strlen(bad[i]), 0, &error) == NULL);
+        ASSERT(error != NULL);
+    }
+}
+
+TEST(test_regex_prefix)
+{
+    const char* error;
+    struct
+    {
+        const char* pattern;
+        u32         flags;
+        size_t      len;
+    } cases[] = {
+        { "ERROR.*timeout", 0, 5 },
+        { "ERROR", SEARCH_IGNORE_CASE, 5 },
+        { "^abc+d", 0, 3 },
+        { "(a|b)c", 0, 0 },
+        { "[aA]b", 0, 0 },
+        { "ab*", 0, 1 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Regex* re = regex_compile(cases[i].pattern, strlen(cases[i].pattern), cases[i].flags, &error);
+        ASSERT(re != NULL);
+        ASSERT_EQ(regex_prefix_len(re), cases[i].len);
+        regex_free(re);
+    }
+}
+
+TEST(test_regex_across_spans)
+{
+    // Every split point of the match falls on the gap or a piece boundary
+    const char* text = "xxxx ERROR in worker: timeout xxxx";
+    size_t      len  = strlen(text);
+    for (int storage = 0; storage < 2; storage++) {
+        for (size_t split = 4; split <= 30; split++) {
+            Buffer* buf = buffer_create_with_storage(16, storage ? STORAGE_PIECE : STORAGE_GAP);
+            buffer_insert_text(buf, text + split, len - split);
+            buf->cursor = 0;
+            buffer_insert_text(buf, text, split);
+            ASSERT_EQ(find_in(buf, "ERROR.*timeout", 0, 0), 5029);
+            ASSERT_EQ(find_in(buf, "in.*:", 0, 0), 11021);
+            buffer_destroy(buf);
+        }
+    }
+}
+
+TEST(test_regex_backward_and_count)
+{
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "aa b aaa c", 10);
+    const char* error;
+    Regex*      re = regex_compile("a+", 2, 0, &error);
+    size_t      a, b;
+    ASSERT(regex_search_backward(re, buf, 0, 10, &a, &b));
+    ASSERT_EQ(a, 5);
+    ASSERT_EQ(b, 8);
+    ASSERT(regex_search_backward(re, buf, 0, 5, &a, &b));
+    ASSERT_EQ(a, 0);
+    ASSERT(!regex_search_backward(re, buf, 8, 10, &a, &b));
+    ASSERT_EQ(regex_count(re, buf, 0, 10), 2);
+    ASSERT_EQ(regex_count(re, buf, 1, 7), 2);
+    regex_free(re);
+    buffer_destroy(buf);
+}
+
+TEST(test_regex_linear_time)
+{
+    // Patterns that make backtracking matchers take exponential time
+    size_t len  = 1 << 20;
+    char*  text = malloc(len);
+    memset(text, 'a', len);
+    Buffer* buf = buffer_create(len);
+    buffer_insert_text(buf, text, len);
+    ASSERT_EQ(find_in(buf, "(a*)*b", 0, 0), -1);
+    ASSERT_EQ(find_in(buf, "(a|aa)+$", 0, 0), (i64)len);
+    ASSERT_EQ(find_in(buf, "(a+a+)+b", 0, 0), -1);
+    buffer_destroy(buf);
+    free(text);
+}
+
+TEST(test_regex_many_states)
+{
+    // An a 13 bytes from the end needs 2^13 DFA states, so the state cache
+    // is flushed and rebuilt along the way
+    size_t len  = 200000;
+    char*  text = malloc(len);
+    srand(7);
+    for (size_t i = 0; i < len; i++)
+        text[i] = rand() % 2 ? 'a' : 'b';
+    Buffer* buf = buffer_create(len);
+    buffer_insert_text(buf, text, len);
+
+    size_t last = 0;
+    for (size_t i = 0; i + 13 <= len; i++) {
+        if (text[i] == 'a')
+            last = i + 13;
+    }
+    ASSERT_EQ(find_in(buf, "[ab]*a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]", 0, 0), (i64)last);
+    buffer_destroy(buf);
+    free(text);
+}
+
+int main(void)
+{
+    printf("Regex tests:\n");
+    RUN_TEST(test_regex_syntax);
+    RUN_TEST(test_regex_leftmost_first);
+    RUN_TEST(test_regex_anchors);
+    RUN_TEST(test_regex_ignore_case);
+    RUN_TEST(test_regex_errors);
+    RUN_TEST(test_regex_prefix);
+    RUN_TEST(test_regex_across_spans);
+    RUN_TEST(test_regex_backward_and_count);
+    RUN_TEST(test_regex_linear_time);
+    RUN_TEST(test_regex_many_states);
+    TEST_SUMMARY();
+}
@@ -0,0 +1,191 @@
+#include "test.h"
+#include "../include/saver.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define SAVER_TEST_FILE "/tmp/ksedit_test_saver.txt"
+
+// ~20 MB so the save is still running while we edit
+static void write_test_file(void)
+{
+    FILE* f = fopen(SAVER_TEST_FILE, "wb");
+    for (int i = 0; i < 400000; i++) {
+        fprintf(f, "line %d: the quick brown fox jumps\n", i);
+    }
+    fclose(f);
+}
+
+static char* read_file(const char* path, size_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = malloc(*len + 1);
+    *len       = fread(data, 1, *len, f);
+    fclose(f);
+    return data;
+}
+
+static bool snapshot_equals(BufferSnapshot* snap, const char* expected, size_t len)
+{
+    size_t pos = 0;
+    for (size_t i = 0; i < snap->span_count; i++) {
+        if (pos + snap->spans[i].len > len || memcmp(snap->spans[i].text, expected + pos, snap->spans[i].len) != 0)
+            return false;
+        pos += snap->spans[i].len;
+    }
+    return pos == len && snap->length == len;
+}
+
+// Edits all over the document: near the cursor, far away (forcing a gap
+// buffer off the shared array) and big enough to grow it
+static void random_edit(Buffer* buf)
+{
+    size_t len = buffer_length(buf);
+    size_t pos = len ? (size_t)rand() % len : 0;
+    switch (rand() % 4) {
+    case 0:
+        buffer_insert_text(buf, "edited\nline ", 12);
+        break;
+    case 1:
+        buf->cursor = pos;
+        buffer_insert_char(buf, 'x');
+        break;
+    case 2:
+        if (pos + 100 <= len)
+            buffer_delete_range(buf, pos, pos + 100);
+        break;
+    default:
+        buf->cursor = pos;
+        buffer_insert_text(buf, "0123456789abcdef0123456789abcdef", 32);
+        break;
+    }
+}
+
+static void check_save_while_editing(BufferStorage storage)
+{
+    write_test_file();
+    Buffer* buf = buffer_create_with_storage(64, storage);
+    ASSERT(buffer_load_file(buf, SAVER_TEST_FILE));
+    buffer_insert_text(buf, "header\n", 7);
+
+    size_t len      = buffer_length(buf);
+    char*  expected = buffer_get_range(buf, 0, len);
+
+    Saver* sv = saver_start(buf);
+    ASSERT(sv != NULL);
+    ASSERT(buf->saving);
+    ASSERT(saver_start(buf) == NULL);
+
+    srand(7);
+    int        edits = 0;
+    SaveStatus status;
+    while ((status = saver_poll(sv)) == SAVE_RUNNING || edits < 500) {
+        random_edit(buf);
+        edits++;
+        ASSERT(buf->save_done <= buf->save_total);
+    }
+    ASSERT_EQ(status, SAVE_DONE);
+    ASSERT(!buf->saving);
+    ASSERT(buf->modified); // The edits made meanwhile are not on disk
+    saver_destroy(sv);
+
+    size_t saved_len;
+    char*  saved = read_file(SAVER_TEST_FILE, &saved_len);
+    ASSERT(saved != NULL);
+    ASSERT_EQ(saved_len, len);
+    ASSERT(memcmp(saved, expected, len) == 0);
+    free(saved);
+    free(expected);
+
+    // Nothing edited during this one, so the buffer is clean afterwards
+    len      = buffer_length(buf);
+    expected = buffer_get_range(buf, 0, len);
+    sv       = saver_start(buf);
+    ASSERT(sv != NULL);
+    while (saver_poll(sv) == SAVE_RUNNING) {
+        struct timespec ts = { 0, 100000 };
+        nanosleep(&ts, NULL);
+    }
+    ASSERT(!buf->modified);
+    saver_destroy(sv);
+
+    saved = read_file(SAVER_TEST_FILE, &saved_len);
+    ASSERT_EQ(saved_len, len);
+    ASSERT(memcmp(saved, expected, len) == 0);
+    free(saved);
+    free(expected);
+
+    buffer_destroy(buf);
+    remove(SAVER_TEST_FILE);
+}
+
+TEST(test_saver_gap)
+{
+    check_save_while_editing(STORAGE_GAP);
+}
+
+TEST(test_saver_piece)
+{
+    check_save_while_editing(STORAGE_PIECE);
+}
+
+TEST(test_snapshot_survives_edits)
+{
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int s = 0; s < 2; s++) {
+        Buffer* buf = buffer_create_with_storage(16, storages[s]);
+        for (int i = 0; i < 2000; i++)
+            buffer_insert_text(buf, "some text\n", 10);
+        buf->cursor = 5000;
+        buffer_insert_char(buf, 'a');
+        buffer_backspace(buf); // Gap now sits at the cursor
+
+        size_t          len      = buffer_length(buf);
+        char*           expected = buffer_get_range(buf, 0, len);
+        BufferSnapshot* snap     = buffer_snapshot(buf);
+        ASSERT(snap != NULL);
+        ASSERT(snapshot_equals(snap, expected, len));
+
+        // Typing at the gap writes only into bytes the snapshot doesn't read
+        buffer_insert_char(buf, 'a');
+        ASSERT(snapshot_equals(snap, expected, len));
+        if (storages[s] == STORAGE_GAP) {
+            ASSERT(buf->snapshot == snap);
+            ASSERT(buffer_snapshot(buf) == NULL);
+        }
+
+        srand(11);
+        for (int i = 0; i < 300; i++)
+            random_edit(buf);
+        ASSERT(snapshot_equals(snap, expected, len));
+        ASSERT(!snap->broken);
+
+        buffer_snapshot_release(snap);
+        ASSERT(buf->snapshot == NULL);
+        free(expected);
+        buffer_destroy(buf);
+    }
+}
+
+TEST(test_saver_no_filename)
+{
+    Buffer* buf = buffer_create(64);
+    buffer_insert_text(buf, "hello", 5);
+    ASSERT(saver_start(buf) == NULL);
+    ASSERT(!buf->saving);
+    buffer_destroy(buf);
+}
+
+int main(void)
+{
+    printf("Saver tests:\n");
+    RUN_TEST(test_saver_gap);
+    RUN_TEST(test_saver_piece);
+    RUN_TEST(test_snapshot_survives_edits);
+    RUN_TEST(test_saver_no_filename);
+    TEST_SUMMARY();
+}
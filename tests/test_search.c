@@ -0,0 +1,337 @@
+#include "test.h"
+#include "../include/search.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const SearchKernel all_kernels[] = { SEARCH_SCALAR, SEARCH_SSE2, SEARCH_AVX2 };
+
+static char fold(char c, u32 flags)
+{
+    return ((flags & SEARCH_IGNORE_CASE) && c >= 'A' && c <= 'Z') ? c + 32 : c;
+}
+
+static bool word_byte(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Byte-by-byte reference: does needle match text at pos?
+static bool reference_match(const char* text, size_t len, size_t pos, const char* needle, size_t n, u32 flags)
+{
+    if (pos + n > len)
+        return false;
+    for (size_t i = 0; i < n; i++) {
+        if (fold(text[pos + i], flags) != fold(needle[i], flags))
+            return false;
+    }
+    if (flags & SEARCH_WHOLE_WORD) {
+        if (pos > 0 && word_byte(text[pos - 1]))
+            return false;
+        if (pos + n < len && word_byte(text[pos + n]))
+            return false;
+    }
+    return true;
+}
+
+static i64 reference_first(const char* text, size_t len, size_t start, size_t end, const char* needle, size_t n,
+    u32 flags)
+{
+    for (size_t pos = start; pos + n <= end; pos++) {
+        if (reference_match(text, len, pos, needle, n, flags))
+            return (i64)pos;
+    }
+    return -1;
+}
+
+static i64 reference_last(const char* text, size_t len, size_t start, size_t end, const char* needle, size_t n,
+    u32 flags)
+{
+    for (size_t pos = end; pos-- > start;) {
+        if (pos + n <= end && reference_match(text, len, pos, needle, n, flags))
+            return (i64)pos;
+    }
+    return -1;
+}
+
+// Small alphabet with mixed case so partial matches and near misses are
+// everywhere
+static void random_text(char* text, size_t len)
+{
+    static const char alphabet[] = "abAB _\n";
+    for (size_t i = 0; i < len; i++)
+        text[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+}
+
+// Text spread over several pieces, or around a gap in the middle
+static Buffer* make_buffer(BufferStorage storage, const char* text, size_t len)
+{
+    Buffer* buf  = buffer_create_with_storage(16, storage);
+    size_t  step = len / 5 + 1;
+    for (size_t done = 0; done < len; done += step) {
+        size_t n    = done + step <= len ? step : len - done;
+        buf->cursor = done / 2;
+        buffer_insert_text(buf, text + done, n);
+    }
+    return buf;
+}
+
+static bool check_against_reference(BufferStorage storage, size_t len, size_t needle_len, u32 flags)
+{
+    char* text = malloc(len);
+    random_text(text, len);
+    Buffer* buf = make_buffer(storage, text, len);
+
+    // Insertion order shuffled the text; the reference reads it back
+    char* content = buffer_get_range(buf, 0, len);
+    bool  ok      = true;
+
+    for (int round = 0; round < 40 && ok; round++) {
+        // Needles taken from the text so they occur, or random so they mostly don't
+        char   needle[128];
+        size_t at = (size_t)rand() % (len - needle_len);
+        if (round % 2)
+            memcpy(needle, content + at, needle_len);
+        else
+            random_text(needle, needle_len);
+        if (round % 3 == 0 && (flags & SEARCH_IGNORE_CASE)) {
+            for (size_t i = 0; i < needle_len; i++)
+                needle[i] = (needle[i] >= 'a' && needle[i] <= 'z') ? needle[i] - 32 : needle[i];
+        }
+
+        Searcher s;
+        if (!search_init(&s, needle, needle_len, flags))
+            return false;
+
+        size_t start = (size_t)rand() % (len / 2);
+        size_t end   = len - (size_t)rand() % (len / 2);
+        ok           = search_forward(&s, buf, start, end)
+                == reference_first(content, len, start, end, needle, needle_len, flags)
+            && search_backward(&s, buf, start, end)
+                == reference_last(content, len, start, end, needle, needle_len, flags);
+        search_free(&s);
+    }
+
+    free(content);
+    free(text);
+    buffer_destroy(buf);
+    return ok;
+}
+
+static bool check_all_kernels(size_t len, size_t needle_len, u32 flags)
+{
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(all_kernels) / sizeof(all_kernels[0]) && ok; k++) {
+        if (!search_use_kernel(all_kernels[k]))
+            continue;
+        ok = check_against_reference(STORAGE_GAP, len, needle_len, flags)
+            && check_against_reference(STORAGE_PIECE, len, needle_len, flags);
+    }
+    if (!search_use_kernel(SEARCH_AVX2))
+        search_use_kernel(SEARCH_SSE2);
+    return ok;
+}
+
+TEST(test_search_short_needles)
+{
+    srand(1);
+    for (size_t n = 1; n <= 8; n++)
+        ASSERT(check_all_kernels(3000, n, 0));
+}
+
+TEST(test_search_long_needles)
+{
+    // Past the vector filter's limit: Horspool
+    srand(2);
+    ASSERT(check_all_kernels(4000, 33, 0));
+    ASSERT(check_all_kernels(4000, 100, 0));
+}
+
+TEST(test_search_ignore_case)
+{
+    srand(3);
+    ASSERT(check_all_kernels(3000, 3, SEARCH_IGNORE_CASE));
+    ASSERT(check_all_kernels(3000, 17, SEARCH_IGNORE_CASE));
+    ASSERT(check_all_kernels(3000, 40, SEARCH_IGNORE_CASE));
+}
+
+TEST(test_search_whole_word)
+{
+    srand(4);
+    ASSERT(check_all_kernels(3000, 2, SEARCH_WHOLE_WORD));
+    ASSERT(check_all_kernels(3000, 4, SEARCH_WHOLE_WORD | SEARCH_IGNORE_CASE));
+
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "cat concat cat_ Cat cat", 23);
+    Searcher s;
+    ASSERT(search_init(&s, "cat", 3, SEARCH_WHOLE_WORD));
+    ASSERT_EQ(search_forward(&s, buf, 0, 23), 0);
+    ASSERT_EQ(search_forward(&s, buf, 1, 23), 20);
+    ASSERT_EQ(search_backward(&s, buf, 0, 20), 0);
+    search_free(&s);
+    ASSERT(search_init(&s, "cat", 3, SEARCH_WHOLE_WORD | SEARCH_IGNORE_CASE));
+    ASSERT_EQ(search_forward(&s, buf, 1, 23), 16);
+    search_free(&s);
+    buffer_destroy(buf);
+}
+
+TEST(test_search_across_gap)
+{
+    // Every split point of the needle falls on the gap once
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "xxxxhaystack needlexxxx", 23);
+    Searcher s;
+    ASSERT(search_init(&s, "haystack needle", 15, 0));
+    for (size_t split = 4; split <= 19; split++) {
+        buf->cursor = split;
+        buffer_insert_char(buf, '-');
+        buffer_backspace(buf);
+        ASSERT_EQ(search_forward(&s, buf, 0, 23), 4);
+        ASSERT_EQ(search_backward(&s, buf, 0, 23), 4);
+        ASSERT_EQ(search_forward(&s, buf, 0, 18), -1);
+    }
+    search_free(&s);
+    buffer_destroy(buf);
+}
+
+TEST(test_search_empty_needle)
+{
+    Searcher s;
+    ASSERT(!search_init(&s, "", 0, 0));
+
+    Buffer* buf = buffer_create(16);
+    buffer_insert_text(buf, "abc", 3);
+    ASSERT_EQ(buffer_find(buf, "", 0), -1);
+    ASSERT_EQ(buffer_find(buf, "c", 0), 2);
+    ASSERT_EQ(buffer_find(buf, "abcd", 0), -1);
+    buffer_destroy(buf);
+}
+
+static size_t reference_count(const char* text, size_t len, size_t start, size_t end, const char* needle, size_t n,
+    u32 flags)
+{
+    size_t count = 0;
+    for (size_t pos = start; pos + n <= end; pos++)
+        count += reference_match(text, len, pos, needle, n, flags);
+    return count;
+}
+
+TEST(test_search_parallel)
+{
+    // Several chunks, with the needle planted across every chunk boundary
+    size_t len  = (size_t)5 << 20;
+    char*  text = malloc(len);
+    srand(5);
+    random_text(text, len);
+    for (size_t at = 1 << 20; at < len; at += 1 << 20)
+        memcpy(text + at - 3, "needle", 6);
+
+    BufferStorage storages[] = { STORAGE_GAP, STORAGE_PIECE };
+    for (int i = 0; i < 2; i++) {
+        // Appended in order so the planted needles stay put, with seams
+        // between pieces and the gap moved off the end
+        Buffer* buf = buffer_create_with_storage(16, storages[i]);
+        for (size_t done = 0; done < len; done += 700001)
+            buffer_insert_text(buf, text + done, done + 700001 <= len ? 700001 : len - done);
+        buf->cursor = (3 << 20) - 2;
+        buffer_insert_char(buf, '-');
+        buffer_backspace(buf);
+        char* content = buffer_get_range(buf, 0, len);
+
+        const char* needles[] = { "needle", "NEEDLE", "aBb", "b_", "\n" };
+        u32         flags[]   = { 0, SEARCH_IGNORE_CASE, SEARCH_IGNORE_CASE, SEARCH_WHOLE_WORD, 0 };
+        for (int k = 0; k < 5; k++) {
+            Searcher s;
+            size_t   n = strlen(needles[k]);
+            ASSERT(search_init(&s, needles[k], n, flags[k]));
+            size_t start = (size_t)rand() % 1000;
+            size_t end   = len - (size_t)rand() % 1000;
+            i64    first = reference_first(content, len, start, end, needles[k], n, flags[k]);
+            size_t count = reference_count(content, len, start, end, needles[k], n, flags[k]);
+            ASSERT_EQ(search_forward_parallel(&s, buf, start, end, 4), first);
+            ASSERT_EQ(search_forward(&s, buf, start, end), first);
+            ASSERT_EQ(search_count(&s, buf, start, end, 4), count);
+            ASSERT_EQ(search_count(&s, buf, start, end, 1), count);
+            search_free(&s);
+        }
+
+        // The only match sits in the last chunk
+        Searcher s;
+        ASSERT(search_init(&s, "needle", 6, 0));
+        size_t last = ((size_t)4 << 20) - 3;
+        ASSERT_EQ(search_forward_parallel(&s, buf, last - 5, len, 3), (i64)last);
+        ASSERT_EQ(search_backward(&s, buf, 0, len), (i64)last);
+        ASSERT_EQ(search_forward_parallel(&s, buf, last + 1, len, 3), -1);
+        search_free(&s);
+
+        free(content);
+        buffer_destroy(buf);
+    }
+    free(text);
+}
+
+TEST(test_search_tiny_pieces)
+{
+    // A match spanning several pieces is still one match
+    Buffer* buf = buffer_create_with_storage(16, STORAGE_PIECE);
+    buffer_insert_text(buf, "say hello now", 13);
+    buf->cursor = 6;
+    buffer_backspace(buf);
+    buffer_insert_char(buf, 'a');
+    Searcher s;
+    ASSERT(search_init(&s, "hallo", 5, 0));
+    SearchHits hits = { 0 };
+    ASSERT_EQ(search_count(&s, buf, 0, 13, 1), 1);
+    ASSERT(search_collect(&s, buf, 0, 13, &hits));
+    ASSERT_EQ(hits.count, 1);
+    ASSERT_EQ(hits.pos[0], 4);
+    hits.count = 0;
+    search_free(&s);
+    buffer_destroy(buf);
+
+    // Every byte its own piece: inserted back to front, none can grow
+    size_t len  = 3000;
+    char*  text = malloc(len);
+    srand(9);
+    random_text(text, len);
+    buf = buffer_create_with_storage(16, STORAGE_PIECE);
+    for (size_t i = len; i-- > 0;) {
+        buf->cursor = 0;
+        buffer_insert_char(buf, text[i]);
+    }
+    const char* needles[] = { "ab", "aBa", "a b", "ab_ab", "b_", "\n" };
+    u32         flags[]   = { 0, SEARCH_IGNORE_CASE, 0, SEARCH_IGNORE_CASE, SEARCH_WHOLE_WORD, 0 };
+    for (int k = 0; k < 6; k++) {
+        size_t n = strlen(needles[k]);
+        ASSERT(search_init(&s, needles[k], n, flags[k]));
+        size_t start = (size_t)rand() % 100;
+        size_t end   = len - (size_t)rand() % 100;
+        size_t count = reference_count(text, len, start, end, needles[k], n, flags[k]);
+        ASSERT_EQ(search_count(&s, buf, start, end, 1), count);
+        ASSERT(search_collect(&s, buf, start, end, &hits));
+        ASSERT_EQ(hits.count, count);
+        for (size_t i = 0; i < hits.count; i++)
+            ASSERT(reference_match(text, len, hits.pos[i], needles[k], n, flags[k])
+                && (i == 0 || hits.pos[i] > hits.pos[i - 1]));
+        ASSERT_EQ(search_forward(&s, buf, start, end), reference_first(text, len, start, end, needles[k], n, flags[k]));
+        ASSERT_EQ(search_backward(&s, buf, start, end), reference_last(text, len, start, end, needles[k], n, flags[k]));
+        hits.count = 0;
+        search_free(&s);
+    }
+    free(hits.pos);
+    buffer_destroy(buf);
+    free(text);
+}
+
+int main(void)
+{
+    printf("Search tests:\n");
+    RUN_TEST(test_search_short_needles);
+    RUN_TEST(test_search_long_needles);
+    RUN_TEST(test_search_ignore_case);
+    RUN_TEST(test_search_whole_word);
+    RUN_TEST(test_search_across_gap);
+    RUN_TEST(test_search_empty_needle);
+    RUN_TEST(test_search_parallel);
+    RUN_TEST(test_search_tiny_pieces);
+    TEST_SUMMARY();
+}
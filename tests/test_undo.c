@@ -109,6 +109,440 @@ TEST(test_undo_truncate_redo)
     undo_destroy(stack);
 }
 
+// Type text one byte at a time from pos, ms apart
+static void type(UndoStack* stack, size_t pos, const char* text, u64* now, u64 ms)
+{
+    for (size_t i = 0; text[i]; i++, *now += ms)
+        undo_push_typed(stack, OP_INSERT, pos + i, text + i, 1, *now);
+}
+
+TEST(test_typed_merge)
+{
+    UndoStack* stack = undo_create();
+    u64        now   = 5000;
+    type(stack, 0, "hello world", &now, 50);
+    ASSERT_EQ(stack->count, 1);
+    ASSERT_EQ(stack->ops[0].pos, 0);
+    ASSERT_STR_EQ(stack->ops[0].text, "hello world");
+
+    // Not next to the last one: a new step
+    type(stack, 3, "x", &now, 50);
+    ASSERT_EQ(stack->count, 2);
+
+    // Nor after a pause
+    now += UNDO_MERGE_MS;
+    type(stack, 4, "y", &now, 50);
+    ASSERT_EQ(stack->count, 3);
+
+    // Nor after the cursor moved
+    undo_seal(stack);
+    type(stack, 5, "z", &now, 50);
+    ASSERT_EQ(stack->count, 4);
+
+    // Nor a different kind of keystroke
+    undo_push_typed(stack, OP_DELETE, 5, "z", 1, now);
+    ASSERT_EQ(stack->count, 5);
+    undo_destroy(stack);
+}
+
+TEST(test_typed_word_breaks)
+{
+    // Steps end where a word starts, once they are long enough
+    UndoStack* stack = undo_create();
+    u64        now   = 0;
+    const char* text = "the quick brown fox jumps over the lazy dog";
+    type(stack, 0, text, &now, 10);
+    ASSERT_EQ(stack->count, 2);
+    ASSERT_EQ(stack->ops[0].len, 35); // Through "over the " - 32 bytes or more, to the next word
+    ASSERT_STR_EQ(stack->ops[1].text, "lazy dog");
+    ASSERT_EQ(stack->ops[1].pos, 35);
+
+    // Each undo takes a step
+    Operation* op = undo_pop(stack);
+    ASSERT_STR_EQ(op->text, "lazy dog");
+    op = undo_pop(stack);
+    ASSERT_EQ(op->pos, 0);
+    ASSERT(!undo_can_undo(stack));
+    undo_destroy(stack);
+}
+
+TEST(test_typed_deletes)
+{
+    // Backspace grows the step to the front, Delete to the back
+    UndoStack* stack = undo_create();
+    u64        now   = 0;
+    undo_push_typed(stack, OP_DELETE, 5, "o", 1, now++);
+    undo_push_typed(stack, OP_DELETE, 4, "l", 1, now++);
+    undo_push_typed(stack, OP_DELETE, 2, "\xce\xbb", 2, now++);
+    undo_push_typed(stack, OP_DELETE, 2, "!", 1, now++);
+    undo_push_typed(stack, OP_DELETE, 2, "?", 1, now++);
+    ASSERT_EQ(stack->count, 1);
+    ASSERT_EQ(stack->ops[0].pos, 2);
+    ASSERT_EQ(stack->ops[0].len, 6);
+    ASSERT_STR_EQ(stack->ops[0].text, "\xce\xbblo!?");
+
+    // A long backspace run, reallocating as it grows either way
+    undo_seal(stack);
+    for (int i = 0; i < 1000; i++)
+        undo_push_typed(stack, OP_DELETE, 1000, "a", 1, now++);
+    ASSERT_EQ(stack->count, 2);
+    for (int i = 999; i >= 0; i--)
+        undo_push_typed(stack, OP_DELETE, (size_t)i, "b", 1, now++);
+    ASSERT_EQ(stack->count, 2);
+    ASSERT_EQ(stack->ops[1].pos, 0);
+    ASSERT_EQ(stack->ops[1].len, 2000);
+    ASSERT_EQ(stack->ops[1].text[0], 'b');
+    ASSERT_EQ(stack->ops[1].text[999], 'b');
+    ASSERT_EQ(stack->ops[1].text[1000], 'a');
+    ASSERT_EQ(stack->ops[1].text[2000], '\0');
+    undo_destroy(stack);
+}
+
+TEST(test_typed_after_undo)
+{
+    // Undo closes the step; typing then drops the redo and starts afresh
+    UndoStack* stack = undo_create();
+    u64        now   = 0;
+    type(stack, 0, "abc", &now, 10);
+    undo_pop(stack);
+    type(stack, 0, "d", &now, 10);
+    ASSERT_EQ(stack->count, 1);
+    ASSERT_STR_EQ(stack->ops[0].text, "d");
+    ASSERT(!undo_can_redo(stack));
+
+    redo_pop(stack);
+    type(stack, 1, "e", &now, 10);
+    ASSERT_EQ(stack->count, 2);
+    undo_destroy(stack);
+}
+
+TEST(test_typed_paragraph)
+{
+    // 100 KB of prose typed without a pause: far fewer steps than bytes
+    UndoStack* stack = undo_create();
+    u64        now   = 0;
+    size_t     pos   = 0;
+    const char* words[] = { "lorem ", "ipsum ", "dolor ", "sit ", "amet, ", "consectetur ", "adipiscing ", "elit.\n" };
+    while (pos < 100000) {
+        const char* w = words[pos % 8];
+        type(stack, pos, w, &now, 1);
+        pos += strlen(w);
+    }
+    ASSERT(stack->count * 10 < pos);
+    size_t total = 0;
+    for (size_t i = 0; i < stack->count; i++)
+        total += stack->ops[i].len;
+    ASSERT_EQ(total, pos);
+    undo_destroy(stack);
+}
+
+TEST(test_arena_truncate_reuses)
+{
+    UndoStack* stack = undo_create();
+    undo_push_insert(stack, 0, "a", 1);
+    undo_push_insert(stack, 1, "bb", 2);
+    char* dropped = stack->ops[1].text;
+    undo_push_insert(stack, 3, "ccc", 3);
+    undo_pop(stack);
+    undo_pop(stack);
+
+    // Cutting off redo hands the space back to the next push
+    undo_push_delete(stack, 0, "xy", 2);
+    ASSERT(stack->ops[1].text == dropped);
+    ASSERT_STR_EQ(stack->ops[1].text, "xy");
+    ASSERT_STR_EQ(stack->ops[0].text, "a");
+    ASSERT_EQ(stack->arena.count, 1);
+    undo_destroy(stack);
+}
+
+TEST(test_drop)
+{
+    // An edit that failed after it was recorded leaves no step behind
+    UndoStack* stack = undo_create();
+    undo_push_insert(stack, 0, "a", 1);
+    char* dropped = stack->ops[0].text + 2;
+    undo_push_delete(stack, 1, "bb", 2);
+    undo_drop(stack);
+    ASSERT_EQ(stack->count, 1);
+    ASSERT_EQ(stack->current, 1);
+    undo_push_insert(stack, 1, "c", 1);
+    ASSERT(stack->ops[1].text == dropped);
+
+    // Only the newest, and only while it is on top
+    undo_pop(stack);
+    undo_drop(stack);
+    ASSERT_EQ(stack->count, 2);
+    undo_destroy(stack);
+}
+
+TEST(test_arena_chunks)
+{
+    UndoStack* stack = undo_create();
+    size_t     big   = UNDO_CHUNK * 2 + 7;
+    char*      text  = malloc(big);
+    memset(text, 'z', big);
+    char line[32];
+    for (size_t i = 0; i < 50000; i++) {
+        int n = snprintf(line, sizeof(line), "line %zu", i);
+        if (i == 20000)
+            undo_push_delete(stack, i, text, big);
+        else
+            undo_push_insert(stack, i, line, (size_t)n);
+    }
+    ASSERT(stack->arena.count > 3);
+
+    // Every text survives the chunk changes
+    for (size_t i = 50000; i-- > 0;) {
+        Operation* op = undo_pop(stack);
+        if (i == 20000) {
+            ASSERT_EQ(op->len, big);
+            ASSERT(op->text[0] == 'z' && op->text[big - 1] == 'z' && op->text[big] == '\0');
+        } else {
+            snprintf(line, sizeof(line), "line %zu", i);
+            ASSERT_STR_EQ(op->text, line);
+        }
+    }
+
+    // Dropping it all keeps the first chunk and at most one spare
+    undo_push_insert(stack, 0, "new", 3);
+    ASSERT_EQ(stack->arena.top, 0);
+    ASSERT(stack->arena.count <= 2);
+    ASSERT_EQ(stack->count, 1);
+    free(text);
+    undo_destroy(stack);
+}
+
+// len bytes that differ from one offset to the next
+static char* pattern(size_t len, unsigned seed)
+{
+    char* text = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        text[i] = (char)('a' + (i * 7 + seed) % 26);
+    return text;
+}
+
+TEST(test_spill_round_trip)
+{
+    UndoStack* stack = undo_create();
+    undo_set_limits(stack, UNDO_MEMORY_LIMIT, 100, UNDO_DISK_LIMIT);
+    char* a = pattern(1000, 1);
+    char* b = pattern(3000, 2);
+
+    undo_push_insert(stack, 0, "small", 5);
+    undo_push_insert(stack, 5, a, 1000);
+    ASSERT(stack->ops[1].text == NULL);
+    ASSERT_EQ(stack->ops[1].spill, 0);
+
+    // A text handed over in pieces
+    ASSERT(undo_push_begin(stack, OP_DELETE, 10, 3000));
+    undo_push_piece(stack, b, 1);
+    undo_push_piece(stack, b + 1, 2000);
+    undo_push_piece(stack, b + 2001, 999);
+    ASSERT_EQ(stack->ops[2].spill, 1000);
+    ASSERT_EQ(stack->spill_end, 4000);
+
+    char out[3000];
+    Operation* op = undo_pop(stack);
+    ASSERT(undo_read_text(stack, op, 0, out, 3000));
+    ASSERT(memcmp(out, b, 3000) == 0);
+    op = undo_pop(stack);
+    ASSERT(undo_read_text(stack, op, 500, out, 500));
+    ASSERT(memcmp(out, a + 500, 500) == 0);
+    op = undo_pop(stack);
+    ASSERT_STR_EQ(op->text, "small");
+
+    // Cutting off redo starts the file over
+    undo_push_insert(stack, 0, "x", 1);
+    ASSERT_EQ(stack->spill_end, 0);
+    free(a);
+    free(b);
+    undo_destroy(stack);
+}
+
+TEST(test_evict_oldest)
+{
+    UndoStack* stack = undo_create();
+    size_t     limit = 4 * UNDO_CHUNK;
+    undo_set_limits(stack, limit, UNDO_SPILL_MIN, UNDO_DISK_LIMIT);
+    char text[200];
+    for (size_t i = 0; i < 20000; i++) {
+        memset(text, 'a' + i % 26, sizeof(text));
+        undo_push_insert(stack, i, text, sizeof(text));
+        ASSERT(stack->memory + stack->arena.bytes <= limit);
+    }
+    ASSERT(stack->count < 20000 && stack->count > 1000);
+
+    // What is left is the newest history, intact
+    size_t first = 20000 - stack->count;
+    for (size_t i = 0; i < stack->count; i++) {
+        Operation* op = &stack->ops[i];
+        ASSERT_EQ(op->pos, first + i);
+        ASSERT(op->text[0] == 'a' + (char)((first + i) % 26) && op->text[199] == op->text[0]);
+    }
+    undo_destroy(stack);
+}
+
+TEST(test_evict_spilled)
+{
+    UndoStack* stack = undo_create();
+    undo_set_limits(stack, UNDO_MEMORY_LIMIT, 100, 10000);
+    char* texts[40];
+    for (size_t i = 0; i < 40; i++) {
+        texts[i] = pattern(1000, (unsigned)i);
+        undo_push_insert(stack, i, texts[i], 1000);
+        ASSERT(stack->spill_end - stack->spill_start <= 10000);
+    }
+
+    // The oldest went; the ones left read back
+    ASSERT(stack->count < 40 && stack->count >= 7);
+    char out[1000];
+    for (size_t i = 0; i < stack->count; i++) {
+        Operation* op = &stack->ops[i];
+        ASSERT(undo_read_text(stack, op, 0, out, 1000));
+        ASSERT(memcmp(out, texts[op->pos], 1000) == 0);
+    }
+    for (size_t i = 0; i < 40; i++)
+        free(texts[i]);
+    undo_destroy(stack);
+}
+
+TEST(test_too_big_to_keep)
+{
+    // A text over every limit can't be undone, and neither can anything
+    // before it
+    UndoStack* stack = undo_create();
+    undo_set_limits(stack, 1000, 100, 1000);
+    undo_push_insert(stack, 0, "abc", 3);
+    ASSERT(!undo_push_begin(stack, OP_DELETE, 0, 5000));
+    undo_push_piece(stack, "ignored", 7);
+    ASSERT(!undo_can_undo(stack));
+    undo_push_insert(stack, 0, "def", 3);
+    ASSERT_EQ(stack->count, 1);
+    undo_destroy(stack);
+}
+
+// The text after a batch's edits, or before them when undoing
+static char* apply_batch(const char* text, const BatchOp* b, bool undo)
+{
+    size_t len = strlen(text);
+    char*  out = malloc(len + 4096);
+    size_t o = 0, at = 0, old_at = 0, new_at = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        const BatchEdit* e    = &b->edits[i];
+        size_t           pos  = undo ? e->pos - old_at + new_at : e->pos;
+        size_t           from = undo ? e->new_len : e->old_len;
+        size_t           to   = undo ? e->old_len : e->new_len;
+        memcpy(out + o, text + at, pos - at);
+        o += pos - at;
+        memcpy(out + o, undo ? b->old_text + old_at : b->new_text + new_at, to);
+        o += to;
+        at = pos + from;
+        old_at += e->old_len;
+        new_at += e->new_len;
+    }
+    memcpy(out + o, text + at, len - at + 1);
+    return out;
+}
+
+TEST(test_group_composes)
+{
+    // Random inserts and deletes in a group come out as one batch that
+    // turns the text before into the text after, and back
+    size_t batches = 0;
+    for (unsigned seed = 0; seed < 300; seed++) {
+        char before[64] = "the quick brown fox jumps over the lazy dog";
+        char now[1024];
+        strcpy(now, before);
+        srand(seed);
+
+        UndoStack* stack = undo_create();
+        undo_push_insert(stack, 0, "x", 1); // Not part of the group
+        undo_begin_group(stack, 3);
+        int ops = 1 + rand() % 8;
+        for (int k = 0; k < ops; k++) {
+            size_t len = strlen(now);
+            size_t pos = (size_t)rand() % (len + 1);
+            if (rand() % 2 && len < 900) {
+                char   text[8];
+                size_t n = 1 + (size_t)rand() % 6;
+                for (size_t c = 0; c < n; c++)
+                    text[c] = (char)('A' + rand() % 26);
+                undo_push_insert(stack, pos, text, n);
+                memmove(now + pos + n, now + pos, len - pos + 1);
+                memcpy(now + pos, text, n);
+            } else if (pos < len) {
+                size_t n = 1 + (size_t)rand() % (len - pos < 10 ? len - pos : 10);
+                undo_push_delete(stack, pos, now + pos, n);
+                memmove(now + pos, now + pos + n, len - pos - n + 1);
+            }
+        }
+        undo_end_group(stack, 9);
+
+        if (stack->count == 2 && stack->ops[1].type == OP_BATCH) {
+            const BatchOp* b     = stack->ops[1].batch;
+            char*          redo  = apply_batch(before, b, false);
+            char*          undo  = apply_batch(now, b, true);
+            ASSERT_STR_EQ(redo, now);
+            ASSERT_STR_EQ(undo, before);
+            ASSERT(b->one_cursor && b->cursor_old == 3 && b->cursor_new == 9);
+            for (size_t e = 1; e < b->count; e++)
+                ASSERT(b->edits[e].pos >= b->edits[e - 1].pos + b->edits[e - 1].old_len);
+            free(redo);
+            free(undo);
+            batches++;
+        } else {
+            // A single operation is left alone
+            ASSERT(stack->count <= 2);
+        }
+        undo_destroy(stack);
+    }
+    ASSERT(batches > 200);
+}
+
+TEST(test_group_nesting)
+{
+    UndoStack* stack = undo_create();
+    undo_begin_group(stack, 0);
+    undo_push_insert(stack, 0, "ab", 2);
+    undo_begin_group(stack, 2);
+    undo_push_insert(stack, 2, "cd", 2);
+    undo_end_group(stack, 4); // Inner: nothing yet
+    ASSERT_EQ(stack->count, 2);
+    undo_push_delete(stack, 0, "a", 1);
+    undo_end_group(stack, 3);
+
+    ASSERT_EQ(stack->count, 1);
+    Operation* op = undo_pop(stack);
+    ASSERT_EQ(op->type, OP_BATCH);
+    ASSERT_EQ(op->batch->count, 1);
+    ASSERT_EQ(op->batch->edits[0].old_len, 0);
+    ASSERT_EQ(op->batch->edits[0].new_len, 3);
+    ASSERT(memcmp(op->batch->new_text, "bcd", 3) == 0);
+    ASSERT(!undo_can_undo(stack));
+    undo_destroy(stack);
+}
+
+TEST(test_group_with_spilled_text)
+{
+    // Spilled text stays on disk, so the group's operations are joined
+    // instead of composed
+    UndoStack* stack = undo_create();
+    undo_set_limits(stack, UNDO_MEMORY_LIMIT, 100, UNDO_DISK_LIMIT);
+    char* big = pattern(500, 3);
+    undo_push_insert(stack, 0, "before", 6);
+    undo_begin_group(stack, 0);
+    undo_push_delete(stack, 0, big, 500);
+    undo_push_insert(stack, 0, "new", 3);
+    undo_end_group(stack, 3);
+
+    ASSERT_EQ(stack->count, 3);
+    ASSERT(!stack->ops[0].joined);
+    ASSERT(!stack->ops[1].joined);
+    ASSERT(stack->ops[2].joined);
+    free(big);
+    undo_destroy(stack);
+}
+
 int main(void)
 {
     printf("Undo tests:\n");
@@ -120,5 +554,20 @@ int main(void)
     RUN_TEST(test_undo_multiple);
     RUN_TEST(test_undo_redo_sequence);
     RUN_TEST(test_undo_truncate_redo);
+    RUN_TEST(test_typed_merge);
+    RUN_TEST(test_typed_word_breaks);
+    RUN_TEST(test_typed_deletes);
+    RUN_TEST(test_typed_after_undo);
+    RUN_TEST(test_typed_paragraph);
+    RUN_TEST(test_arena_truncate_reuses);
+    RUN_TEST(test_drop);
+    RUN_TEST(test_arena_chunks);
+    RUN_TEST(test_spill_round_trip);
+    RUN_TEST(test_evict_oldest);
+    RUN_TEST(test_evict_spilled);
+    RUN_TEST(test_too_big_to_keep);
+    RUN_TEST(test_group_composes);
+    RUN_TEST(test_group_nesting);
+    RUN_TEST(test_group_with_spilled_text);
     TEST_SUMMARY();
 }
@@ -0,0 +1,231 @@
+#include "test.h"
+#include "../include/colindex.h"
+#include "../include/utf8.h"
+#include <stdlib.h>
+
+static const Utf8Kernel all_kernels[] = { UTF8_SCALAR, UTF8_SSE2, UTF8_AVX2 };
+
+// Mixed text: ASCII runs, two to four byte characters, combining marks,
+// wide characters and a sprinkling of malformed bytes
+static char* make_text(size_t len, unsigned seed)
+{
+    static const char* pieces[] = { "a", "bc", "hello ", "\xce\xbb", "\xd0\xb6", "\xe4\xb8\xad", "e\xcc\x81",
+        "\xf0\x9f\x94\xa5", "\xe0\xa4\x95", "\x80", "\xff", "\xe4\xb8", "\t" };
+    char*  text = malloc(len + 8);
+    size_t n    = 0;
+    srand(seed);
+    while (n < len) {
+        const char* p = pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+        size_t      m = strlen(p);
+        memcpy(text + n, p, m);
+        n += m;
+    }
+    return text;
+}
+
+// Character by character, with no vector code
+static Utf8Pos reference_walk(const char* p, size_t len, Utf8Unit unit, size_t target)
+{
+    Utf8Pos at = { 0, 0, 0 };
+    while (at.byte < len) {
+        u32    cp;
+        size_t n    = utf8_decode(p + at.byte, len - at.byte, &cp);
+        size_t w    = (size_t)utf8_width(cp);
+        size_t step = unit == UTF8_BYTES ? n : unit == UTF8_CODEPOINTS ? 1 : w;
+        if (step > target - utf8_pos_get(&at, unit))
+            break;
+        at.byte += n;
+        at.cp++;
+        at.col += w;
+    }
+    return at;
+}
+
+static bool same_pos(Utf8Pos a, Utf8Pos b) { return a.byte == b.byte && a.cp == b.cp && a.col == b.col; }
+
+TEST(test_utf8_decode_valid)
+{
+    u32 cp;
+    ASSERT_EQ(utf8_decode("A", 1, &cp), 1);
+    ASSERT_EQ(cp, 'A');
+    ASSERT_EQ(utf8_decode("\xce\xbb", 2, &cp), 2);
+    ASSERT_EQ(cp, 0x3BB);
+    ASSERT_EQ(utf8_decode("\xe4\xb8\xad", 3, &cp), 3);
+    ASSERT_EQ(cp, 0x4E2D);
+    ASSERT_EQ(utf8_decode("\xf0\x9f\x94\xa5", 4, &cp), 4);
+    ASSERT_EQ(cp, 0x1F525);
+    ASSERT_EQ(utf8_decode("\xf4\x8f\xbf\xbf", 4, &cp), 4);
+    ASSERT_EQ(cp, 0x10FFFF);
+}
+
+TEST(test_utf8_decode_malformed)
+{
+    // Each is taken as one byte of U+FFFD
+    static const char* bad[] = {
+        "\x80",             // Stray continuation
+        "\xc0\xaf",         // Overlong
+        "\xe0\x80\xaf",     // Overlong
+        "\xed\xa0\x80",     // Surrogate
+        "\xf4\x90\x80\x80", // Past U+10FFFF
+        "\xf8\x88\x80\x80", // No such lead byte
+        "\xe4\xb8",         // Truncated
+        "\xe4\x41\x41",     // Continuation missing
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        u32 cp;
+        ASSERT_EQ(utf8_decode(bad[i], strlen(bad[i]), &cp), 1);
+        ASSERT_EQ(cp, UTF8_REPLACEMENT);
+    }
+}
+
+TEST(test_utf8_encode_round_trip)
+{
+    static const u32 cps[] = { 0, 'x', 0x7F, 0x80, 0x7FF, 0x800, 0xFFFD, 0x10000, 0x1F525, 0x10FFFF };
+    for (size_t i = 0; i < sizeof(cps) / sizeof(cps[0]); i++) {
+        char   out[UTF8_MAX];
+        size_t n = utf8_encode(cps[i], out);
+        u32    cp;
+        ASSERT(n > 0);
+        ASSERT_EQ(utf8_decode(out, n, &cp), n);
+        ASSERT_EQ(cp, cps[i]);
+    }
+    char out[UTF8_MAX];
+    ASSERT_EQ(utf8_encode(0xD800, out), 0);
+    ASSERT_EQ(utf8_encode(0x110000, out), 0);
+}
+
+TEST(test_utf8_width)
+{
+    ASSERT_EQ(utf8_width('a'), 1);
+    ASSERT_EQ(utf8_width(0x3BB), 1);  // Greek lambda
+    ASSERT_EQ(utf8_width(0x301), 0);  // Combining acute
+    ASSERT_EQ(utf8_width(0x200D), 0); // Zero width joiner
+    ASSERT_EQ(utf8_width(0x4E2D), 2); // CJK
+    ASSERT_EQ(utf8_width(0xAC00), 2); // Hangul
+    ASSERT_EQ(utf8_width(0x1F525), 2); // Emoji
+    ASSERT_EQ(utf8_width(0x20000), 2); // CJK extension B
+    ASSERT_EQ(utf8_width(UTF8_REPLACEMENT), 1);
+}
+
+TEST(test_utf8_walk_matches_reference)
+{
+    size_t len  = 3000;
+    char*  text = make_text(len, 7);
+    Utf8Pos all = reference_walk(text, len, UTF8_BYTES, len);
+
+    for (size_t k = 0; k < sizeof(all_kernels) / sizeof(all_kernels[0]); k++) {
+        if (!utf8_use_kernel(all_kernels[k]))
+            continue;
+        for (int unit = UTF8_BYTES; unit <= UTF8_COLUMNS; unit++) {
+            size_t end = utf8_pos_get(&all, (Utf8Unit)unit);
+            for (size_t target = 0; target <= end + 1; target += 1 + target / 16) {
+                Utf8Pos expected = reference_walk(text, len, (Utf8Unit)unit, target);
+                Utf8Pos got      = { 0, 0, 0 };
+                ASSERT_EQ(utf8_walk(text, len, len, (Utf8Unit)unit, target, &got), got.byte);
+                ASSERT(same_pos(got, expected));
+            }
+        }
+    }
+    free(text);
+}
+
+TEST(test_utf8_walk_in_windows)
+{
+    // Walking a line a window at a time, with a few bytes of lookahead,
+    // lands where a single walk does
+    size_t len  = 5000;
+    char*  text = make_text(len, 11);
+    for (size_t window = 5; window < 300; window += 37) {
+        Utf8Pos at = { 0, 0, 0 };
+        while (at.byte < len) {
+            size_t left  = len - at.byte;
+            size_t stop  = left < window ? left : window;
+            size_t avail = left < stop + UTF8_MAX - 1 ? left : stop + UTF8_MAX - 1;
+            utf8_walk(text + at.byte, avail, stop, UTF8_BYTES, SIZE_MAX, &at);
+        }
+        ASSERT(same_pos(at, reference_walk(text, len, UTF8_BYTES, len)));
+    }
+    free(text);
+}
+
+TEST(test_utf8_walk_columns)
+{
+    // "a中b" then a combining mark: the wide character isn't split, and
+    // the mark stays with its base
+    const char* s  = "a\xe4\xb8\xad" "be\xcc\x81x";
+    size_t      n  = strlen(s);
+    Utf8Pos     at = { 0, 0, 0 };
+    utf8_walk(s, n, n, UTF8_COLUMNS, 2, &at);
+    ASSERT_EQ(at.byte, 1);
+    ASSERT_EQ(at.col, 1);
+
+    at = (Utf8Pos) { 0, 0, 0 };
+    utf8_walk(s, n, n, UTF8_COLUMNS, 5, &at);
+    ASSERT_EQ(at.byte, 8); // Past "e" and its accent
+    ASSERT_EQ(at.cp, 5);
+    ASSERT_EQ(at.col, 5);
+}
+
+TEST(test_colindex_edit_shifts)
+{
+    ColIndex ci;
+    colindex_init(&ci);
+    ColLine* cl = colindex_claim(&ci, 100, 20000);
+    ASSERT(cl != NULL);
+    for (size_t i = 1; i < 5; i++)
+        ASSERT(colindex_push(cl, (Utf8Pos) { i * 4096, i * 4000, i * 4100 }));
+
+    // Before the line: it moves
+    colindex_edit(&ci, 10, 0, 5, "hello", 5);
+    ASSERT(colindex_get(&ci, 105) == cl);
+    ASSERT_EQ(cl->count, 5);
+
+    // Inside: the points around the edit stay, later ones shift bytes and
+    // wait to be measured
+    colindex_edit(&ci, 105 + 5000, 10, 3, "abc", 3);
+    ASSERT_EQ(cl->len, 20000 - 7);
+    ASSERT_EQ(cl->count, 5);
+    ASSERT(cl->stale);
+    ASSERT_EQ(cl->stale_at, 1);
+    ASSERT_EQ(cl->points[2].byte, 2 * 4096 - 7);
+    ASSERT_EQ(colindex_find(cl, UTF8_BYTES, 2 * 4096 - 8), 1);
+
+    // A second edit further on widens the stretch to measure
+    colindex_edit(&ci, 105 + 3 * 4096, 1, 0, NULL, 0);
+    ASSERT_EQ(cl->stale_at, 1);
+    ASSERT_EQ(cl->count, 3);
+    ASSERT_EQ(cl->points[2].byte, 4 * 4096 - 8);
+
+    // A newline splits it
+    colindex_edit(&ci, 105 + 10, 0, 1, "\n", 1);
+    ASSERT(colindex_get(&ci, 105) == NULL);
+    colindex_free(&ci);
+}
+
+TEST(test_colindex_lru)
+{
+    ColIndex ci;
+    colindex_init(&ci);
+    for (size_t i = 0; i < COL_CACHE_LINES; i++)
+        ASSERT(colindex_claim(&ci, i * 100000, 50000) != NULL);
+    ASSERT(colindex_get(&ci, 0) != NULL); // Line 0 used last
+    ASSERT(colindex_claim(&ci, 999999, 50000) != NULL);
+    ASSERT(colindex_get(&ci, 0) != NULL);
+    ASSERT(colindex_get(&ci, 100000) == NULL); // Oldest one went
+    colindex_free(&ci);
+}
+
+int main(void)
+{
+    printf("UTF-8 tests:\n");
+    RUN_TEST(test_utf8_decode_valid);
+    RUN_TEST(test_utf8_decode_malformed);
+    RUN_TEST(test_utf8_encode_round_trip);
+    RUN_TEST(test_utf8_width);
+    RUN_TEST(test_utf8_walk_matches_reference);
+    RUN_TEST(test_utf8_walk_in_windows);
+    RUN_TEST(test_utf8_walk_columns);
+    RUN_TEST(test_colindex_edit_shifts);
+    RUN_TEST(test_colindex_lru);
+    TEST_SUMMARY();
+}